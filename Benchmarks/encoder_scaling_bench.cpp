@@ -0,0 +1,216 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  Scaling of block encoding with the number of threads, for the channel
+  counts of multi-probe Neuropixels setups (4 x 384 channels by default).
+
+  Every block is encoded through an EncodingCache backed by an
+  EncoderPool with 0..N-1 workers, i.e. 1..N threads including the
+  calling one. Each run's output is compared with the single-threaded
+  encoding to confirm the channel groups are reassembled identically.
+
+  Usage: encoder_scaling_bench [--channels N] [--samples N] [--blocks N]
+                               [--threads N] [--encoding float32|int16]
+                               [--decimation N] [--pin] [--json file]
+*/
+
+#include "BlockEncoder.h"
+#include "EncoderPool.h"
+#include "EncodingCache.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    int channels = 1536;
+    int samples = 1024;
+    int blocks = 200;
+    int threads = (int) std::max (1u, std::thread::hardware_concurrency());
+    BlockEncoder::Encoding encoding = BlockEncoder::INT16;
+    int decimation = 1;
+    bool pin = false;
+    std::string jsonFile;
+};
+
+struct Result
+{
+    int threads = 0;
+    double blocksPerSecond = 0;
+    double megabytesPerSecond = 0;
+    double speedup = 0;
+    bool identical = false;
+};
+
+int main (int argc, char** argv)
+{
+    Options options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--pin")
+            options.pin = true;
+        else if (arg == "--channels" && hasValue)
+            options.channels = std::atoi (argv[++i]);
+        else if (arg == "--samples" && hasValue)
+            options.samples = std::atoi (argv[++i]);
+        else if (arg == "--blocks" && hasValue)
+            options.blocks = std::atoi (argv[++i]);
+        else if (arg == "--threads" && hasValue)
+            options.threads = std::atoi (argv[++i]);
+        else if (arg == "--encoding" && hasValue)
+            options.encoding = std::string (argv[++i]) == "float32" ? BlockEncoder::FLOAT32 : BlockEncoder::INT16;
+        else if (arg == "--decimation" && hasValue)
+            options.decimation = std::atoi (argv[++i]);
+        else if (arg == "--json" && hasValue)
+            options.jsonFile = argv[++i];
+    }
+
+    // synthetic signal: a different sine per channel plus a little noise
+    std::vector<std::vector<float>> samples ((size_t) options.channels, std::vector<float> ((size_t) options.samples));
+    std::vector<const float*> channels ((size_t) options.channels);
+    unsigned seed = 1;
+
+    for (int ch = 0; ch < options.channels; ch++)
+    {
+        for (int i = 0; i < options.samples; i++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            samples[(size_t) ch][(size_t) i] = 100.0f * std::sin (0.01f * (ch + 1) * i) + (float) (seed >> 16) / 65536.0f;
+        }
+
+        channels[(size_t) ch] = samples[(size_t) ch].data();
+    }
+
+    BlockEncoder::Format format;
+    format.decimation = options.decimation;
+    format.encoding = options.encoding;
+
+    for (int ch = 0; ch < options.channels; ch++)
+        format.channels.push_back (ch);
+
+    // single-threaded reference
+    std::vector<uint8_t> referenceData;
+    std::vector<float> referenceScales;
+    BlockEncoder::encode (channels.data(), options.channels, options.samples, format, referenceData, referenceScales);
+
+    std::printf ("%d channels x %d samples, %s, decimation %d, %d blocks per run%s\n\n",
+                 options.channels,
+                 options.samples,
+                 BlockEncoder::getEncodingName (options.encoding),
+                 options.decimation,
+                 options.blocks,
+                 options.pin ? ", pinned" : "");
+    std::printf ("%-8s %12s %10s %9s %10s\n", "threads", "blocks/s", "MB/s in", "speedup", "identical");
+
+    std::vector<Result> results;
+    const double bytesPerBlock = (double) options.channels * options.samples * sizeof (float);
+
+    for (int threads = 1; threads <= options.threads; threads++)
+    {
+        EncoderPool pool;
+        pool.start (threads - 1, options.pin);
+
+        EncodingCache cache;
+        cache.setPool (&pool);
+
+        Result result;
+        result.threads = threads;
+        result.identical = true;
+
+        auto start = Clock::now();
+
+        for (int block = 0; block < options.blocks; block++)
+        {
+            cache.beginBlock (0, channels.data(), options.channels, options.samples, (int64_t) block * options.samples);
+            EncodingCache::BufferPtr buffer = cache.get (format);
+
+            if (block == 0)
+                result.identical = buffer->data == referenceData && buffer->scales == referenceScales;
+        }
+
+        const double seconds = std::chrono::duration<double> (Clock::now() - start).count();
+
+        result.blocksPerSecond = options.blocks / seconds;
+        result.megabytesPerSecond = result.blocksPerSecond * bytesPerBlock / 1.0e6;
+        result.speedup = results.empty() ? 1.0 : result.blocksPerSecond / results.front().blocksPerSecond;
+        results.push_back (result);
+
+        std::printf ("%-8d %12.1f %10.1f %8.2fx %10s\n",
+                     result.threads,
+                     result.blocksPerSecond,
+                     result.megabytesPerSecond,
+                     result.speedup,
+                     result.identical ? "yes" : "NO");
+    }
+
+    if (! options.jsonFile.empty())
+    {
+        FILE* f = std::fopen (options.jsonFile.c_str(), "w");
+        if (f == nullptr)
+            return 1;
+
+        std::fprintf (f,
+                      "{\n  \"channels\": %d,\n  \"samples\": %d,\n  \"encoding\": \"%s\",\n  \"decimation\": %d,\n  \"results\": [\n",
+                      options.channels,
+                      options.samples,
+                      BlockEncoder::getEncodingName (options.encoding),
+                      options.decimation);
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result& r = results[i];
+            std::fprintf (f,
+                          "    {\"threads\": %d, \"blocks_per_second\": %.1f, \"megabytes_per_second\": %.1f, \"speedup\": %.3f, \"identical\": %s}%s\n",
+                          r.threads,
+                          r.blocksPerSecond,
+                          r.megabytesPerSecond,
+                          r.speedup,
+                          r.identical ? "true" : "false",
+                          i + 1 < results.size() ? "," : "");
+        }
+
+        std::fprintf (f, "  ]\n}\n");
+        std::fclose (f);
+    }
+
+    for (auto& r : results)
+        if (! r.identical)
+            return 1;
+
+    return 0;
+}
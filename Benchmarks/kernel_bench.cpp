@@ -0,0 +1,908 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/*
+  Per-kernel costs of the send paths (sendData, sendEvent and the spike
+  senders), across channel counts and block sizes:
+
+   - header_json        DATA header written field by field per message, the
+                        way the JSON writer builds it
+   - header_template    DATA header rendered from a per-channel
+                        HeaderTemplate
+   - frames_copy        envelope, header and payload frames created with
+                        zmq_msg_init_size + memcpy and sent
+   - frames_zero_copy   the same with the payload handed to libzmq by
+                        reference (zmq_msg_init_data), its reference taken
+                        from a preallocated pool of handles as the plugin does
+   - pack_float32       BlockEncoder packing of the block into float32
+   - pack_int16         BlockEncoder packing into scaled int16
+   - governor_normal    what one block of DATA costs at each CPU governor
+   - governor_decimate  level before it reaches the socket: encoding the
+   - governor_quantize  level's format, then a templated header per channel
+   - governor_priority  (priority = the first half of the channels)
+   - spike_json         spike header with its per-channel threshold array
+   - spike_record       the same spike as a SpikeRecord plus its waveform
+   - ttl_json           TTL event header per event
+   - ttl_record         TTL events as TtlRecords of a batch
+
+  The JSON kernels use a small std::string writer rather than JUCE's, so
+  they can be built without the GUI; they stand for "format every message"
+  against the precomputed paths. Frames are sent to a PUB socket without
+  subscribers, which libzmq drops after the send path has run.
+
+  Each benchmark runs until --min-time has passed, like Google Benchmark,
+  and reports ns per message and bytes per second. --json writes the
+  results in Google Benchmark's JSON format (compare.py reads it);
+  --compare prints the change against such a file, e.g. the baseline in
+  Benchmarks/baselines.
+
+  Usage: kernel_bench [--filter substring] [--min-time seconds]
+                      [--json file] [--compare file]
+*/
+
+#include "BlockEncoder.h"
+#include "HeaderTemplate.h"
+#include "ZmqWireFormat.h"
+
+#include <zmq.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+/** What a benchmark is given and reports, after Google Benchmark's State */
+struct State
+{
+    int channels = 0;
+    int samples = 0;
+    int64_t iterations = 0;
+
+    // set by the benchmark: per iteration
+    int64_t messagesPerIteration = 1;
+    int64_t bytesPerIteration = 0;
+};
+
+struct Benchmark
+{
+    const char* name;
+    void (*function) (State&);
+    std::vector<std::pair<int, int>> args; // (channels, samples)
+    const char* argNames;
+};
+
+struct Result
+{
+    std::string name;
+    int64_t iterations = 0;
+    double realNs = 0; // per iteration
+    double cpuNs = 0;
+    double nsPerMessage = 0;
+    double bytesPerSecond = 0;
+    double messagesPerSecond = 0;
+};
+
+// keeps the compiler from dropping work whose result is unused
+static volatile uint64_t sink;
+
+static void consume (const void* data, size_t size)
+{
+    sink = sink + size + (size > 0 ? ((const uint8_t*) data)[size - 1] : 0);
+}
+
+//==============================================================================
+// a minimal JSON writer, enough for the plugin's headers
+
+static void appendString (std::string& out, const char* text)
+{
+    out += '"';
+    for (const char* c = text; *c != 0; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            out += '\\';
+        out += *c;
+    }
+    out += '"';
+}
+
+static void appendKey (std::string& out, const char* key)
+{
+    if (out.back() != '{' && out.back() != '[')
+        out += ", ";
+    appendString (out, key);
+    out += ": ";
+}
+
+static void appendInt (std::string& out, const char* key, int64_t value)
+{
+    char number[32];
+    std::snprintf (number, sizeof (number), "%lld", (long long) value);
+    appendKey (out, key);
+    out += number;
+}
+
+static void appendDouble (std::string& out, const char* key, double value)
+{
+    char number[32];
+    std::snprintf (number, sizeof (number), "%.17g", value);
+    if (key != nullptr)
+        appendKey (out, key);
+    else if (out.back() != '[')
+        out += ", ";
+    out += number;
+}
+
+static void appendText (std::string& out, const char* key, const char* value)
+{
+    appendKey (out, key);
+    appendString (out, value);
+}
+
+//==============================================================================
+// shared fixtures
+
+struct Channel
+{
+    std::string name;
+    float bitVolts;
+    HeaderTemplate header;
+};
+
+static std::vector<Channel> makeChannels (int count)
+{
+    std::vector<Channel> channels ((size_t) count);
+
+    for (int i = 0; i < count; i++)
+    {
+        channels[(size_t) i].name = "CH" + std::to_string (i + 1);
+        channels[(size_t) i].bitVolts = 0.195f;
+    }
+
+    return channels;
+}
+
+static std::vector<std::vector<float>> makeSignal (int channels, int samples)
+{
+    std::vector<std::vector<float>> signal ((size_t) channels, std::vector<float> ((size_t) samples));
+    unsigned seed = 1;
+
+    for (int ch = 0; ch < channels; ch++)
+        for (int i = 0; i < samples; i++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            signal[(size_t) ch][(size_t) i] = 100.0f * std::sin (0.01f * (ch + 1) * i) + (float) (seed >> 16) / 65536.0f;
+        }
+
+    return signal;
+}
+
+// numbers of the DATA header that change per message, in createDataHeader's slot order
+enum
+{
+    SLOT_MESSAGE_NUM = 0,
+    SLOT_NUM_SAMPLES,
+    SLOT_SAMPLE_NUM,
+    SLOT_DATA_SIZE,
+    SLOT_TIMESTAMP,
+    SLOT_SEQ,
+    NUM_SLOTS
+};
+
+static void writeDataHeader (std::string& out,
+                             const Channel& channel,
+                             int index,
+                             const int64_t* values,
+                             const BlockEncoder::Format* format = nullptr)
+{
+    const int decimation = format != nullptr ? format->decimation : 1;
+
+    out.clear();
+    out += '{';
+    appendInt (out, "message_num", values[SLOT_MESSAGE_NUM]);
+    appendText (out, "type", "data");
+    appendKey (out, "content");
+    out += '{';
+    appendText (out, "stream", "example_data");
+    appendInt (out, "channel_num", index);
+    appendText (out, "channel_name", channel.name.c_str());
+    appendInt (out, "num_samples", values[SLOT_NUM_SAMPLES]);
+    appendInt (out, "sample_num", values[SLOT_SAMPLE_NUM]);
+    appendDouble (out, "sample_rate", 30000.0 / decimation);
+    appendDouble (out, "bit_volts", channel.bitVolts);
+    if (format != nullptr)
+    {
+        appendInt (out, "decimation", decimation);
+        appendText (out, "encoding", BlockEncoder::getEncodingName (format->encoding));
+    }
+    out += '}';
+    appendInt (out, "data_size", values[SLOT_DATA_SIZE]);
+    appendInt (out, "timestamp", values[SLOT_TIMESTAMP]);
+    appendInt (out, "seq", values[SLOT_SEQ]);
+    out += '}';
+}
+
+static void fillValues (int64_t* values, int64_t message, int samples)
+{
+    values[SLOT_MESSAGE_NUM] = message;
+    values[SLOT_NUM_SAMPLES] = samples;
+    values[SLOT_SAMPLE_NUM] = message * samples;
+    values[SLOT_DATA_SIZE] = (int64_t) samples * (int64_t) sizeof (float);
+    values[SLOT_TIMESTAMP] = 1700000000000 + message;
+    values[SLOT_SEQ] = message;
+}
+
+/** A PUB socket without subscribers: sends run the whole send path and are dropped */
+struct Publisher
+{
+    Publisher()
+    {
+        context = zmq_ctx_new();
+        socket = zmq_socket (context, ZMQ_PUB);
+        zmq_bind (socket, "inproc://kernel-bench");
+    }
+
+    ~Publisher()
+    {
+        zmq_close (socket);
+        zmq_ctx_destroy (context);
+    }
+
+    void* context;
+    void* socket;
+};
+
+static void sendCopy (void* socket, const void* data, size_t size, int flags)
+{
+    zmq_msg_t message;
+    zmq_msg_init_size (&message, size);
+    std::memcpy (zmq_msg_data (&message), data, size);
+    zmq_msg_send (&message, socket, flags);
+    zmq_msg_close (&message);
+}
+
+//==============================================================================
+// kernels
+
+static void headerJson (State& state)
+{
+    std::vector<Channel> channels = makeChannels (state.channels);
+    std::string header;
+    int64_t values[NUM_SLOTS];
+    int64_t message = 0;
+    size_t bytes = 0;
+
+    for (int64_t it = 0; it < state.iterations; it++)
+        for (int ch = 0; ch < state.channels; ch++)
+        {
+            fillValues (values, ++message, state.samples);
+            writeDataHeader (header, channels[(size_t) ch], ch, values);
+            bytes = header.size();
+            consume (header.data(), header.size());
+        }
+
+    state.messagesPerIteration = state.channels;
+    state.bytesPerIteration = (int64_t) bytes * state.channels;
+}
+
+static void headerTemplate (State& state)
+{
+    std::vector<Channel> channels = makeChannels (state.channels);
+    std::string header;
+    int64_t values[NUM_SLOTS];
+
+    for (int slot = 0; slot < NUM_SLOTS; slot++)
+        values[slot] = HeaderTemplate::getPlaceholder (slot);
+
+    for (int ch = 0; ch < state.channels; ch++)
+    {
+        writeDataHeader (header, channels[(size_t) ch], ch, values);
+        channels[(size_t) ch].header.prepare (header, NUM_SLOTS);
+    }
+
+    int64_t message = 0;
+
+    for (int64_t it = 0; it < state.iterations; it++)
+        for (int ch = 0; ch < state.channels; ch++)
+        {
+            fillValues (values, ++message, state.samples);
+            channels[(size_t) ch].header.render (values, header);
+            consume (header.data(), header.size());
+        }
+
+    state.messagesPerIteration = state.channels;
+    state.bytesPerIteration = (int64_t) header.size() * state.channels;
+}
+
+typedef std::shared_ptr<std::vector<std::vector<float>>> BlockPtr;
+
+/** A reference to the block held by libzmq until a frame is sent, as ZmqInterface::FrameHandle */
+struct FrameHandle
+{
+    BlockPtr owner;
+    std::atomic<bool> inUse { false };
+};
+
+static const size_t FRAME_HANDLE_POOL_SIZE = 8192;
+
+static void releaseFrameHandle (void*, void* hint)
+{
+    FrameHandle* handle = static_cast<FrameHandle*> (hint);
+    handle->owner = nullptr;
+    handle->inUse.store (false, std::memory_order_release);
+}
+
+static FrameHandle* acquireFrameHandle (FrameHandle* handles, size_t& next, const BlockPtr& owner)
+{
+    for (size_t n = 0; n < FRAME_HANDLE_POOL_SIZE; n++)
+    {
+        FrameHandle& handle = handles[next];
+        next = (next + 1) % FRAME_HANDLE_POOL_SIZE;
+
+        bool expected = false;
+        if (handle.inUse.compare_exchange_strong (expected, true, std::memory_order_acquire))
+        {
+            handle.owner = owner;
+            return &handle;
+        }
+    }
+
+    return nullptr;
+}
+
+static void frames (State& state, bool zeroCopy)
+{
+    // declared before the publisher, so they outlive the frames it still holds
+    std::unique_ptr<FrameHandle[]> handles (new FrameHandle[FRAME_HANDLE_POOL_SIZE]);
+    size_t nextHandle = 0;
+
+    Publisher publisher;
+    std::vector<Channel> channels = makeChannels (state.channels);
+    std::vector<std::vector<float>> signal = makeSignal (state.channels, state.samples);
+    std::string header;
+    int64_t values[NUM_SLOTS];
+
+    for (int slot = 0; slot < NUM_SLOTS; slot++)
+        values[slot] = HeaderTemplate::getPlaceholder (slot);
+
+    for (int ch = 0; ch < state.channels; ch++)
+    {
+        writeDataHeader (header, channels[(size_t) ch], ch, values);
+        channels[(size_t) ch].header.prepare (header, NUM_SLOTS);
+    }
+
+    // the block's payload, shared by reference as EncodingCache buffers are
+    auto block = std::make_shared<std::vector<std::vector<float>>> (signal);
+    const size_t payloadSize = sizeof (float) * (size_t) state.samples;
+    int64_t message = 0;
+
+    for (int64_t it = 0; it < state.iterations; it++)
+        for (int ch = 0; ch < state.channels; ch++)
+        {
+            fillValues (values, ++message, state.samples);
+            channels[(size_t) ch].header.render (values, header);
+
+            sendCopy (publisher.socket, "DATA", 5, ZMQ_SNDMORE);
+            sendCopy (publisher.socket, header.data(), header.size(), ZMQ_SNDMORE);
+
+            FrameHandle* handle = zeroCopy ? acquireFrameHandle (handles.get(), nextHandle, block) : nullptr;
+
+            if (handle != nullptr)
+            {
+                zmq_msg_t payload;
+                zmq_msg_init_data (&payload, (*block)[(size_t) ch].data(), payloadSize, releaseFrameHandle, handle);
+                zmq_msg_send (&payload, publisher.socket, 0);
+                zmq_msg_close (&payload);
+            }
+            else
+            {
+                sendCopy (publisher.socket, (*block)[(size_t) ch].data(), payloadSize, 0);
+            }
+        }
+
+    state.messagesPerIteration = state.channels;
+    state.bytesPerIteration = (int64_t) (5 + header.size() + payloadSize) * state.channels;
+}
+
+static void framesCopy (State& state)
+{
+    frames (state, false);
+}
+
+static void framesZeroCopy (State& state)
+{
+    frames (state, true);
+}
+
+static void pack (State& state, BlockEncoder::Encoding encoding)
+{
+    std::vector<std::vector<float>> signal = makeSignal (state.channels, state.samples);
+    std::vector<const float*> inputs;
+
+    for (auto& channel : signal)
+        inputs.push_back (channel.data());
+
+    BlockEncoder::Format format;
+    format.encoding = encoding;
+
+    std::vector<uint8_t> data;
+    std::vector<float> scales;
+
+    for (int64_t it = 0; it < state.iterations; it++)
+    {
+        BlockEncoder::encode (inputs.data(), state.channels, state.samples, format, data, scales);
+        consume (data.data(), data.size());
+    }
+
+    state.messagesPerIteration = state.channels;
+    state.bytesPerIteration = (int64_t) state.channels * state.samples * (int64_t) sizeof (float);
+}
+
+static void packFloat32 (State& state)
+{
+    pack (state, BlockEncoder::FLOAT32);
+}
+
+static void packInt16 (State& state)
+{
+    pack (state, BlockEncoder::INT16);
+}
+
+// the plugin's GOVERNOR_DECIMATION
+static const int GOVERNOR_DECIMATION = 4;
+
+static void governorLevel (State& state, int decimation, BlockEncoder::Encoding encoding, int numSent)
+{
+    std::vector<Channel> channels = makeChannels (state.channels);
+    std::vector<std::vector<float>> signal = makeSignal (state.channels, state.samples);
+    std::vector<const float*> inputs;
+
+    for (auto& channel : signal)
+        inputs.push_back (channel.data());
+
+    BlockEncoder::Format format;
+    format.decimation = decimation;
+    format.encoding = encoding;
+
+    for (int ch = 0; ch < numSent; ch++)
+        format.channels.push_back (ch);
+
+    std::string header;
+    int64_t values[NUM_SLOTS];
+
+    for (int slot = 0; slot < NUM_SLOTS; slot++)
+        values[slot] = HeaderTemplate::getPlaceholder (slot);
+
+    for (int ch = 0; ch < numSent; ch++)
+    {
+        writeDataHeader (header, channels[(size_t) ch], ch, values, &format);
+        channels[(size_t) ch].header.prepare (header, NUM_SLOTS);
+    }
+
+    std::vector<uint8_t> data;
+    std::vector<float> scales;
+    int64_t message = 0;
+
+    for (int64_t it = 0; it < state.iterations; it++)
+    {
+        BlockEncoder::encode (inputs.data(), state.channels, state.samples, format, data, scales);
+        consume (data.data(), data.size());
+
+        for (int ch = 0; ch < numSent; ch++)
+        {
+            fillValues (values, ++message, state.samples);
+            channels[(size_t) ch].header.render (values, header);
+            consume (header.data(), header.size());
+        }
+    }
+
+    state.messagesPerIteration = numSent;
+    state.bytesPerIteration = (int64_t) data.size() + (int64_t) header.size() * numSent;
+}
+
+static void governorNormal (State& state)
+{
+    governorLevel (state, 1, BlockEncoder::FLOAT32, state.channels);
+}
+
+static void governorDecimate (State& state)
+{
+    governorLevel (state, GOVERNOR_DECIMATION, BlockEncoder::FLOAT32, state.channels);
+}
+
+static void governorQuantize (State& state)
+{
+    governorLevel (state, GOVERNOR_DECIMATION, BlockEncoder::INT16, state.channels);
+}
+
+static void governorPriority (State& state)
+{
+    governorLevel (state, GOVERNOR_DECIMATION, BlockEncoder::INT16, (state.channels + 1) / 2);
+}
+
+// spikes: channels = channels of the electrode, samples = samples per channel of the waveform
+
+static void spikeJson (State& state)
+{
+    std::vector<float> thresholds ((size_t) state.channels, -50.0f);
+    std::string header;
+
+    for (int64_t it = 0; it < state.iterations; it++)
+    {
+        header.clear();
+        header += '{';
+        appendInt (header, "message_num", it);
+        appendText (header, "type", "spike");
+        appendKey (header, "spike");
+        header += '{';
+        appendText (header, "stream", "example_data");
+        appendInt (header, "source_node", 104);
+        appendText (header, "electrode", "Tetrode 1");
+        appendInt (header, "sample_num", it * 30);
+        appendInt (header, "num_channels", state.channels);
+        appendInt (header, "num_samples", state.samples);
+        appendInt (header, "sorted_id", 0);
+        appendKey (header, "threshold");
+        header += '[';
+        for (float threshold : thresholds)
+            appendDouble (header, nullptr, threshold);
+        header += "]}";
+        appendInt (header, "timestamp", 1700000000000 + it);
+        appendInt (header, "seq", it);
+        header += '}';
+
+        consume (header.data(), header.size());
+    }
+
+    state.bytesPerIteration = (int64_t) header.size() + (int64_t) sizeof (float) * state.channels * state.samples;
+}
+
+static void spikeRecord (State& state)
+{
+    std::vector<std::vector<float>> waveform = makeSignal (state.channels, state.samples);
+    std::vector<float> thresholds ((size_t) state.channels, -50.0f);
+
+    // one block's batch, reused like the plugin's spike buffers
+    const int batch = 256;
+    std::vector<SpikeRecord> records;
+    std::vector<float> waveforms;
+    records.reserve (batch);
+    waveforms.reserve ((size_t) batch * state.channels * state.samples);
+
+    for (int64_t it = 0; it < state.iterations; it++)
+    {
+        if (records.size() == (size_t) batch)
+        {
+            consume (records.data(), records.size() * sizeof (SpikeRecord));
+            records.clear();
+            waveforms.clear();
+        }
+
+        SpikeRecord record;
+        record.sampleNumber = it * 30;
+        record.electrode = 0;
+        record.sortedId = 0;
+        record.numChannels = (uint8_t) state.channels;
+        record.waveformChannels = (uint8_t) state.channels;
+        record.waveformSamples = (uint16_t) state.samples;
+        record.peakChannel = 0;
+
+        for (int i = 0; i < SPIKE_RECORD_THRESHOLDS; i++)
+            record.thresholds[i] = i < state.channels ? thresholds[(size_t) i] : 0.0f;
+
+        for (auto& channel : waveform)
+            waveforms.insert (waveforms.end(), channel.begin(), channel.end());
+
+        records.push_back (record);
+    }
+
+    state.bytesPerIteration = (int64_t) sizeof (SpikeRecord) + (int64_t) sizeof (float) * state.channels * state.samples;
+}
+
+// TTL: channels = events per block
+
+static void ttlJson (State& state)
+{
+    std::string header;
+
+    for (int64_t it = 0; it < state.iterations; it++)
+        for (int event = 0; event < state.channels; event++)
+        {
+            header.clear();
+            header += '{';
+            appendInt (header, "message_num", it * state.channels + event);
+            appendText (header, "type", "event");
+            appendKey (header, "content");
+            header += '{';
+            appendText (header, "stream", "example_data");
+            appendInt (header, "source_node", 104);
+            appendInt (header, "type", 3);
+            appendInt (header, "line", event % 8);
+            appendInt (header, "state", event & 1);
+            appendInt (header, "sample_num", it * 1024 + event);
+            header += '}';
+            appendInt (header, "timestamp", 1700000000000 + it);
+            appendInt (header, "seq", it * state.channels + event);
+            header += '}';
+
+            consume (header.data(), header.size());
+        }
+
+    state.messagesPerIteration = state.channels;
+    state.bytesPerIteration = (int64_t) header.size() * state.channels;
+}
+
+static void ttlRecord (State& state)
+{
+    std::vector<TtlRecord> records;
+    records.reserve ((size_t) state.channels);
+    uint64_t word = 0;
+
+    for (int64_t it = 0; it < state.iterations; it++)
+    {
+        records.clear();
+
+        for (int event = 0; event < state.channels; event++)
+        {
+            const uint8_t line = (uint8_t) (event % 8);
+            word ^= (uint64_t) 1 << line;
+
+            TtlRecord record;
+            record.line = line;
+            record.state = (uint8_t) ((word >> line) & 1);
+            record.sampleNumber = it * 1024 + event;
+            record.word = word;
+            records.push_back (record);
+        }
+
+        consume (records.data(), records.size() * sizeof (TtlRecord));
+    }
+
+    state.messagesPerIteration = state.channels;
+    state.bytesPerIteration = (int64_t) sizeof (TtlRecord) * state.channels;
+}
+
+//==============================================================================
+
+static std::vector<Benchmark> getBenchmarks()
+{
+    const std::vector<std::pair<int, int>> blocks = {
+        { 16, 256 }, { 16, 1024 }, { 64, 256 }, { 64, 1024 }, { 384, 256 }, { 384, 1024 }, { 384, 4096 }
+    };
+
+    const std::vector<std::pair<int, int>> spikes = { { 1, 40 }, { 4, 40 }, { 32, 40 }, { 384, 82 } };
+    const std::vector<std::pair<int, int>> ttl = { { 1, 0 }, { 16, 0 }, { 256, 0 } };
+
+    return {
+        { "header_json", headerJson, blocks, "channels/samples" },
+        { "header_template", headerTemplate, blocks, "channels/samples" },
+        { "frames_copy", framesCopy, blocks, "channels/samples" },
+        { "frames_zero_copy", framesZeroCopy, blocks, "channels/samples" },
+        { "pack_float32", packFloat32, blocks, "channels/samples" },
+        { "pack_int16", packInt16, blocks, "channels/samples" },
+        { "governor_normal", governorNormal, blocks, "channels/samples" },
+        { "governor_decimate", governorDecimate, blocks, "channels/samples" },
+        { "governor_quantize", governorQuantize, blocks, "channels/samples" },
+        { "governor_priority", governorPriority, blocks, "channels/samples" },
+        { "spike_json", spikeJson, spikes, "channels/samples" },
+        { "spike_record", spikeRecord, spikes, "channels/samples" },
+        { "ttl_json", ttlJson, ttl, "events" },
+        { "ttl_record", ttlRecord, ttl, "events" }
+    };
+}
+
+static std::string getRunName (const Benchmark& benchmark, const std::pair<int, int>& args)
+{
+    std::string name = std::string (benchmark.name) + "/" + std::to_string (args.first);
+    if (std::strchr (benchmark.argNames, '/') != nullptr)
+        name += "/" + std::to_string (args.second);
+    return name;
+}
+
+/** Runs one benchmark with growing iteration counts until it takes minTime */
+static Result run (const Benchmark& benchmark, const std::pair<int, int>& args, double minTime)
+{
+    State state;
+    state.channels = args.first;
+    state.samples = args.second;
+    state.iterations = 1;
+
+    double seconds = 0;
+    double cpuSeconds = 0;
+
+    while (true)
+    {
+        const std::clock_t cpuStart = std::clock();
+        const auto start = Clock::now();
+
+        benchmark.function (state);
+
+        seconds = std::chrono::duration<double> (Clock::now() - start).count();
+        cpuSeconds = (double) (std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+        if (seconds >= minTime || state.iterations >= ((int64_t) 1 << 40))
+            break;
+
+        // aim a little past minTime, growing at most 10x per attempt
+        const double factor = seconds > 0 ? minTime * 1.4 / seconds : 10.0;
+        state.iterations = (int64_t) std::ceil (state.iterations * std::min (10.0, std::max (2.0, factor)));
+    }
+
+    Result result;
+    result.name = getRunName (benchmark, args);
+    result.iterations = state.iterations;
+    result.realNs = seconds * 1.0e9 / state.iterations;
+    result.cpuNs = cpuSeconds * 1.0e9 / state.iterations;
+    result.nsPerMessage = result.realNs / state.messagesPerIteration;
+    result.messagesPerSecond = state.messagesPerIteration * state.iterations / seconds;
+    result.bytesPerSecond = (double) state.bytesPerIteration * state.iterations / seconds;
+    return result;
+}
+
+/** Reads ns_per_message of every benchmark from a file written with --json */
+static std::map<std::string, double> readBaseline (const std::string& path)
+{
+    std::map<std::string, double> baseline;
+    FILE* f = std::fopen (path.c_str(), "r");
+    if (f == nullptr)
+        return baseline;
+
+    char line[1024];
+    std::string name;
+
+    while (std::fgets (line, sizeof (line), f) != nullptr)
+    {
+        const char* key = std::strstr (line, "\"name\": \"");
+        if (key != nullptr)
+        {
+            const char* start = key + 9;
+            const char* end = std::strchr (start, '"');
+            name = end != nullptr ? std::string (start, end) : std::string();
+        }
+
+        const char* value = std::strstr (line, "\"ns_per_message\": ");
+        if (value != nullptr && ! name.empty())
+            baseline[name] = std::atof (value + 18);
+    }
+
+    std::fclose (f);
+    return baseline;
+}
+
+static bool writeJson (const std::string& path, const std::vector<Result>& results, double minTime)
+{
+    FILE* f = std::fopen (path.c_str(), "w");
+    if (f == nullptr)
+        return false;
+
+    char date[64];
+    const std::time_t now = std::time (nullptr);
+    std::strftime (date, sizeof (date), "%Y-%m-%dT%H:%M:%S", std::localtime (&now));
+
+    std::fprintf (f,
+                  "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"executable\": \"kernel_bench\",\n    \"num_cpus\": %u,\n"
+                  "    \"min_time\": %.2f,\n    \"library_build_type\": \"%s\"\n  },\n  \"benchmarks\": [\n",
+                  date,
+                  std::thread::hardware_concurrency(),
+                  minTime,
+#ifdef NDEBUG
+                  "release"
+#else
+                  "debug"
+#endif
+    );
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        std::fprintf (f,
+                      "    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"iteration\",\n"
+                      "      \"iterations\": %lld,\n      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\",\n"
+                      "      \"ns_per_message\": %.3f,\n      \"items_per_second\": %.1f,\n      \"bytes_per_second\": %.1f\n    }%s\n",
+                      r.name.c_str(),
+                      r.name.c_str(),
+                      (long long) r.iterations,
+                      r.realNs,
+                      r.cpuNs,
+                      r.nsPerMessage,
+                      r.messagesPerSecond,
+                      r.bytesPerSecond,
+                      i + 1 < results.size() ? "," : "");
+    }
+
+    std::fprintf (f, "  ]\n}\n");
+    return std::fclose (f) == 0;
+}
+
+int main (int argc, char** argv)
+{
+    std::string filter;
+    std::string jsonFile;
+    std::string compareFile;
+    double minTime = 0.2;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--filter" && hasValue)
+            filter = argv[++i];
+        else if (arg == "--min-time" && hasValue)
+            minTime = std::atof (argv[++i]);
+        else if (arg == "--json" && hasValue)
+            jsonFile = argv[++i];
+        else if (arg == "--compare" && hasValue)
+            compareFile = argv[++i];
+    }
+
+    const std::map<std::string, double> baseline = readBaseline (compareFile);
+
+    if (! compareFile.empty() && baseline.empty())
+        std::fprintf (stderr, "no results in %s\n", compareFile.c_str());
+
+    std::printf ("%-34s %14s %12s %12s %12s%s\n", "benchmark", "iterations", "ns/iter", "ns/message", "MB/s", baseline.empty() ? "" : "   vs baseline");
+
+    std::vector<Result> results;
+
+    for (auto& benchmark : getBenchmarks())
+        for (auto& args : benchmark.args)
+        {
+            if (! filter.empty() && getRunName (benchmark, args).find (filter) == std::string::npos)
+                continue;
+
+            Result r = run (benchmark, args, minTime);
+            results.push_back (r);
+
+            std::printf ("%-34s %14lld %12.1f %12.1f %12.1f",
+                         r.name.c_str(),
+                         (long long) r.iterations,
+                         r.realNs,
+                         r.nsPerMessage,
+                         r.bytesPerSecond / 1.0e6);
+
+            auto before = baseline.find (r.name);
+            if (before != baseline.end() && before->second > 0)
+                std::printf ("   %+7.1f%%", (r.nsPerMessage / before->second - 1.0) * 100.0);
+
+            std::printf ("\n");
+            std::fflush (stdout);
+        }
+
+    if (! jsonFile.empty() && ! writeJson (jsonFile, results, minTime))
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,862 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/*
+  Load generator for the plugin's publisher and control plane: N SUB
+  clients on the data socket and M REQ applications sending heartbeats
+  (and optionally events) to the listening socket, stepped through every
+  combination of the given N and M.
+
+  For every step it reports
+   - publish rate: messages per second the publisher sent, from the
+     sequence numbers in the headers
+   - per-client receive rate (mean and slowest client) and drops (gaps in
+     the sequence numbers; high-water-mark drops show up here)
+   - control round trips: p50 / p99 / max latency, replies per second and
+     requests that timed out
+   - publisher CPU: with --pid, the plugin's (GUI's) process from
+     /proc/<pid>/stat (Linux); with --synthetic, the synthetic publisher's
+     own threads
+
+  The clients share the machine with the publisher: on few cores their
+  own CPU use limits the receive rates, so compare steps from one host.
+
+  Without a running plugin, --synthetic starts a publisher in this process
+  that mimics the plugin's sockets: DATA messages with the plugin's header
+  fields at the given channel count, block size and sample rate, and a REP
+  socket answering like the plugin's listening socket.
+
+  Usage: load_generator [--host H] [--data-port P] [--listen-port P]
+                        [--subscribers 1,10,50] [--apps 0,100,500]
+                        [--duration s] [--heartbeat-ms N] [--events-per-second N]
+                        [--timeout-ms N] [--threads N] [--pid N]
+                        [--synthetic] [--channels N] [--samples N] [--sample-rate N]
+                        [--report file]
+*/
+
+#include <zmq.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int dataPort = 5556;
+    int listenPort = 0; // data port + 1, as in the plugin
+    std::string topic = "DATA";
+    std::vector<int> subscribers = { 1, 10, 50 };
+    std::vector<int> apps = { 0, 100, 500 };
+    double duration = 5.0;
+    int heartbeatMs = 1000;
+    double eventsPerSecond = 0;
+    int timeoutMs = 2000;
+    int threads = 4;
+    int pid = 0;
+    bool synthetic = false;
+    int channels = 64;
+    int samples = 1024;
+    double sampleRate = 30000.0;
+    std::string reportFile;
+};
+
+struct Step
+{
+    int subscribers = 0;
+    int apps = 0;
+    double seconds = 0;
+
+    double publishRate = 0;
+    double meanReceiveRate = 0;
+    double minReceiveRate = 0;
+    double dropFraction = 0;
+    double worstDropFraction = 0;
+
+    int64_t requests = 0;
+    int64_t timeouts = 0;
+    double replyRate = 0;
+    double rttP50 = 0;
+    double rttP99 = 0;
+    double rttMax = 0;
+
+    double cpuPercent = -1;
+};
+
+static double secondsSince (Clock::time_point start)
+{
+    return std::chrono::duration<double> (Clock::now() - start).count();
+}
+
+static std::vector<int> parseList (const std::string& list)
+{
+    std::vector<int> values;
+    size_t start = 0;
+
+    while (start <= list.size())
+    {
+        size_t end = list.find (',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        if (end > start)
+            values.push_back (std::atoi (list.substr (start, end - start).c_str()));
+        start = end + 1;
+    }
+
+    return values;
+}
+
+/** Reads the number after "key": in a JSON header; returns -1 if absent */
+static int64_t readNumber (const char* header, size_t size, const char* key)
+{
+    const std::string text (header, size);
+    size_t at = text.find (key);
+    if (at == std::string::npos)
+        return -1;
+
+    at = text.find (':', at + std::strlen (key));
+    if (at == std::string::npos)
+        return -1;
+
+    return std::atoll (text.c_str() + at + 1);
+}
+
+//==============================================================================
+
+/** CPU time used so far, in seconds: of a process, or of a set of threads */
+class CpuMeter
+{
+public:
+    void setProcess (int processId) { pid = processId; }
+
+    void addThread (std::thread& thread)
+    {
+#ifdef __linux__
+        clockid_t clock;
+        if (pthread_getcpuclockid (thread.native_handle(), &clock) == 0)
+            threadClocks.push_back (clock);
+#else
+        (void) thread;
+#endif
+    }
+
+    void clearThreads() { threadClocks.clear(); }
+
+    /** Returns -1 where it cannot be measured */
+    double read() const
+    {
+#ifdef __linux__
+        if (pid > 0)
+        {
+            char path[64];
+            std::snprintf (path, sizeof (path), "/proc/%d/stat", pid);
+
+            FILE* f = std::fopen (path, "r");
+            if (f == nullptr)
+                return -1;
+
+            char line[1024];
+            const bool ok = std::fgets (line, sizeof (line), f) != nullptr;
+            std::fclose (f);
+
+            // utime and stime are fields 14 and 15, counted after the ')' closing the command name
+            const char* fields = ok ? std::strrchr (line, ')') : nullptr;
+            unsigned long long utime = 0, stime = 0;
+
+            if (fields == nullptr || std::sscanf (fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2)
+                return -1;
+
+            return (double) (utime + stime) / (double) sysconf (_SC_CLK_TCK);
+        }
+
+        if (threadClocks.empty())
+            return -1;
+
+        double total = 0;
+
+        for (clockid_t clock : threadClocks)
+        {
+            timespec time;
+            if (clock_gettime (clock, &time) == 0)
+                total += time.tv_sec + time.tv_nsec / 1.0e9;
+        }
+
+        return total;
+#else
+        return -1;
+#endif
+    }
+
+private:
+    int pid = 0;
+#ifdef __linux__
+    std::vector<clockid_t> threadClocks;
+#endif
+};
+
+//==============================================================================
+
+/** Stands in for the plugin: a PUB socket with DATA messages and a REP listening socket */
+class SyntheticPublisher
+{
+public:
+    bool start (void* context, const Options& options, CpuMeter& cpu)
+    {
+        pub = zmq_socket (context, ZMQ_PUB);
+        rep = zmq_socket (context, ZMQ_REP);
+
+        const std::string dataEndpoint = "tcp://*:" + std::to_string (options.dataPort);
+        const std::string listenEndpoint = "tcp://*:" + std::to_string (options.listenPort);
+
+        if (zmq_bind (pub, dataEndpoint.c_str()) != 0 || zmq_bind (rep, listenEndpoint.c_str()) != 0)
+        {
+            std::fprintf (stderr, "synthetic publisher: bind failed: %s\n", zmq_strerror (zmq_errno()));
+            return false;
+        }
+
+        running = true;
+        publisher = std::thread ([this, options] { publish (options); });
+        listener = std::thread ([this] { listen(); });
+
+        cpu.addThread (publisher);
+        cpu.addThread (listener);
+        return true;
+    }
+
+    void stop()
+    {
+        running = false;
+
+        if (publisher.joinable())
+            publisher.join();
+        if (listener.joinable())
+            listener.join();
+
+        zmq_close (pub);
+        zmq_close (rep);
+    }
+
+private:
+    void publish (const Options& options)
+    {
+        std::vector<float> payload ((size_t) options.samples, 1.0f);
+        const auto blockPeriod = std::chrono::duration<double> (options.samples / options.sampleRate);
+        auto nextBlock = Clock::now();
+        int64_t messageNum = 0;
+        int64_t sampleNum = 0;
+        char header[512];
+
+        while (running)
+        {
+            for (int ch = 0; ch < options.channels; ch++)
+            {
+                messageNum++;
+
+                const int size = std::snprintf (header,
+                                                sizeof (header),
+                                                "{\"message_num\": %lld, \"type\": \"data\", \"content\": {\"stream\": \"synthetic\", "
+                                                "\"channel_num\": %d, \"channel_name\": \"CH%d\", \"num_samples\": %d, \"sample_num\": %lld, "
+                                                "\"sample_rate\": %g, \"bit_volts\": 0.195}, \"data_size\": %d, \"timestamp\": %lld, \"seq\": %lld}",
+                                                (long long) messageNum,
+                                                ch,
+                                                ch + 1,
+                                                options.samples,
+                                                (long long) sampleNum,
+                                                options.sampleRate,
+                                                (int) (payload.size() * sizeof (float)),
+                                                (long long) std::chrono::duration_cast<std::chrono::milliseconds> (Clock::now().time_since_epoch()).count(),
+                                                (long long) messageNum);
+
+                zmq_send (pub, "DATA", 5, ZMQ_SNDMORE);
+                zmq_send (pub, header, (size_t) size, ZMQ_SNDMORE);
+                zmq_send (pub, payload.data(), payload.size() * sizeof (float), 0);
+            }
+
+            sampleNum += options.samples;
+            nextBlock += std::chrono::duration_cast<Clock::duration> (blockPeriod);
+            std::this_thread::sleep_until (nextBlock);
+        }
+    }
+
+    void listen()
+    {
+        char request[4096];
+        zmq_pollitem_t item = { rep, 0, ZMQ_POLLIN, 0 };
+
+        while (running)
+        {
+            if (zmq_poll (&item, 1, 100) <= 0)
+                continue;
+
+            const int size = zmq_recv (rep, request, sizeof (request) - 1, 0);
+            if (size < 0)
+                continue;
+
+            request[std::min (size, (int) sizeof (request) - 1)] = 0;
+
+            const char* reply = std::strstr (request, "\"event\"") != nullptr ? "message correctly parsed" : "heartbeat received";
+            zmq_send (rep, reply, std::strlen (reply), 0);
+        }
+    }
+
+    void* pub = nullptr;
+    void* rep = nullptr;
+    std::atomic<bool> running { false };
+    std::thread publisher;
+    std::thread listener;
+};
+
+//==============================================================================
+
+struct Subscriber
+{
+    void* socket = nullptr;
+    int64_t received = 0;
+    int64_t missed = 0;
+    int64_t firstSeq = -1;
+    int64_t lastSeq = -1;
+};
+
+/** Receives on a share of the SUB clients; counts only while measuring */
+static void runSubscribers (std::vector<Subscriber*> clients, const std::atomic<bool>& measuring, const std::atomic<bool>& running)
+{
+    std::vector<zmq_pollitem_t> items;
+    for (auto* client : clients)
+        items.push_back ({ client->socket, 0, ZMQ_POLLIN, 0 });
+
+    std::vector<char> frame (1 << 16);
+
+    while (running)
+    {
+        if (zmq_poll (items.data(), (int) items.size(), 100) <= 0)
+            continue;
+
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            if (! (items[i].revents & ZMQ_POLLIN))
+                continue;
+
+            Subscriber& client = *clients[i];
+
+            // drain what is queued: envelope, header, payload frames
+            while (true)
+            {
+                int more = 1;
+                size_t moreSize = sizeof (more);
+                int part = 0;
+                int64_t seq = -1;
+
+                while (more)
+                {
+                    const int size = zmq_recv (client.socket, frame.data(), frame.size(), part == 0 ? ZMQ_DONTWAIT : 0);
+                    if (size < 0)
+                        break;
+
+                    if (part == 1)
+                        seq = readNumber (frame.data(), (size_t) std::min (size, (int) frame.size()), "\"seq\"");
+
+                    zmq_getsockopt (client.socket, ZMQ_RCVMORE, &more, &moreSize);
+                    part++;
+                }
+
+                if (part == 0)
+                    break;
+
+                if (! measuring || seq < 0)
+                    continue;
+
+                if (client.firstSeq < 0)
+                    client.firstSeq = seq;
+                else if (seq > client.lastSeq + 1)
+                    client.missed += seq - client.lastSeq - 1;
+
+                client.lastSeq = std::max (client.lastSeq, seq);
+                client.received++;
+            }
+        }
+    }
+}
+
+struct App
+{
+    void* socket = nullptr;
+    std::string uuid;
+    bool waiting = false;
+    bool counted = false; // sent while measuring
+    Clock::time_point sentAt;
+    Clock::time_point nextHeartbeat;
+    Clock::time_point nextEvent;
+};
+
+struct AppStats
+{
+    std::vector<double> rttMs;
+    int64_t requests = 0;
+    int64_t timeouts = 0;
+};
+
+static void* openApp (void* context, const std::string& endpoint)
+{
+    void* socket = zmq_socket (context, ZMQ_REQ);
+    int linger = 0;
+    zmq_setsockopt (socket, ZMQ_LINGER, &linger, sizeof (linger));
+    zmq_connect (socket, endpoint.c_str());
+    return socket;
+}
+
+/** Drives a share of the REQ applications: heartbeats, events and their replies */
+static void runApps (void* context,
+                     std::vector<App*> apps,
+                     const Options& options,
+                     const std::string& endpoint,
+                     AppStats& stats,
+                     const std::atomic<bool>& measuring,
+                     const std::atomic<bool>& running)
+{
+    const auto heartbeatPeriod = std::chrono::milliseconds (options.heartbeatMs);
+    const auto eventPeriod = std::chrono::duration_cast<Clock::duration> (std::chrono::duration<double> (options.eventsPerSecond > 0 ? 1.0 / options.eventsPerSecond : 1.0e9));
+    const auto timeout = std::chrono::milliseconds (options.timeoutMs);
+
+    std::vector<zmq_pollitem_t> items (apps.size());
+    std::vector<App*> waiting;
+    char reply[256];
+    char request[512];
+    int64_t eventNum = 0;
+
+    while (running)
+    {
+        const auto now = Clock::now();
+        items.clear();
+        waiting.clear();
+
+        for (auto* app : apps)
+        {
+            if (app->waiting && now - app->sentAt > timeout)
+            {
+                // a REQ socket without its reply cannot send again; start over
+                zmq_close (app->socket);
+                app->socket = openApp (context, endpoint);
+                app->waiting = false;
+
+                if (app->counted)
+                    stats.timeouts++;
+            }
+
+            if (! app->waiting)
+            {
+                int size = 0;
+
+                if (options.eventsPerSecond > 0 && now >= app->nextEvent)
+                {
+                    size = std::snprintf (request,
+                                          sizeof (request),
+                                          "{\"application\": \"load_generator\", \"uuid\": \"%s\", \"type\": \"event\", "
+                                          "\"event\": {\"type\": 3, \"event_id\": 1, \"event_channel\": 0, \"sample_num\": %lld}}",
+                                          app->uuid.c_str(),
+                                          (long long) ++eventNum);
+                    app->nextEvent += eventPeriod;
+                }
+                else if (now >= app->nextHeartbeat)
+                {
+                    size = std::snprintf (request,
+                                          sizeof (request),
+                                          "{\"application\": \"load_generator\", \"uuid\": \"%s\", \"type\": \"heartbeat\"}",
+                                          app->uuid.c_str());
+                    app->nextHeartbeat += heartbeatPeriod;
+                }
+
+                if (size > 0 && zmq_send (app->socket, request, (size_t) size, ZMQ_DONTWAIT) >= 0)
+                {
+                    app->waiting = true;
+                    app->counted = measuring;
+                    app->sentAt = Clock::now();
+
+                    if (app->counted)
+                        stats.requests++;
+                }
+            }
+
+            if (app->waiting)
+            {
+                items.push_back ({ app->socket, 0, ZMQ_POLLIN, 0 });
+                waiting.push_back (app);
+            }
+        }
+
+        if (items.empty())
+        {
+            std::this_thread::sleep_for (std::chrono::milliseconds (1));
+            continue;
+        }
+
+        if (zmq_poll (items.data(), (int) items.size(), 5) <= 0)
+            continue;
+
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            if (! (items[i].revents & ZMQ_POLLIN))
+                continue;
+
+            App& app = *waiting[i];
+
+            if (zmq_recv (app.socket, reply, sizeof (reply), 0) < 0)
+                continue;
+
+            app.waiting = false;
+
+            if (app.counted)
+                stats.rttMs.push_back (std::chrono::duration<double, std::milli> (Clock::now() - app.sentAt).count());
+        }
+    }
+}
+
+//==============================================================================
+
+static Step runStep (void* context, const Options& options, int numSubscribers, int numApps, CpuMeter& cpu)
+{
+    Step step;
+    step.subscribers = numSubscribers;
+    step.apps = numApps;
+
+    const std::string dataEndpoint = "tcp://" + options.host + ":" + std::to_string (options.dataPort);
+    const std::string listenEndpoint = "tcp://" + options.host + ":" + std::to_string (options.listenPort);
+    const int numThreads = std::max (1, options.threads);
+
+    std::vector<std::unique_ptr<Subscriber>> subscribers;
+
+    for (int i = 0; i < numSubscribers; i++)
+    {
+        subscribers.emplace_back (new Subscriber());
+        Subscriber& client = *subscribers.back();
+
+        client.socket = zmq_socket (context, ZMQ_SUB);
+        int linger = 0;
+        zmq_setsockopt (client.socket, ZMQ_LINGER, &linger, sizeof (linger));
+        zmq_connect (client.socket, dataEndpoint.c_str());
+        zmq_setsockopt (client.socket, ZMQ_SUBSCRIBE, options.topic.c_str(), options.topic.size());
+    }
+
+    std::vector<std::unique_ptr<App>> apps;
+    const auto now = Clock::now();
+
+    for (int i = 0; i < numApps; i++)
+    {
+        apps.emplace_back (new App());
+        App& app = *apps.back();
+
+        char uuid[64];
+        std::snprintf (uuid, sizeof (uuid), "load-%08x-%04d", (unsigned) std::rand(), i);
+
+        app.uuid = uuid;
+        app.socket = openApp (context, listenEndpoint);
+
+        // spread the heartbeats over the period
+        app.nextHeartbeat = now + std::chrono::milliseconds (options.heartbeatMs * i / std::max (1, numApps));
+        app.nextEvent = now;
+    }
+
+    std::atomic<bool> measuring { false };
+    std::atomic<bool> running { true };
+    std::vector<std::thread> threads;
+    std::vector<AppStats> appStats ((size_t) numThreads);
+
+    for (int t = 0; t < numThreads; t++)
+    {
+        std::vector<Subscriber*> subscriberShare;
+        for (size_t i = (size_t) t; i < subscribers.size(); i += (size_t) numThreads)
+            subscriberShare.push_back (subscribers[i].get());
+
+        std::vector<App*> appShare;
+        for (size_t i = (size_t) t; i < apps.size(); i += (size_t) numThreads)
+            appShare.push_back (apps[i].get());
+
+        if (! subscriberShare.empty())
+            threads.emplace_back (runSubscribers, subscriberShare, std::cref (measuring), std::cref (running));
+
+        if (! appShare.empty())
+            threads.emplace_back (runApps, context, appShare, std::cref (options), listenEndpoint, std::ref (appStats[(size_t) t]), std::cref (measuring), std::cref (running));
+    }
+
+    // let connections and subscriptions settle before counting; many
+    // simultaneous connects can overflow the listen backlog and take seconds
+    std::this_thread::sleep_for (std::chrono::milliseconds (500 + 5 * std::max (numSubscribers, numApps)));
+
+    const double cpuStart = cpu.read();
+    const auto start = Clock::now();
+    measuring = true;
+
+    std::this_thread::sleep_for (std::chrono::duration<double> (options.duration));
+
+    measuring = false;
+    step.seconds = secondsSince (start);
+    const double cpuEnd = cpu.read();
+
+    running = false;
+    for (auto& thread : threads)
+        thread.join();
+
+    if (cpuStart >= 0 && cpuEnd >= 0)
+        step.cpuPercent = (cpuEnd - cpuStart) / step.seconds * 100.0;
+
+    // subscribers
+    int64_t totalReceived = 0;
+    int64_t totalMissed = 0;
+    int64_t published = 0;
+    step.minReceiveRate = numSubscribers > 0 ? 1.0e300 : 0;
+
+    for (auto& client : subscribers)
+    {
+        const double rate = client->received / step.seconds;
+        const int64_t expected = client->received + client->missed;
+
+        totalReceived += client->received;
+        totalMissed += client->missed;
+        published = std::max (published, client->firstSeq >= 0 ? client->lastSeq - client->firstSeq + 1 : 0);
+
+        step.minReceiveRate = std::min (step.minReceiveRate, rate);
+        step.worstDropFraction = std::max (step.worstDropFraction, expected > 0 ? (double) client->missed / expected : 0.0);
+
+        zmq_close (client->socket);
+    }
+
+    step.publishRate = published / step.seconds;
+    step.meanReceiveRate = numSubscribers > 0 ? totalReceived / step.seconds / numSubscribers : 0;
+    step.dropFraction = totalReceived + totalMissed > 0 ? (double) totalMissed / (totalReceived + totalMissed) : 0;
+
+    // control plane
+    std::vector<double> rtt;
+
+    for (auto& stats : appStats)
+    {
+        rtt.insert (rtt.end(), stats.rttMs.begin(), stats.rttMs.end());
+        step.requests += stats.requests;
+        step.timeouts += stats.timeouts;
+    }
+
+    for (auto& app : apps)
+        zmq_close (app->socket);
+
+    step.replyRate = rtt.size() / step.seconds;
+
+    if (! rtt.empty())
+    {
+        std::sort (rtt.begin(), rtt.end());
+        step.rttP50 = rtt[rtt.size() / 2];
+        step.rttP99 = rtt[std::min (rtt.size() - 1, rtt.size() * 99 / 100)];
+        step.rttMax = rtt.back();
+    }
+
+    return step;
+}
+
+static bool writeReport (const std::string& path, const Options& options, const std::vector<Step>& steps)
+{
+    FILE* f = std::fopen (path.c_str(), "w");
+    if (f == nullptr)
+        return false;
+
+    std::fprintf (f,
+                  "{\n  \"target\": \"%s\",\n  \"data_port\": %d,\n  \"listen_port\": %d,\n  \"duration\": %.1f,\n"
+                  "  \"heartbeat_ms\": %d,\n  \"events_per_second\": %.1f,\n",
+                  options.synthetic ? "synthetic" : options.host.c_str(),
+                  options.dataPort,
+                  options.listenPort,
+                  options.duration,
+                  options.heartbeatMs,
+                  options.eventsPerSecond);
+
+    if (options.synthetic)
+        std::fprintf (f, "  \"channels\": %d,\n  \"samples\": %d,\n  \"sample_rate\": %.1f,\n", options.channels, options.samples, options.sampleRate);
+
+    std::fprintf (f, "  \"steps\": [\n");
+
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+        const Step& s = steps[i];
+        std::fprintf (f,
+                      "    {\"subscribers\": %d, \"apps\": %d, \"seconds\": %.2f, \"publish_rate\": %.1f, "
+                      "\"mean_receive_rate\": %.1f, \"min_receive_rate\": %.1f, \"drop_fraction\": %.5f, \"worst_drop_fraction\": %.5f, "
+                      "\"requests\": %lld, \"timeouts\": %lld, \"reply_rate\": %.1f, \"rtt_p50_ms\": %.3f, \"rtt_p99_ms\": %.3f, \"rtt_max_ms\": %.3f, "
+                      "\"cpu_percent\": %.1f}%s\n",
+                      s.subscribers,
+                      s.apps,
+                      s.seconds,
+                      s.publishRate,
+                      s.meanReceiveRate,
+                      s.minReceiveRate,
+                      s.dropFraction,
+                      s.worstDropFraction,
+                      (long long) s.requests,
+                      (long long) s.timeouts,
+                      s.replyRate,
+                      s.rttP50,
+                      s.rttP99,
+                      s.rttMax,
+                      s.cpuPercent,
+                      i + 1 < steps.size() ? "," : "");
+    }
+
+    std::fprintf (f, "  ]\n}\n");
+    return std::fclose (f) == 0;
+}
+
+int main (int argc, char** argv)
+{
+    Options options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--synthetic")
+            options.synthetic = true;
+        else if (arg == "--host" && hasValue)
+            options.host = argv[++i];
+        else if (arg == "--data-port" && hasValue)
+            options.dataPort = std::atoi (argv[++i]);
+        else if (arg == "--listen-port" && hasValue)
+            options.listenPort = std::atoi (argv[++i]);
+        else if (arg == "--topic" && hasValue)
+            options.topic = argv[++i];
+        else if (arg == "--subscribers" && hasValue)
+            options.subscribers = parseList (argv[++i]);
+        else if (arg == "--apps" && hasValue)
+            options.apps = parseList (argv[++i]);
+        else if (arg == "--duration" && hasValue)
+            options.duration = std::atof (argv[++i]);
+        else if (arg == "--heartbeat-ms" && hasValue)
+            options.heartbeatMs = std::max (1, std::atoi (argv[++i]));
+        else if (arg == "--events-per-second" && hasValue)
+            options.eventsPerSecond = std::atof (argv[++i]);
+        else if (arg == "--timeout-ms" && hasValue)
+            options.timeoutMs = std::atoi (argv[++i]);
+        else if (arg == "--threads" && hasValue)
+            options.threads = std::atoi (argv[++i]);
+        else if (arg == "--pid" && hasValue)
+            options.pid = std::atoi (argv[++i]);
+        else if (arg == "--channels" && hasValue)
+            options.channels = std::atoi (argv[++i]);
+        else if (arg == "--samples" && hasValue)
+            options.samples = std::atoi (argv[++i]);
+        else if (arg == "--sample-rate" && hasValue)
+            options.sampleRate = std::atof (argv[++i]);
+        else if (arg == "--report" && hasValue)
+            options.reportFile = argv[++i];
+    }
+
+    if (options.listenPort == 0)
+        options.listenPort = options.dataPort + 1;
+
+    int maxSubscribers = 0, maxApps = 0;
+    for (int n : options.subscribers)
+        maxSubscribers = std::max (maxSubscribers, n);
+    for (int m : options.apps)
+        maxApps = std::max (maxApps, m);
+
+    void* context = zmq_ctx_new();
+    zmq_ctx_set (context, ZMQ_MAX_SOCKETS, std::max (1024, 2 * (maxSubscribers + maxApps) + 16));
+
+    CpuMeter cpu;
+    SyntheticPublisher synthetic;
+
+    if (options.synthetic)
+    {
+        options.host = "127.0.0.1";
+        if (! synthetic.start (context, options, cpu))
+            return 1;
+    }
+    else
+    {
+        cpu.setProcess (options.pid);
+    }
+
+    std::printf ("%s, data port %d, listening port %d, %.1f s per step, heartbeat every %d ms%s\n\n",
+                 options.synthetic ? "synthetic publisher" : options.host.c_str(),
+                 options.dataPort,
+                 options.listenPort,
+                 options.duration,
+                 options.heartbeatMs,
+                 options.eventsPerSecond > 0 ? ", with events" : "");
+    std::printf ("%5s %5s %11s %11s %11s %8s %9s %9s %9s %9s %8s %6s\n",
+                 "subs", "apps", "publish/s", "recv/s", "min recv/s", "drops", "replies/s", "p50 (ms)", "p99 (ms)", "max (ms)", "timeouts", "cpu %");
+
+    std::vector<Step> steps;
+
+    for (int numSubscribers : options.subscribers)
+        for (int numApps : options.apps)
+        {
+            Step s = runStep (context, options, numSubscribers, numApps, cpu);
+            steps.push_back (s);
+
+            char cpuText[16] = "n/a";
+            if (s.cpuPercent >= 0)
+                std::snprintf (cpuText, sizeof (cpuText), "%.1f", s.cpuPercent);
+
+            std::printf ("%5d %5d %11.0f %11.0f %11.0f %7.2f%% %9.0f %9.2f %9.2f %9.2f %8lld %6s\n",
+                         s.subscribers,
+                         s.apps,
+                         s.publishRate,
+                         s.meanReceiveRate,
+                         s.minReceiveRate,
+                         s.dropFraction * 100.0,
+                         s.replyRate,
+                         s.rttP50,
+                         s.rttP99,
+                         s.rttMax,
+                         (long long) s.timeouts,
+                         cpuText);
+            std::fflush (stdout);
+        }
+
+    if (options.synthetic)
+    {
+        synthetic.stop();
+        cpu.clearThreads();
+    }
+
+    zmq_ctx_destroy (context);
+
+    if (! options.reportFile.empty() && ! writeReport (options.reportFile, options, steps))
+        return 1;
+
+    return 0;
+}
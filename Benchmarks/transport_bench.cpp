@@ -0,0 +1,345 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/*
+  Compares tcp://, ipc:// and inproc:// for the plugin's publishing
+  pattern: one PUB socket, three-frame messages (envelope, JSON header,
+  float32 payload), one SUB on the same machine.
+
+  For every transport it measures
+   - throughput: messages sent back-to-back, counted at the subscriber
+   - latency: paced messages carrying a send timestamp, one-way delay
+     measured at the subscriber (same clock, same host)
+
+  Usage: transport_bench [--messages N] [--samples N] [--latency-messages N]
+                         [--transports tcp,ipc,inproc] [--json file]
+*/
+
+#include <zmq.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    int messages = 20000;
+    int samples = 1024;
+    int latencyMessages = 2000;
+    std::vector<std::string> transports = { "tcp", "ipc", "inproc" };
+    std::string jsonFile;
+};
+
+struct Result
+{
+    std::string transport;
+    double messagesPerSecond = 0;
+    double megabytesPerSecond = 0;
+    double received = 0;
+    double p50 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (Clock::now().time_since_epoch()).count();
+}
+
+static std::string endpointFor (const std::string& transport)
+{
+    if (transport == "tcp")
+        return "tcp://127.0.0.1:15556";
+    if (transport == "ipc")
+        return "ipc:///tmp/zmq-interface-bench";
+    return "inproc://zmq-interface-bench";
+}
+
+static void sendMessage (void* pub, const std::vector<float>& payload, int64_t messageNum)
+{
+    char header[256];
+    int headerSize = std::snprintf (header,
+                                    sizeof (header),
+                                    "{\"message_num\": %lld, \"type\": \"data\", \"timestamp_ns\": %lld}",
+                                    (long long) messageNum,
+                                    (long long) nowNs());
+
+    zmq_send (pub, "DATA", 5, ZMQ_SNDMORE);
+    zmq_send (pub, header, (size_t) headerSize, ZMQ_SNDMORE);
+    zmq_send (pub, payload.data(), payload.size() * sizeof (float), 0);
+}
+
+/** Receives one three-frame message; returns the send timestamp, or -1 on timeout */
+static int64_t receiveMessage (void* sub, std::vector<char>& buffer)
+{
+    int more = 1;
+    size_t moreSize = sizeof (more);
+    int frame = 0;
+    int64_t sentNs = -1;
+
+    while (more)
+    {
+        int size = zmq_recv (sub, buffer.data(), buffer.size(), 0);
+        if (size < 0)
+            return -1;
+
+        if (frame == 1)
+        {
+            const char* ts = std::strstr (buffer.data(), "\"timestamp_ns\": ");
+            if (ts != nullptr)
+                sentNs = std::atoll (ts + 16);
+        }
+
+        zmq_getsockopt (sub, ZMQ_RCVMORE, &more, &moreSize);
+        frame++;
+    }
+
+    return sentNs;
+}
+
+static bool connectPair (void* context, const std::string& endpoint, void*& pub, void*& sub, const std::vector<float>& payload)
+{
+    pub = zmq_socket (context, ZMQ_PUB);
+    sub = zmq_socket (context, ZMQ_SUB);
+
+    int hwm = 0; // unlimited: measure the transport, not drops
+    zmq_setsockopt (pub, ZMQ_SNDHWM, &hwm, sizeof (hwm));
+    zmq_setsockopt (sub, ZMQ_RCVHWM, &hwm, sizeof (hwm));
+
+    int timeout = 2000;
+    zmq_setsockopt (sub, ZMQ_RCVTIMEO, &timeout, sizeof (timeout));
+
+    if (zmq_bind (pub, endpoint.c_str()) != 0)
+    {
+        std::fprintf (stderr, "bind %s failed: %s\n", endpoint.c_str(), zmq_strerror (zmq_errno()));
+        return false;
+    }
+
+    zmq_connect (sub, endpoint.c_str());
+    zmq_setsockopt (sub, ZMQ_SUBSCRIBE, "", 0);
+
+    // wait until the subscription has reached the publisher
+    std::vector<char> buffer (payload.size() * sizeof (float) + 1024);
+    int nonBlocking = 50;
+    zmq_setsockopt (sub, ZMQ_RCVTIMEO, &nonBlocking, sizeof (nonBlocking));
+
+    for (int attempt = 0; attempt < 100; attempt++)
+    {
+        sendMessage (pub, payload, -1);
+        if (receiveMessage (sub, buffer) >= 0)
+            break;
+    }
+
+    // drain warm-up messages
+    while (receiveMessage (sub, buffer) >= 0)
+    {
+    }
+
+    zmq_setsockopt (sub, ZMQ_RCVTIMEO, &timeout, sizeof (timeout));
+    return true;
+}
+
+static Result runTransport (const std::string& transport, const Options& options)
+{
+    Result result;
+    result.transport = transport;
+
+    void* context = zmq_ctx_new();
+    void* pub = nullptr;
+    void* sub = nullptr;
+
+    std::vector<float> payload ((size_t) options.samples, 1.0f);
+    std::vector<char> buffer (payload.size() * sizeof (float) + 1024);
+
+    if (! connectPair (context, endpointFor (transport), pub, sub, payload))
+    {
+        zmq_close (pub);
+        zmq_close (sub);
+        zmq_ctx_destroy (context);
+        return result;
+    }
+
+    // throughput
+    {
+        std::thread publisher ([&]
+                               {
+                                   for (int i = 0; i < options.messages; i++)
+                                       sendMessage (pub, payload, i);
+                               });
+
+        int received = 0;
+        auto start = Clock::now();
+
+        while (received < options.messages && receiveMessage (sub, buffer) >= 0)
+            received++;
+
+        double seconds = std::chrono::duration<double> (Clock::now() - start).count();
+        publisher.join();
+
+        const double bytes = (double) received * (payload.size() * sizeof (float) + 64);
+
+        result.received = (double) received / options.messages;
+        result.messagesPerSecond = received / seconds;
+        result.megabytesPerSecond = bytes / seconds / 1.0e6;
+    }
+
+    // latency
+    {
+        std::vector<double> latencies;
+        latencies.reserve ((size_t) options.latencyMessages);
+
+        std::thread publisher ([&]
+                               {
+                                   for (int i = 0; i < options.latencyMessages; i++)
+                                   {
+                                       sendMessage (pub, payload, i);
+                                       std::this_thread::sleep_for (std::chrono::microseconds (200));
+                                   }
+                               });
+
+        for (int i = 0; i < options.latencyMessages; i++)
+        {
+            int64_t sent = receiveMessage (sub, buffer);
+            if (sent < 0)
+                break;
+
+            latencies.push_back ((nowNs() - sent) / 1000.0);
+        }
+
+        publisher.join();
+
+        if (! latencies.empty())
+        {
+            std::sort (latencies.begin(), latencies.end());
+            result.p50 = latencies[latencies.size() / 2];
+            result.p99 = latencies[std::min (latencies.size() - 1, latencies.size() * 99 / 100)];
+            result.max = latencies.back();
+        }
+    }
+
+    zmq_close (pub);
+    zmq_close (sub);
+    zmq_ctx_destroy (context);
+
+    return result;
+}
+
+static std::vector<std::string> split (const std::string& list)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+
+    while (start <= list.size())
+    {
+        size_t end = list.find (',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        if (end > start)
+            items.push_back (list.substr (start, end - start));
+        start = end + 1;
+    }
+
+    return items;
+}
+
+int main (int argc, char** argv)
+{
+    Options options;
+
+    for (int i = 1; i < argc - 1; i++)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--messages")
+            options.messages = std::atoi (argv[++i]);
+        else if (arg == "--samples")
+            options.samples = std::atoi (argv[++i]);
+        else if (arg == "--latency-messages")
+            options.latencyMessages = std::atoi (argv[++i]);
+        else if (arg == "--transports")
+            options.transports = split (argv[++i]);
+        else if (arg == "--json")
+            options.jsonFile = argv[++i];
+    }
+
+    std::printf ("%d messages of %d float32 samples per transport\n\n", options.messages, options.samples);
+    std::printf ("%-8s %12s %10s %9s %10s %10s %10s\n", "", "msg/s", "MB/s", "received", "p50 (us)", "p99 (us)", "max (us)");
+
+    std::vector<Result> results;
+
+    for (auto& transport : options.transports)
+    {
+        Result r = runTransport (transport, options);
+        results.push_back (r);
+
+        std::printf ("%-8s %12.0f %10.1f %8.1f%% %10.1f %10.1f %10.1f\n",
+                     r.transport.c_str(),
+                     r.messagesPerSecond,
+                     r.megabytesPerSecond,
+                     r.received * 100.0,
+                     r.p50,
+                     r.p99,
+                     r.max);
+    }
+
+    if (! options.jsonFile.empty())
+    {
+        FILE* f = std::fopen (options.jsonFile.c_str(), "w");
+        if (f == nullptr)
+            return 1;
+
+        std::fprintf (f, "{\n  \"messages\": %d,\n  \"samples\": %d,\n  \"results\": [\n", options.messages, options.samples);
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result& r = results[i];
+            std::fprintf (f,
+                          "    {\"transport\": \"%s\", \"messages_per_second\": %.1f, \"megabytes_per_second\": %.2f, "
+                          "\"received\": %.4f, \"latency_p50_us\": %.2f, \"latency_p99_us\": %.2f, \"latency_max_us\": %.2f}%s\n",
+                          r.transport.c_str(),
+                          r.messagesPerSecond,
+                          r.megabytesPerSecond,
+                          r.received,
+                          r.p50,
+                          r.p99,
+                          r.max,
+                          i + 1 < results.size() ? "," : "");
+        }
+
+        std::fprintf (f, "  ]\n}\n");
+        std::fclose (f);
+    }
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+"""
+Binary control requests for the ZMQ Interface listening socket.
+
+Instead of one JSON message per heartbeat or event, a client can batch
+heartbeats, events and stats reports into a single binary request; the
+plugin answers with an 8-byte reply. The format is described in
+Source/ControlProtocol.h.
+
+Example:
+
+    control = BinaryControl(port=5557, application='my_app')
+    control.heartbeat()
+    control.event(event_type=0, event_id=1, event_channel=2, sample_number=1000)
+    control.stats(received=1200, missed=3, latency_us=850)
+    control.lag('DATA', last_seq=5120, queue_depth=4, processing_us=900)
+    status, accepted = control.send()
+"""
+
+import struct
+import uuid
+
+import zmq
+
+REQUEST_MAGIC = 0x3143515A  # "ZQC1"
+REPLY_MAGIC = 0x3152515A    # "ZQR1"
+VERSION = 1
+
+HEARTBEAT, EVENT, STATS, LAG = 1, 2, 3, 4
+OK, BAD_HEADER, TRUNCATED, TOO_MANY_COMMANDS = 0, 1, 2, 3
+
+
+def encode_request(client_uuid, application, commands):
+    """Encodes a request; commands is a list of (command, payload bytes)"""
+    name = application.encode('utf-8')[:255]
+    parts = [struct.pack('<IHH16sB', REQUEST_MAGIC, VERSION, len(commands),
+                         client_uuid.bytes, len(name)), name]
+
+    for command, payload in commands:
+        parts.append(struct.pack('<BBH', command, 0, len(payload)))
+        parts.append(payload)
+
+    return b''.join(parts)
+
+
+def decode_reply(reply):
+    """Returns (status, number of commands accepted)"""
+    magic, status, accepted = struct.unpack('<IHH', reply)
+    if magic != REPLY_MAGIC:
+        raise ValueError('not a binary control reply')
+    return status, accepted
+
+
+class BinaryControl(object):
+    """
+    Collects commands and sends them as one request on the listening socket
+    """
+
+    def __init__(self, port=5557, host='localhost', application='python',
+                 client_uuid=None):
+        self.uuid = client_uuid or uuid.uuid4()
+        self.application = application
+        self.commands = []
+
+        self.context = zmq.Context.instance()
+        self.socket = self.context.socket(zmq.REQ)
+        self.socket.connect(f'tcp://{host}:{port}')
+
+    def heartbeat(self):
+        self.commands.append((HEARTBEAT, b''))
+
+    def event(self, event_type, event_id, event_channel, sample_number):
+        self.commands.append((EVENT, struct.pack('<BBBxq', event_type,
+                                                 event_id, event_channel,
+                                                 sample_number)))
+
+    def stats(self, received, missed, latency_us):
+        self.commands.append((STATS, struct.pack('<QQI', received, missed,
+                                                 latency_us)))
+
+    def lag(self, topic, last_seq, queue_depth=0, processing_us=0):
+        """Reports the last message of a topic processed; one call per topic"""
+        name = topic.encode('utf-8')[:23]
+        self.commands.append((LAG, struct.pack('<QIIB', last_seq, queue_depth,
+                                               processing_us, len(name))
+                              + name))
+
+    def send(self):
+        """Sends the collected commands; returns (status, accepted)"""
+        request = encode_request(self.uuid, self.application, self.commands)
+        self.commands = []
+        self.socket.send(request)
+        return decode_reply(self.socket.recv())
+
+    def close(self):
+        self.socket.close()
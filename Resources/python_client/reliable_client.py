@@ -0,0 +1,115 @@
+"""
+Consumer for the ZMQ Interface reliable channel.
+
+With "reliable" enabled, the plugin delivers every published message to
+credit-based consumers on a ROUTER socket (port 5559 by default). A
+consumer grants credit in blocks; the plugin never sends more messages
+than granted and buffers the rest, so a slow consumer is throttled
+instead of losing data. When its backlog grows large, it receives a
+BACKPRESSURE message asking for credit while there is still room. If it
+falls so far behind that the plugin's buffer limit is reached, or the
+plugin had to drop messages before buffering them, it receives a GAP
+message with the sequence numbers it missed.
+
+With mode='adaptive', continuous data arrives as one BLOCK message per
+block holding all channels. The plugin lowers the resolution (int16,
+then decimated) while blocks wait for credit, and raises it again once
+the consumer keeps up; decode them with decode_block().
+
+Example:
+
+    client = ReliableClient(port=5559, topics=['DATA'])
+    for frames in client.messages():
+        envelope, header = frames[0], json.loads(frames[1])
+        ...
+"""
+
+import json
+
+import numpy as np
+import zmq
+
+
+def decode_block(frames):
+    """Returns (header, data) for a BLOCK message, data being a
+       (num_channels, num_output_samples) float32 array"""
+    header = json.loads(frames[1].decode('utf-8'))
+    shape = (len(header['channels']), header['num_output_samples'])
+
+    if header['encoding'] == 'int16':
+        scales = np.frombuffer(frames[3], dtype='<f4')
+        data = np.frombuffer(frames[2], dtype='<i2').reshape(shape)
+        return header, data * scales[:, None]
+
+    return header, np.frombuffer(frames[2], dtype='<f4').reshape(shape)
+
+
+class ReliableClient(object):
+
+    def __init__(self, ip='tcp://localhost', port=5559, topics=None,
+                 credit_block=256, application='Reliable client',
+                 mode='reliable'):
+        self.context = zmq.Context()
+        self.socket = self.context.socket(zmq.DEALER)
+        self.socket.connect(f'{ip}:{port}')
+        self.credit_block = credit_block
+        self.credit = credit_block
+
+        hello = {'type': 'hello',
+                 'application': application,
+                 'credit': credit_block,
+                 'mode': mode}
+        if topics:
+            hello['topics'] = topics
+        self.socket.send(json.dumps(hello).encode('utf-8'))
+
+    def grant(self, credit):
+        """Allows the plugin to send credit more messages"""
+        self.socket.send(json.dumps({'type': 'credit',
+                                     'credit': credit}).encode('utf-8'))
+        self.credit += credit
+
+    def messages(self, timeout_ms=1000):
+        """Yields the frames of every message, in order. Credit is topped
+           up whenever half of it has been used, and renewed while idle so
+           the plugin does not release the consumer"""
+        while True:
+            if not self.socket.poll(timeout_ms):
+                self.grant(0)
+                continue
+
+            frames = self.socket.recv_multipart()
+
+            if frames[0].rstrip(b'\0') == b'GAP':
+                gap = json.loads(frames[1].decode('utf-8'))
+                print(f"Plugin buffer overflowed: {gap['topic']} messages "
+                      f"{gap['first_seq']}-{gap['last_seq']} were dropped")
+                continue
+
+            if frames[0].rstrip(b'\0') == b'BACKPRESSURE':
+                notice = json.loads(frames[1].decode('utf-8'))
+                print(f"Plugin buffer filling: {notice['queued_messages']} "
+                      f"messages wait for credit")
+                self.grant(self.credit_block)
+                continue
+
+            self.credit -= 1
+            if self.credit <= self.credit_block // 2:
+                self.grant(self.credit_block - self.credit)
+
+            yield frames
+
+    def close(self):
+        self.socket.send(json.dumps({'type': 'bye'}).encode('utf-8'))
+        self.socket.close()
+
+
+if __name__ == '__main__':
+    client = ReliableClient()
+    received = 0
+    for frames in client.messages():
+        header = json.loads(frames[1].decode('utf-8'))
+        received += 1
+        if received % 1000 == 0:
+            print(f"{received} messages, last {header['type']} "
+                  f"seq {header['seq']}")
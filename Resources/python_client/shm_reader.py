@@ -0,0 +1,143 @@
+"""
+Reader for the ZMQ Interface shared-memory transport.
+
+Local clients can read continuous data directly from the segment the
+plugin writes when "shared_memory" is enabled, instead of receiving it
+over the data socket. The layout is documented in
+Resources/shm_client/zmq_interface_shm.h.
+
+Example:
+
+    reader = ShmReader(data_port=5556)
+    for info, data in reader.blocks():
+        # data is a (num_channels, num_samples) float32 array
+        print(info['sample_number'], data.shape)
+"""
+
+import mmap
+import os
+import struct
+import time
+
+import numpy as np
+
+MAGIC = 0x49514D5A
+VERSION = 1
+
+HEADER_FORMAT = '<IIIIIfQQQQQ64s'
+SLOT_FORMAT = '<QQqqII'
+SLOT_HEADER_SIZE = 64
+
+OK, NOT_READY, OVERRUN, TORN, STALE = 0, 1, 2, 3, 5
+
+
+class ShmReader(object):
+    """
+    Maps the segment of a ZMQ Interface plugin read-only
+    """
+
+    def __init__(self, name=None, data_port=5556):
+        self.name = name or f'/oe_zmq_{data_port}'
+        self.open()
+
+    def open(self):
+        path = '/dev/shm' + self.name
+        with open(path, 'rb') as f:
+            self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+        (magic, version, self.num_slots, self.max_samples,
+         self.num_channels, self.sample_rate, self.session_id,
+         channel_table_offset, self.slots_offset, self.slot_stride,
+         _, stream_name) = struct.unpack_from(HEADER_FORMAT, self.map, 0)
+
+        if magic != MAGIC or version != VERSION:
+            raise ValueError(f'{self.name} is not a ZMQ Interface segment')
+
+        self.stream_name = stream_name.split(b'\0')[0].decode('utf-8')
+        self.channels = np.frombuffer(self.map, dtype='<u4',
+                                      count=self.num_channels,
+                                      offset=channel_table_offset).copy()
+
+    def _write_index(self):
+        return struct.unpack_from('<Q', self.map, 56)[0]
+
+    def _session_id(self):
+        return struct.unpack_from('<Q', self.map, 24)[0]
+
+    def latest(self):
+        """Index of the most recently published block"""
+        return max(self._write_index() - 1, 0)
+
+    def read(self, block_index):
+        """
+        Returns (status, info, data) for one block. data is a copy of the
+        block as a (num_channels, num_samples) float32 array.
+        """
+        if self._session_id() != self.session_id:
+            return STALE, None, None
+
+        written = self._write_index()
+        if block_index >= written:
+            return NOT_READY, None, None
+        if written - block_index > self.num_slots:
+            return OVERRUN, None, None
+
+        offset = (self.slots_offset
+                  + (block_index % self.num_slots) * self.slot_stride)
+        expected = 2 * (block_index + 1)
+
+        before = struct.unpack_from('<Q', self.map, offset)[0]
+        if before != expected:
+            return (TORN if before & 1 or before < expected
+                    else OVERRUN), None, None
+
+        (_, index, sample_number, timestamp_ms,
+         num_samples, num_channels) = struct.unpack_from(SLOT_FORMAT,
+                                                          self.map, offset)
+        data = np.frombuffer(self.map, dtype='<f4',
+                             count=num_samples * num_channels,
+                             offset=offset + SLOT_HEADER_SIZE).copy()
+
+        if struct.unpack_from('<Q', self.map, offset)[0] != expected:
+            return OVERRUN, None, None
+
+        info = {'block_index': index,
+                'sample_number': sample_number,
+                'timestamp_ms': timestamp_ms,
+                'num_samples': num_samples}
+
+        return OK, info, data.reshape(num_channels, num_samples)
+
+    def blocks(self, poll_interval=0.0005):
+        """Yields (info, data) for every new block, skipping ahead on overruns"""
+        next_block = self._write_index()
+
+        while True:
+            status, info, data = self.read(next_block)
+
+            if status == OK:
+                next_block += 1
+                yield info, data
+            elif status == NOT_READY or status == TORN:
+                time.sleep(poll_interval)
+            elif status == OVERRUN:
+                print('Reader fell behind, skipping to the latest block')
+                next_block = self.latest()
+            elif status == STALE:
+                self.close()
+                time.sleep(0.5)
+                self.open()
+                next_block = self._write_index()
+
+    def close(self):
+        self.map.close()
+
+
+if __name__ == '__main__':
+    reader = ShmReader()
+    print(f'Reading {reader.num_channels} channels of '
+          f'"{reader.stream_name}" from {reader.name}')
+
+    for info, data in reader.blocks():
+        print(f"block {info['block_index']}: {info['num_samples']} samples "
+              f"starting at {info['sample_number']}")
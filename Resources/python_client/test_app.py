@@ -7,6 +7,24 @@ import time
 
 from threading import Thread, current_thread
 
+# one threshold crossing record, see Source/ZmqWireFormat.h
+CROSSING_DTYPE = np.dtype([('channel', '<u4'), ('sample_num', '<i8')])
+
+# one batched TTL record, see Source/ZmqWireFormat.h
+TTL_DTYPE = np.dtype([('line', 'u1'), ('state', 'u1'),
+                      ('sample_num', '<i8'), ('word', '<u8')])
+
+# per-block state of all TTL lines, see Source/ZmqWireFormat.h
+LINE_STATE_DTYPE = np.dtype([('sample_num', '<i8'), ('num_samples', '<u4'),
+                             ('states', '<u8'), ('changed', '<u8')])
+
+# one batched spike record, see Source/ZmqWireFormat.h
+SPIKE_DTYPE = np.dtype([('sample_num', '<i8'), ('electrode', '<u4'),
+                        ('sorted_id', '<u2'), ('num_channels', 'u1'),
+                        ('waveform_channels', 'u1'),
+                        ('waveform_samples', '<u2'),
+                        ('peak_channel', '<u2'), ('threshold', '<f4', 4)])
+
 class Event(object):
     """
     
@@ -86,7 +104,7 @@ class TestApp(object):
     """
     Python app used to test the ZMQ Interface plugin
     """
-    def __init__(self, ip="tcp://localhost", port=5556):
+    def __init__(self, ip="tcp://localhost", port=5556, event_port=None):
         self._timer = None
         
         self.interval = 0.1
@@ -97,7 +115,10 @@ class TestApp(object):
         self.poller = zmq.Poller()
         self.ip = ip
         self.port = port
+        self.event_port = event_port
         self.message_num = 0
+        self.topic_seq = {}
+        self.processing_us = 0.
         self.socket_waits_reply = False
 
         self.uuid = str(uuid.uuid4())
@@ -119,6 +140,12 @@ class TestApp(object):
             self.data_socket = self.context.socket(zmq.SUB)
             self.data_socket.connect(ip_string)
 
+            if self.event_port:
+                # events and spikes published on a separate socket
+                ip_string = f'{self.ip}:{self.event_port}'
+                print("Connecting to event socket on " + ip_string)
+                self.data_socket.connect(ip_string)
+
             self.data_socket.setsockopt(zmq.SUBSCRIBE, b'')
             self.poller.register(self.data_socket, zmq.POLLIN)
 
@@ -152,13 +179,105 @@ class TestApp(object):
         """
         d = {'application': self.app_name,
              'uuid': self.uuid,
-             'type': 'heartbeat'}
+             'type': 'heartbeat',
+             # lets the plugin show (and act on) how far behind we are
+             'lag': {'seq': self.topic_seq,
+                     'processing_us': int(self.processing_us)}}
         j_msg = json.dumps(d)
         print("sending heartbeat")
         self.heartbeat_socket.send(j_msg.encode('utf-8'))
         self.last_heartbeat_time = time.time()
         self.socket_waits_reply = True
 
+    def request_history(self, sample_num, num_samples, stream='',
+                        history_port=None):
+        """Requests a range of recent samples the app may have missed.
+           Returns (header, data), data being a (num_channels, num_samples)
+           float32 array, or None if the range is not available. Replies
+           on the listening socket hold at most 1 MB; pass the plugin's
+           history_port (named in every reply) for up to 16 MB
+        """
+        port = history_port if history_port else self.port + 1
+        ip_string = f'{self.ip}:{port}'
+        history_socket = self.context.socket(zmq.REQ)
+        history_socket.connect(ip_string)
+
+        d = {'type': 'history',
+             'stream': stream,
+             'sample_num': int(sample_num),
+             'num_samples': int(num_samples)}
+        history_socket.send(json.dumps(d).encode('utf-8'))
+
+        header_frame, data_frame = history_socket.recv_multipart()
+        history_socket.close()
+
+        header = json.loads(header_frame.decode('utf-8'))
+        if header['status'] != 'ok':
+            print(f"History not available: {header['status']}")
+            return header, None
+
+        data = np.frombuffer(data_frame, dtype=np.float32)
+        return header, data.reshape(len(header['channels']),
+                                    header['num_samples'])
+
+    def subscribe(self, channels=None, sample_rate=None, encoding='float32',
+                  stream=''):
+        """Asks the plugin for a topic carrying only the given channels,
+           decimated to about sample_rate. Returns the reply describing
+           the topic; send it again with each heartbeat to keep it alive
+        """
+        ip_string = f'{self.ip}:{self.port + 1}'
+        subscribe_socket = self.context.socket(zmq.REQ)
+        subscribe_socket.connect(ip_string)
+
+        d = {'type': 'subscribe',
+             'application': self.app_name,
+             'uuid': self.uuid,
+             'stream': stream,
+             'encoding': encoding}
+        if channels is not None:
+            d['channels'] = list(channels)
+        if sample_rate:
+            d['sample_rate'] = sample_rate
+
+        subscribe_socket.send(json.dumps(d).encode('utf-8'))
+        reply = json.loads(subscribe_socket.recv().decode('utf-8'))
+        subscribe_socket.close()
+
+        print(f'Subscription: {reply}')
+        return reply
+
+    def request_retransmit(self, topic, first, last):
+        """Requests messages first..last (inclusive) of a topic ('DATA',
+           'EVENT', 'CROSSINGS' or 'LINES') that were not received.
+           Returns a list of (seq, frames) with the frames of each message
+           as it was published, envelope first
+        """
+        ip_string = f'{self.ip}:{self.port + 1}'
+        retransmit_socket = self.context.socket(zmq.REQ)
+        retransmit_socket.connect(ip_string)
+
+        d = {'type': 'retransmit',
+             'topic': topic,
+             'ranges': [[int(first), int(last)]]}
+        retransmit_socket.send(json.dumps(d).encode('utf-8'))
+
+        frames = retransmit_socket.recv_multipart()
+        retransmit_socket.close()
+
+        header = json.loads(frames[0].decode('utf-8'))
+        if header['missing']:
+            print(f"{len(header['missing'])} {topic} messages "
+                  f"could not be resent")
+
+        messages = []
+        offset = 1
+        for seq, count in zip(header['resent'], header['frames']):
+            messages.append((seq, frames[offset:offset + count]))
+            offset += count
+
+        return messages
+
     def callback(self):
 
         t = current_thread()
@@ -205,6 +324,7 @@ class TestApp(object):
                     
                 if message:
 
+                    started = time.perf_counter()
                     self.message_num += 1
 
                     if len(message) < 2:
@@ -219,6 +339,21 @@ class TestApp(object):
                         print("Missed a message at number", self.message_num)
 
                     self.message_num = header['message_num']
+
+                    # per-topic sequence numbers: recover gaps from the
+                    # plugin's retransmit buffer (if enabled)
+                    topic = message[0].rstrip(b'\0').decode('utf-8')
+                    seq = header.get('seq')
+                    last_seq = self.topic_seq.get(topic)
+                    if seq is not None:
+                        if last_seq is not None and seq > last_seq + 1:
+                            print(f"Missed {topic} messages "
+                                  f"{last_seq + 1}-{seq - 1}, requesting")
+                            resent = self.request_retransmit(topic,
+                                                             last_seq + 1,
+                                                             seq - 1)
+                            print(f"Recovered {len(resent)} messages")
+                        self.topic_seq[topic] = seq
                     
                     if header['type'] == 'data':
                         c = header['content']
@@ -258,8 +393,53 @@ class TestApp(object):
                         spike = Spike(header['spike'],
                                                     message[2])
                         print(spike)
+
+                    elif header['type'] == 'ttl':
+                        for record in np.frombuffer(message[2],
+                                                    dtype=TTL_DTYPE):
+                            print(f"TTL line {record['line']} -> "
+                                  f"{record['state']} at {record['sample_num']}")
+
+                    elif header['type'] == 'line_states':
+                        record = np.frombuffer(message[2],
+                                               dtype=LINE_STATE_DTYPE)[0]
+                        if record['changed']:
+                            print(f"Line states {record['states']:#018x}")
+
+                    elif header['type'] == 'spikes':
+                        c = header['content']
+                        spikes = np.frombuffer(message[2], dtype=SPIKE_DTYPE)
+                        if len(message) > 3:
+                            waveforms = np.frombuffer(message[3],
+                                                      dtype=np.float32)
+                        print(f"Received {c['num_spikes']} spikes "
+                              f"in block starting at {c['sample_num']}")
+
+                    elif header['type'] == 'subscription':
+                        c = header['content']
+                        shape = (len(c['channels']), c['num_output_samples'])
+                        if c['encoding'] == 'int16':
+                            scales = np.frombuffer(message[3], dtype=np.float32)
+                            data = np.frombuffer(message[2], dtype=np.int16)
+                            data = data.reshape(shape) * scales[:, None]
+                        else:
+                            data = np.frombuffer(message[2], dtype=np.float32)
+                            data = data.reshape(shape)
+                        print(f"Received {shape[1]} samples of {shape[0]} "
+                              f"channels on {c['topic']}")
+
+                    elif header['type'] == 'crossings':
+                        c = header['content']
+                        crossings = np.frombuffer(message[2],
+                                                  dtype=CROSSING_DTYPE)
+                        print(f"Received {c['num_crossings']} crossings "
+                              f"in block starting at {c['sample_num']}")
                     else:
                         raise ValueError("message type unknown")
+
+                    elapsed_us = (time.perf_counter() - started) * 1e6
+                    self.processing_us += 0.1 * (elapsed_us
+                                                 - self.processing_us)
                 else:
                     print("No data in message, breaking")
 
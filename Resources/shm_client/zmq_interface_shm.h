@@ -0,0 +1,294 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/*
+  Shared-memory block ring written by the ZMQ Interface plugin, and a
+  header-only reader for C and C++ clients on the same machine (POSIX).
+
+  Segment layout (all offsets in bytes, little-endian):
+
+    zmqi_shm_header                  at 0
+    uint32 channel_num[num_channels] at channel_table_offset
+    slot[num_slots]                  at slots_offset, slot_stride apart
+
+  Each slot is a zmqi_shm_slot_header followed by
+  float32 data[num_channels][num_samples] (channel-major).
+
+  Slots are protected by a sequence lock: the writer makes `sequence`
+  odd while a slot is being written and sets it to 2 * (block_index + 1)
+  when it is complete. A reader copies a slot and then checks that the
+  sequence is unchanged and equals the expected value; otherwise the
+  copy is torn or the slot was overwritten, and it must retry or skip.
+  `write_index` is the number of blocks published so far.
+
+  Usage:
+
+    zmqi_shm_reader r;
+    if (zmqi_shm_open (&r, "/oe_zmq_5556") == 0)
+    {
+        uint64_t next = zmqi_shm_latest (&r);
+        ...
+        int rc = zmqi_shm_read (&r, next, &info, buffer, buffer_floats);
+        if (rc == 0) next++;
+        else if (rc == ZMQI_SHM_OVERRUN) next = zmqi_shm_latest (&r);
+    }
+    zmqi_shm_close (&r);
+*/
+
+#ifndef ZMQ_INTERFACE_SHM_H_INCLUDED
+#define ZMQ_INTERFACE_SHM_H_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+
+#define ZMQI_SHM_MAGIC 0x49514D5Au /* "ZMQI" */
+#define ZMQI_SHM_VERSION 1u
+#define ZMQI_SHM_STREAM_NAME_LENGTH 64
+
+/* return codes of zmqi_shm_read */
+#define ZMQI_SHM_OK 0
+#define ZMQI_SHM_NOT_READY 1 /* block not published yet */
+#define ZMQI_SHM_OVERRUN 2 /* block already overwritten, reader fell behind */
+#define ZMQI_SHM_TORN 3 /* slot changed while copying, retry */
+#define ZMQI_SHM_TOO_SMALL 4 /* destination buffer too small */
+#define ZMQI_SHM_STALE 5 /* segment was re-created, reopen it */
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t max_samples; /* per channel, per slot */
+    uint32_t num_channels;
+    float sample_rate;
+    uint64_t session_id; /* changes whenever the writer re-creates the segment */
+    uint64_t channel_table_offset;
+    uint64_t slots_offset;
+    uint64_t slot_stride;
+    uint64_t write_index; /* blocks published so far (atomic) */
+    char stream_name[ZMQI_SHM_STREAM_NAME_LENGTH];
+    uint8_t reserved[256 - 64 - ZMQI_SHM_STREAM_NAME_LENGTH];
+} zmqi_shm_header;
+
+typedef struct
+{
+    uint64_t sequence; /* seqlock word (atomic) */
+    uint64_t block_index;
+    int64_t sample_number; /* first sample of the block */
+    int64_t timestamp_ms; /* wall clock time the block was written */
+    uint32_t num_samples;
+    uint32_t num_channels;
+    uint8_t reserved[64 - 40];
+} zmqi_shm_slot_header;
+
+#ifdef __cplusplus
+static_assert (sizeof (zmqi_shm_header) == 256, "unexpected header size");
+static_assert (sizeof (zmqi_shm_slot_header) == 64, "unexpected slot header size");
+#endif
+
+#define ZMQI_SHM_LOAD(ptr) __atomic_load_n ((ptr), __ATOMIC_ACQUIRE)
+#define ZMQI_SHM_STORE(ptr, value) __atomic_store_n ((ptr), (value), __ATOMIC_RELEASE)
+
+/** Name of the segment published by a plugin using the given data port */
+static inline void zmqi_shm_default_name (int data_port, char* name, size_t length)
+{
+    char digits[16];
+    int n = 0;
+
+    do
+    {
+        digits[n++] = (char) ('0' + data_port % 10);
+        data_port /= 10;
+    } while (data_port > 0 && n < 15);
+
+    size_t pos = 0;
+    const char* prefix = "/oe_zmq_";
+
+    while (*prefix && pos + 1 < length)
+        name[pos++] = *prefix++;
+
+    while (n > 0 && pos + 1 < length)
+        name[pos++] = digits[--n];
+
+    name[pos] = 0;
+}
+
+static inline zmqi_shm_slot_header* zmqi_shm_slot (uint8_t* base, uint64_t block_index)
+{
+    const zmqi_shm_header* h = (const zmqi_shm_header*) base;
+    return (zmqi_shm_slot_header*) (base + h->slots_offset + (block_index % h->num_slots) * h->slot_stride);
+}
+
+static inline uint64_t zmqi_shm_segment_size (uint32_t num_slots, uint32_t num_channels, uint32_t max_samples)
+{
+    uint64_t table = ((uint64_t) num_channels * sizeof (uint32_t) + 63) & ~(uint64_t) 63;
+    uint64_t stride = (sizeof (zmqi_shm_slot_header) + (uint64_t) num_channels * max_samples * sizeof (float) + 63) & ~(uint64_t) 63;
+    return sizeof (zmqi_shm_header) + table + stride * num_slots;
+}
+
+#if ! defined(_WIN32)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct
+{
+    uint8_t* base;
+    size_t size;
+    uint64_t session_id;
+} zmqi_shm_reader;
+
+typedef struct
+{
+    uint64_t block_index;
+    int64_t sample_number;
+    int64_t timestamp_ms;
+    uint32_t num_samples;
+    uint32_t num_channels;
+} zmqi_shm_block_info;
+
+/** Maps an existing segment read-only. Returns 0 on success */
+static inline int zmqi_shm_open (zmqi_shm_reader* reader, const char* name)
+{
+    reader->base = NULL;
+    reader->size = 0;
+
+    int fd = shm_open (name, O_RDONLY, 0);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (zmqi_shm_header))
+    {
+        close (fd);
+        return -1;
+    }
+
+    void* p = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+
+    if (p == MAP_FAILED)
+        return -1;
+
+    const zmqi_shm_header* h = (const zmqi_shm_header*) p;
+    if (h->magic != ZMQI_SHM_MAGIC || h->version != ZMQI_SHM_VERSION)
+    {
+        munmap (p, (size_t) st.st_size);
+        return -1;
+    }
+
+    reader->base = (uint8_t*) p;
+    reader->size = (size_t) st.st_size;
+    reader->session_id = h->session_id;
+    return 0;
+}
+
+/** Unmaps the segment */
+static inline void zmqi_shm_close (zmqi_shm_reader* reader)
+{
+    if (reader->base)
+        munmap (reader->base, reader->size);
+
+    reader->base = NULL;
+    reader->size = 0;
+}
+
+static inline const zmqi_shm_header* zmqi_shm_get_header (const zmqi_shm_reader* reader)
+{
+    return (const zmqi_shm_header*) reader->base;
+}
+
+/** Channel numbers (local channel indices) of the channels in each slot */
+static inline const uint32_t* zmqi_shm_channels (const zmqi_shm_reader* reader)
+{
+    return (const uint32_t*) (reader->base + zmqi_shm_get_header (reader)->channel_table_offset);
+}
+
+/** Index of the most recently published block (0 if none yet) */
+static inline uint64_t zmqi_shm_latest (const zmqi_shm_reader* reader)
+{
+    uint64_t written = ZMQI_SHM_LOAD (&((zmqi_shm_header*) reader->base)->write_index);
+    return written > 0 ? written - 1 : 0;
+}
+
+/** Copies one block into dst (num_channels * num_samples floats, channel-major) */
+static inline int zmqi_shm_read (const zmqi_shm_reader* reader,
+                                 uint64_t block_index,
+                                 zmqi_shm_block_info* info,
+                                 float* dst,
+                                 size_t dst_floats)
+{
+    zmqi_shm_header* h = (zmqi_shm_header*) reader->base;
+
+    if (h->session_id != reader->session_id)
+        return ZMQI_SHM_STALE;
+
+    uint64_t written = ZMQI_SHM_LOAD (&h->write_index);
+
+    if (block_index >= written)
+        return ZMQI_SHM_NOT_READY;
+
+    if (written - block_index > h->num_slots)
+        return ZMQI_SHM_OVERRUN;
+
+    zmqi_shm_slot_header* slot = zmqi_shm_slot (reader->base, block_index);
+    const uint64_t expected = 2 * (block_index + 1);
+
+    uint64_t before = ZMQI_SHM_LOAD (&slot->sequence);
+
+    if (before != expected)
+        return (before & 1) || before < expected ? ZMQI_SHM_TORN : ZMQI_SHM_OVERRUN;
+
+    zmqi_shm_block_info local;
+    local.block_index = block_index;
+    local.sample_number = slot->sample_number;
+    local.timestamp_ms = slot->timestamp_ms;
+    local.num_samples = slot->num_samples;
+    local.num_channels = slot->num_channels;
+
+    const size_t count = (size_t) local.num_samples * local.num_channels;
+
+    if (count > dst_floats)
+        return ZMQI_SHM_TOO_SMALL;
+
+    memcpy (dst, (const uint8_t*) slot + sizeof (zmqi_shm_slot_header), count * sizeof (float));
+
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+    if (ZMQI_SHM_LOAD (&slot->sequence) != expected)
+        return ZMQI_SHM_OVERRUN;
+
+    if (info)
+        *info = local;
+
+    return ZMQI_SHM_OK;
+}
+
+#endif // ! _WIN32
+
+#endif // ZMQ_INTERFACE_SHM_H_INCLUDED
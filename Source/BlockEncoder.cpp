@@ -0,0 +1,339 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "BlockEncoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define ZMQ_ENCODER_SSE2 1
+#endif
+
+namespace
+{
+// decimated samples of one channel kept on the stack; longer outputs are decimated twice
+const int DECIMATION_TILE = 2048;
+
+#if ZMQ_ENCODER_SSE2
+/** (x0 + x1, x2 + x3, y0 + y1, y2 + y3) */
+inline __m128 pairSums (__m128 x, __m128 y)
+{
+    return _mm_add_ps (_mm_shuffle_ps (x, y, _MM_SHUFFLE (2, 0, 2, 0)),
+                       _mm_shuffle_ps (x, y, _MM_SHUFFLE (3, 1, 3, 1)));
+}
+#endif
+
+/** Averages count whole groups of D samples; the group size is known, so the loop vectorizes */
+template <int D>
+void decimateWhole (const float* in, int count, float* out)
+{
+    int i = 0;
+
+#if ZMQ_ENCODER_SSE2
+    // compilers leave the strided sums of small groups scalar; pairwise shuffles do four groups at a time
+    if (D == 2 || D == 4)
+    {
+        const __m128 inverse = _mm_set1_ps (1.0f / D);
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const float* group = in + i * D;
+            __m128 sum = pairSums (_mm_loadu_ps (group), _mm_loadu_ps (group + 4));
+
+            if (D == 4)
+                sum = pairSums (sum, pairSums (_mm_loadu_ps (group + 8), _mm_loadu_ps (group + 12)));
+
+            _mm_storeu_ps (out + i, _mm_mul_ps (sum, inverse));
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        float sum = 0.0f;
+        for (int j = 0; j < D; j++)
+            sum += in[i * D + j];
+
+        out[i] = sum * (1.0f / D);
+    }
+}
+
+/** Averages the groups of decimation samples that make output samples [first, first + count) */
+void decimate (const float* in, int numSamples, int decimation, int first, int count, float* out)
+{
+    const float* group = in + (size_t) first * decimation;
+    const int numWhole = std::max (0, std::min (count, numSamples / decimation - first));
+
+    switch (decimation)
+    {
+        case 2:
+            decimateWhole<2> (group, numWhole, out);
+            break;
+        case 4:
+            decimateWhole<4> (group, numWhole, out);
+            break;
+        case 8:
+            decimateWhole<8> (group, numWhole, out);
+            break;
+        default:
+        {
+            const float inverse = 1.0f / decimation;
+
+            for (int i = 0; i < numWhole; i++)
+            {
+                float sum = 0.0f;
+                for (int j = 0; j < decimation; j++)
+                    sum += group[i * decimation + j];
+
+                out[i] = sum * inverse;
+            }
+        }
+    }
+
+    // a final short group is averaged over the samples it has
+    for (int i = numWhole; i < count; i++)
+    {
+        const int start = (first + i) * decimation;
+        const int n = std::min (decimation, numSamples - start);
+
+        float sum = 0.0f;
+        for (int j = 0; j < n; j++)
+            sum += in[start + j];
+
+        out[i] = sum / n;
+    }
+}
+
+/** Largest absolute value (compilers keep a float maximum scalar without fast-math) */
+float findPeak (const float* values, int numValues)
+{
+    float peak = 0.0f;
+    int i = 0;
+
+#if ZMQ_ENCODER_SSE2
+    const __m128 magnitude = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+    __m128 a = _mm_setzero_ps();
+    __m128 b = _mm_setzero_ps();
+    __m128 c = _mm_setzero_ps();
+    __m128 d = _mm_setzero_ps();
+
+    // four independent maxima, so the loop is not bound by the latency of one
+    for (; i + 16 <= numValues; i += 16)
+    {
+        a = _mm_max_ps (a, _mm_and_ps (_mm_loadu_ps (values + i), magnitude));
+        b = _mm_max_ps (b, _mm_and_ps (_mm_loadu_ps (values + i + 4), magnitude));
+        c = _mm_max_ps (c, _mm_and_ps (_mm_loadu_ps (values + i + 8), magnitude));
+        d = _mm_max_ps (d, _mm_and_ps (_mm_loadu_ps (values + i + 12), magnitude));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps (lanes, _mm_max_ps (_mm_max_ps (a, b), _mm_max_ps (c, d)));
+
+    for (float lane : lanes)
+        peak = std::max (peak, lane);
+#endif
+
+    for (; i < numValues; i++)
+        peak = std::max (peak, std::fabs (values[i]));
+
+    return peak;
+}
+
+/** Rounds half away from zero */
+void quantize (const float* values, int numValues, float inverseScale, int16_t* dest)
+{
+    int i = 0;
+
+#if ZMQ_ENCODER_SSE2
+    const __m128 scale = _mm_set1_ps (inverseScale);
+    const __m128 sign = _mm_castsi128_ps (_mm_set1_epi32 ((int) 0x80000000));
+    const __m128 half = _mm_set1_ps (0.5f);
+
+    for (; i + 8 <= numValues; i += 8)
+    {
+        const __m128 a = _mm_mul_ps (_mm_loadu_ps (values + i), scale);
+        const __m128 b = _mm_mul_ps (_mm_loadu_ps (values + i + 4), scale);
+
+        // truncating a +-0.5 offset, then packing with saturation
+        const __m128i ia = _mm_cvttps_epi32 (_mm_add_ps (a, _mm_or_ps (half, _mm_and_ps (a, sign))));
+        const __m128i ib = _mm_cvttps_epi32 (_mm_add_ps (b, _mm_or_ps (half, _mm_and_ps (b, sign))));
+
+        _mm_storeu_si128 ((__m128i*) (dest + i), _mm_packs_epi32 (ia, ib));
+    }
+#endif
+
+    for (; i < numValues; i++)
+    {
+        const float v = values[i] * inverseScale;
+        dest[i] = (int16_t) (v + (v < 0.0f ? -0.5f : 0.5f));
+    }
+}
+
+/** Encodes output channels [firstChannel, firstChannel + numOutChannels); inputs (ch)
+    returns the samples of input channel ch. Never allocates */
+template <typename Inputs>
+void encodeOutputChannels (const Inputs& inputs,
+                           int numSamples,
+                           const BlockEncoder::Format& format,
+                           int firstChannel,
+                           int numOutChannels,
+                           uint8_t* data,
+                           float* scales)
+{
+    const int decimation = std::max (1, format.decimation);
+    const int numOut = BlockEncoder::getNumOutputSamples (numSamples, decimation);
+
+    float tile[DECIMATION_TILE];
+
+    for (int out = firstChannel; out < firstChannel + numOutChannels; out++)
+    {
+        const int ch = format.channels.empty() ? out : format.channels[(size_t) out];
+        const float* in = inputs (ch);
+
+        if (format.encoding == BlockEncoder::FLOAT32)
+        {
+            float* dest = (float*) (data + (size_t) out * numOut * sizeof (float));
+
+            if (decimation > 1)
+                decimate (in, numSamples, decimation, 0, numOut, dest);
+            else
+                std::memcpy (dest, in, sizeof (float) * numOut);
+
+            continue;
+        }
+
+        int16_t* dest = (int16_t*) (data + (size_t) out * numOut * sizeof (int16_t));
+        const bool twoPasses = decimation > 1 && numOut > DECIMATION_TILE;
+        const float* values = in;
+
+        if (decimation > 1 && ! twoPasses)
+        {
+            decimate (in, numSamples, decimation, 0, numOut, tile);
+            values = tile;
+        }
+
+        float peak = 0.0f;
+
+        if (twoPasses)
+        {
+            for (int first = 0; first < numOut; first += DECIMATION_TILE)
+            {
+                const int count = std::min (DECIMATION_TILE, numOut - first);
+                decimate (in, numSamples, decimation, first, count, tile);
+                peak = std::max (peak, findPeak (tile, count));
+            }
+        }
+        else
+        {
+            peak = findPeak (values, numOut);
+        }
+
+        scales[(size_t) out] = peak > 0.0f ? peak / 32767.0f : 1.0f;
+        const float inverseScale = peak > 0.0f ? 32767.0f / peak : 1.0f;
+
+        if (twoPasses)
+        {
+            for (int first = 0; first < numOut; first += DECIMATION_TILE)
+            {
+                const int count = std::min (DECIMATION_TILE, numOut - first);
+                decimate (in, numSamples, decimation, first, count, tile);
+                quantize (tile, count, inverseScale, dest + first);
+            }
+        }
+        else
+        {
+            quantize (values, numOut, inverseScale, dest);
+        }
+    }
+}
+} // namespace
+
+int BlockEncoder::getNumOutputSamples (int numSamples, int decimation)
+{
+    decimation = std::max (1, decimation);
+    return (numSamples + decimation - 1) / decimation;
+}
+
+const char* BlockEncoder::getEncodingName (Encoding encoding)
+{
+    return encoding == INT16 ? "int16" : "float32";
+}
+
+void BlockEncoder::encode (const float* samples,
+                           int numChannels,
+                           int numSamples,
+                           const Format& format,
+                           std::vector<uint8_t>& data,
+                           std::vector<float>& scales)
+{
+    const int numOutChannels = prepareOutput (numChannels, numSamples, format, data, scales);
+
+    encodeOutputChannels ([samples, numSamples] (int ch) { return samples + (size_t) ch * numSamples; },
+                          numSamples, format, 0, numOutChannels, data.data(), scales.data());
+}
+
+void BlockEncoder::encode (const float* const* channels,
+                           int numChannels,
+                           int numSamples,
+                           const Format& format,
+                           std::vector<uint8_t>& data,
+                           std::vector<float>& scales)
+{
+    const int numOutChannels = prepareOutput (numChannels, numSamples, format, data, scales);
+
+    encodeChannels (channels, numSamples, format, 0, numOutChannels, data.data(), scales.data());
+}
+
+int BlockEncoder::prepareOutput (int numChannels,
+                                 int numSamples,
+                                 const Format& format,
+                                 std::vector<uint8_t>& data,
+                                 std::vector<float>& scales)
+{
+    const int numOut = getNumOutputSamples (numSamples, format.decimation);
+    const int numOutChannels = format.channels.empty() ? numChannels : (int) format.channels.size();
+    const size_t sampleSize = format.encoding == INT16 ? sizeof (int16_t) : sizeof (float);
+
+    data.resize ((size_t) numOutChannels * numOut * sampleSize);
+    scales.assign (format.encoding == INT16 ? (size_t) numOutChannels : 0, 0.0f);
+
+    return numOutChannels;
+}
+
+void BlockEncoder::encodeChannels (const float* const* channels,
+                                   int numSamples,
+                                   const Format& format,
+                                   int firstChannel,
+                                   int numOutChannels,
+                                   uint8_t* data,
+                                   float* scales)
+{
+    encodeOutputChannels ([channels] (int ch) { return channels[ch]; },
+                          numSamples, format, firstChannel, numOutChannels, data, scales);
+}
@@ -0,0 +1,106 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef BLOCKENCODER_H_INCLUDED
+#define BLOCKENCODER_H_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+/**
+    Reduced-size encodings of a block of continuous data, for clients
+    that cannot keep up with (or do not need) the full stream.
+
+    Input and output are channel-major. Decimation averages groups of
+    `decimation` samples (a boxcar, which also limits aliasing); a final
+    short group is averaged over the samples it has. INT16 stores every
+    channel as int16 with its own scale: value = int16 * scale.
+*/
+class BlockEncoder
+{
+public:
+    enum Encoding
+    {
+        FLOAT32 = 0,
+        INT16
+    };
+
+    struct Format
+    {
+        int decimation = 1;
+        Encoding encoding = FLOAT32;
+
+        /** Indices of the input channels to include; empty means all */
+        std::vector<int> channels;
+
+        bool operator== (const Format& other) const
+        {
+            return decimation == other.decimation && encoding == other.encoding && channels == other.channels;
+        }
+    };
+
+    /** Number of output samples per channel for a block of numSamples */
+    static int getNumOutputSamples (int numSamples, int decimation);
+
+    /** Encodes numSamples of numChannels input channels. data receives the samples
+        (float32 or int16), scales one float per output channel (INT16 only) */
+    static void encode (const float* samples,
+                        int numChannels,
+                        int numSamples,
+                        const Format& format,
+                        std::vector<uint8_t>& data,
+                        std::vector<float>& scales);
+
+    /** Same, with one input pointer per channel */
+    static void encode (const float* const* channels,
+                        int numChannels,
+                        int numSamples,
+                        const Format& format,
+                        std::vector<uint8_t>& data,
+                        std::vector<float>& scales);
+
+    /** Sizes data and scales for the encoding of a block; returns the number of output channels */
+    static int prepareOutput (int numChannels,
+                              int numSamples,
+                              const Format& format,
+                              std::vector<uint8_t>& data,
+                              std::vector<float>& scales);
+
+    /** Encodes output channels [firstChannel, firstChannel + numOutChannels) into data
+        and scales, which must already be sized with prepareOutput() */
+    static void encodeChannels (const float* const* channels,
+                                int numSamples,
+                                const Format& format,
+                                int firstChannel,
+                                int numOutChannels,
+                                uint8_t* data,
+                                float* scales);
+
+    /** Returns "float32" or "int16" */
+    static const char* getEncodingName (Encoding encoding);
+};
+
+#endif // BLOCKENCODER_H_INCLUDED
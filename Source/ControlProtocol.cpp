@@ -0,0 +1,172 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "ControlProtocol.h"
+
+#include <algorithm>
+#include <cstring>
+
+const size_t HEADER_SIZE = 25;
+const size_t COMMAND_HEADER_SIZE = 4;
+const size_t EVENT_PAYLOAD_SIZE = 12;
+const size_t STATS_PAYLOAD_SIZE = 20;
+const size_t LAG_PAYLOAD_SIZE = 17;
+
+template <typename T>
+static T readValue (const uint8_t* p)
+{
+    T value;
+    std::memcpy (&value, p, sizeof (T));
+    return value;
+}
+
+static void formatUuid (const uint8_t* uuid, char* dest)
+{
+    static const char digits[] = "0123456789abcdef";
+    int pos = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        if (i == 4 || i == 6 || i == 8 || i == 10)
+            dest[pos++] = '-';
+
+        dest[pos++] = digits[uuid[i] >> 4];
+        dest[pos++] = digits[uuid[i] & 15];
+    }
+
+    dest[pos] = 0;
+}
+
+bool ControlProtocol::isRequest (const void* data, size_t size)
+{
+    return size >= sizeof (uint32_t) && readValue<uint32_t> ((const uint8_t*) data) == REQUEST_MAGIC;
+}
+
+int ControlProtocol::decode (const void* data, size_t size, Record* records, int maxRecords, Status& status)
+{
+    const uint8_t* p = (const uint8_t*) data;
+
+    if (! isRequest (data, size) || size < HEADER_SIZE || readValue<uint16_t> (p + 4) != VERSION)
+    {
+        status = BAD_HEADER;
+        return 0;
+    }
+
+    const int numCommands = readValue<uint16_t> (p + 6);
+    const uint8_t* uuid = p + 8;
+    const size_t nameLength = p[24];
+
+    if (HEADER_SIZE + nameLength > size)
+    {
+        status = BAD_HEADER;
+        return 0;
+    }
+
+    Record common;
+    std::memset (&common, 0, sizeof (common));
+    formatUuid (uuid, common.uuid);
+
+    const size_t copied = std::min (nameLength, sizeof (common.application) - 1);
+    std::memcpy (common.application, p + HEADER_SIZE, copied);
+
+    size_t offset = HEADER_SIZE + nameLength;
+    int numRecords = 0;
+    status = OK;
+
+    for (int i = 0; i < numCommands; i++)
+    {
+        if (offset + COMMAND_HEADER_SIZE > size)
+        {
+            status = TRUNCATED;
+            break;
+        }
+
+        const uint8_t command = p[offset];
+        const size_t payloadSize = readValue<uint16_t> (p + offset + 2);
+        const uint8_t* payload = p + offset + COMMAND_HEADER_SIZE;
+
+        if (offset + COMMAND_HEADER_SIZE + payloadSize > size)
+        {
+            status = TRUNCATED;
+            break;
+        }
+
+        offset += COMMAND_HEADER_SIZE + payloadSize;
+
+        const bool known = (command == HEARTBEAT)
+                           || (command == EVENT && payloadSize >= EVENT_PAYLOAD_SIZE)
+                           || (command == STATS && payloadSize >= STATS_PAYLOAD_SIZE)
+                           || (command == LAG && payloadSize >= LAG_PAYLOAD_SIZE && payloadSize >= LAG_PAYLOAD_SIZE + payload[16]);
+
+        if (! known)
+            continue;
+
+        if (numRecords == maxRecords)
+        {
+            status = TOO_MANY_COMMANDS;
+            break;
+        }
+
+        Record& record = records[numRecords++];
+        record = common;
+        record.command = command;
+
+        if (command == EVENT)
+        {
+            record.eventType = payload[0];
+            record.eventId = payload[1];
+            record.eventChannel = payload[2];
+            record.sampleNumber = readValue<int64_t> (payload + 4);
+        }
+        else if (command == STATS)
+        {
+            record.received = readValue<uint64_t> (payload);
+            record.missed = readValue<uint64_t> (payload + 8);
+            record.latencyUs = readValue<uint32_t> (payload + 16);
+        }
+        else if (command == LAG)
+        {
+            record.sequence = readValue<uint64_t> (payload);
+            record.queueDepth = readValue<uint32_t> (payload + 8);
+            record.processingUs = readValue<uint32_t> (payload + 12);
+
+            const size_t topicLength = std::min ((size_t) payload[16], sizeof (record.topic) - 1);
+            std::memcpy (record.topic, payload + LAG_PAYLOAD_SIZE, topicLength);
+        }
+    }
+
+    return numRecords;
+}
+
+void ControlProtocol::encodeReply (Status status, int numAccepted, uint8_t* dest)
+{
+    const uint32_t magic = REPLY_MAGIC;
+    const uint16_t statusValue = (uint16_t) status;
+    const uint16_t accepted = (uint16_t) numAccepted;
+
+    std::memcpy (dest, &magic, 4);
+    std::memcpy (dest + 4, &statusValue, 2);
+    std::memcpy (dest + 6, &accepted, 2);
+}
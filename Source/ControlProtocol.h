@@ -0,0 +1,121 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef CONTROLPROTOCOL_H_INCLUDED
+#define CONTROLPROTOCOL_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+    Compact binary alternative to the JSON messages on the listening socket.
+
+    One request carries any number of commands from one client, so e.g. a
+    heartbeat, a burst of events and a stats report cost one round trip
+    and no JSON parsing. All fields are little-endian.
+
+    Request:
+      uint32   magic "ZQC1"
+      uint16   version (1)
+      uint16   number of commands
+      uint8    uuid[16]           shown as the usual 8-4-4-4-12 hex string
+      uint8    application name length, then the name (UTF-8)
+      commands, each:
+        uint8  command, uint8 flags (0), uint16 payload size, payload
+          HEARTBEAT  no payload
+          EVENT      uint8 type, uint8 event id, uint8 event channel,
+                     uint8 reserved, int64 sample number
+          STATS      uint64 messages received, uint64 messages missed,
+                     uint32 latency in microseconds
+          LAG        uint64 sequence number of the last message processed,
+                     uint32 messages waiting in the receive queue,
+                     uint32 processing time per block in microseconds,
+                     uint8 topic name length, then the topic name
+                     (e.g. "DATA" or "SUB-0001"); one per topic
+        Commands with unknown numbers are skipped.
+
+    Reply:
+      uint32   magic "ZQR1"
+      uint16   status (Status)
+      uint16   number of commands accepted
+
+    decode() turns a request into fixed-size Records without allocating.
+*/
+class ControlProtocol
+{
+public:
+    static const uint32_t REQUEST_MAGIC = 0x3143515A; // "ZQC1"
+    static const uint32_t REPLY_MAGIC = 0x3152515A;   // "ZQR1"
+    static const uint16_t VERSION = 1;
+
+    static const size_t REPLY_SIZE = 8;
+
+    enum Command
+    {
+        HEARTBEAT = 1,
+        EVENT = 2,
+        STATS = 3,
+        LAG = 4
+    };
+
+    enum Status
+    {
+        OK = 0,
+        BAD_HEADER,
+        TRUNCATED,
+        TOO_MANY_COMMANDS
+    };
+
+    struct Record
+    {
+        uint8_t command;
+        uint8_t eventType;
+        uint8_t eventId;
+        uint8_t eventChannel;
+        uint32_t latencyUs;
+        int64_t sampleNumber;
+        uint64_t received;
+        uint64_t missed;
+        int64_t time;
+        uint64_t sequence;
+        uint32_t queueDepth;
+        uint32_t processingUs;
+        char topic[24];
+        char uuid[40];
+        char application[32];
+    };
+
+    /** True if data starts like a binary request (JSON requests start with '{') */
+    static bool isRequest (const void* data, size_t size);
+
+    /** Decodes up to maxRecords commands into records (time is left for the caller).
+        Returns the number of records; status tells whether the whole request was read */
+    static int decode (const void* data, size_t size, Record* records, int maxRecords, Status& status);
+
+    /** Writes a reply of REPLY_SIZE bytes */
+    static void encodeReply (Status status, int numAccepted, uint8_t* dest);
+};
+
+#endif // CONTROLPROTOCOL_H_INCLUDED
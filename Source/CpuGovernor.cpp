@@ -0,0 +1,145 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "CpuGovernor.h"
+
+#include <algorithm>
+
+// time constant of the load smoothing, in seconds
+const double SMOOTHING_SECONDS = 0.25;
+
+// time at a level before shedding more
+const double STEP_UP_SECONDS = 0.5;
+
+// time below the restore threshold before a level is given back; doubled
+// after every restore that had to be undone, up to the maximum
+const double MIN_RESTORE_SECONDS = 2.0;
+const double MAX_RESTORE_SECONDS = 60.0;
+
+// load, relative to the budget, below which service is restored
+const double RESTORE_FRACTION = 0.6;
+
+CpuGovernor::CpuGovernor()
+    : enabled (false),
+      budget (0.5),
+      level (NORMAL),
+      load (0.0),
+      numChanges (0),
+      smoothedLoad (0.0),
+      secondsAtLevel (0.0),
+      restoreHoldSeconds (MIN_RESTORE_SECONDS),
+      justRestored (false)
+{
+}
+
+void CpuGovernor::setEnabled (bool shouldBeEnabled)
+{
+    enabled = shouldBeEnabled;
+}
+
+void CpuGovernor::setBudget (double fraction)
+{
+    budget = std::max (0.01, fraction);
+}
+
+int CpuGovernor::update (double costSeconds, double blockSeconds)
+{
+    if (blockSeconds <= 0.0)
+        return level.load (std::memory_order_relaxed);
+
+    // exponential smoothing with a time constant independent of the block size
+    const double alpha = std::min (1.0, blockSeconds / SMOOTHING_SECONDS);
+    smoothedLoad += alpha * (costSeconds / blockSeconds - smoothedLoad);
+    load.store (smoothedLoad, std::memory_order_relaxed);
+
+    int current = level.load (std::memory_order_relaxed);
+    secondsAtLevel += blockSeconds;
+
+    if (! enabled.load (std::memory_order_relaxed))
+    {
+        if (current != NORMAL)
+        {
+            level.store (NORMAL, std::memory_order_relaxed);
+            numChanges.fetch_add (1, std::memory_order_relaxed);
+        }
+
+        restoreHoldSeconds = MIN_RESTORE_SECONDS;
+        justRestored = false;
+        return NORMAL;
+    }
+
+    const double limit = budget.load (std::memory_order_relaxed);
+    int next = current;
+
+    if (smoothedLoad > limit && current < NUM_LEVELS - 1 && secondsAtLevel >= STEP_UP_SECONDS)
+    {
+        // the last restore did not hold: wait longer before the next one
+        if (justRestored)
+            restoreHoldSeconds = std::min (restoreHoldSeconds * 2.0, MAX_RESTORE_SECONDS);
+
+        next = current + 1;
+        justRestored = false;
+    }
+    else if (smoothedLoad < limit * RESTORE_FRACTION && current > NORMAL && secondsAtLevel >= restoreHoldSeconds)
+    {
+        next = current - 1;
+        justRestored = true;
+    }
+    else if (justRestored && secondsAtLevel >= restoreHoldSeconds)
+    {
+        // the restored level held
+        justRestored = false;
+        restoreHoldSeconds = MIN_RESTORE_SECONDS;
+    }
+
+    if (next != current)
+    {
+        level.store (next, std::memory_order_relaxed);
+        numChanges.fetch_add (1, std::memory_order_relaxed);
+        secondsAtLevel = 0.0;
+    }
+
+    return next;
+}
+
+const char* CpuGovernor::getLevelName (int level)
+{
+    switch (level)
+    {
+        case NORMAL:
+            return "normal";
+        case DROP_FEATURES:
+            return "drop_features";
+        case DECIMATE:
+            return "decimate";
+        case QUANTIZE:
+            return "quantize";
+        case PRIORITY_CHANNELS:
+            return "priority_channels";
+        default:
+            return "unknown";
+    }
+}
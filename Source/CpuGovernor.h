@@ -0,0 +1,101 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef CPUGOVERNOR_H_INCLUDED
+#define CPUGOVERNOR_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+
+/**
+    Keeps the plugin's processing time within a share of the block period.
+
+    update() is given the cost of every block and the block's duration.
+    While the smoothed load stays above the budget, the governor steps up
+    one level at a time; every level sheds more work (see Level). Once the
+    load has fallen well below the budget for a while, it steps back down.
+    Restoring a level that pushes the load straight back over the budget
+    doubles the time waited before the next attempt, so the governor does
+    not oscillate between two levels.
+
+    update() runs on the processing thread and does not allocate; the
+    level and load can be read from any thread.
+*/
+class CpuGovernor
+{
+public:
+    enum Level
+    {
+        NORMAL = 0,
+        DROP_FEATURES,     // no crossings or line states
+        DECIMATE,          // DATA decimated
+        QUANTIZE,          // DATA decimated and sent as int16
+        PRIORITY_CHANNELS, // only the priority channels
+        NUM_LEVELS
+    };
+
+    /** Constructor */
+    CpuGovernor();
+
+    /** Enables or disables the governor; disabling returns to NORMAL */
+    void setEnabled (bool enabled);
+
+    /** Sets the budget as a fraction of the block period */
+    void setBudget (double fraction);
+
+    /** Returns the budget as a fraction of the block period */
+    double getBudget() const { return budget.load(); }
+
+    /** Accounts for one block; returns the level to use for the next one */
+    int update (double costSeconds, double blockSeconds);
+
+    /** Returns the current level */
+    int getLevel() const { return level.load (std::memory_order_relaxed); }
+
+    /** Returns the smoothed cost of a block as a fraction of its period */
+    double getLoad() const { return load.load (std::memory_order_relaxed); }
+
+    /** Returns the number of level changes so far */
+    uint64_t getNumChanges() const { return numChanges.load (std::memory_order_relaxed); }
+
+    /** Returns a short name of a level, e.g. "decimate" */
+    static const char* getLevelName (int level);
+
+private:
+    std::atomic<bool> enabled;
+    std::atomic<double> budget;
+    std::atomic<int> level;
+    std::atomic<double> load;
+    std::atomic<uint64_t> numChanges;
+
+    /** Processing thread only */
+    double smoothedLoad;
+    double secondsAtLevel;
+    double restoreHoldSeconds;
+    bool justRestored;
+};
+
+#endif // CPUGOVERNOR_H_INCLUDED
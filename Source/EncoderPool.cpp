@@ -0,0 +1,231 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "EncoderPool.h"
+#include "RealtimeAudit.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+static void pinCurrentThread (int core)
+{
+    const int numCores = (int) std::max (1u, std::thread::hardware_concurrency());
+    core %= numCores;
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    CPU_SET (core, &set);
+    pthread_setaffinity_np (pthread_self(), sizeof (set), &set);
+#elif defined(_WIN32)
+    SetThreadAffinityMask (GetCurrentThread(), (DWORD_PTR) 1 << core);
+#else
+    (void) core; // macOS offers no hard affinity
+#endif
+}
+
+EncoderPool::EncoderPool()
+    : generation (0),
+      shouldExit (false),
+      jobFunction (nullptr),
+      jobContext (nullptr),
+      remaining (0)
+{
+    queues.emplace_back (new Queue());
+    queues.back()->tasks.resize (MAX_TASKS);
+}
+
+EncoderPool::~EncoderPool()
+{
+    stop();
+}
+
+void EncoderPool::start (int numWorkers, bool pinToCores)
+{
+    stop();
+
+    std::lock_guard<std::mutex> config (configLock);
+
+    // queue 0 belongs to the calling thread
+    for (int i = 0; i < numWorkers; i++)
+    {
+        queues.emplace_back (new Queue());
+        queues.back()->tasks.resize (MAX_TASKS);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock (wakeLock);
+        shouldExit = false;
+    }
+
+    for (int i = 0; i < numWorkers; i++)
+    {
+        workers.emplace_back ([this, i, pinToCores]
+                              {
+                                  if (pinToCores)
+                                      pinCurrentThread (i + 1);
+
+                                  workerLoop (i + 1);
+                              });
+    }
+}
+
+void EncoderPool::stop()
+{
+    std::lock_guard<std::mutex> config (configLock);
+
+    {
+        std::lock_guard<std::mutex> lock (wakeLock);
+        shouldExit = true;
+    }
+
+    wake.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+
+    workers.clear();
+    queues.resize (1);
+}
+
+void EncoderPool::runTasks (int numTasks, void (*function) (void*, int), void* context)
+{
+    std::unique_lock<std::mutex> config (configLock, std::try_to_lock);
+    RT_AUDIT_LOCK ("EncoderPool::runTasks");
+
+    if (! config.owns_lock() || workers.empty() || numTasks <= 1 || numTasks > MAX_TASKS)
+    {
+        for (int i = 0; i < numTasks; i++)
+            function (context, i);
+        return;
+    }
+
+    const int numQueues = (int) queues.size();
+
+    jobFunction = function;
+    jobContext = context;
+    remaining.store (numTasks);
+
+    for (int q = 0; q < numQueues; q++)
+    {
+        Queue& queue = *queues[(size_t) q];
+        std::lock_guard<std::mutex> lock (queue.lock);
+        RT_AUDIT_LOCK ("EncoderPool::runTasks");
+
+        queue.head = 0;
+        queue.tail = 0;
+
+        for (int task = q; task < numTasks; task += numQueues)
+            queue.tasks[(size_t) queue.tail++] = task;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock (wakeLock);
+        RT_AUDIT_LOCK ("EncoderPool::runTasks");
+        generation++;
+    }
+
+    RT_AUDIT_SYSCALL ("EncoderPool::runTasks");
+    wake.notify_all();
+
+    work (0);
+
+    // tasks taken by workers may still be running
+    RT_AUDIT_SYSCALL ("EncoderPool::runTasks");
+    while (remaining.load (std::memory_order_acquire) > 0)
+        std::this_thread::yield();
+}
+
+void EncoderPool::workerLoop (int index)
+{
+    uint64_t seen = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock (wakeLock);
+            wake.wait (lock, [this, seen]
+                       { return shouldExit || generation != seen; });
+
+            if (shouldExit)
+                return;
+
+            seen = generation;
+        }
+
+        work (index);
+    }
+}
+
+void EncoderPool::work (int index)
+{
+    const int numQueues = (int) queues.size();
+    int task;
+
+    while (true)
+    {
+        bool found = popOwn (*queues[(size_t) index], task);
+
+        for (int i = 1; ! found && i < numQueues; i++)
+            found = steal (*queues[(size_t) ((index + i) % numQueues)], task);
+
+        if (! found)
+            return;
+
+        jobFunction (jobContext, task);
+        remaining.fetch_sub (1, std::memory_order_release);
+    }
+}
+
+bool EncoderPool::popOwn (Queue& queue, int& task)
+{
+    std::lock_guard<std::mutex> lock (queue.lock);
+    RT_AUDIT_LOCK ("EncoderPool::popOwn");
+
+    if (queue.head == queue.tail)
+        return false;
+
+    task = queue.tasks[(size_t) queue.head++];
+    return true;
+}
+
+bool EncoderPool::steal (Queue& queue, int& task)
+{
+    std::lock_guard<std::mutex> lock (queue.lock);
+    RT_AUDIT_LOCK ("EncoderPool::steal");
+
+    if (queue.head == queue.tail)
+        return false;
+
+    task = queue.tasks[(size_t) --queue.tail];
+    return true;
+}
@@ -0,0 +1,119 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ENCODERPOOL_H_INCLUDED
+#define ENCODERPOOL_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+    A small work-stealing thread pool for splitting the encoding of a block
+    into channel-group tasks.
+
+    run() deals the tasks out round-robin to one queue per worker plus one
+    for the calling thread. Everyone works through their own queue and then
+    steals from the back of the others', so a worker that is descheduled
+    does not hold up the block. run() returns once every task has finished.
+    Tasks write to disjoint, precomputed parts of the output, so the result
+    does not depend on which thread ran what.
+
+    One job runs at a time; run() is meant to be called from the processing
+    thread. With no workers (or while the pool is being reconfigured) the
+    tasks simply run on the calling thread.
+*/
+class EncoderPool
+{
+public:
+    /** Largest number of tasks in one job */
+    static const int MAX_TASKS = 4096;
+
+    /** Constructor */
+    EncoderPool();
+
+    /** Destructor, stops the workers */
+    ~EncoderPool();
+
+    /** Starts numWorkers threads (0 runs everything on the calling thread).
+        With pinToCores, worker i is bound to core i + 1, leaving core 0 to the GUI */
+    void start (int numWorkers, bool pinToCores);
+
+    /** Stops the workers */
+    void stop();
+
+    /** Returns the number of worker threads */
+    int getNumWorkers() const { return (int) workers.size(); }
+
+    /** Runs task (int index) for every index in [0, numTasks) and waits for all of them */
+    template <typename Task>
+    void run (int numTasks, Task& task)
+    {
+        runTasks (numTasks, &invoke<Task>, &task);
+    }
+
+private:
+    template <typename Task>
+    static void invoke (void* context, int index)
+    {
+        (*static_cast<Task*> (context)) (index);
+    }
+
+    struct Queue
+    {
+        std::mutex lock;
+        std::vector<int> tasks;
+        int head = 0;
+        int tail = 0;
+    };
+
+    void runTasks (int numTasks, void (*function) (void*, int), void* context);
+    void workerLoop (int index);
+
+    /** Runs tasks from queue index first, then from the others; returns when all queues are empty */
+    void work (int index);
+
+    bool popOwn (Queue& queue, int& task);
+    bool steal (Queue& queue, int& task);
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    std::mutex configLock;
+
+    std::mutex wakeLock;
+    std::condition_variable wake;
+    uint64_t generation;
+    bool shouldExit;
+
+    void (*jobFunction) (void*, int);
+    void* jobContext;
+    std::atomic<int> remaining;
+};
+
+#endif // ENCODERPOOL_H_INCLUDED
@@ -0,0 +1,141 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "EncodingCache.h"
+
+#include <algorithm>
+
+// unreferenced buffers kept for reuse
+const size_t MAX_SPARE_BUFFERS = 64;
+
+EncodingCache::EncodingCache()
+    : streamId (0),
+      channels (nullptr),
+      numChannels (0),
+      numSamples (0),
+      sampleNumber (0),
+      pool (nullptr),
+      numEncoded (0),
+      numShared (0)
+{
+}
+
+void EncodingCache::setPool (EncoderPool* newPool)
+{
+    pool = newPool;
+}
+
+void EncodingCache::beginBlock (uint16_t newStreamId,
+                                const float* const* newChannels,
+                                int newNumChannels,
+                                int newNumSamples,
+                                int64_t newSampleNumber)
+{
+    streamId = newStreamId;
+    channels = newChannels;
+    numChannels = newNumChannels;
+    numSamples = newNumSamples;
+    sampleNumber = newSampleNumber;
+
+    for (auto& entry : entries)
+        if (spare.size() < MAX_SPARE_BUFFERS)
+            spare.push_back (std::move (entry));
+
+    entries.clear();
+}
+
+EncodingCache::BufferPtr EncodingCache::get (const BlockEncoder::Format& format)
+{
+    if (BufferPtr buffer = find (format))
+    {
+        numShared.fetch_add (1, std::memory_order_relaxed);
+        return buffer;
+    }
+
+    std::shared_ptr<Buffer> buffer = acquire();
+    buffer->streamId = streamId;
+    buffer->sampleNumber = sampleNumber;
+    buffer->numSamples = numSamples;
+    buffer->numOutputSamples = BlockEncoder::getNumOutputSamples (numSamples, format.decimation);
+    buffer->format = format;
+
+    const int numOutChannels = BlockEncoder::prepareOutput (numChannels, numSamples, format, buffer->data, buffer->scales);
+    const int numTasks = (numOutChannels + CHANNELS_PER_TASK - 1) / CHANNELS_PER_TASK;
+    buffer->numOutputChannels = numOutChannels;
+
+    // every group writes its own channels, so the result is the same whoever runs it
+    auto encodeGroup = [this, &format, &buffer, numOutChannels] (int task)
+    {
+        const int first = task * CHANNELS_PER_TASK;
+
+        BlockEncoder::encodeChannels (channels,
+                                      numSamples,
+                                      format,
+                                      first,
+                                      std::min (numOutChannels - first, (int) CHANNELS_PER_TASK),
+                                      buffer->data.data(),
+                                      buffer->scales.data());
+    };
+
+    if (pool != nullptr)
+        pool->run (numTasks, encodeGroup);
+    else
+        for (int task = 0; task < numTasks; task++)
+            encodeGroup (task);
+
+    entries.push_back (buffer);
+    numEncoded.fetch_add (1, std::memory_order_relaxed);
+
+    return buffer;
+}
+
+EncodingCache::BufferPtr EncodingCache::find (const BlockEncoder::Format& format) const
+{
+    for (auto& entry : entries)
+        if (entry->format == format)
+            return entry;
+
+    return nullptr;
+}
+
+std::shared_ptr<EncodingCache::Buffer> EncodingCache::acquire()
+{
+    for (size_t i = 0; i < spare.size(); i++)
+    {
+        if (spare[i].use_count() != 1)
+            continue;
+
+        // the last reader released it on another thread; make its reads happen before our writes
+        std::atomic_thread_fence (std::memory_order_acquire);
+
+        std::shared_ptr<Buffer> buffer = std::move (spare[i]);
+        spare[i] = std::move (spare.back());
+        spare.pop_back();
+
+        return buffer;
+    }
+
+    return std::make_shared<Buffer>();
+}
@@ -0,0 +1,131 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ENCODINGCACHE_H_INCLUDED
+#define ENCODINGCACHE_H_INCLUDED
+
+#include "BlockEncoder.h"
+#include "EncoderPool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+    Encodes each distinct representation of the current block once.
+
+    A representation is identified by the block (stream and first sample)
+    and a BlockEncoder::Format (channel set, decimation, i.e. output rate,
+    and encoding). It is only encoded when someone asks for it, and every
+    later request for the same key gets the same buffer. Buffers are
+    immutable once handed out and reference counted, so PUB frames,
+    subscription topics and the reliable channel can all hold on to one
+    copy for as long as they need it, on any thread.
+
+    Buffers that nobody references any more are recycled, so a steady
+    configuration encodes without allocating. With an EncoderPool, large
+    channel sets are encoded in groups of CHANNELS_PER_TASK in parallel. The cache is used from the
+    processing thread only; the buffers it returns may be read anywhere.
+*/
+class EncodingCache
+{
+public:
+    struct Buffer
+    {
+        uint16_t streamId = 0;
+        int64_t sampleNumber = 0;
+        int numSamples = 0;
+        int numOutputSamples = 0;
+        int numOutputChannels = 0;
+        BlockEncoder::Format format;
+
+        /** Channel-major samples, float32 or int16 */
+        std::vector<uint8_t> data;
+
+        /** One scale per channel for int16, empty for float32 */
+        std::vector<float> scales;
+
+        /** Returns the number of bytes of one channel */
+        size_t getChannelSize() const { return numOutputChannels > 0 ? data.size() / (size_t) numOutputChannels : 0; }
+
+        /** Returns the samples of one output channel */
+        const uint8_t* getChannelData (int channelIndex) const { return data.data() + (size_t) channelIndex * getChannelSize(); }
+    };
+
+    typedef std::shared_ptr<const Buffer> BufferPtr;
+
+    /** Channels encoded by one pool task */
+    static const int CHANNELS_PER_TASK = 32;
+
+    /** Constructor */
+    EncodingCache();
+
+    /** Encodes on pool's threads from now on (nullptr encodes on the calling thread) */
+    void setPool (EncoderPool* pool);
+
+    /** Starts a new block; representations of the previous one are no longer
+        returned, but stay valid for whoever still references them */
+    void beginBlock (uint16_t streamId, const float* const* channels, int numChannels, int numSamples, int64_t sampleNumber);
+
+    /** Returns the current block in the given format, encoding it on first request.
+        format.channels are indices into the channels passed to beginBlock() */
+    BufferPtr get (const BlockEncoder::Format& format);
+
+    /** Returns the current block in the given format if it has been encoded, without encoding it */
+    BufferPtr find (const BlockEncoder::Format& format) const;
+
+    /** Returns an empty buffer for a representation that is not tied to the current
+        block (e.g. samples carried across blocks); fill it before sharing it */
+    std::shared_ptr<Buffer> acquire();
+
+    uint16_t getStreamId() const { return streamId; }
+    const float* const* getChannels() const { return channels; }
+    int getNumChannels() const { return numChannels; }
+    int getNumSamples() const { return numSamples; }
+    int64_t getSampleNumber() const { return sampleNumber; }
+
+    /** Number of representations encoded so far */
+    uint64_t getNumEncoded() const { return numEncoded.load (std::memory_order_relaxed); }
+
+    /** Number of requests answered with an already encoded representation */
+    uint64_t getNumShared() const { return numShared.load (std::memory_order_relaxed); }
+
+private:
+    uint16_t streamId;
+    const float* const* channels;
+    int numChannels;
+    int numSamples;
+    int64_t sampleNumber;
+    EncoderPool* pool;
+
+    std::vector<std::shared_ptr<Buffer>> entries;
+    std::vector<std::shared_ptr<Buffer>> spare;
+
+    std::atomic<uint64_t> numEncoded;
+    std::atomic<uint64_t> numShared;
+};
+
+#endif // ENCODINGCACHE_H_INCLUDED
@@ -0,0 +1,79 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "HeaderTemplate.h"
+
+#include <charconv>
+#include <cstring>
+
+// -1000000000000000001, -1000000000000000002, ...: 20 characters, unlikely anywhere else
+const int64_t PLACEHOLDER_BASE = -1000000000000000000LL;
+
+HeaderTemplate::HeaderTemplate()
+{
+}
+
+int64_t HeaderTemplate::getPlaceholder (int slot)
+{
+    return PLACEHOLDER_BASE - 1 - slot;
+}
+
+bool HeaderTemplate::prepare (const std::string& rendered, int numSlots)
+{
+    text.clear();
+    offsets.clear();
+
+    std::vector<size_t> found;
+
+    for (int slot = 0; slot < numSlots; slot++)
+    {
+        const std::string placeholder = std::to_string (getPlaceholder (slot));
+        const size_t offset = rendered.find (placeholder);
+
+        if (offset == std::string::npos || rendered.find (placeholder, offset + 1) != std::string::npos)
+            return false;
+
+        found.push_back (offset);
+    }
+
+    text = rendered;
+    offsets = found;
+
+    return true;
+}
+
+void HeaderTemplate::render (const int64_t* values, std::string& dest) const
+{
+    dest.assign (text);
+
+    for (size_t slot = 0; slot < offsets.size(); slot++)
+    {
+        char* first = &dest[offsets[slot]];
+        char* last = first + SLOT_WIDTH;
+
+        char* end = std::to_chars (first, last, values[slot]).ptr;
+        std::memset (end, ' ', (size_t) (last - end));
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef HEADERTEMPLATE_H_INCLUDED
+#define HEADERTEMPLATE_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+    A JSON header rendered once, with fixed-width slots for the numbers
+    that change from message to message.
+
+    The header is rendered by the usual JSON writer with getPlaceholder (i)
+    in place of each changing number. prepare() finds the placeholders, and
+    render() copies the text and writes the numbers into their slots, padded
+    with spaces (JSON allows whitespace after a value, so parsers read the
+    same object as before).
+*/
+class HeaderTemplate
+{
+public:
+    /** Characters reserved for a number: a sign and 19 digits hold any int64 */
+    static const int SLOT_WIDTH = 20;
+
+    /** Constructor */
+    HeaderTemplate();
+
+    /** Returns the number to render in place of slot index; it is SLOT_WIDTH characters long */
+    static int64_t getPlaceholder (int slot);
+
+    /** Takes the rendered text and locates numSlots placeholders in it.
+        Returns false (and stays invalid) if any of them is missing or appears twice */
+    bool prepare (const std::string& rendered, int numSlots);
+
+    /** True once prepare() succeeded */
+    bool isValid() const { return ! offsets.empty(); }
+
+    /** Writes the header with the given slot values to dest (which keeps its capacity) */
+    void render (const int64_t* values, std::string& dest) const;
+
+private:
+    std::string text;
+    std::vector<size_t> offsets;
+};
+
+#endif // HEADERTEMPLATE_H_INCLUDED
@@ -0,0 +1,285 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "HistoryRing.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if ! defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+HistoryRing::HistoryRing()
+    : capacity (0),
+      numChannels (0),
+      samples (nullptr),
+      mappedSize (0),
+      mapped (false),
+      sampleRate (0.0f),
+      end (0),
+      writeLimit (0),
+      validFrom (0),
+      generation (0)
+{
+}
+
+HistoryRing::~HistoryRing()
+{
+    release();
+}
+
+bool HistoryRing::prepare (int64_t capacitySamples,
+                           const std::vector<uint32_t>& channelNumbers,
+                           float rate,
+                           const std::string& name,
+                           bool useFile)
+{
+    release();
+
+    std::lock_guard<std::mutex> lock (configLock);
+
+    if (capacitySamples <= 0 || channelNumbers.empty())
+        return false;
+
+    const size_t bytes = (size_t) capacitySamples * channelNumbers.size() * sizeof (float);
+
+#if ! defined(_WIN32)
+    if (useFile)
+    {
+        // unlinked right away: the file only exists as long as the mapping
+        const char* tmp = std::getenv ("TMPDIR");
+        std::string path = std::string (tmp != nullptr ? tmp : "/tmp") + "/zmq-interface-history-XXXXXX";
+
+        int fd = mkstemp (&path[0]);
+        if (fd < 0)
+            return false;
+
+        unlink (path.c_str());
+
+        void* p = MAP_FAILED;
+        if (ftruncate (fd, (off_t) bytes) == 0)
+            p = mmap (nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        close (fd);
+
+        if (p == MAP_FAILED)
+            return false;
+
+        samples = (float*) p;
+        mappedSize = bytes;
+        mapped = true;
+    }
+#endif
+
+    if (samples == nullptr)
+    {
+        samples = new (std::nothrow) float[bytes / sizeof (float)];
+        if (samples == nullptr)
+            return false;
+    }
+
+    capacity = capacitySamples;
+    numChannels = (int) channelNumbers.size();
+    channels = channelNumbers;
+    sampleRate = rate;
+    streamName = name;
+
+    end.store (0);
+    writeLimit.store (0);
+    validFrom.store (0);
+
+    return true;
+}
+
+void HistoryRing::release()
+{
+    std::lock_guard<std::mutex> lock (configLock);
+
+    if (samples == nullptr)
+        return;
+
+#if ! defined(_WIN32)
+    if (mapped)
+        munmap (samples, mappedSize);
+    else
+#endif
+        delete[] samples;
+
+    samples = nullptr;
+    mapped = false;
+    mappedSize = 0;
+    capacity = 0;
+    numChannels = 0;
+    channels.clear();
+}
+
+void HistoryRing::reset()
+{
+    generation.fetch_add (1, std::memory_order_acq_rel);
+    end.store (0, std::memory_order_relaxed);
+    writeLimit.store (0, std::memory_order_relaxed);
+    validFrom.store (0, std::memory_order_relaxed);
+    generation.fetch_add (1, std::memory_order_release);
+}
+
+void HistoryRing::write (const float* const* input, int numSamples, int64_t sampleNumber)
+{
+    if (samples == nullptr || numSamples <= 0)
+        return;
+
+    if (sampleNumber != end.load (std::memory_order_relaxed))
+    {
+        // discontinuity: older samples no longer line up with their slots
+        generation.fetch_add (1, std::memory_order_acq_rel);
+        validFrom.store (sampleNumber, std::memory_order_relaxed);
+        writeLimit.store (sampleNumber, std::memory_order_relaxed);
+        end.store (sampleNumber, std::memory_order_relaxed);
+        generation.fetch_add (1, std::memory_order_release);
+    }
+
+    // only the newest capacity samples of a very long block are kept
+    const int skip = (int) std::max<int64_t> (0, numSamples - capacity);
+    const int64_t first = sampleNumber + skip;
+    const int64_t count = numSamples - skip;
+
+    writeLimit.store (sampleNumber + numSamples, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+
+    const int64_t pos = first % capacity;
+    const int64_t head = std::min (count, capacity - pos);
+
+    for (int ch = 0; ch < numChannels; ch++)
+    {
+        float* dest = samples + (size_t) ch * capacity;
+        const float* src = input[ch] + skip;
+
+        std::memcpy (dest + pos, src, sizeof (float) * head);
+        if (head < count)
+            std::memcpy (dest, src + head, sizeof (float) * (count - head));
+    }
+
+    end.store (sampleNumber + numSamples, std::memory_order_release);
+}
+
+HistoryRing::Range HistoryRing::read (int64_t firstSample, int64_t maxSamples, std::vector<float>& dest) const
+{
+    std::lock_guard<std::mutex> lock (configLock);
+
+    Range range;
+
+    if (samples == nullptr)
+        return range;
+
+    for (int attempt = 0; attempt < 4; attempt++)
+    {
+        const uint64_t g = generation.load (std::memory_order_acquire);
+        if (g & 1)
+            continue;
+
+        const int64_t newest = end.load (std::memory_order_acquire);
+        const int64_t oldest = std::max (validFrom.load (std::memory_order_acquire), newest - capacity);
+
+        range.oldestSample = oldest;
+        range.newestSample = newest;
+        range.sampleNumber = std::max (firstSample, oldest);
+        range.numSamples = std::max<int64_t> (0, std::min (maxSamples, newest - range.sampleNumber));
+
+        if (range.numSamples == 0)
+        {
+            dest.clear();
+            return range;
+        }
+
+        const int64_t count = range.numSamples;
+        const int64_t pos = range.sampleNumber % capacity;
+        const int64_t head = std::min (count, capacity - pos);
+
+        dest.resize ((size_t) numChannels * count);
+
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            const float* src = samples + (size_t) ch * capacity;
+            float* out = dest.data() + (size_t) ch * count;
+
+            std::memcpy (out, src + pos, sizeof (float) * head);
+            if (head < count)
+                std::memcpy (out + head, src, sizeof (float) * (count - head));
+        }
+
+        std::atomic_thread_fence (std::memory_order_acquire);
+
+        if (generation.load (std::memory_order_relaxed) != g)
+            continue;
+
+        // samples the writer reached while we were copying are not reliable
+        const int64_t overwritten = writeLimit.load (std::memory_order_relaxed) - capacity - range.sampleNumber;
+
+        if (overwritten >= count)
+            continue;
+
+        if (overwritten > 0)
+        {
+            const int64_t kept = count - overwritten;
+
+            for (int ch = 0; ch < numChannels; ch++)
+                std::memmove (dest.data() + (size_t) ch * kept,
+                              dest.data() + (size_t) ch * count + overwritten,
+                              sizeof (float) * kept);
+
+            dest.resize ((size_t) numChannels * kept);
+            range.sampleNumber += overwritten;
+            range.numSamples = kept;
+        }
+
+        return range;
+    }
+
+    dest.clear();
+    range.numSamples = 0;
+    return range;
+}
+
+std::vector<uint32_t> HistoryRing::getChannelNumbers() const
+{
+    std::lock_guard<std::mutex> lock (configLock);
+    return channels;
+}
+
+std::string HistoryRing::getStreamName() const
+{
+    std::lock_guard<std::mutex> lock (configLock);
+    return streamName;
+}
+
+float HistoryRing::getSampleRate() const
+{
+    std::lock_guard<std::mutex> lock (configLock);
+    return sampleRate;
+}
@@ -0,0 +1,127 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef HISTORYRING_H_INCLUDED
+#define HISTORYRING_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+    Keeps the most recent samples of the published channels so that
+    clients joining late, or reconnecting after a drop, can catch up.
+
+    Samples are stored channel-major in a circular buffer indexed by
+    sample number (sample s lives at s % capacity), so a range request
+    maps directly to at most two copies per channel. The buffer is either
+    heap memory or, with useFile, a mapping of an unlinked temporary file
+    that the OS can page out instead of holding it in RAM.
+
+    write() is called from the processing thread and never blocks or
+    allocates. read() may run concurrently on another thread; samples
+    overwritten while they were being copied are trimmed from the result.
+    prepare() and release() must not overlap with write().
+*/
+class HistoryRing
+{
+public:
+    /** Constructor */
+    HistoryRing();
+
+    /** Destructor */
+    ~HistoryRing();
+
+    /** Allocates a buffer holding capacitySamples per channel. Returns false if it could not be allocated */
+    bool prepare (int64_t capacitySamples,
+                  const std::vector<uint32_t>& channelNumbers,
+                  float sampleRate,
+                  const std::string& streamName,
+                  bool useFile);
+
+    /** Frees the buffer */
+    void release();
+
+    /** Forgets all stored samples (e.g. when sample numbers restart) */
+    void reset();
+
+    /** True if a buffer is allocated */
+    bool isOpen() const { return samples != nullptr; }
+
+    /** Stores one block (channel-major input, one pointer per channel) */
+    void write (const float* const* channels, int numSamples, int64_t sampleNumber);
+
+    struct Range
+    {
+        int64_t sampleNumber = 0;
+        int64_t numSamples = 0;
+        int64_t oldestSample = 0;
+        int64_t newestSample = 0;
+    };
+
+    /** Copies up to maxSamples samples starting at firstSample (or the oldest
+        available sample, if later) into dest, channel-major with
+        numSamples values per channel. Returns the range actually copied */
+    Range read (int64_t firstSample, int64_t maxSamples, std::vector<float>& dest) const;
+
+    /** Returns the channel numbers stored */
+    std::vector<uint32_t> getChannelNumbers() const;
+
+    /** Returns the name of the stream stored */
+    std::string getStreamName() const;
+
+    /** Returns the sample rate of the stream stored */
+    float getSampleRate() const;
+
+private:
+    int64_t capacity;
+    int numChannels;
+    float* samples;
+    size_t mappedSize;
+    bool mapped;
+
+    std::vector<uint32_t> channels;
+    float sampleRate;
+    std::string streamName;
+
+    /** Sample number one past the last complete sample */
+    std::atomic<int64_t> end;
+
+    /** Sample number one past the last sample being written */
+    std::atomic<int64_t> writeLimit;
+
+    /** First sample after the most recent discontinuity */
+    std::atomic<int64_t> validFrom;
+
+    /** Odd while validFrom/end are being changed for a discontinuity */
+    std::atomic<uint64_t> generation;
+
+    mutable std::mutex configLock;
+};
+
+#endif // HISTORYRING_H_INCLUDED
@@ -0,0 +1,235 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "LocalStreamApi.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#define LOCAL_API_EXPORT __declspec (dllexport)
+#else
+#define LOCAL_API_EXPORT __attribute__ ((visibility ("default")))
+#endif
+
+extern "C" LOCAL_API_EXPORT LocalStreamRegistry* zmqInterfaceGetLocalStreamRegistry()
+{
+    return &LocalStreamRegistry::getInstance();
+}
+
+LocalStreamSubscriber::LocalStreamSubscriber (std::shared_ptr<LocalStream> s, size_t queueSize)
+    : stream (s),
+      queue (queueSize + 1)
+{
+}
+
+LocalStreamSubscriber::~LocalStreamSubscriber()
+{
+    if (slot >= 0)
+        stream->unsubscribe (slot);
+}
+
+LocalStream::LocalStream (const std::string& streamName, int poolSize)
+    : name (streamName)
+{
+    for (int i = 0; i < std::max (2, poolSize); i++)
+        pool.push_back (std::make_unique<LocalDataBlock>());
+}
+
+std::shared_ptr<LocalStreamSubscriber> LocalStream::subscribe (size_t queueSize)
+{
+    std::lock_guard<std::mutex> guard (subscribeLock);
+
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+    {
+        if (slots[i].subscriber.load() == nullptr)
+        {
+            std::shared_ptr<LocalStreamSubscriber> subscriber (new LocalStreamSubscriber (shared_from_this(), queueSize));
+            subscriber->slot = i;
+            slots[i].subscriber.store (subscriber.get());
+            numSubscribers++;
+            return subscriber;
+        }
+    }
+
+    return nullptr;
+}
+
+void LocalStream::unsubscribe (int slot)
+{
+    std::lock_guard<std::mutex> guard (subscribeLock);
+
+    slots[slot].subscriber.store (nullptr);
+
+    // wait until the publisher is done with the subscriber's queue
+    while (slots[slot].publishing.load() != 0)
+        std::this_thread::yield();
+
+    numSubscribers--;
+}
+
+void LocalStream::prepare (int numChannels, int maxSamples)
+{
+    for (auto& block : pool)
+    {
+        if (block->refCount.load (std::memory_order_acquire) != 0)
+            continue;
+
+        block->channelNumbers.reserve ((size_t) numChannels);
+        block->samples.reserve ((size_t) numChannels * maxSamples);
+    }
+}
+
+LocalDataBlock* LocalStream::acquireBlock()
+{
+    for (size_t n = 0; n < pool.size(); n++)
+    {
+        LocalDataBlock* block = pool[nextPoolIndex].get();
+        nextPoolIndex = (nextPoolIndex + 1) % pool.size();
+
+        if (block->refCount.load (std::memory_order_acquire) == 0)
+            return block;
+    }
+
+    return nullptr;
+}
+
+void LocalStream::dropBlock()
+{
+    for (auto& slot : slots)
+    {
+        slot.publishing.fetch_add (1, std::memory_order_acq_rel);
+
+        if (LocalStreamSubscriber* subscriber = slot.subscriber.load (std::memory_order_acquire))
+            subscriber->dropped.fetch_add (1, std::memory_order_relaxed);
+
+        slot.publishing.fetch_sub (1, std::memory_order_acq_rel);
+    }
+}
+
+bool LocalStream::publish (const float* const* channels,
+                           const uint32_t* channelNumbers,
+                           int numChannels,
+                           int numSamples,
+                           int64_t sampleNumber,
+                           float sampleRate)
+{
+    if (numSubscribers.load (std::memory_order_relaxed) == 0)
+        return true;
+
+    LocalDataBlock* block = acquireBlock();
+
+    // either every pool block is still held by some subscriber, or filling
+    // this one would make it grow on the processing thread
+    if (block == nullptr
+        || (size_t) numChannels > block->channelNumbers.capacity()
+        || (size_t) numChannels * numSamples > block->samples.capacity())
+    {
+        dropBlock();
+        return false;
+    }
+
+    block->blockIndex = nextBlockIndex++;
+    block->sampleNumber = sampleNumber;
+    block->numSamples = numSamples;
+    block->sampleRate = sampleRate;
+    block->channelNumbers.assign (channelNumbers, channelNumbers + numChannels);
+    block->samples.resize ((size_t) numChannels * numSamples);
+
+    for (int ch = 0; ch < numChannels; ch++)
+        std::memcpy (block->samples.data() + (size_t) ch * numSamples, channels[ch], sizeof (float) * numSamples);
+
+    // hold one reference while handing out, so the block cannot be
+    // recycled before every subscriber has been served
+    LocalBlockRef publisherRef (block);
+
+    for (auto& slot : slots)
+    {
+        slot.publishing.fetch_add (1, std::memory_order_acq_rel);
+
+        if (LocalStreamSubscriber* subscriber = slot.subscriber.load (std::memory_order_acquire))
+        {
+            LocalBlockRef ref (publisherRef);
+
+            if (! subscriber->queue.push (ref))
+                subscriber->dropped.fetch_add (1, std::memory_order_relaxed);
+        }
+
+        slot.publishing.fetch_sub (1, std::memory_order_acq_rel);
+    }
+
+    return true;
+}
+
+LocalStreamRegistry& LocalStreamRegistry::getInstance()
+{
+    static LocalStreamRegistry registry;
+    return registry;
+}
+
+std::shared_ptr<LocalStream> LocalStreamRegistry::createStream (const std::string& streamName, int poolSize)
+{
+    std::lock_guard<std::mutex> guard (lock);
+
+    streams.erase (std::remove_if (streams.begin(), streams.end(), [&] (const std::shared_ptr<LocalStream>& s)
+                                   { return s->getName() == streamName; }),
+                   streams.end());
+
+    streams.push_back (std::make_shared<LocalStream> (streamName, poolSize));
+    return streams.back();
+}
+
+void LocalStreamRegistry::removeStream (const std::string& streamName)
+{
+    std::lock_guard<std::mutex> guard (lock);
+
+    streams.erase (std::remove_if (streams.begin(), streams.end(), [&] (const std::shared_ptr<LocalStream>& s)
+                                   { return s->getName() == streamName; }),
+                   streams.end());
+}
+
+std::shared_ptr<LocalStream> LocalStreamRegistry::findStream (const std::string& streamName)
+{
+    std::lock_guard<std::mutex> guard (lock);
+
+    for (auto& stream : streams)
+        if (stream->getName() == streamName)
+            return stream;
+
+    return nullptr;
+}
+
+std::vector<std::string> LocalStreamRegistry::getStreamNames()
+{
+    std::lock_guard<std::mutex> guard (lock);
+
+    std::vector<std::string> names;
+    for (auto& stream : streams)
+        names.push_back (stream->getName());
+
+    return names;
+}
@@ -0,0 +1,287 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef LOCALSTREAMAPI_H_INCLUDED
+#define LOCALSTREAMAPI_H_INCLUDED
+
+/*
+  In-process API for plugins running in the same GUI as a ZMQ Interface.
+
+  Every ZMQ Interface with the "local_api" parameter enabled registers a
+  LocalStream named "ZMQ Interface <node id>" in a process-wide
+  registry. Subscribers receive reference-counted handles to the blocks
+  the plugin has already gathered for publishing: no copies, no sockets.
+  Blocks are immutable once published and return to the publisher's pool
+  when the last handle is released, so hold on to them only as long as
+  needed.
+
+  The registry lives inside the ZMQ Interface library. Other plugins get
+  it with findLocalStreamRegistry(), which looks up the exported
+  zmqInterfaceGetLocalStreamRegistry() function. Both sides must be built
+  with the same compiler and standard library, as for any GUI plugin.
+
+      auto* registry = findLocalStreamRegistry();
+      auto stream = registry ? registry->findStream ("ZMQ Interface 105") : nullptr;
+      auto subscriber = stream ? stream->subscribe (256) : nullptr;
+      ...
+      LocalBlockRef block;
+      while (subscriber->pop (block))
+          decode (block->getChannelData (0), block->getNumSamples());
+*/
+
+#include "SpscQueue.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+class LocalStream;
+
+/** One block of continuous data, immutable once published */
+class LocalDataBlock
+{
+public:
+    /** Index of the block in the publisher's sequence */
+    uint64_t getBlockIndex() const { return blockIndex; }
+
+    /** Sample number of the first sample */
+    int64_t getSampleNumber() const { return sampleNumber; }
+
+    int getNumSamples() const { return numSamples; }
+
+    int getNumChannels() const { return (int) channelNumbers.size(); }
+
+    float getSampleRate() const { return sampleRate; }
+
+    /** Local channel index ("channel_num") of the n-th channel in the block */
+    uint32_t getChannelNumber (int index) const { return channelNumbers[index]; }
+
+    /** Samples of the n-th channel */
+    const float* getChannelData (int index) const { return samples.data() + (size_t) index * numSamples; }
+
+private:
+    friend class LocalStream;
+    friend class LocalBlockRef;
+
+    mutable std::atomic<int> refCount { 0 };
+
+    uint64_t blockIndex = 0;
+    int64_t sampleNumber = 0;
+    int numSamples = 0;
+    float sampleRate = 0.0f;
+    std::vector<uint32_t> channelNumbers;
+    std::vector<float> samples;
+};
+
+/** Reference-counted handle to a published block */
+class LocalBlockRef
+{
+public:
+    LocalBlockRef() = default;
+
+    explicit LocalBlockRef (const LocalDataBlock* b) : block (b)
+    {
+        if (block != nullptr)
+            block->refCount.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    LocalBlockRef (const LocalBlockRef& other) : LocalBlockRef (other.block) {}
+
+    LocalBlockRef (LocalBlockRef&& other) noexcept : block (other.block) { other.block = nullptr; }
+
+    LocalBlockRef& operator= (LocalBlockRef other) noexcept
+    {
+        std::swap (block, other.block);
+        return *this;
+    }
+
+    ~LocalBlockRef() { reset(); }
+
+    void reset()
+    {
+        if (block != nullptr)
+            block->refCount.fetch_sub (1, std::memory_order_acq_rel);
+
+        block = nullptr;
+    }
+
+    const LocalDataBlock* get() const { return block; }
+    const LocalDataBlock* operator->() const { return block; }
+    explicit operator bool() const { return block != nullptr; }
+
+private:
+    const LocalDataBlock* block = nullptr;
+};
+
+/** Receiving end of a subscription; pop() from one thread only */
+class LocalStreamSubscriber
+{
+public:
+    ~LocalStreamSubscriber();
+
+    /** Takes the oldest pending block; returns false if there is none */
+    bool pop (LocalBlockRef& block) { return queue.pop (block); }
+
+    /** Number of blocks waiting */
+    size_t getNumPending() const { return queue.size(); }
+
+    /** Blocks that were dropped because the queue was full */
+    uint64_t getNumDropped() const { return dropped.load (std::memory_order_relaxed); }
+
+private:
+    friend class LocalStream;
+
+    LocalStreamSubscriber (std::shared_ptr<LocalStream> stream, size_t queueSize);
+
+    std::shared_ptr<LocalStream> stream;
+    SpscQueue<LocalBlockRef> queue;
+    std::atomic<uint64_t> dropped { 0 };
+    int slot = -1;
+};
+
+/** A named stream of blocks published by one ZMQ Interface */
+class LocalStream : public std::enable_shared_from_this<LocalStream>
+{
+public:
+    static const int MAX_SUBSCRIBERS = 32;
+
+    LocalStream (const std::string& name, int poolSize);
+
+    const std::string& getName() const { return name; }
+
+    /** Creates a subscription with room for queueSize pending blocks (nullptr if all slots are taken) */
+    std::shared_ptr<LocalStreamSubscriber> subscribe (size_t queueSize);
+
+    /** Number of active subscribers */
+    int getNumSubscribers() const { return numSubscribers.load(); }
+
+    /** Publisher side: sizes every free pool block for up to numChannels channels of
+        maxSamples samples. Call while nothing is being published; blocks still held by
+        subscribers keep their size. */
+    void prepare (int numChannels, int maxSamples);
+
+    /** Publisher side: gathers one block and hands it to every subscriber.
+        Called from the processing thread; never allocates. Returns false if the
+        block was dropped, because every pool block was still in use or it is larger
+        than prepare() allowed for. */
+    bool publish (const float* const* channels,
+                  const uint32_t* channelNumbers,
+                  int numChannels,
+                  int numSamples,
+                  int64_t sampleNumber,
+                  float sampleRate);
+
+private:
+    friend class LocalStreamSubscriber;
+
+    struct SubscriberSlot
+    {
+        std::atomic<LocalStreamSubscriber*> subscriber { nullptr };
+        std::atomic<int> publishing { 0 };
+    };
+
+    void unsubscribe (int slot);
+
+    LocalDataBlock* acquireBlock();
+
+    /** Counts a block that could not be published as dropped by every subscriber */
+    void dropBlock();
+
+    std::string name;
+    std::vector<std::unique_ptr<LocalDataBlock>> pool;
+    size_t nextPoolIndex = 0;
+    uint64_t nextBlockIndex = 0;
+
+    SubscriberSlot slots[MAX_SUBSCRIBERS];
+    std::atomic<int> numSubscribers { 0 };
+    std::mutex subscribeLock;
+};
+
+/** Process-wide list of local streams */
+class LocalStreamRegistry
+{
+public:
+    /** Registers a stream (replacing one with the same name) */
+    std::shared_ptr<LocalStream> createStream (const std::string& name, int poolSize);
+
+    /** Removes a stream; existing subscribers keep it alive but receive nothing more */
+    void removeStream (const std::string& name);
+
+    /** Returns a stream by name, or nullptr */
+    std::shared_ptr<LocalStream> findStream (const std::string& name);
+
+    /** Names of all registered streams */
+    std::vector<std::string> getStreamNames();
+
+    /** The registry of this library */
+    static LocalStreamRegistry& getInstance();
+
+private:
+    std::mutex lock;
+    std::vector<std::shared_ptr<LocalStream>> streams;
+};
+
+extern "C" typedef LocalStreamRegistry* (*LocalStreamRegistryGetter)();
+
+/** Finds the registry exported by a loaded ZMQ Interface library (nullptr if not loaded).
+    libraryName is the library file without extension, or its full path. */
+inline LocalStreamRegistry* findLocalStreamRegistry (const char* libraryName = "zmq-interface")
+{
+    const char* symbol = "zmqInterfaceGetLocalStreamRegistry";
+    void* function = nullptr;
+
+#if defined(_WIN32)
+    HMODULE module = GetModuleHandleA ((std::string (libraryName) + ".dll").c_str());
+    if (module != nullptr)
+        function = (void*) GetProcAddress (module, symbol);
+#else
+#if defined(__APPLE__)
+    std::string file = std::string (libraryName) + ".bundle/Contents/MacOS/" + libraryName;
+#else
+    std::string file = std::string (libraryName) + ".so";
+#endif
+    void* handle = dlopen (file.c_str(), RTLD_NOW | RTLD_NOLOAD);
+    function = dlsym (handle != nullptr ? handle : RTLD_DEFAULT, symbol);
+    if (handle != nullptr)
+        dlclose (handle);
+#endif
+
+    return function != nullptr ? ((LocalStreamRegistryGetter) function)() : nullptr;
+}
+
+#endif // LOCALSTREAMAPI_H_INCLUDED
@@ -0,0 +1,131 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef RCUPOINTER_H_INCLUDED
+#define RCUPOINTER_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+    Holds an immutable object that readers use without locks while writers
+    replace it (read-copy-update).
+
+    Readers take a ReadLock, which costs two atomic increments and never
+    waits. Writers build a complete new object and publish() it with an
+    atomic pointer swap; the old object is deleted only after every reader
+    that could still see it has released its lock (a grace period, tracked
+    with two reader counters that alternate between publications).
+
+    publish() waits for that grace period, so it belongs on a control
+    thread, never on a thread that holds a ReadLock.
+*/
+template <typename T>
+class RcuPointer
+{
+public:
+    /** Constructor; the initial object is default-constructed */
+    RcuPointer()
+        : current (new T()),
+          epoch (0)
+    {
+        readers[0].store (0);
+        readers[1].store (0);
+    }
+
+    /** Destructor; no reader may be active */
+    ~RcuPointer()
+    {
+        delete current.load();
+    }
+
+    /** Replaces the object; returns once no reader can see the old one */
+    void publish (std::unique_ptr<const T> next)
+    {
+        std::lock_guard<std::mutex> lock (writeLock);
+
+        const T* old = current.exchange (next.release());
+        const int previous = epoch.fetch_add (1) & 1;
+
+        while (readers[previous].load() > 0)
+            std::this_thread::sleep_for (std::chrono::microseconds (100));
+
+        delete old;
+    }
+
+    /** Gives a reader a consistent view of the object until it goes out of scope */
+    class ReadLock
+    {
+    public:
+        explicit ReadLock (RcuPointer& owner)
+            : counter (nullptr)
+        {
+            while (true)
+            {
+                const int e = owner.epoch.load();
+                counter = &owner.readers[e & 1];
+                counter->fetch_add (1);
+
+                // a writer may have switched epochs before we were counted
+                if (owner.epoch.load() == e)
+                    break;
+
+                counter->fetch_sub (1);
+            }
+
+            object = owner.current.load();
+        }
+
+        ~ReadLock()
+        {
+            counter->fetch_sub (1);
+        }
+
+        const T* get() const { return object; }
+        const T* operator->() const { return object; }
+        const T& operator*() const { return *object; }
+
+    private:
+        std::atomic<int>* counter;
+        const T* object;
+
+        ReadLock (const ReadLock&) = delete;
+        ReadLock& operator= (const ReadLock&) = delete;
+    };
+
+private:
+    std::atomic<const T*> current;
+    std::atomic<int> epoch;
+    std::atomic<int> readers[2];
+    std::mutex writeLock;
+
+    RcuPointer (const RcuPointer&) = delete;
+    RcuPointer& operator= (const RcuPointer&) = delete;
+};
+
+#endif // RCUPOINTER_H_INCLUDED
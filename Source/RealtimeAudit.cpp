@@ -0,0 +1,252 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "RealtimeAudit.h"
+
+#if ZMQ_INTERFACE_RT_AUDIT
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace
+{
+const int NUM_REPORTS = 64;
+
+// state of the calling thread; plain values, so reading them never allocates
+thread_local int depth = 0;
+thread_local bool reporting = false;
+thread_local const char* entryPoint = nullptr;
+thread_local const char* currentSite = nullptr;
+thread_local const char* firstSite = nullptr;
+thread_local uint32_t blockCounts[RealtimeAudit::NUM_KINDS];
+
+std::atomic<uint64_t> numBlocks { 0 };
+std::atomic<uint64_t> numViolatingBlocks { 0 };
+std::atomic<uint64_t> totalCounts[RealtimeAudit::NUM_KINDS];
+std::atomic<uint64_t> numDroppedReports { 0 };
+
+RealtimeAudit::Report reports[NUM_REPORTS];
+std::atomic<uint32_t> reportHead { 0 }; // next to read
+std::atomic<uint32_t> reportTail { 0 }; // next to write
+
+void pushReport (const RealtimeAudit::Report& report)
+{
+    const uint32_t tail = reportTail.load (std::memory_order_relaxed);
+
+    if (tail - reportHead.load (std::memory_order_acquire) >= (uint32_t) NUM_REPORTS)
+    {
+        numDroppedReports.fetch_add (1, std::memory_order_relaxed);
+        return;
+    }
+
+    reports[tail % NUM_REPORTS] = report;
+    reportTail.store (tail + 1, std::memory_order_release);
+}
+
+void* allocate (std::size_t size)
+{
+    RealtimeAudit::note (RealtimeAudit::ALLOCATION, nullptr);
+    return std::malloc (size == 0 ? 1 : size);
+}
+
+void* allocateAligned (std::size_t size, std::size_t alignment)
+{
+    RealtimeAudit::note (RealtimeAudit::ALLOCATION, nullptr);
+#ifdef _WIN32
+    return _aligned_malloc (size == 0 ? 1 : size, alignment);
+#else
+    void* pointer = nullptr;
+    return posix_memalign (&pointer, alignment < sizeof (void*) ? sizeof (void*) : alignment, size == 0 ? 1 : size) == 0 ? pointer : nullptr;
+#endif
+}
+
+void release (void* pointer)
+{
+    if (pointer == nullptr)
+        return;
+
+    RealtimeAudit::note (RealtimeAudit::FREE, nullptr);
+    std::free (pointer);
+}
+
+void releaseAligned (void* pointer)
+{
+    if (pointer == nullptr)
+        return;
+
+    RealtimeAudit::note (RealtimeAudit::FREE, nullptr);
+#ifdef _WIN32
+    _aligned_free (pointer);
+#else
+    std::free (pointer);
+#endif
+}
+} // namespace
+
+namespace RealtimeAudit
+{
+void note (Kind kind, const char* site)
+{
+    if (depth == 0 || reporting)
+        return;
+
+    blockCounts[kind]++;
+
+    if (firstSite == nullptr)
+        firstSite = site != nullptr ? site : currentSite;
+
+#if ZMQ_INTERFACE_RT_AUDIT_ASSERT
+    reporting = true;
+    std::fprintf (stderr, "ZMQ Interface: %s on the audio thread in %s\n", getKindName (kind), firstSite);
+    std::abort();
+#endif
+}
+
+bool popReport (Report& report)
+{
+    const uint32_t head = reportHead.load (std::memory_order_relaxed);
+
+    if (head == reportTail.load (std::memory_order_acquire))
+        return false;
+
+    report = reports[head % NUM_REPORTS];
+    reportHead.store (head + 1, std::memory_order_release);
+    return true;
+}
+
+Totals getTotals()
+{
+    Totals totals;
+    totals.blocks = numBlocks.load();
+    totals.violatingBlocks = numViolatingBlocks.load();
+    totals.droppedReports = numDroppedReports.load();
+
+    for (int i = 0; i < NUM_KINDS; i++)
+        totals.counts[i] = totalCounts[i].load();
+
+    return totals;
+}
+
+const char* getKindName (Kind kind)
+{
+    static const char* names[] = { "allocation", "free", "lock", "syscall" };
+    return names[kind];
+}
+
+Scope::Scope (const char* name)
+    : previousSite (currentSite)
+{
+    if (depth++ == 0)
+    {
+        entryPoint = name;
+        firstSite = nullptr;
+
+        for (int i = 0; i < NUM_KINDS; i++)
+            blockCounts[i] = 0;
+    }
+
+    currentSite = name;
+}
+
+Scope::~Scope()
+{
+    currentSite = previousSite;
+
+    if (--depth > 0)
+        return;
+
+    numBlocks.fetch_add (1, std::memory_order_relaxed);
+
+    if (firstSite == nullptr)
+        return;
+
+    Report report;
+    report.block = numBlocks.load (std::memory_order_relaxed);
+    report.entryPoint = entryPoint;
+    report.site = firstSite;
+
+    for (int i = 0; i < NUM_KINDS; i++)
+    {
+        report.counts[i] = blockCounts[i];
+        totalCounts[i].fetch_add (blockCounts[i], std::memory_order_relaxed);
+    }
+
+    numViolatingBlocks.fetch_add (1, std::memory_order_relaxed);
+    pushReport (report);
+}
+} // namespace RealtimeAudit
+
+// the plugin's own allocations go through these while auditing
+void* operator new (std::size_t size)
+{
+    if (void* pointer = allocate (size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[] (std::size_t size)
+{
+    if (void* pointer = allocate (size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept { return allocate (size); }
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept { return allocate (size); }
+
+void operator delete (void* pointer) noexcept { release (pointer); }
+void operator delete[] (void* pointer) noexcept { release (pointer); }
+void operator delete (void* pointer, std::size_t) noexcept { release (pointer); }
+void operator delete[] (void* pointer, std::size_t) noexcept { release (pointer); }
+void operator delete (void* pointer, const std::nothrow_t&) noexcept { release (pointer); }
+void operator delete[] (void* pointer, const std::nothrow_t&) noexcept { release (pointer); }
+
+void* operator new (std::size_t size, std::align_val_t alignment)
+{
+    if (void* pointer = allocateAligned (size, (std::size_t) alignment))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[] (std::size_t size, std::align_val_t alignment)
+{
+    if (void* pointer = allocateAligned (size, (std::size_t) alignment))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete (void* pointer, std::align_val_t) noexcept { releaseAligned (pointer); }
+void operator delete[] (void* pointer, std::align_val_t) noexcept { releaseAligned (pointer); }
+void operator delete (void* pointer, std::size_t, std::align_val_t) noexcept { releaseAligned (pointer); }
+void operator delete[] (void* pointer, std::size_t, std::align_val_t) noexcept { releaseAligned (pointer); }
+
+#endif
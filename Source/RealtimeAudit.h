@@ -0,0 +1,129 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef REALTIMEAUDIT_H_INCLUDED
+#define REALTIMEAUDIT_H_INCLUDED
+
+/**
+    Debug-build auditing of what the audio thread does inside the plugin.
+
+    Built only with the CMake option ZMQ_INTERFACE_RT_AUDIT (which defines
+    ZMQ_INTERFACE_RT_AUDIT=1); otherwise the macros expand to nothing.
+
+    RT_AUDIT_SCOPE ("name") marks an audio-thread entry point (process(),
+    handleTTLEvent, handleSpike) or a site inside one. While a thread is in
+    such a scope, heap allocations through the plugin's operator new and
+    delete are counted, and so are the locks and blocking calls marked with
+    RT_AUDIT_LOCK / RT_AUDIT_SYSCALL. Allocations made inside libraries
+    (JUCE's String internals, libzmq) are not seen by the hook; the call
+    sites mark those with RT_AUDIT_ALLOCATION.
+
+    When the outermost scope ends, a block with any of these leaves a
+    Report naming the scope it first happened in; the message thread
+    collects them with popReport(). With ZMQ_INTERFACE_RT_AUDIT_ASSERT the
+    first violation aborts instead, with the offending call on the stack.
+
+    One thread at a time may run audited scopes (the GUI's processing
+    thread); reports are queued lock-free for one reader.
+*/
+
+#if ZMQ_INTERFACE_RT_AUDIT
+
+#include <cstdint>
+
+namespace RealtimeAudit
+{
+enum Kind
+{
+    ALLOCATION = 0,
+    FREE,
+    LOCK,
+    SYSCALL,
+    NUM_KINDS
+};
+
+/** What one block did that it should not have */
+struct Report
+{
+    uint64_t block;
+    const char* entryPoint;
+    const char* site;
+    uint32_t counts[NUM_KINDS];
+};
+
+/** Counts since the plugin was loaded */
+struct Totals
+{
+    uint64_t blocks;
+    uint64_t violatingBlocks;
+    uint64_t counts[NUM_KINDS];
+    uint64_t droppedReports;
+};
+
+/** Records a violation if the calling thread is inside an audited scope */
+void note (Kind kind, const char* site);
+
+/** Takes the oldest pending report; returns false if there is none */
+bool popReport (Report& report);
+
+/** Returns the counts since the plugin was loaded */
+Totals getTotals();
+
+/** Returns a readable name for a kind */
+const char* getKindName (Kind kind);
+
+class Scope
+{
+public:
+    explicit Scope (const char* name);
+    ~Scope();
+
+private:
+    const char* previousSite;
+};
+} // namespace RealtimeAudit
+
+#define RT_AUDIT_CONCAT_INNER(a, b) a##b
+#define RT_AUDIT_CONCAT(a, b) RT_AUDIT_CONCAT_INNER (a, b)
+#define RT_AUDIT_SCOPE(name) RealtimeAudit::Scope RT_AUDIT_CONCAT (realtimeAuditScope, __LINE__) (name)
+#define RT_AUDIT_ALLOCATION(site) RealtimeAudit::note (RealtimeAudit::ALLOCATION, site)
+#define RT_AUDIT_ALLOCATION_IF(condition, site) \
+    if (condition)                             \
+    RT_AUDIT_ALLOCATION (site)
+#define RT_AUDIT_LOCK(site) RealtimeAudit::note (RealtimeAudit::LOCK, site)
+#define RT_AUDIT_SYSCALL(site) RealtimeAudit::note (RealtimeAudit::SYSCALL, site)
+
+#else
+
+#define RT_AUDIT_SCOPE(name)
+#define RT_AUDIT_ALLOCATION(site)
+#define RT_AUDIT_ALLOCATION_IF(condition, site)
+#define RT_AUDIT_LOCK(site)
+#define RT_AUDIT_SYSCALL(site)
+
+#endif
+
+#endif // REALTIMEAUDIT_H_INCLUDED
@@ -0,0 +1,55 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "Rechunker.h"
+
+Rechunker::Rechunker()
+    : mode (BLOCK),
+      numChannels (0),
+      capacity (1),
+      maxLatencyMs (0.0),
+      numPending (0),
+      pendingSampleNumber (0)
+{
+}
+
+void Rechunker::prepare (Mode newMode, int newNumChannels, int chunkSamples, double newMaxLatencyMs)
+{
+    mode = newMode;
+    numChannels = std::max (0, newNumChannels);
+    capacity = std::max (1, chunkSamples);
+    maxLatencyMs = std::max (0.0, newMaxLatencyMs);
+
+    buffer.assign ((size_t) numChannels * capacity, 0.0f);
+
+    reset();
+}
+
+void Rechunker::reset()
+{
+    numPending = 0;
+    pendingSampleNumber = 0;
+}
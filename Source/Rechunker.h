@@ -0,0 +1,149 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef RECHUNKER_H_INCLUDED
+#define RECHUNKER_H_INCLUDED
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+    Regroups the samples of a set of channels into output chunks that are
+    independent of the GUI's block size.
+
+    FIXED_SIZE emits exactly chunkSamples per chunk. COALESCE collects
+    blocks until chunkSamples are buffered or the buffered samples span
+    maxLatencyMs of sample time, whichever comes first; a block that would
+    take them past the limit sends what is held first, so no sample waits
+    for a block beyond the limit. A block longer than the limit is sent
+    on its own, as soon as it arrives. A gap in the incoming
+    sample numbers flushes the pending samples as a shorter chunk, so
+    every chunk covers a contiguous range.
+
+    Storage is allocated in prepare() only.
+*/
+class Rechunker
+{
+public:
+    enum Mode
+    {
+        BLOCK = 0,
+        FIXED_SIZE,
+        COALESCE
+    };
+
+    /** Constructor */
+    Rechunker();
+
+    /** Allocates buffers for a new configuration; pending samples are discarded */
+    void prepare (Mode mode, int numChannels, int chunkSamples, double maxLatencyMs);
+
+    /** Discards pending samples */
+    void reset();
+
+    /** Returns the current mode */
+    Mode getMode() const { return mode; }
+
+    /** Returns the number of channels */
+    int getNumChannels() const { return numChannels; }
+
+    /** Returns the number of samples waiting for the next chunk */
+    int getNumPendingSamples() const { return numPending; }
+
+    /** Returns the buffered samples of one channel (valid inside the chunk callback) */
+    const float* getChannelData (int channelIndex) const { return buffer.data() + (size_t) channelIndex * capacity; }
+
+    /** Adds a block of samples for all channels. onChunk (int64_t sampleNumber, int numSamples)
+        is called for every completed chunk; read the samples with getChannelData() */
+    template <typename Callback>
+    void addBlock (const float* const* channels, int numSamples, int64_t firstSampleNumber, double sampleRate, Callback&& onChunk)
+    {
+        const int latencySamples = getLatencySamples (sampleRate);
+
+        if (numPending > 0 && (firstSampleNumber != pendingSampleNumber + numPending || numPending + numSamples > latencySamples))
+            flush (onChunk);
+
+        int offset = 0;
+
+        while (offset < numSamples)
+        {
+            if (numPending == 0)
+                pendingSampleNumber = firstSampleNumber + offset;
+
+            const int count = std::min (numSamples - offset, capacity - numPending);
+
+            for (int ch = 0; ch < numChannels; ch++)
+                std::memcpy (buffer.data() + (size_t) ch * capacity + numPending,
+                             channels[ch] + offset,
+                             sizeof (float) * count);
+
+            numPending += count;
+            offset += count;
+
+            if (numPending == capacity)
+                flush (onChunk);
+        }
+
+        if (numPending >= latencySamples)
+            flush (onChunk);
+    }
+
+    /** Emits the pending samples as a (possibly short) chunk */
+    template <typename Callback>
+    void flush (Callback&& onChunk)
+    {
+        if (numPending == 0)
+            return;
+
+        onChunk (pendingSampleNumber, numPending);
+        numPending = 0;
+    }
+
+private:
+    /** Samples that span maxLatencyMs in COALESCE mode (at least one), no limit otherwise */
+    int getLatencySamples (double sampleRate) const
+    {
+        if (mode != COALESCE || sampleRate <= 0.0)
+            return capacity;
+
+        return std::max (1, (int) std::min ((double) capacity, std::floor (maxLatencyMs * sampleRate / 1000.0)));
+    }
+
+    Mode mode;
+    int numChannels;
+    int capacity;
+    double maxLatencyMs;
+
+    std::vector<float> buffer;
+
+    int numPending;
+    int64_t pendingSampleNumber;
+};
+
+#endif // RECHUNKER_H_INCLUDED
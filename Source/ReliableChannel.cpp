@@ -0,0 +1,779 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ReliableChannel.h"
+#include "BlockEncoder.h"
+
+#include <ProcessorHeaders.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <zmq.h>
+
+// messages waiting between publish() and the channel thread, and the bytes they may hold
+const size_t INCOMING_QUEUE_SIZE = 16384;
+const size_t INCOMING_RING_BYTES = 16 * 1024 * 1024;
+
+// blocks in flight or waiting for adaptive consumers; each keeps room for this many
+// channel numbers and stream name characters, so filling one does not allocate
+const size_t BLOCK_POOL_SIZE = 256;
+const size_t RESERVED_BLOCK_CHANNELS = 1024;
+const size_t RESERVED_STREAM_NAME = 256;
+
+// decimation and encoding of the adaptive tiers
+static const int tierDecimation[] = { 1, 1, 4, 16 };
+static const BlockEncoder::Encoding tierEncoding[] = { BlockEncoder::FLOAT32, BlockEncoder::INT16, BlockEncoder::INT16, BlockEncoder::INT16 };
+
+// an adaptive consumer moves down a tier when more blocks than this wait for its credit,
+// and back up after this many blocks in a row found nothing waiting
+const int TIER_DOWN_BACKLOG = 4;
+const int TIER_UP_BLOCKS = 200;
+
+// blocks kept for an adaptive consumer before the oldest is dropped
+const int MAX_ADAPTIVE_BACKLOG = 32;
+
+// a consumer is asked for credit when its backlog passes this share of its limit, or the
+// whole buffer passes BUFFER_CONGESTED; it is asked again once both fall below half of that
+const double CONSUMER_CONGESTED = 0.5;
+const double BUFFER_CONGESTED = 0.75;
+
+static int64_t currentTimeMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ReliableChannel::ReliableChannel()
+    : socket (nullptr),
+      running (false),
+      shouldExit (false),
+      dataTopic (-1),
+      blockTopic (-1),
+      blockSequence (0),
+      maxBufferedBytes (0),
+      incoming (INCOMING_QUEUE_SIZE),
+      incomingBlocks (BLOCK_POOL_SIZE + 1),
+      ring (new uint8_t[INCOMING_RING_BYTES]),
+      ringWrite (0),
+      ringRead (0),
+      ringReleased (0),
+      freeBlocks (BLOCK_POOL_SIZE + 1),
+      numAdaptiveConsumers (0),
+      bufferedBytes (0),
+      droppedAtInput (0),
+      numConsumers (0)
+{
+    for (size_t i = 0; i < BLOCK_POOL_SIZE; i++)
+    {
+        blockPool.emplace_back (new Block());
+
+        Block* block = blockPool.back().get();
+        block->channelNumbers.reserve (RESERVED_BLOCK_CHANNELS);
+        block->streamName.reserve (RESERVED_STREAM_NAME);
+        freeBlocks.push (block);
+    }
+
+    tierFormat.channels.reserve (RESERVED_BLOCK_CHANNELS);
+}
+
+ReliableChannel::~ReliableChannel()
+{
+    stop();
+}
+
+bool ReliableChannel::start (void* context,
+                             const std::string& endpoint,
+                             size_t maxBytes,
+                             const std::vector<std::string>& topics)
+{
+    stop();
+
+    socket = zmq_socket (context, ZMQ_ROUTER);
+    if (socket == nullptr)
+        return false;
+
+    // fail instead of silently discarding messages to vanished peers
+    int mandatory = 1;
+    zmq_setsockopt (socket, ZMQ_ROUTER_MANDATORY, &mandatory, sizeof (mandatory));
+
+    int linger = 0;
+    zmq_setsockopt (socket, ZMQ_LINGER, &linger, sizeof (linger));
+
+    if (zmq_bind (socket, endpoint.c_str()) != 0)
+    {
+        zmq_close (socket);
+        socket = nullptr;
+        return false;
+    }
+
+    topicNames = topics;
+    dataTopic = (int) (std::find (topicNames.begin(), topicNames.end(), "DATA") - topicNames.begin());
+    blockTopic = (int) topicNames.size();
+    topicNames.push_back ("BLOCK");
+    blockSequence = 0;
+    maxBufferedBytes = maxBytes;
+    bufferedBytes.store (0);
+    droppedAtInput.store (0);
+    numConsumers.store (0);
+
+    shouldExit.store (false);
+    running.store (true);
+    thread = std::thread ([this]
+                          { run(); });
+
+    return true;
+}
+
+void ReliableChannel::stop()
+{
+    if (! thread.joinable())
+        return;
+
+    shouldExit.store (true);
+    thread.join();
+
+    consumers.clear();
+
+    // the channel thread has finished, so this thread consumes in its place
+    Incoming message;
+    while (incoming.pop (message))
+    {
+        ringRead += message.size;
+        ringReleased.store (ringRead, std::memory_order_release);
+    }
+
+    Block* block;
+    while (incomingBlocks.pop (block))
+        recycleBlock (block);
+
+    zmq_close (socket);
+    socket = nullptr;
+
+    bufferedBytes.store (0);
+    numConsumers.store (0);
+    numAdaptiveConsumers.store (0);
+    running.store (false);
+
+    std::lock_guard<std::mutex> lock (statsLock);
+    stats = Stats();
+}
+
+void ReliableChannel::publish (int topic, uint64_t sequence, const Part* parts, int numParts)
+{
+    if (! running.load (std::memory_order_relaxed) || numConsumers.load (std::memory_order_relaxed) == 0)
+        return;
+
+    size_t size = 0;
+    for (int i = 0; i < numParts; i++)
+        size += parts[i].size;
+
+    // a dropped message leaves a hole in the topic's sequence numbers, which the
+    // channel thread reports to the topic's consumers as a gap
+    const size_t ringFree = INCOMING_RING_BYTES - (ringWrite - ringReleased.load (std::memory_order_acquire));
+
+    if (numParts > MAX_PARTS || size > ringFree || bufferedBytes.load (std::memory_order_relaxed) + size > maxBufferedBytes)
+    {
+        droppedAtInput.fetch_add (1, std::memory_order_relaxed);
+        return;
+    }
+
+    Incoming message;
+    message.topic = topic;
+    message.sequence = sequence;
+    message.size = size;
+    message.numParts = numParts;
+
+    size_t position = ringWrite;
+    for (int i = 0; i < numParts; i++)
+    {
+        writeRing (position, parts[i].data, parts[i].size);
+        message.partSizes[i] = parts[i].size;
+        position += parts[i].size;
+    }
+
+    bufferedBytes.fetch_add (size, std::memory_order_relaxed);
+
+    if (! incoming.push (message))
+    {
+        bufferedBytes.fetch_sub (size, std::memory_order_relaxed);
+        droppedAtInput.fetch_add (1, std::memory_order_relaxed);
+        return;
+    }
+
+    ringWrite = position;
+}
+
+void ReliableChannel::publishBlock (EncodingCache& cache,
+                                    const BlockEncoder::Format& format,
+                                    const uint32_t* channelNumbers,
+                                    float sampleRate,
+                                    const std::string& streamName)
+{
+    if (! running.load (std::memory_order_relaxed) || numAdaptiveConsumers.load (std::memory_order_relaxed) == 0)
+        return;
+
+    const size_t size = sizeof (float) * format.channels.size() * (size_t) cache.getNumSamples();
+
+    // numbered here, so a block dropped before the channel thread leaves a gap in the sequence
+    const uint64_t sequence = ++blockSequence;
+    Block* block = nullptr;
+
+    if (bufferedBytes.load (std::memory_order_relaxed) + size > maxBufferedBytes || ! freeBlocks.pop (block))
+    {
+        droppedAtInput.fetch_add (1, std::memory_order_relaxed);
+        return;
+    }
+
+    block->sequence = sequence;
+    block->sampleNumber = cache.getSampleNumber();
+    block->numSamples = cache.getNumSamples();
+    block->sampleRate = sampleRate;
+    block->streamName = streamName;
+    block->channelNumbers.assign (channelNumbers, channelNumbers + format.channels.size());
+
+    tierFormat.channels = format.channels;
+
+    for (int tier = 0; tier < NUM_TIERS; tier++)
+    {
+        tierFormat.decimation = tierDecimation[tier];
+        tierFormat.encoding = tierEncoding[tier];
+
+        block->tiers[tier] = tier == 0 ? cache.get (tierFormat) : cache.find (tierFormat);
+    }
+
+    bufferedBytes.fetch_add (size, std::memory_order_relaxed);
+
+    // the queue has room for the whole pool, so a block taken from it always fits; there is
+    // no failure path, since only the channel thread may return blocks to freeBlocks
+    const bool queued = incomingBlocks.push (block);
+    jassert (queued);
+    (void) queued;
+}
+
+void ReliableChannel::recycleBlock (Block* block)
+{
+    // release the encodings now rather than when the block is next used
+    for (int tier = 0; tier < NUM_TIERS; tier++)
+    {
+        block->tiers[tier] = nullptr;
+        block->encoded[tier] = nullptr;
+    }
+
+    freeBlocks.push (block);
+}
+
+void ReliableChannel::writeRing (size_t position, const void* data, size_t size)
+{
+    const size_t start = position % INCOMING_RING_BYTES;
+    const size_t first = std::min (size, INCOMING_RING_BYTES - start);
+
+    if (first > 0)
+        std::memcpy (ring.get() + start, data, first);
+
+    if (size > first)
+        std::memcpy (ring.get(), (const uint8_t*) data + first, size - first);
+}
+
+void ReliableChannel::readRing (size_t position, void* data, size_t size) const
+{
+    const size_t start = position % INCOMING_RING_BYTES;
+    const size_t first = std::min (size, INCOMING_RING_BYTES - start);
+
+    if (first > 0)
+        std::memcpy (data, ring.get() + start, first);
+
+    if (size > first)
+        std::memcpy ((uint8_t*) data + first, ring.get(), size - first);
+}
+
+ReliableChannel::Stats ReliableChannel::getStats() const
+{
+    std::lock_guard<std::mutex> lock (statsLock);
+    return stats;
+}
+
+void ReliableChannel::run()
+{
+    int64_t lastStatsMs = 0;
+
+    while (! shouldExit.load())
+    {
+        zmq_pollitem_t item = { socket, 0, ZMQ_POLLIN, 0 };
+        zmq_poll (&item, 1, 1);
+
+        const int64_t nowMs = currentTimeMs();
+
+        receiveRequests (nowMs);
+        distributeBlocks();
+        distribute();
+        sendToConsumers();
+
+        for (auto it = consumers.begin(); it != consumers.end();)
+        {
+            if (nowMs - it->second.lastSeenMs > CONSUMER_TIMEOUT_MS)
+                it = consumers.erase (it);
+            else
+                ++it;
+        }
+
+        int adaptive = 0;
+        for (auto& entry : consumers)
+            adaptive += entry.second.adaptive ? 1 : 0;
+
+        numConsumers.store ((int) consumers.size());
+        numAdaptiveConsumers.store (adaptive);
+
+        if (nowMs - lastStatsMs >= 100)
+        {
+            updateStats();
+            lastStatsMs = nowMs;
+        }
+    }
+}
+
+void ReliableChannel::receiveRequests (int64_t nowMs)
+{
+    char identity[256];
+    char request[4096];
+
+    while (true)
+    {
+        int identitySize = zmq_recv (socket, identity, sizeof (identity), ZMQ_DONTWAIT);
+        if (identitySize < 0)
+            return;
+
+        int more = 0;
+        size_t moreSize = sizeof (more);
+        zmq_getsockopt (socket, ZMQ_RCVMORE, &more, &moreSize);
+
+        int requestSize = 0;
+        while (more)
+        {
+            // keep the first frame, discard any others
+            int size = zmq_recv (socket, request, sizeof (request) - 1, 0);
+            if (requestSize == 0 && size > 0)
+                requestSize = jmin (size, (int) sizeof (request) - 1);
+            zmq_getsockopt (socket, ZMQ_RCVMORE, &more, &moreSize);
+        }
+        request[requestSize] = 0;
+
+        var v;
+        if (JSON::parse (String (request), v).failed())
+            continue;
+
+        const std::string id (identity, (size_t) jmin (identitySize, (int) sizeof (identity)));
+        const String type = v["type"].toString();
+
+        if (type == "bye")
+        {
+            consumers.erase (id);
+            continue;
+        }
+
+        auto found = consumers.find (id);
+
+        if (found == consumers.end())
+        {
+            Consumer consumer;
+            consumer.identity = id;
+            consumer.topics.assign (topicNames.size(), true);
+            consumer.nextSequences.assign (topicNames.size(), 0);
+            found = consumers.emplace (id, std::move (consumer)).first;
+        }
+
+        Consumer& consumer = found->second;
+        consumer.lastSeenMs = nowMs;
+
+        if (type == "hello")
+        {
+            consumer.name = v["application"].toString().toStdString();
+            consumer.adaptive = v["mode"].toString() == "adaptive";
+
+            // what it receives changes, so sequence numbers are followed afresh
+            consumer.nextSequences.assign (topicNames.size(), 0);
+
+            if (const Array<var>* topics = v["topics"].getArray())
+            {
+                consumer.topics.assign (topicNames.size(), false);
+
+                for (auto& topic : *topics)
+                    for (size_t i = 0; i < topicNames.size(); i++)
+                        if (topic.toString() == String (topicNames[i]))
+                            consumer.topics[i] = true;
+            }
+        }
+
+        consumer.credit += jmax ((int64) 0, (int64) v.getProperty ("credit", 0));
+    }
+}
+
+void ReliableChannel::distribute()
+{
+    const size_t consumerLimit = maxBufferedBytes / 2;
+
+    Incoming next;
+    while (incoming.pop (next))
+    {
+        // the channel thread's own copy frees the ring for the processing thread
+        Message* raw = new Message();
+        raw->topic = next.topic;
+        raw->sequence = next.sequence;
+        raw->bytes.resize (next.size);
+        raw->partSizes.assign (next.partSizes, next.partSizes + next.numParts);
+
+        readRing (ringRead, raw->bytes.data(), next.size);
+        ringRead += next.size;
+        ringReleased.store (ringRead, std::memory_order_release);
+
+        size_t size = next.size;
+        std::atomic<size_t>& buffered = bufferedBytes;
+
+        // released when the last consumer has sent it
+        std::shared_ptr<const Message> message (raw, [&buffered, size] (const Message* m)
+                                                {
+                                                    buffered.fetch_sub (size, std::memory_order_relaxed);
+                                                    delete m;
+                                                });
+
+        for (auto& entry : consumers)
+        {
+            Consumer& consumer = entry.second;
+
+            if (message->topic < 0 || message->topic >= (int) consumer.topics.size() || ! consumer.topics[(size_t) message->topic])
+                continue;
+
+            // adaptive consumers get continuous data as blocks
+            if (consumer.adaptive && message->topic == dataTopic)
+                continue;
+
+            checkSequence (consumer, message->topic, message->sequence);
+
+            if (consumer.queuedBytes + size > consumerLimit)
+            {
+                consumer.dropped++;
+                addGap (consumer, message->topic, message->sequence, message->sequence);
+                continue;
+            }
+
+            consumer.queue.push_back ({ message, nullptr });
+            consumer.queuedBytes += size;
+        }
+    }
+}
+
+void ReliableChannel::distributeBlocks()
+{
+    Block* raw;
+    while (incomingBlocks.pop (raw))
+    {
+        const size_t size = sizeof (float) * raw->channelNumbers.size() * (size_t) raw->numSamples;
+
+        // returned to the pool when the last consumer has sent it
+        std::shared_ptr<Block> block (raw, [this, size] (Block* b)
+                                      {
+                                          bufferedBytes.fetch_sub (size, std::memory_order_relaxed);
+                                          recycleBlock (b);
+                                      });
+
+        for (auto& entry : consumers)
+        {
+            Consumer& consumer = entry.second;
+
+            if (! consumer.adaptive || (dataTopic < (int) consumer.topics.size() && ! consumer.topics[(size_t) dataTopic]))
+                continue;
+
+            checkSequence (consumer, blockTopic, block->sequence);
+
+            // move down a tier while blocks pile up, back up after a calm period
+            if (consumer.queuedBlocks > TIER_DOWN_BACKLOG && consumer.tier < NUM_TIERS - 1)
+            {
+                consumer.tier++;
+                consumer.calmBlocks = 0;
+            }
+            else if (consumer.queuedBlocks == 0 && consumer.tier > 0 && ++consumer.calmBlocks >= TIER_UP_BLOCKS)
+            {
+                consumer.tier--;
+                consumer.calmBlocks = 0;
+            }
+            else if (consumer.queuedBlocks > 0)
+            {
+                consumer.calmBlocks = 0;
+            }
+
+            if (consumer.queuedBlocks >= MAX_ADAPTIVE_BACKLOG)
+            {
+                // drop the oldest whole block rather than part of one
+                for (auto it = consumer.queue.begin(); it != consumer.queue.end(); ++it)
+                {
+                    if (it->block == nullptr)
+                        continue;
+
+                    addGap (consumer, blockTopic, it->block->sequence, it->block->sequence);
+
+                    consumer.queue.erase (it);
+                    consumer.queuedBlocks--;
+                    consumer.dropped++;
+                    break;
+                }
+            }
+
+            consumer.queue.push_back ({ nullptr, block });
+            consumer.queuedBlocks++;
+        }
+    }
+}
+
+const ReliableChannel::Message& ReliableChannel::getEncodedBlock (Block& block, int tier)
+{
+    if (block.encoded[tier] != nullptr)
+        return *block.encoded[tier];
+
+    BlockEncoder::Format format;
+    format.decimation = tierDecimation[tier];
+    format.encoding = tierEncoding[tier];
+
+    if (block.tiers[tier] == nullptr)
+    {
+        std::shared_ptr<EncodingCache::Buffer> buffer = std::make_shared<EncodingCache::Buffer>();
+        buffer->numOutputSamples = BlockEncoder::getNumOutputSamples (block.numSamples, format.decimation);
+        buffer->numOutputChannels = (int) block.channelNumbers.size();
+        buffer->format = format;
+
+        const float* samples = (const float*) block.tiers[0]->data.data();
+        BlockEncoder::encode (samples, buffer->numOutputChannels, block.numSamples, format, buffer->data, buffer->scales);
+
+        block.tiers[tier] = buffer;
+    }
+
+    const std::vector<uint8_t>& data = block.tiers[tier]->data;
+    const std::vector<float>& scales = block.tiers[tier]->scales;
+
+    Array<var> channels;
+    for (auto channel : block.channelNumbers)
+        channels.add ((int) channel);
+
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty ("type", "block");
+    obj->setProperty ("seq", (int64) block.sequence);
+    obj->setProperty ("stream", String (block.streamName));
+    obj->setProperty ("sample_num", block.sampleNumber);
+    obj->setProperty ("num_samples", block.numSamples);
+    obj->setProperty ("num_output_samples", BlockEncoder::getNumOutputSamples (block.numSamples, format.decimation));
+    obj->setProperty ("decimation", format.decimation);
+    obj->setProperty ("sample_rate", block.sampleRate / format.decimation);
+    obj->setProperty ("encoding", BlockEncoder::getEncodingName (format.encoding));
+    obj->setProperty ("channels", channels);
+    obj->setProperty ("tier", tier);
+    obj->setProperty ("data_size", (int) data.size());
+
+    const String header = JSON::toString (var (obj));
+
+    Message* message = new Message();
+    message->topic = blockTopic;
+    message->sequence = block.sequence;
+
+    const size_t headerSize = header.getNumBytesAsUTF8();
+    const size_t scalesSize = scales.size() * sizeof (float);
+
+    // envelope, header, samples, then per-channel scales for int16
+    message->bytes.resize (6 + headerSize + data.size() + scalesSize);
+    message->partSizes = { 6, headerSize, data.size() };
+    if (scalesSize > 0)
+        message->partSizes.push_back (scalesSize);
+
+    uint8_t* dest = message->bytes.data();
+    std::memcpy (dest, "BLOCK", 6);
+    std::memcpy (dest + 6, header.toRawUTF8(), headerSize);
+    std::memcpy (dest + 6 + headerSize, data.data(), data.size());
+    if (scalesSize > 0)
+        std::memcpy (dest + 6 + headerSize + data.size(), scales.data(), scalesSize);
+
+    block.encoded[tier].reset (message);
+    return *message;
+}
+
+void ReliableChannel::addGap (Consumer& consumer, int topic, uint64_t first, uint64_t last)
+{
+    auto gap = consumer.gaps.find (topic);
+    if (gap == consumer.gaps.end())
+        consumer.gaps[topic] = { first, last };
+    else
+        gap->second.second = last;
+}
+
+void ReliableChannel::checkSequence (Consumer& consumer, int topic, uint64_t sequence)
+{
+    uint64_t& expected = consumer.nextSequences[(size_t) topic];
+
+    // messages the consumer would have had that never reached the channel
+    if (expected != 0 && sequence > expected)
+    {
+        consumer.dropped += sequence - expected;
+        addGap (consumer, topic, expected, sequence - 1);
+    }
+
+    expected = sequence + 1;
+}
+
+bool ReliableChannel::sendGapNotice (Consumer& consumer)
+{
+    for (auto& gap : consumer.gaps)
+    {
+        DynamicObject::Ptr obj = new DynamicObject();
+        obj->setProperty ("type", "gap");
+        obj->setProperty ("topic", String (topicNames[(size_t) gap.first]));
+        obj->setProperty ("first_seq", (int64) gap.second.first);
+        obj->setProperty ("last_seq", (int64) gap.second.second);
+
+        String notice = JSON::toString (var (obj));
+
+        if (zmq_send (socket, consumer.identity.data(), consumer.identity.size(), ZMQ_SNDMORE | ZMQ_DONTWAIT) < 0)
+            return false;
+
+        zmq_send (socket, "GAP", 4, ZMQ_SNDMORE);
+        zmq_send (socket, notice.toRawUTF8(), notice.getNumBytesAsUTF8(), 0);
+    }
+
+    consumer.gaps.clear();
+    return true;
+}
+
+void ReliableChannel::updateBackpressure (Consumer& consumer, bool& unreachable)
+{
+    const size_t consumerLimit = maxBufferedBytes / 2;
+    const double consumerUse = consumerLimit > 0 ? (double) consumer.queuedBytes / consumerLimit : 0.0;
+    const double bufferUse = maxBufferedBytes > 0 ? (double) bufferedBytes.load (std::memory_order_relaxed) / maxBufferedBytes : 0.0;
+
+    if (consumer.congested)
+    {
+        consumer.congested = consumerUse >= CONSUMER_CONGESTED / 2 || (bufferUse >= BUFFER_CONGESTED / 2 && consumer.queuedBytes > 0);
+        return;
+    }
+
+    if (consumerUse < CONSUMER_CONGESTED && (bufferUse < BUFFER_CONGESTED || consumer.queuedBytes == 0))
+        return;
+
+    // ask for credit while there is still room, instead of only reporting the gap afterwards
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty ("type", "backpressure");
+    obj->setProperty ("queued_messages", (int64) consumer.queue.size());
+    obj->setProperty ("queued_bytes", (int64) consumer.queuedBytes);
+    obj->setProperty ("limit_bytes", (int64) consumerLimit);
+    obj->setProperty ("buffer_use", bufferUse);
+
+    String notice = JSON::toString (var (obj));
+
+    if (zmq_send (socket, consumer.identity.data(), consumer.identity.size(), ZMQ_SNDMORE | ZMQ_DONTWAIT) < 0)
+    {
+        // EAGAIN: retried on the next pass
+        unreachable = zmq_errno() == EHOSTUNREACH;
+        return;
+    }
+
+    zmq_send (socket, "BACKPRESSURE", 13, ZMQ_SNDMORE);
+    zmq_send (socket, notice.toRawUTF8(), notice.getNumBytesAsUTF8(), 0);
+    consumer.congested = true;
+}
+
+void ReliableChannel::sendToConsumers()
+{
+    for (auto it = consumers.begin(); it != consumers.end();)
+    {
+        Consumer& consumer = it->second;
+        bool unreachable = false;
+
+        // the gap is reported once the consumer has caught up with what was kept
+        if (! consumer.gaps.empty() && consumer.queue.empty())
+            unreachable = ! sendGapNotice (consumer) && zmq_errno() == EHOSTUNREACH;
+
+        while (! unreachable && consumer.credit > 0 && ! consumer.queue.empty())
+        {
+            const Pending& pending = consumer.queue.front();
+            const Message& message = pending.block != nullptr ? getEncodedBlock (*pending.block, consumer.tier)
+                                                               : *pending.message;
+
+            if (zmq_send (socket, consumer.identity.data(), consumer.identity.size(), ZMQ_SNDMORE | ZMQ_DONTWAIT) < 0)
+            {
+                // EAGAIN: the peer's pipe is full, retry on the next pass
+                unreachable = zmq_errno() == EHOSTUNREACH;
+                break;
+            }
+
+            size_t offset = 0;
+            for (size_t i = 0; i < message.partSizes.size(); i++)
+            {
+                zmq_send (socket, message.bytes.data() + offset, message.partSizes[i], i + 1 < message.partSizes.size() ? ZMQ_SNDMORE : 0);
+                offset += message.partSizes[i];
+            }
+
+            if (pending.block != nullptr)
+                consumer.queuedBlocks--;
+            else
+                consumer.queuedBytes -= message.bytes.size();
+
+            consumer.queue.pop_front();
+            consumer.credit--;
+            consumer.sent++;
+        }
+
+        if (! unreachable)
+            updateBackpressure (consumer, unreachable);
+
+        if (unreachable)
+            it = consumers.erase (it);
+        else
+            ++it;
+    }
+}
+
+void ReliableChannel::updateStats()
+{
+    Stats snapshot;
+    snapshot.bufferedBytes = bufferedBytes.load();
+    snapshot.maxBufferedBytes = maxBufferedBytes;
+    snapshot.droppedAtInput = droppedAtInput.load();
+
+    for (auto& entry : consumers)
+    {
+        const Consumer& consumer = entry.second;
+
+        ConsumerStats c;
+        c.name = consumer.name;
+        c.credit = consumer.credit;
+        c.queuedMessages = consumer.queue.size();
+        c.queuedBytes = consumer.queuedBytes;
+        c.sent = consumer.sent;
+        c.dropped = consumer.dropped;
+        c.overflowing = ! consumer.gaps.empty();
+        c.adaptive = consumer.adaptive;
+        c.tier = consumer.tier;
+
+        snapshot.consumers.push_back (c);
+    }
+
+    std::lock_guard<std::mutex> lock (statsLock);
+    stats = std::move (snapshot);
+}
@@ -0,0 +1,279 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef RELIABLECHANNEL_H_INCLUDED
+#define RELIABLECHANNEL_H_INCLUDED
+
+#include "EncodingCache.h"
+#include "SpscQueue.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+    Lossless delivery of published messages to consumers that must not
+    miss data (recorders, offline-equivalent decoders).
+
+    Consumers connect a DEALER socket to the channel's ROUTER and grant
+    credit: each message sent uses one credit, and nothing is sent to a
+    consumer without credit. Messages a consumer has no credit for are
+    buffered for it, up to half of the memory bound. When a consumer's
+    backlog passes half of that, or the whole buffer is three quarters
+    full while it holds messages, it is sent a BACKPRESSURE notice asking
+    for credit. Beyond the bound the consumer is reported as overflowing
+    in the metrics and told about the gap, instead of messages vanishing
+    silently as they do on PUB when the high water mark is reached.
+    Messages dropped before they reach the channel (buffer or queue full)
+    leave a hole in their topic's sequence numbers, which is reported to
+    every consumer of the topic as a gap as well.
+
+    Consumer protocol (one JSON frame per message):
+      {"type": "hello", "application": name, "credit": n, "topics": [...],
+       "mode": "reliable"|"adaptive"}
+      {"type": "credit", "credit": n}      grants n more messages
+      {"type": "bye"}
+    Notices from the channel (envelope frame, then one JSON frame; they use no credit):
+      GAP           {"type": "gap", "topic": name, "first_seq": a, "last_seq": b}
+      BACKPRESSURE  {"type": "backpressure", "queued_messages": n, "queued_bytes": b,
+                     "limit_bytes": l, "buffer_use": 0..1}
+    Consumers that send nothing for CONSUMER_TIMEOUT_MS are released.
+
+    Adaptive consumers get continuous data as one BLOCK message per block
+    with all channels, instead of one DATA message per channel, so what
+    they receive is always complete. When blocks pile up waiting for their
+    credit they are moved to a cheaper tier (int16, then decimated); after
+    a sustained period without backlog they move back up. If even the
+    cheapest tier backs up, whole blocks are dropped and reported as a gap.
+
+    The channel runs its own thread, which owns the ROUTER socket.
+    publish() is called from the processing thread; it copies the message
+    once into a preallocated ring and hands it over through a lock-free
+    queue. publishBlock() takes a block from a preallocated pool and hands
+    over references to the block's shared encodings instead of copying it.
+    Neither allocates.
+*/
+class ReliableChannel
+{
+public:
+    /** Consumers that send nothing (credit or hello) for this long are released */
+    static const int CONSUMER_TIMEOUT_MS = 10000;
+
+    /** Number of adaptive tiers; tier 0 is full resolution */
+    static const int NUM_TIERS = 4;
+
+    /** Most frames in one published message */
+    static const int MAX_PARTS = 8;
+
+    /** Constructor */
+    ReliableChannel();
+
+    /** Destructor, stops the channel */
+    ~ReliableChannel();
+
+    /** Binds a ROUTER socket to endpoint and starts the channel thread */
+    bool start (void* context,
+                const std::string& endpoint,
+                size_t maxBufferedBytes,
+                const std::vector<std::string>& topicNames);
+
+    /** Stops the thread and closes the socket */
+    void stop();
+
+    /** True while the channel thread runs */
+    bool isRunning() const { return running.load(); }
+
+    struct Part
+    {
+        const void* data;
+        size_t size;
+    };
+
+    /** Queues one published message (envelope, header, data frames) for all consumers */
+    void publish (int topic, uint64_t sequence, const Part* parts, int numParts);
+
+    /** Queues the cache's current block, restricted to format.channels, for adaptive consumers.
+        Tiers the cache already holds are reused, the others are encoded on the channel thread */
+    void publishBlock (EncodingCache& cache,
+                       const BlockEncoder::Format& format,
+                       const uint32_t* channelNumbers,
+                       float sampleRate,
+                       const std::string& streamName);
+
+    /** True if any adaptive consumer is connected */
+    bool hasAdaptiveConsumers() const { return numAdaptiveConsumers.load (std::memory_order_relaxed) > 0; }
+
+    struct ConsumerStats
+    {
+        std::string name;
+        int64_t credit = 0;
+        size_t queuedMessages = 0;
+        size_t queuedBytes = 0;
+        uint64_t sent = 0;
+        uint64_t dropped = 0;
+        bool overflowing = false;
+        bool adaptive = false;
+        int tier = 0;
+    };
+
+    struct Stats
+    {
+        size_t bufferedBytes = 0;
+        size_t maxBufferedBytes = 0;
+        uint64_t droppedAtInput = 0;
+        std::vector<ConsumerStats> consumers;
+    };
+
+    /** Returns a snapshot of the channel state (refreshed a few times per second) */
+    Stats getStats() const;
+
+private:
+    /** A published message in the incoming queue; its bytes are in the ring, in queue order */
+    struct Incoming
+    {
+        int topic;
+        uint64_t sequence;
+        size_t size;
+        int numParts;
+        size_t partSizes[MAX_PARTS];
+    };
+
+    struct Message
+    {
+        int topic;
+        uint64_t sequence;
+        std::vector<uint8_t> bytes;
+        std::vector<size_t> partSizes;
+    };
+
+    struct Block
+    {
+        uint64_t sequence;
+        int64_t sampleNumber;
+        int numSamples;
+        float sampleRate;
+        std::string streamName;
+        std::vector<uint32_t> channelNumbers;
+
+        /** Samples per tier; tier 0 is always present, the others if they were already encoded */
+        EncodingCache::BufferPtr tiers[NUM_TIERS];
+
+        /** Messages built once per tier, on first use */
+        std::shared_ptr<const Message> encoded[NUM_TIERS];
+    };
+
+    struct Pending
+    {
+        std::shared_ptr<const Message> message;
+        std::shared_ptr<Block> block;
+    };
+
+    struct Consumer
+    {
+        std::string identity;
+        std::string name;
+        std::vector<bool> topics;
+        int64_t credit = 0;
+        std::deque<Pending> queue;
+        size_t queuedBytes = 0;
+        bool adaptive = false;
+        int tier = 0;
+        int queuedBlocks = 0;
+        int calmBlocks = 0;
+        uint64_t sent = 0;
+        uint64_t dropped = 0;
+        int64_t lastSeenMs = 0;
+
+        /** Set once a BACKPRESSURE notice was sent, until the backlog has drained */
+        bool congested = false;
+
+        /** Sequence number expected next per topic, 0 before the first message */
+        std::vector<uint64_t> nextSequences;
+
+        /** First and last sequence number dropped per topic since the last gap notice */
+        std::map<int, std::pair<uint64_t, uint64_t>> gaps;
+    };
+
+    void run();
+    void receiveRequests (int64_t nowMs);
+    void distribute();
+    void distributeBlocks();
+    void sendToConsumers();
+    const Message& getEncodedBlock (Block& block, int tier);
+    void recycleBlock (Block* block);
+    void writeRing (size_t position, const void* data, size_t size);
+    void readRing (size_t position, void* data, size_t size) const;
+    void addGap (Consumer& consumer, int topic, uint64_t first, uint64_t last);
+    void checkSequence (Consumer& consumer, int topic, uint64_t sequence);
+    bool sendGapNotice (Consumer& consumer);
+    void updateBackpressure (Consumer& consumer, bool& unreachable);
+    void updateStats();
+
+    void* socket;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<bool> shouldExit;
+
+    std::vector<std::string> topicNames;
+    int dataTopic;
+    int blockTopic;
+    uint64_t blockSequence;
+    size_t maxBufferedBytes;
+
+    SpscQueue<Incoming> incoming;
+    SpscQueue<Block*> incomingBlocks;
+
+    /** Bytes of the incoming messages; positions count all bytes ever written and read */
+    std::unique_ptr<uint8_t[]> ring;
+    size_t ringWrite;
+    size_t ringRead;
+    std::atomic<size_t> ringReleased;
+
+    /** Blocks not in use, returned by the channel thread */
+    std::vector<std::unique_ptr<Block>> blockPool;
+    SpscQueue<Block*> freeBlocks;
+
+    /** publishBlock()'s format of the tier being looked up, reused so it does not allocate */
+    BlockEncoder::Format tierFormat;
+    std::atomic<int> numAdaptiveConsumers;
+    std::atomic<size_t> bufferedBytes;
+    std::atomic<uint64_t> droppedAtInput;
+    std::atomic<int> numConsumers;
+
+    std::map<std::string, Consumer> consumers;
+
+    mutable std::mutex statsLock;
+    Stats stats;
+};
+
+#endif // RELIABLECHANNEL_H_INCLUDED
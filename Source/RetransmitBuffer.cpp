@@ -0,0 +1,197 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "RetransmitBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+static size_t alignRecord (size_t size)
+{
+    return (size + 7) & ~(size_t) 7;
+}
+
+RetransmitBuffer::RetransmitBuffer()
+    : capacity (0),
+      numTopics (0),
+      writeEnd (0),
+      writeLimit (0)
+{
+}
+
+bool RetransmitBuffer::prepare (size_t capacityBytes, int topics)
+{
+    release();
+
+    std::lock_guard<std::mutex> lock (configLock);
+
+    capacityBytes = alignRecord (capacityBytes);
+
+    ring.reset (new (std::nothrow) uint8_t[capacityBytes]);
+    index.reset (new (std::nothrow) std::atomic<uint64_t>[(size_t) topics * INDEX_SIZE]);
+
+    if (ring == nullptr || index == nullptr)
+    {
+        ring.reset();
+        index.reset();
+        return false;
+    }
+
+    for (size_t i = 0; i < (size_t) topics * INDEX_SIZE; i++)
+        index[i].store (0, std::memory_order_relaxed);
+
+    capacity = capacityBytes;
+    numTopics = topics;
+    writeEnd.store (0);
+    writeLimit.store (0);
+
+    return true;
+}
+
+void RetransmitBuffer::release()
+{
+    std::lock_guard<std::mutex> lock (configLock);
+
+    ring.reset();
+    index.reset();
+    capacity = 0;
+    numTopics = 0;
+}
+
+void RetransmitBuffer::copyIn (uint64_t position, const void* src, size_t size)
+{
+    const size_t offset = (size_t) (position % capacity);
+    const size_t head = std::min (size, capacity - offset);
+
+    std::memcpy (ring.get() + offset, src, head);
+    if (head < size)
+        std::memcpy (ring.get(), (const uint8_t*) src + head, size - head);
+}
+
+void RetransmitBuffer::copyOut (uint64_t position, void* dest, size_t size) const
+{
+    const size_t offset = (size_t) (position % capacity);
+    const size_t head = std::min (size, capacity - offset);
+
+    std::memcpy (dest, ring.get() + offset, head);
+    if (head < size)
+        std::memcpy ((uint8_t*) dest + head, ring.get(), size - head);
+}
+
+bool RetransmitBuffer::isIntact (uint64_t position) const
+{
+    std::atomic_thread_fence (std::memory_order_acquire);
+    return writeLimit.load (std::memory_order_relaxed) <= position + capacity;
+}
+
+void RetransmitBuffer::store (int topic, uint64_t sequence, const Part* parts, int numParts)
+{
+    if (ring == nullptr || topic < 0 || topic >= numTopics)
+        return;
+
+    RecordHeader header;
+    header.sequence = sequence;
+    header.topic = (uint32_t) topic;
+    header.numParts = (uint32_t) numParts;
+    header.totalSize = sizeof (RecordHeader) + alignRecord (sizeof (uint64_t) * numParts);
+
+    for (int i = 0; i < numParts; i++)
+        header.totalSize += parts[i].size;
+
+    header.totalSize = alignRecord (header.totalSize);
+
+    if (header.totalSize > capacity / 2)
+        return;
+
+    const uint64_t start = writeEnd.load (std::memory_order_relaxed);
+
+    writeLimit.store (start + header.totalSize, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+
+    uint64_t position = start;
+
+    copyIn (position, &header, sizeof (RecordHeader));
+    position += sizeof (RecordHeader);
+
+    for (int i = 0; i < numParts; i++)
+    {
+        const uint64_t size = parts[i].size;
+        copyIn (position + sizeof (uint64_t) * i, &size, sizeof (uint64_t));
+    }
+
+    position += alignRecord (sizeof (uint64_t) * numParts);
+
+    for (int i = 0; i < numParts; i++)
+    {
+        copyIn (position, parts[i].data, parts[i].size);
+        position += parts[i].size;
+    }
+
+    writeEnd.store (start + header.totalSize, std::memory_order_release);
+    index[(size_t) topic * INDEX_SIZE + sequence % INDEX_SIZE].store (start + 1, std::memory_order_release);
+}
+
+bool RetransmitBuffer::fetch (int topic, uint64_t sequence, std::vector<uint8_t>& dest, std::vector<size_t>& partSizes) const
+{
+    std::lock_guard<std::mutex> lock (configLock);
+
+    if (ring == nullptr || topic < 0 || topic >= numTopics)
+        return false;
+
+    const uint64_t entry = index[(size_t) topic * INDEX_SIZE + sequence % INDEX_SIZE].load (std::memory_order_acquire);
+    if (entry == 0)
+        return false;
+
+    const uint64_t start = entry - 1;
+
+    RecordHeader header;
+    copyOut (start, &header, sizeof (RecordHeader));
+
+    if (! isIntact (start) || header.sequence != sequence || header.topic != (uint32_t) topic || header.numParts > 64 || header.totalSize > capacity / 2)
+        return false;
+
+    std::vector<uint64_t> sizes (header.numParts);
+    copyOut (start + sizeof (RecordHeader), sizes.data(), sizeof (uint64_t) * header.numParts);
+
+    const uint64_t dataStart = start + sizeof (RecordHeader) + alignRecord (sizeof (uint64_t) * header.numParts);
+
+    size_t dataSize = 0;
+    for (auto size : sizes)
+        dataSize += (size_t) size;
+
+    if (dataSize > header.totalSize)
+        return false;
+
+    dest.resize (dataSize);
+    copyOut (dataStart, dest.data(), dataSize);
+
+    if (! isIntact (start))
+        return false;
+
+    partSizes.assign (sizes.begin(), sizes.end());
+    return true;
+}
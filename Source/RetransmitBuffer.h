@@ -0,0 +1,110 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef RETRANSMITBUFFER_H_INCLUDED
+#define RETRANSMITBUFFER_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+    Keeps copies of recently published messages so that they can be
+    resent when a client reports a gap in a topic's sequence numbers.
+
+    Messages are stored back to back in a byte ring of fixed capacity;
+    the oldest ones are overwritten first. A per-topic index maps a
+    sequence number to the position of its message.
+
+    store() is called from the processing thread and never blocks or
+    allocates. fetch() may run concurrently on another thread and fails
+    for messages that have been (or are being) overwritten.
+    prepare() and release() must not overlap with store().
+*/
+class RetransmitBuffer
+{
+public:
+    /** Number of sequence numbers remembered per topic */
+    static const int INDEX_SIZE = 65536;
+
+    /** Constructor */
+    RetransmitBuffer();
+
+    /** Allocates capacityBytes of storage for numTopics topics. Returns false on failure */
+    bool prepare (size_t capacityBytes, int numTopics);
+
+    /** Frees the storage */
+    void release();
+
+    /** True if storage is allocated */
+    bool isOpen() const { return ring != nullptr; }
+
+    struct Part
+    {
+        const void* data;
+        size_t size;
+    };
+
+    /** Stores the parts of one message. Messages larger than half the capacity are not kept */
+    void store (int topic, uint64_t sequence, const Part* parts, int numParts);
+
+    /** Copies the parts of a stored message into dest and their sizes into partSizes.
+        Returns false if the message is no longer available */
+    bool fetch (int topic, uint64_t sequence, std::vector<uint8_t>& dest, std::vector<size_t>& partSizes) const;
+
+private:
+    struct RecordHeader
+    {
+        uint64_t sequence;
+        uint32_t topic;
+        uint32_t numParts;
+        uint64_t totalSize;
+    };
+
+    void copyIn (uint64_t position, const void* src, size_t size);
+    void copyOut (uint64_t position, void* dest, size_t size) const;
+
+    /** True if the bytes starting at position have not been overwritten */
+    bool isIntact (uint64_t position) const;
+
+    std::unique_ptr<uint8_t[]> ring;
+    size_t capacity;
+    int numTopics;
+
+    /** Ring position of every indexed message, plus one (0 = none) */
+    std::unique_ptr<std::atomic<uint64_t>[]> index;
+
+    /** Total bytes written, and written or being written */
+    std::atomic<uint64_t> writeEnd;
+    std::atomic<uint64_t> writeLimit;
+
+    mutable std::mutex configLock;
+};
+
+#endif // RETRANSMITBUFFER_H_INCLUDED
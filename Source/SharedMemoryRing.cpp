@@ -0,0 +1,177 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "SharedMemoryRing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+SharedMemoryRing::SharedMemoryRing()
+    : base (nullptr),
+      size (0),
+      nextBlock (0)
+{
+}
+
+SharedMemoryRing::~SharedMemoryRing()
+{
+    destroy();
+}
+
+#if defined(_WIN32)
+
+bool SharedMemoryRing::create (const std::string&, int, int, const std::vector<uint32_t>&, float, const std::string&)
+{
+    return false;
+}
+
+void SharedMemoryRing::destroy()
+{
+}
+
+#else
+
+bool SharedMemoryRing::create (const std::string& segmentName,
+                               int numSlots,
+                               int maxSamples,
+                               const std::vector<uint32_t>& channelNumbers,
+                               float sampleRate,
+                               const std::string& streamName)
+{
+    destroy();
+
+    const uint32_t numChannels = (uint32_t) channelNumbers.size();
+    const size_t segmentSize = (size_t) zmqi_shm_segment_size ((uint32_t) numSlots, numChannels, (uint32_t) maxSamples);
+
+    // unlink first: readers still mapping an old segment keep their copy,
+    // which destroy() has marked stale
+    shm_unlink (segmentName.c_str());
+
+    int fd = shm_open (segmentName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+        return false;
+
+    if (ftruncate (fd, (off_t) segmentSize) != 0)
+    {
+        close (fd);
+        shm_unlink (segmentName.c_str());
+        return false;
+    }
+
+    void* p = mmap (nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+
+    if (p == MAP_FAILED)
+    {
+        shm_unlink (segmentName.c_str());
+        return false;
+    }
+
+    base = (uint8_t*) p;
+    size = segmentSize;
+    name = segmentName;
+    nextBlock = 0;
+
+    std::memset (base, 0, sizeof (zmqi_shm_header));
+
+    zmqi_shm_header* h = (zmqi_shm_header*) base;
+    h->magic = ZMQI_SHM_MAGIC;
+    h->version = ZMQI_SHM_VERSION;
+    h->num_slots = (uint32_t) numSlots;
+    h->max_samples = (uint32_t) maxSamples;
+    h->num_channels = numChannels;
+    h->sample_rate = sampleRate;
+    h->session_id = (uint64_t) std::chrono::steady_clock::now().time_since_epoch().count() | 1;
+    h->channel_table_offset = sizeof (zmqi_shm_header);
+    h->slots_offset = sizeof (zmqi_shm_header) + ((numChannels * sizeof (uint32_t) + 63) & ~(size_t) 63);
+    h->slot_stride = (sizeof (zmqi_shm_slot_header) + (size_t) numChannels * maxSamples * sizeof (float) + 63) & ~(size_t) 63;
+    std::strncpy (h->stream_name, streamName.c_str(), ZMQI_SHM_STREAM_NAME_LENGTH - 1);
+
+    if (numChannels > 0)
+        std::memcpy (base + h->channel_table_offset, channelNumbers.data(), numChannels * sizeof (uint32_t));
+
+    return true;
+}
+
+void SharedMemoryRing::destroy()
+{
+    if (base == nullptr)
+        return;
+
+    zmqi_shm_header* h = (zmqi_shm_header*) base;
+    ZMQI_SHM_STORE (&h->session_id, (uint64_t) 0);
+
+    munmap (base, size);
+    shm_unlink (name.c_str());
+
+    base = nullptr;
+    size = 0;
+}
+
+#endif
+
+void SharedMemoryRing::write (const float* const* channels, int numSamples, int64_t sampleNumber, int64_t timestampMs)
+{
+    if (base == nullptr)
+        return;
+
+    const int maxSamples = (int) ((const zmqi_shm_header*) base)->max_samples;
+
+    for (int offset = 0; offset < numSamples; offset += maxSamples)
+    {
+        const int count = std::min (maxSamples, numSamples - offset);
+        writeSlot (channels, offset, count, sampleNumber + offset, timestampMs);
+    }
+}
+
+void SharedMemoryRing::writeSlot (const float* const* channels, int offset, int numSamples, int64_t sampleNumber, int64_t timestampMs)
+{
+#if ! defined(_WIN32)
+    zmqi_shm_header* h = (zmqi_shm_header*) base;
+    zmqi_shm_slot_header* slot = zmqi_shm_slot (base, nextBlock);
+
+    // odd sequence: slot is being written
+    ZMQI_SHM_STORE (&slot->sequence, 2 * nextBlock + 1);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    slot->block_index = nextBlock;
+    slot->sample_number = sampleNumber;
+    slot->timestamp_ms = timestampMs;
+    slot->num_samples = (uint32_t) numSamples;
+    slot->num_channels = h->num_channels;
+
+    float* dest = (float*) ((uint8_t*) slot + sizeof (zmqi_shm_slot_header));
+
+    for (uint32_t ch = 0; ch < h->num_channels; ch++)
+        std::memcpy (dest + (size_t) ch * numSamples, channels[ch] + offset, sizeof (float) * numSamples);
+
+    ZMQI_SHM_STORE (&slot->sequence, 2 * (nextBlock + 1));
+
+    nextBlock++;
+    ZMQI_SHM_STORE (&h->write_index, nextBlock);
+#endif
+}
@@ -0,0 +1,86 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SHAREDMEMORYRING_H_INCLUDED
+#define SHAREDMEMORYRING_H_INCLUDED
+
+#include "../Resources/shm_client/zmq_interface_shm.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+    Writer side of the same-host shared-memory transport.
+
+    Publishes every block of the selected channels into a POSIX shared
+    memory segment laid out as described in zmq_interface_shm.h, so that
+    local readers get the data without going through a socket. Blocks
+    longer than the slot size are split over several slots.
+
+    create() and destroy() allocate and release the segment and must not
+    be called from the processing thread; write() only copies.
+    Not available on Windows, where create() always fails.
+*/
+class SharedMemoryRing
+{
+public:
+    /** Constructor */
+    SharedMemoryRing();
+
+    /** Destructor, releases the segment */
+    ~SharedMemoryRing();
+
+    /** Creates (or re-creates) the segment. Returns false if it could not be mapped */
+    bool create (const std::string& name,
+                 int numSlots,
+                 int maxSamples,
+                 const std::vector<uint32_t>& channelNumbers,
+                 float sampleRate,
+                 const std::string& streamName);
+
+    /** Marks the segment stale for connected readers and unlinks it */
+    void destroy();
+
+    /** True if a segment is mapped */
+    bool isOpen() const { return base != nullptr; }
+
+    /** Returns the name of the segment */
+    const std::string& getName() const { return name; }
+
+    /** Publishes one block (channel-major input, one pointer per channel) */
+    void write (const float* const* channels, int numSamples, int64_t sampleNumber, int64_t timestampMs);
+
+private:
+    void writeSlot (const float* const* channels, int offset, int numSamples, int64_t sampleNumber, int64_t timestampMs);
+
+    std::string name;
+    uint8_t* base;
+    size_t size;
+    uint64_t nextBlock;
+};
+
+#endif // SHAREDMEMORYRING_H_INCLUDED
@@ -0,0 +1,148 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "SocketMonitor.h"
+
+#include <zmq.h>
+
+#include <cstring>
+
+SocketMonitor::SocketMonitor()
+    : watchedSocket (nullptr),
+      monitorSocket (nullptr),
+      numPeers (0),
+      numAccepted (0),
+      numDisconnected (0),
+      numHandshakeFailures (0)
+{
+}
+
+SocketMonitor::~SocketMonitor()
+{
+    stop();
+}
+
+bool SocketMonitor::start (void* context, void* socket, const std::string& endpoint)
+{
+    stop();
+
+    const int events = ZMQ_EVENT_ACCEPTED | ZMQ_EVENT_DISCONNECTED
+                       | ZMQ_EVENT_HANDSHAKE_FAILED_NO_DETAIL
+                       | ZMQ_EVENT_HANDSHAKE_FAILED_PROTOCOL
+                       | ZMQ_EVENT_HANDSHAKE_FAILED_AUTH;
+
+    if (zmq_socket_monitor (socket, endpoint.c_str(), events) != 0)
+        return false;
+
+    monitorSocket = zmq_socket (context, ZMQ_PAIR);
+
+    if (monitorSocket == nullptr || zmq_connect (monitorSocket, endpoint.c_str()) != 0)
+    {
+        if (monitorSocket != nullptr)
+            zmq_close (monitorSocket);
+
+        zmq_socket_monitor (socket, nullptr, 0);
+        monitorSocket = nullptr;
+        return false;
+    }
+
+    watchedSocket = socket;
+    numPeers = 0;
+
+    return true;
+}
+
+void SocketMonitor::stop()
+{
+    if (monitorSocket == nullptr)
+        return;
+
+    zmq_socket_monitor (watchedSocket, nullptr, 0);
+
+    int linger = 0;
+    zmq_setsockopt (monitorSocket, ZMQ_LINGER, &linger, sizeof (linger));
+    zmq_close (monitorSocket);
+
+    monitorSocket = nullptr;
+    watchedSocket = nullptr;
+    numPeers = 0;
+}
+
+bool SocketMonitor::readEvent (Event& event)
+{
+    if (monitorSocket == nullptr)
+        return false;
+
+    // first frame: uint16 event, uint32 value; second frame: endpoint address
+    zmq_msg_t frame;
+    zmq_msg_init (&frame);
+
+    if (zmq_msg_recv (&frame, monitorSocket, ZMQ_DONTWAIT) < 0)
+    {
+        zmq_msg_close (&frame);
+        return false;
+    }
+
+    const uint8_t* data = (const uint8_t*) zmq_msg_data (&frame);
+    const bool valid = zmq_msg_size (&frame) >= 6;
+    uint16_t type = 0;
+    uint32_t value = 0;
+
+    if (valid)
+    {
+        std::memcpy (&type, data, sizeof (type));
+        std::memcpy (&value, data + 2, sizeof (value));
+    }
+
+    while (zmq_msg_more (&frame))
+        zmq_msg_recv (&frame, monitorSocket, 0);
+
+    zmq_msg_close (&frame);
+
+    event.type = type;
+    event.value = (int) value;
+
+    if (type == ZMQ_EVENT_ACCEPTED)
+    {
+        numAccepted++;
+        numPeers++;
+    }
+    else if (type == ZMQ_EVENT_DISCONNECTED)
+    {
+        numDisconnected++;
+
+        if (numPeers > 0)
+            numPeers--;
+    }
+    else if (type == ZMQ_EVENT_HANDSHAKE_FAILED_NO_DETAIL
+             || type == ZMQ_EVENT_HANDSHAKE_FAILED_PROTOCOL
+             || type == ZMQ_EVENT_HANDSHAKE_FAILED_AUTH)
+    {
+        numHandshakeFailures++;
+    }
+
+    return true;
+}
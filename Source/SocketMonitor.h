@@ -0,0 +1,95 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SOCKETMONITOR_H_INCLUDED
+#define SOCKETMONITOR_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+    Follows the connections of one ZMQ socket through zmq_socket_monitor.
+
+    start() attaches a PAIR socket to the monitor endpoint of the watched
+    socket; readEvent() then drains the events libzmq reports (accepted
+    and dropped connections, handshake results) without blocking. A peer
+    that stops answering ZMTP heartbeats is dropped by libzmq and shows
+    up here as a disconnect.
+
+    start(), stop() and readEvent() must be called from one thread; the
+    counters can be read from any thread.
+*/
+class SocketMonitor
+{
+public:
+    struct Event
+    {
+        int type;  // ZMQ_EVENT_*
+        int value; // the peer's file descriptor for connection events
+    };
+
+    /** Constructor */
+    SocketMonitor();
+
+    /** Destructor */
+    ~SocketMonitor();
+
+    /** Starts monitoring socket through the inproc endpoint (unique per context) */
+    bool start (void* context, void* socket, const std::string& endpoint);
+
+    /** Stops monitoring; call before the watched socket is closed */
+    void stop();
+
+    /** Returns the socket to poll for events, or nullptr if not monitoring */
+    void* getSocket() const { return monitorSocket; }
+
+    /** Reads the next pending event and updates the counters; false if there is none */
+    bool readEvent (Event& event);
+
+    /** Peers currently connected */
+    int getNumPeers() const { return numPeers.load(); }
+
+    /** Connections accepted since the socket was opened */
+    uint64_t getNumAccepted() const { return numAccepted.load(); }
+
+    /** Connections dropped, by either side or by a heartbeat timeout */
+    uint64_t getNumDisconnected() const { return numDisconnected.load(); }
+
+    /** Connections whose ZMTP handshake failed */
+    uint64_t getNumHandshakeFailures() const { return numHandshakeFailures.load(); }
+
+private:
+    void* watchedSocket;
+    void* monitorSocket;
+
+    std::atomic<int> numPeers;
+    std::atomic<uint64_t> numAccepted;
+    std::atomic<uint64_t> numDisconnected;
+    std::atomic<uint64_t> numHandshakeFailures;
+};
+
+#endif // SOCKETMONITOR_H_INCLUDED
@@ -0,0 +1,95 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SPSCQUEUE_H_INCLUDED
+#define SPSCQUEUE_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+    Bounded single-producer / single-consumer queue.
+
+    push() and pop() are wait-free and never allocate; the storage is
+    allocated once in the constructor. One slot is kept empty, so the
+    queue holds capacity - 1 items.
+*/
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue (size_t capacity)
+        : items (capacity < 2 ? 2 : capacity),
+          head (0),
+          tail (0)
+    {
+    }
+
+    /** Adds an item; returns false (and leaves item untouched) if the queue is full */
+    bool push (T& item)
+    {
+        const size_t t = tail.load (std::memory_order_relaxed);
+        const size_t next = (t + 1) % items.size();
+
+        if (next == head.load (std::memory_order_acquire))
+            return false;
+
+        items[t] = std::move (item);
+        tail.store (next, std::memory_order_release);
+        return true;
+    }
+
+    /** Removes the oldest item; returns false if the queue is empty */
+    bool pop (T& item)
+    {
+        const size_t h = head.load (std::memory_order_relaxed);
+
+        if (h == tail.load (std::memory_order_acquire))
+            return false;
+
+        item = std::move (items[h]);
+        items[h] = T();
+        head.store ((h + 1) % items.size(), std::memory_order_release);
+        return true;
+    }
+
+    /** Number of queued items (approximate when called concurrently) */
+    size_t size() const
+    {
+        const size_t h = head.load (std::memory_order_acquire);
+        const size_t t = tail.load (std::memory_order_acquire);
+        return (t + items.size() - h) % items.size();
+    }
+
+private:
+    std::vector<T> items;
+    alignas (64) std::atomic<size_t> head;
+    alignas (64) std::atomic<size_t> tail;
+};
+
+#endif // SPSCQUEUE_H_INCLUDED
@@ -0,0 +1,386 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "SubscriptionTable.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+// decimation factors clients can ask for
+const int MAX_DECIMATION = 1024;
+
+// topic headers are written here rather than with the JSON writer, which this table does not depend on
+static void appendJsonString (std::string& json, const std::string& value)
+{
+    json += '"';
+
+    for (char c : value)
+    {
+        if (c == '"' || c == '\\')
+        {
+            json += '\\';
+            json += c;
+        }
+        else if ((unsigned char) c < 0x20)
+        {
+            char escaped[8];
+            std::snprintf (escaped, sizeof (escaped), "\\u%04x", (unsigned) c);
+            json += escaped;
+        }
+        else
+        {
+            json += c;
+        }
+    }
+
+    json += '"';
+}
+
+static void appendJsonField (std::string& json, const char* name, int64_t value)
+{
+    char text[96];
+    std::snprintf (text, sizeof (text), "\"%s\": %lld, ", name, (long long) value);
+    json += text;
+}
+
+SubscriptionTable::SubscriptionTable()
+    : nextTopicNumber (1),
+      numTopics (0)
+{
+}
+
+void SubscriptionTable::setStreams (const std::vector<StreamInfo>& newStreams)
+{
+    std::lock_guard<std::mutex> lock (tableLock);
+
+    streams = newStreams;
+
+    for (auto it = topics.begin(); it != topics.end();)
+    {
+        const Topic& topic = *it->second;
+        bool valid = false;
+
+        for (auto& stream : streams)
+        {
+            if (stream.name != topic.streamName)
+                continue;
+
+            valid = true;
+            for (int channel : topic.format.channels)
+                valid = valid && channel < stream.numChannels;
+
+            // stream ids may change when the signal chain is rebuilt
+            it->second->streamId = stream.streamId;
+
+            if (it->second->sampleRate != stream.sampleRate)
+            {
+                it->second->sampleRate = stream.sampleRate;
+                prepareHeader (*it->second);
+            }
+        }
+
+        if (valid)
+            ++it;
+        else
+            it = topics.erase (it);
+    }
+
+    publishRoutes();
+}
+
+std::string SubscriptionTable::subscribe (const std::string& client,
+                                          const std::string& streamName,
+                                          const std::vector<int>& channels,
+                                          int decimation,
+                                          double sampleRate,
+                                          BlockEncoder::Encoding encoding,
+                                          std::string& error)
+{
+    std::lock_guard<std::mutex> lock (tableLock);
+
+    const StreamInfo* stream = nullptr;
+
+    for (auto& s : streams)
+        if (streamName.empty() || s.name == streamName)
+        {
+            stream = &s;
+            break;
+        }
+
+    if (stream == nullptr)
+    {
+        error = "unknown stream";
+        return {};
+    }
+
+    if (sampleRate > 0)
+        decimation = std::max (1, (int) std::lround (stream->sampleRate / sampleRate));
+
+    if (decimation < 1 || decimation > MAX_DECIMATION)
+    {
+        error = "invalid decimation";
+        return {};
+    }
+
+    BlockEncoder::Format format;
+    format.decimation = decimation;
+    format.encoding = encoding;
+    format.channels = channels;
+
+    if (format.channels.empty())
+        for (int i = 0; i < stream->numChannels; i++)
+            format.channels.push_back (i);
+
+    for (int channel : format.channels)
+    {
+        if (channel < 0 || channel >= stream->numChannels)
+        {
+            error = "invalid channel";
+            return {};
+        }
+    }
+
+    for (auto& entry : topics)
+    {
+        Topic& topic = *entry.second;
+
+        if (topic.streamName == stream->name && topic.format == format)
+        {
+            topic.clients.insert (client);
+            return topic.name;
+        }
+    }
+
+    // names are never reused, so a stale client cannot receive another request's data
+    char name[32];
+    std::snprintf (name, sizeof (name), "SUB-%04d", nextTopicNumber++);
+
+    std::shared_ptr<Topic> topic = std::make_shared<Topic>();
+    topic->name = name;
+    topic->streamId = stream->streamId;
+    topic->streamName = stream->name;
+    topic->sampleRate = stream->sampleRate;
+    topic->format = format;
+    topic->clients.insert (client);
+    topic->pending.resize (format.channels.size() * (size_t) decimation);
+
+    // the processing thread never resizes these; a multiple of the decimation, so pieces end on whole groups
+    const int capacity = std::max ((int) SCRATCH_SAMPLES, largestBlock.load (std::memory_order_relaxed)) + decimation;
+    topic->scratchSamples = capacity - capacity % decimation;
+    topic->scratch.resize (format.channels.size() * (size_t) topic->scratchSamples);
+    topic->scratchChannels.resize (format.channels.size());
+
+    prepareHeader (*topic);
+
+    topics[topic->name] = std::move (topic);
+    publishRoutes();
+
+    return name;
+}
+
+void SubscriptionTable::unsubscribe (const std::string& client, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock (tableLock);
+
+    auto it = topics.find (name);
+    if (it == topics.end())
+        return;
+
+    it->second->clients.erase (client);
+
+    if (it->second->clients.empty())
+    {
+        topics.erase (it);
+        publishRoutes();
+    }
+}
+
+void SubscriptionTable::release (const std::string& client)
+{
+    std::lock_guard<std::mutex> lock (tableLock);
+
+    const size_t before = topics.size();
+
+    laggingClients.erase (client);
+
+    for (auto it = topics.begin(); it != topics.end();)
+    {
+        it->second->clients.erase (client);
+
+        if (it->second->clients.empty())
+            it = topics.erase (it);
+        else
+            ++it;
+    }
+
+    if (topics.size() != before)
+        publishRoutes();
+}
+
+int SubscriptionTable::getNumTopics() const
+{
+    return numTopics.load (std::memory_order_relaxed);
+}
+
+bool SubscriptionTable::getTopicInfo (const std::string& name, Topic& info) const
+{
+    std::lock_guard<std::mutex> lock (tableLock);
+
+    auto it = topics.find (name);
+    if (it == topics.end())
+        return false;
+
+    const Topic& topic = *it->second;
+    info.name = topic.name;
+    info.streamId = topic.streamId;
+    info.streamName = topic.streamName;
+    info.sampleRate = topic.sampleRate;
+    info.format = topic.format;
+    info.clients = topic.clients;
+    info.sequence = topic.sequence.load();
+
+    return true;
+}
+
+bool SubscriptionTable::getSequence (const std::string& name, uint64_t& sequence) const
+{
+    std::lock_guard<std::mutex> lock (tableLock);
+
+    auto it = topics.find (name);
+    if (it == topics.end())
+        return false;
+
+    sequence = it->second->sequence.load();
+    return true;
+}
+
+void SubscriptionTable::setClientLagging (const std::string& client, bool lagging)
+{
+    std::lock_guard<std::mutex> lock (tableLock);
+
+    const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    if (lagging)
+        laggingClients.insert (client);
+    else
+        laggingClients.erase (client);
+
+    for (auto& entry : topics)
+    {
+        Topic& topic = *entry.second;
+
+        if (topic.clients.count (client) == 0)
+            continue;
+
+        int numLagging = 0;
+        for (auto& c : topic.clients)
+            numLagging += (int) laggingClients.count (c);
+
+        const int thinning = topic.thinning.load();
+        int next = thinning;
+
+        if (numLagging == (int) topic.clients.size())
+            next = std::min (thinning * 2, (int) MAX_THINNING);
+        else if (numLagging == 0)
+            next = std::max (thinning / 2, 1);
+
+        // repeated reports of the same state must not step again before the last step could take effect
+        if (next != thinning && (thinning == 1 || now - topic.thinningChangedMs >= THINNING_STEP_MS))
+        {
+            topic.thinning = next;
+            topic.thinningChangedMs = now;
+        }
+    }
+}
+
+void SubscriptionTable::resetThinning()
+{
+    std::lock_guard<std::mutex> lock (tableLock);
+
+    laggingClients.clear();
+
+    for (auto& entry : topics)
+        entry.second->thinning = 1;
+}
+
+void SubscriptionTable::prepareHeader (Topic& topic)
+{
+    // the object sendSubscriptionData() used to build for every message, with
+    // placeholders for the numbers that change
+    int64_t slots[NUM_HEADER_SLOTS];
+    for (int slot = 0; slot < NUM_HEADER_SLOTS; slot++)
+        slots[slot] = HeaderTemplate::getPlaceholder (slot);
+
+    const int decimation = topic.format.decimation;
+    char text[64];
+    std::string json = "{";
+
+    appendJsonField (json, "message_num", slots[SLOT_MESSAGE_NUM]);
+    json += "\"type\": \"subscription\", \"content\": {\"topic\": ";
+    appendJsonString (json, topic.name);
+    json += ", \"stream\": ";
+    appendJsonString (json, topic.streamName);
+    json += ", ";
+    appendJsonField (json, "sample_num", slots[SLOT_SAMPLE_NUM]);
+    appendJsonField (json, "num_samples", slots[SLOT_NUM_SAMPLES]);
+    appendJsonField (json, "num_output_samples", slots[SLOT_NUM_OUTPUT_SAMPLES]);
+    appendJsonField (json, "decimation", decimation);
+    appendJsonField (json, "thinning", slots[SLOT_THINNING]);
+
+    std::snprintf (text, sizeof (text), "\"sample_rate\": %.15g, ", (double) (topic.sampleRate / decimation));
+    json += text;
+
+    json += "\"encoding\": ";
+    appendJsonString (json, BlockEncoder::getEncodingName (topic.format.encoding));
+    json += ", \"channels\": [";
+
+    for (size_t i = 0; i < topic.format.channels.size(); i++)
+    {
+        std::snprintf (text, sizeof (text), i > 0 ? ", %d" : "%d", topic.format.channels[i]);
+        json += text;
+    }
+
+    json += "]}, ";
+    appendJsonField (json, "data_size", slots[SLOT_DATA_SIZE]);
+    appendJsonField (json, "timestamp", slots[SLOT_TIMESTAMP]);
+
+    std::snprintf (text, sizeof (text), "\"seq\": %lld}", (long long) slots[SLOT_SEQ]);
+    json += text;
+
+    topic.header.prepare (json, NUM_HEADER_SLOTS);
+}
+
+void SubscriptionTable::publishRoutes()
+{
+    std::unique_ptr<Routes> next (new Routes());
+
+    for (auto& entry : topics)
+        next->push_back ({ entry.second->streamId, entry.second->sampleRate, entry.second, entry.second->header });
+
+    numTopics.store ((int) next->size(), std::memory_order_relaxed);
+    routes.publish (std::move (next));
+}
@@ -0,0 +1,329 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SUBSCRIPTIONTABLE_H_INCLUDED
+#define SUBSCRIPTIONTABLE_H_INCLUDED
+
+#include "BlockEncoder.h"
+#include "EncodingCache.h"
+#include "HeaderTemplate.h"
+#include "RcuPointer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+    Output topics set up on request of clients, each carrying a subset of
+    one stream's channels at a chosen decimation and encoding.
+
+    Clients with identical requests share a topic, so its data is encoded
+    and sent once per block however many clients use it. Topics whose
+    output lines up with the block take it from the EncodingCache, so they
+    also share the encoding with any other user of the same representation. A topic is
+    removed when its last client unsubscribes or is released (e.g. because
+    its heartbeat expired).
+
+    subscribe() and release() are called from the ZMQ and message
+    threads and take the table's lock. After every change they publish an
+    immutable list of routes, which process() reads on the processing
+    thread without locking.
+
+    Clients that report falling behind can have their topics thinned:
+    while all clients of a topic lag, it sends only every 2nd, then 4th,
+    ... output block, and steps back once none of them does. Clients
+    report with every heartbeat, so a topic steps at most once per
+    THINNING_STEP_MS, giving each step time to show its effect.
+*/
+class SubscriptionTable
+{
+public:
+    /** Largest thinning factor of a topic whose clients fall behind */
+    static const int MAX_THINNING = 8;
+
+    /** Shortest time between two thinning steps of a topic */
+    static const int THINNING_STEP_MS = 2000;
+
+    /** Samples per channel of a topic's scratch buffer, at least; larger blocks are sent in pieces */
+    static const int SCRATCH_SAMPLES = 4096;
+
+    /** Slots of a topic's header template: the numbers that change from message to message */
+    enum HeaderSlot
+    {
+        SLOT_MESSAGE_NUM = 0,
+        SLOT_SAMPLE_NUM,
+        SLOT_NUM_SAMPLES,
+        SLOT_NUM_OUTPUT_SAMPLES,
+        SLOT_THINNING,
+        SLOT_DATA_SIZE,
+        SLOT_TIMESTAMP,
+        SLOT_SEQ,
+        NUM_HEADER_SLOTS
+    };
+
+    struct StreamInfo
+    {
+        uint16_t streamId;
+        std::string name;
+        int numChannels;
+        float sampleRate;
+    };
+
+    struct Topic
+    {
+        /** Fixed when the topic is created */
+        std::string name;
+        std::string streamName;
+
+        /** channels are indices into the stream's continuous channels */
+        BlockEncoder::Format format;
+
+        /** Current stream id and rate, and clients; only used under the table's lock */
+        uint16_t streamId;
+        float sampleRate;
+        std::set<std::string> clients;
+
+        std::atomic<uint64_t> sequence { 0 };
+
+        /** Output blocks per block sent, raised while the clients fall behind */
+        std::atomic<int> thinning { 1 };
+
+        /** When thinning last changed (steady clock); only used under the table's lock */
+        int64_t thinningChangedMs = 0;
+
+        /** The topic's message header at sampleRate, rendered when either is set; only
+            used under the table's lock (routes carry a copy) */
+        HeaderTemplate header;
+
+        /** Processing thread only from here on:
+            samples of an incomplete decimation group carried to the next block */
+        std::vector<float> pending;
+        int numPending = 0;
+        int64_t pendingSampleNumber = 0;
+
+        /** Sized when the topic is created: scratchSamples per channel, a multiple of the decimation */
+        std::vector<float> scratch;
+        std::vector<const float*> scratchChannels;
+        int scratchSamples = 0;
+
+        uint64_t numOutputBlocks = 0;
+
+        /** The encoded output, valid inside the process() callback */
+        EncodingCache::BufferPtr output;
+    };
+
+    /** A topic as seen by the processing thread */
+    struct Route
+    {
+        uint16_t streamId;
+        float sampleRate;
+        std::shared_ptr<Topic> topic;
+
+        /** The topic's header; render it with the HeaderSlot values of a message */
+        HeaderTemplate header;
+    };
+
+    typedef std::vector<Route> Routes;
+
+    /** Constructor */
+    SubscriptionTable();
+
+    /** Updates the streams clients can subscribe to; topics of streams that are gone are removed */
+    void setStreams (const std::vector<StreamInfo>& streams);
+
+    /** Adds client to the topic matching the request, creating it if needed.
+        An empty stream name selects the first stream, empty channels all of them.
+        A sampleRate > 0 overrides decimation with the nearest integer factor.
+        Returns the topic, or an empty string (with error set) if the request is invalid */
+    std::string subscribe (const std::string& client,
+                           const std::string& streamName,
+                           const std::vector<int>& channels,
+                           int decimation,
+                           double sampleRate,
+                           BlockEncoder::Encoding encoding,
+                           std::string& error);
+
+    /** Removes client from one topic */
+    void unsubscribe (const std::string& client, const std::string& topic);
+
+    /** Removes client from all topics */
+    void release (const std::string& client);
+
+    /** Returns the number of topics */
+    int getNumTopics() const;
+
+    /** Returns the description of a topic (without its buffers) */
+    bool getTopicInfo (const std::string& name, Topic& info) const;
+
+    /** Returns the sequence number of the last message of a topic */
+    bool getSequence (const std::string& name, uint64_t& sequence) const;
+
+    /** Records whether a client falls behind and steps the thinning of its topics
+        up (all of their clients lag) or down (none does) */
+    void setClientLagging (const std::string& client, bool lagging);
+
+    /** Sends every output block of all topics again */
+    void resetThinning();
+
+    /** Feeds the cache's current block to all topics of its stream. onOutput (const Route&,
+        int64_t sampleNumber, int numSamples) is called for every topic with complete
+        output; the encoded samples are in route.topic->output */
+    template <typename Callback>
+    void process (EncodingCache& cache, Callback&& onOutput)
+    {
+        RcuPointer<Routes>::ReadLock current (routes);
+
+        // topics created later size their scratch for the largest block seen
+        if (cache.getNumSamples() > largestBlock.load (std::memory_order_relaxed))
+            largestBlock.store (cache.getNumSamples(), std::memory_order_relaxed);
+
+        for (auto& route : *current)
+            if (route.streamId == cache.getStreamId())
+                processTopic (route, cache, onOutput);
+    }
+
+private:
+    template <typename Callback>
+    void processTopic (const Route& route, EncodingCache& cache, Callback& onOutput)
+    {
+        Topic& topic = *route.topic;
+        const float* const* channels = cache.getChannels();
+        const int numSamples = cache.getNumSamples();
+        const int64_t sampleNumber = cache.getSampleNumber();
+        const int decimation = topic.format.decimation;
+        const int numChannels = (int) topic.format.channels.size();
+
+        if (topic.numPending > 0 && sampleNumber != topic.pendingSampleNumber + topic.numPending)
+            topic.numPending = 0;
+
+        if (topic.numPending == 0)
+            topic.pendingSampleNumber = sampleNumber;
+
+        const int total = topic.numPending + numSamples;
+        const int usable = total - total % decimation;
+        const int fromBlock = usable - topic.numPending;
+
+        // thinned topics skip whole output blocks, including their encoding
+        const int thinning = topic.thinning.load (std::memory_order_relaxed);
+        const bool skip = usable > 0 && thinning > 1 && (topic.numOutputBlocks++ % (uint64_t) thinning) != 0;
+
+        if (skip)
+        {
+            topic.pendingSampleNumber += usable;
+            topic.numPending = 0;
+        }
+        else if (usable > 0 && usable == numSamples && topic.numPending == 0)
+        {
+            // the output is exactly this block: share its encoding
+            topic.output = cache.get (topic.format);
+            onOutput (route, sampleNumber, usable);
+            topic.output = nullptr;
+
+            topic.pendingSampleNumber += usable;
+        }
+        else if (usable > 0)
+        {
+            BlockEncoder::Format format;
+            format.decimation = decimation;
+            format.encoding = topic.format.encoding;
+
+            // the pending samples followed by the block's, in pieces that fit the scratch buffer
+            const int numPending = topic.numPending;
+
+            for (int done = 0; done < usable;)
+            {
+                const int count = std::min (usable - done, topic.scratchSamples);
+                const int fromPending = std::max (0, std::min (count, numPending - done));
+
+                for (int c = 0; c < numChannels; c++)
+                {
+                    float* dest = topic.scratch.data() + (size_t) c * count;
+                    std::memcpy (dest, topic.pending.data() + (size_t) c * decimation + done, sizeof (float) * fromPending);
+                    std::memcpy (dest + fromPending,
+                                 channels[topic.format.channels[(size_t) c]] + (done + fromPending - numPending),
+                                 sizeof (float) * (count - fromPending));
+                    topic.scratchChannels[(size_t) c] = dest;
+                }
+
+                std::shared_ptr<EncodingCache::Buffer> buffer = cache.acquire();
+                buffer->streamId = route.streamId;
+                buffer->sampleNumber = topic.pendingSampleNumber;
+                buffer->numSamples = count;
+                buffer->numOutputSamples = count / decimation;
+                buffer->numOutputChannels = numChannels;
+                buffer->format = topic.format;
+
+                BlockEncoder::encode (topic.scratchChannels.data(), numChannels, count, format, buffer->data, buffer->scales);
+
+                topic.output = buffer;
+                onOutput (route, topic.pendingSampleNumber, count);
+                topic.output = nullptr;
+
+                topic.pendingSampleNumber += count;
+                done += count;
+            }
+
+            topic.numPending = 0;
+        }
+
+        // keep the samples of an incomplete group for the next block
+        const int first = std::max (0, fromBlock);
+        const int remaining = numSamples - first;
+
+        for (int c = 0; c < numChannels; c++)
+            std::memcpy (topic.pending.data() + (size_t) c * decimation + topic.numPending,
+                         channels[topic.format.channels[(size_t) c]] + first,
+                         sizeof (float) * remaining);
+
+        topic.numPending += remaining;
+    }
+
+    /** Renders topic's header template for its current sample rate; call with the lock held */
+    static void prepareHeader (Topic& topic);
+
+    /** Publishes the current topics to the processing thread; call with the lock held */
+    void publishRoutes();
+
+    std::vector<StreamInfo> streams;
+    std::map<std::string, std::shared_ptr<Topic>> topics;
+    std::set<std::string> laggingClients;
+    std::atomic<int> largestBlock { 0 };
+    int nextTopicNumber;
+
+    mutable std::mutex tableLock;
+
+    RcuPointer<Routes> routes;
+    std::atomic<int> numTopics;
+};
+
+#endif // SUBSCRIPTIONTABLE_H_INCLUDED
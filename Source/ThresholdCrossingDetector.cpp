@@ -0,0 +1,231 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ThresholdCrossingDetector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define ZMQ_CROSSINGS_SSE2 1
+#endif
+
+// samples used per block for the median estimate
+const int MAX_NOISE_SAMPLES = 256;
+
+// time constant of the running noise estimate
+const float NOISE_ADAPTATION_SECONDS = 2.0f;
+
+// median(|x|) / 0.6745 estimates sigma for gaussian noise
+const float MAD_TO_SIGMA = 1.0f / 0.6745f;
+
+const int64_t NO_CROSSING = std::numeric_limits<int64_t>::min() / 2;
+
+ThresholdCrossingDetector::ThresholdCrossingDetector()
+    : mode (ADAPTIVE),
+      sampleRate (30000.0f),
+      defaultThreshold (-50.0f),
+      adaptiveMultiplier (4.5f),
+      refractoryMs (1.0f),
+      refractorySamples (30),
+      numDropped (0)
+{
+}
+
+void ThresholdCrossingDetector::prepare (int numChannels, float newSampleRate)
+{
+    sampleRate = newSampleRate > 0 ? newSampleRate : 30000.0f;
+
+    channels.resize (numChannels);
+    scratch.resize (MAX_NOISE_SAMPLES);
+
+    crossings.clear();
+    crossings.reserve ((size_t) numChannels * MAX_CROSSINGS_PER_CHANNEL);
+    numDropped.store (0, std::memory_order_relaxed);
+
+    for (auto& state : channels)
+        state.fixedThreshold = defaultThreshold;
+
+    setRefractoryPeriod (refractoryMs);
+    reset();
+}
+
+void ThresholdCrossingDetector::reset()
+{
+    for (auto& state : channels)
+    {
+        state.noiseEstimate = -1.0f;
+        state.lastCrossing = NO_CROSSING;
+        state.wasPastThreshold = false;
+    }
+}
+
+void ThresholdCrossingDetector::setFixedThreshold (float threshold)
+{
+    defaultThreshold = threshold;
+
+    for (auto& state : channels)
+        state.fixedThreshold = threshold;
+}
+
+void ThresholdCrossingDetector::setChannelThreshold (int channelIndex, float threshold)
+{
+    if (channelIndex >= 0 && channelIndex < (int) channels.size())
+        channels[channelIndex].fixedThreshold = threshold;
+}
+
+void ThresholdCrossingDetector::setRefractoryPeriod (float milliseconds)
+{
+    refractoryMs = std::max (0.0f, milliseconds);
+    refractorySamples = std::max<int64_t> (1, (int64_t) std::lround (refractoryMs * sampleRate / 1000.0f));
+}
+
+float ThresholdCrossingDetector::getThreshold (int channelIndex) const
+{
+    if (channelIndex < 0 || channelIndex >= (int) channels.size())
+        return 0.0f;
+
+    const ChannelState& state = channels[channelIndex];
+
+    if (mode == FIXED)
+        return state.fixedThreshold;
+
+    return -adaptiveMultiplier * std::max (0.0f, state.noiseEstimate);
+}
+
+void ThresholdCrossingDetector::updateNoiseEstimate (ChannelState& state, const float* data, int numSamples)
+{
+    if (numSamples <= 0 || scratch.empty())
+        return;
+
+    const int maxSamples = (int) scratch.size();
+    const int stride = std::max (1, (numSamples + maxSamples - 1) / maxSamples);
+
+    int count = 0;
+    for (int i = 0; i < numSamples && count < maxSamples; i += stride)
+        scratch[count++] = std::fabs (data[i]);
+
+    auto middle = scratch.begin() + count / 2;
+    std::nth_element (scratch.begin(), middle, scratch.begin() + count);
+
+    const float sigma = *middle * MAD_TO_SIGMA;
+
+    if (state.noiseEstimate < 0.0f)
+    {
+        state.noiseEstimate = sigma;
+    }
+    else
+    {
+        const float alpha = std::min (1.0f, numSamples / (sampleRate * NOISE_ADAPTATION_SECONDS));
+        state.noiseEstimate += alpha * (sigma - state.noiseEstimate);
+    }
+}
+
+int ThresholdCrossingDetector::detect (int channelIndex,
+                                       uint32_t channelNum,
+                                       const float* data,
+                                       int numSamples,
+                                       int64_t firstSampleNumber)
+{
+    if (channelIndex < 0 || channelIndex >= (int) channels.size() || numSamples <= 0)
+        return 0;
+
+    ChannelState& state = channels[channelIndex];
+
+    if (mode == ADAPTIVE)
+    {
+        updateNoiseEstimate (state, data, numSamples);
+
+        if (state.noiseEstimate <= 0.0f)
+            return 0; // flat channel, nothing meaningful to detect
+    }
+
+    const float threshold = getThreshold (channelIndex);
+    const bool downward = threshold <= 0.0f;
+
+    int numFound = 0;
+
+    auto addCrossing = [&] (int index)
+    {
+        const int64_t sampleNumber = firstSampleNumber + index;
+
+        if (sampleNumber - state.lastCrossing < refractorySamples)
+            return;
+
+        state.lastCrossing = sampleNumber;
+        numFound++;
+
+        if (crossings.size() < crossings.capacity())
+            crossings.push_back ({ channelNum, sampleNumber });
+        else
+            numDropped.fetch_add (1, std::memory_order_relaxed);
+    };
+
+    bool wasPast = state.wasPastThreshold;
+    int i = 0;
+
+#if ZMQ_CROSSINGS_SSE2
+    // 4 samples per step: build a bitmask of samples past threshold, and
+    // keep only the bits whose preceding sample was not past threshold
+    const __m128 t = _mm_set1_ps (threshold);
+
+    for (; i + 4 <= numSamples; i += 4)
+    {
+        const __m128 x = _mm_loadu_ps (data + i);
+        const int past = _mm_movemask_ps (downward ? _mm_cmplt_ps (x, t) : _mm_cmpgt_ps (x, t));
+        const int previous = ((past << 1) | (wasPast ? 1 : 0)) & 0xF;
+        int onsets = past & ~previous;
+
+        while (onsets != 0)
+        {
+            int bit = 0;
+            while (((onsets >> bit) & 1) == 0)
+                bit++;
+
+            addCrossing (i + bit);
+            onsets &= onsets - 1;
+        }
+
+        wasPast = (past & 0x8) != 0;
+    }
+#endif
+
+    for (; i < numSamples; i++)
+    {
+        const bool past = downward ? data[i] < threshold : data[i] > threshold;
+
+        if (past && ! wasPast)
+            addCrossing (i);
+
+        wasPast = past;
+    }
+
+    state.wasPastThreshold = wasPast;
+
+    return numFound;
+}
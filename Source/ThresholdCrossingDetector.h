@@ -0,0 +1,129 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef THRESHOLDCROSSINGDETECTOR_H_INCLUDED
+#define THRESHOLDCROSSINGDETECTOR_H_INCLUDED
+
+#include "ZmqWireFormat.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+    Detects multi-unit threshold crossings on continuous channels.
+
+    Negative thresholds detect downward crossings, positive thresholds
+    upward ones. In adaptive mode each channel's threshold is
+    -multiplier * sigma, where sigma is a running median-absolute-deviation
+    noise estimate (median(|x|) / 0.6745).
+
+    All buffers are allocated in prepare(); detect() does not allocate.
+    Crossings beyond the storage reserved for a block are counted and dropped.
+*/
+class ThresholdCrossingDetector
+{
+public:
+    enum Mode
+    {
+        FIXED = 0,
+        ADAPTIVE
+    };
+
+    /** Crossings stored per channel and block, on average; more are dropped */
+    static const int MAX_CROSSINGS_PER_CHANNEL = 64;
+
+    /** Constructor */
+    ThresholdCrossingDetector();
+
+    /** Allocates per-channel state for a new channel count / sample rate */
+    void prepare (int numChannels, float sampleRate);
+
+    /** Clears crossing history and noise estimates (call at the start of acquisition) */
+    void reset();
+
+    /** Sets fixed vs. adaptive thresholds */
+    void setMode (Mode newMode) { mode = newMode; }
+
+    /** Sets the fixed threshold applied to every channel without an override */
+    void setFixedThreshold (float threshold);
+
+    /** Overrides the fixed threshold of one channel */
+    void setChannelThreshold (int channelIndex, float threshold);
+
+    /** Sets the MAD multiplier used in adaptive mode */
+    void setAdaptiveMultiplier (float multiplier) { adaptiveMultiplier = multiplier; }
+
+    /** Sets the minimum interval between two crossings on the same channel */
+    void setRefractoryPeriod (float milliseconds);
+
+    /** Returns the threshold currently applied to a channel */
+    float getThreshold (int channelIndex) const;
+
+    /** Clears the crossings of the previous block */
+    void beginBlock() { crossings.clear(); }
+
+    /** Appends the crossings of one channel's block to getCrossings().
+        channelIndex selects the detector state, channelNum is written to the records.
+        Returns the number of crossings found, including dropped ones. */
+    int detect (int channelIndex,
+                uint32_t channelNum,
+                const float* data,
+                int numSamples,
+                int64_t firstSampleNumber);
+
+    /** The crossings found since beginBlock() */
+    const std::vector<CrossingRecord>& getCrossings() const { return crossings; }
+
+    /** Crossings found but not stored since prepare(); may be read from any thread */
+    uint64_t getNumDropped() const { return numDropped.load (std::memory_order_relaxed); }
+
+private:
+    struct ChannelState
+    {
+        float fixedThreshold;
+        float noiseEstimate;
+        int64_t lastCrossing;
+        bool wasPastThreshold;
+    };
+
+    void updateNoiseEstimate (ChannelState& state, const float* data, int numSamples);
+
+    std::vector<ChannelState> channels;
+    std::vector<float> scratch;
+    std::vector<CrossingRecord> crossings;
+
+    Mode mode;
+    float sampleRate;
+    float defaultThreshold;
+    float adaptiveMultiplier;
+    float refractoryMs;
+    int64_t refractorySamples;
+
+    std::atomic<uint64_t> numDropped;
+};
+
+#endif // THRESHOLDCROSSINGDETECTOR_H_INCLUDED
@@ -0,0 +1,219 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "Trace.h"
+
+#if ZMQ_INTERFACE_TRACE
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+/** One thread's ring; written by its thread only, read by whoever dumps it */
+struct ThreadBuffer
+{
+    struct Event
+    {
+        std::atomic<const char*> name { nullptr };
+        std::atomic<uint64_t> begin { 0 };
+        std::atomic<uint64_t> end { 0 };
+    };
+
+    explicit ThreadBuffer (int threadId) : id (threadId), events (Trace::EVENTS_PER_THREAD) {}
+
+    int id;
+    std::atomic<const char*> name { nullptr };
+    std::vector<Event> events;
+    std::atomic<uint64_t> numWritten { 0 };
+};
+
+std::mutex registryLock;
+std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+// a ring set aside for the next real-time thread
+std::atomic<ThreadBuffer*> reservedBuffer { nullptr };
+
+// the calling thread's ring; buffers outlive their threads
+thread_local ThreadBuffer* threadBuffer = nullptr;
+thread_local bool realtimeThread = false;
+
+ThreadBuffer* createBuffer()
+{
+    std::lock_guard<std::mutex> lock (registryLock);
+    buffers.emplace_back (new ThreadBuffer ((int) buffers.size() + 1));
+    return buffers.back().get();
+}
+
+/** Returns the calling thread's ring; null on a real-time thread that has none */
+ThreadBuffer* getThreadBuffer()
+{
+    if (threadBuffer == nullptr && ! realtimeThread)
+        threadBuffer = createBuffer();
+
+    return threadBuffer;
+}
+
+void appendEscaped (std::string& out, const std::string& text)
+{
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if ((unsigned char) c >= 0x20)
+            out += c;
+    }
+}
+} // namespace
+
+namespace Trace
+{
+uint64_t now()
+{
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record (const char* name, uint64_t beginNs, uint64_t endNs)
+{
+    ThreadBuffer* buffer = getThreadBuffer();
+    if (buffer == nullptr)
+        return;
+
+    const uint64_t index = buffer->numWritten.load (std::memory_order_relaxed);
+    ThreadBuffer::Event& event = buffer->events[index % EVENTS_PER_THREAD];
+
+    // orders the previous numWritten store before the slot is overwritten (see toChromeJson)
+    std::atomic_thread_fence (std::memory_order_release);
+
+    event.name.store (name, std::memory_order_relaxed);
+    event.begin.store (beginNs, std::memory_order_relaxed);
+    event.end.store (endNs, std::memory_order_relaxed);
+
+    buffer->numWritten.store (index + 1, std::memory_order_release);
+}
+
+void setThreadName (const char* name)
+{
+    if (ThreadBuffer* buffer = getThreadBuffer())
+        buffer->name.store (name, std::memory_order_relaxed);
+}
+
+void reserveRealtimeThread()
+{
+    if (reservedBuffer.load() != nullptr)
+        return;
+
+    ThreadBuffer* buffer = createBuffer();
+    ThreadBuffer* expected = nullptr;
+
+    // another caller may have won; its ring stays registered and unused
+    reservedBuffer.compare_exchange_strong (expected, buffer);
+}
+
+void setRealtimeThread (const char* name)
+{
+    realtimeThread = true;
+
+    if (threadBuffer == nullptr)
+        threadBuffer = reservedBuffer.exchange (nullptr);
+
+    if (threadBuffer != nullptr && threadBuffer->name.load (std::memory_order_relaxed) != name)
+        threadBuffer->name.store (name, std::memory_order_relaxed);
+}
+
+std::string toChromeJson()
+{
+    std::lock_guard<std::mutex> lock (registryLock);
+
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    char line[256];
+
+    for (auto& buffer : buffers)
+    {
+        if (const char* threadName = buffer->name.load (std::memory_order_relaxed))
+        {
+            out += first ? "" : ",";
+            out += "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string (buffer->id) + ",\"args\":{\"name\":\"";
+            appendEscaped (out, threadName);
+            out += "\"}}";
+            first = false;
+        }
+
+        const uint64_t written = buffer->numWritten.load (std::memory_order_acquire);
+        const uint64_t oldest = written > (uint64_t) EVENTS_PER_THREAD ? written - EVENTS_PER_THREAD : 0;
+
+        for (uint64_t i = oldest; i < written; i++)
+        {
+            const ThreadBuffer::Event& event = buffer->events[i % EVENTS_PER_THREAD];
+            const char* name = event.name.load (std::memory_order_relaxed);
+            const uint64_t begin = event.begin.load (std::memory_order_relaxed);
+            const uint64_t end = event.end.load (std::memory_order_relaxed);
+
+            // skip slots the thread has overwritten, or may be overwriting, while we
+            // were reading: slot i is rewritten as event i + EVENTS_PER_THREAD, before
+            // numWritten moves past it
+            std::atomic_thread_fence (std::memory_order_acquire);
+
+            if (buffer->numWritten.load (std::memory_order_relaxed) - i >= (uint64_t) EVENTS_PER_THREAD || name == nullptr)
+                continue;
+
+            std::snprintf (line,
+                           sizeof (line),
+                           "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                           first ? "" : ",",
+                           name,
+                           buffer->id,
+                           begin / 1000.0,
+                           (std::max (end, begin) - begin) / 1000.0);
+
+            out += line;
+            first = false;
+        }
+    }
+
+    out += "\n]}\n";
+    return out;
+}
+
+bool writeFile (const std::string& path)
+{
+    FILE* file = std::fopen (path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    const std::string json = toChromeJson();
+    const bool ok = std::fwrite (json.data(), 1, json.size(), file) == json.size();
+
+    return std::fclose (file) == 0 && ok;
+}
+} // namespace Trace
+
+#endif
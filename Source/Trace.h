@@ -0,0 +1,115 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+/**
+    Optional tracing of the plugin's hot paths, for attributing latency
+    spikes to checkForEvents, routing, JSON encoding, zmq_msg_send and
+    the control paths.
+
+    Built only with the CMake option ZMQ_INTERFACE_TRACE (which defines
+    ZMQ_INTERFACE_TRACE=1); otherwise the macros expand to nothing and
+    cost nothing.
+
+    TRACE_SCOPE ("name") records the time spent until the end of the
+    enclosing scope. Each thread writes its events to its own fixed-size
+    ring, without locks or allocation; when a ring is full the oldest
+    events are overwritten. Names must be string literals.
+
+    Other threads get their ring on their first event. The audio thread
+    must not allocate, so it takes one reserved beforehand:
+    TRACE_RESERVE_REALTIME_THREAD() (e.g. in startAcquisition) sets one
+    aside, and TRACE_REALTIME_THREAD ("name") claims it. Without a reserved
+    ring the real-time thread records nothing.
+
+    Trace::toChromeJson() renders the recorded events in the Chrome trace
+    event format, which chrome://tracing and ui.perfetto.dev open.
+*/
+
+#if ZMQ_INTERFACE_TRACE
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace Trace
+{
+/** Events kept per thread */
+const int EVENTS_PER_THREAD = 1 << 16;
+
+/** Returns the current time in nanoseconds */
+uint64_t now();
+
+/** Records one complete event on the calling thread */
+void record (const char* name, uint64_t beginNs, uint64_t endNs);
+
+/** Names the calling thread in the trace */
+void setThreadName (const char* name);
+
+/** Sets a ring aside for a real-time thread, unless one is already waiting */
+void reserveRealtimeThread();
+
+/** Makes the calling thread a real-time one: it uses the reserved ring, never allocates,
+    and records nothing if none was reserved. Cheap to repeat */
+void setRealtimeThread (const char* name);
+
+/** Renders the events of all threads as Chrome trace JSON */
+std::string toChromeJson();
+
+/** Writes toChromeJson() to a file; returns false on failure */
+bool writeFile (const std::string& path);
+
+class Scope
+{
+public:
+    explicit Scope (const char* scopeName) : name (scopeName), begin (now()) {}
+    ~Scope() { record (name, begin, now()); }
+
+private:
+    const char* name;
+    uint64_t begin;
+};
+} // namespace Trace
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER (a, b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT (traceScope, __LINE__) (name)
+#define TRACE_THREAD(name) Trace::setThreadName (name)
+#define TRACE_REALTIME_THREAD(name) Trace::setRealtimeThread (name)
+#define TRACE_RESERVE_REALTIME_THREAD() Trace::reserveRealtimeThread()
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_THREAD(name)
+#define TRACE_REALTIME_THREAD(name)
+#define TRACE_RESERVE_REALTIME_THREAD()
+
+#endif
+
+#endif // TRACE_H_INCLUDED
@@ -27,7 +27,9 @@
  */
 
 #include "ZmqInterface.h"
+#include "LocalStreamApi.h"
 #include "ZmqInterfaceEditor.h"
+#include <cmath>
 #include <errno.h>
 #include <iostream>
 #include <string.h>
@@ -37,6 +39,53 @@
 #define DEBUG_ZMQ
 const int MAX_MESSAGE_LENGTH = 64000;
 
+// largest payload of one history or retransmit reply; clients page through longer ranges
+const int64 MAX_REPLY_BYTES = 16 * 1024 * 1024;
+
+// largest history reply on the listening socket, which other clients share
+const int64 MAX_LISTEN_HISTORY_BYTES = 1024 * 1024;
+
+// most sequence numbers one retransmit request can ask for
+const int64 MAX_RETRANSMIT_REQUEST = 10000;
+
+// binary frames per message kept for retransmission
+const int MAX_MESSAGE_FRAMES = 4;
+
+// envelopes of the message topics
+static const char* topicEnvelopes[] = { "DATA", "EVENT", "CROSSINGS", "LINES" };
+
+// blocks a local stream can have handed out at once, and the samples per channel each
+// is sized for before acquisition; longer blocks are dropped
+const int LOCAL_STREAM_POOL_SIZE = 256;
+const int LOCAL_STREAM_MAX_SAMPLES = 1024;
+
+// ZMQ_AFFINITY masks of the two context I/O threads
+const uint64 DATA_IO_THREAD = 1;
+const uint64 EVENT_IO_THREAD = 2;
+
+// decimation of the DATA topic while the CPU governor sheds load
+const int GOVERNOR_DECIMATION = 4;
+
+// commands decoded from one binary control request
+const int MAX_CONTROL_RECORDS = 1024;
+
+// libzmq keeps message bodies up to this size inside zmq_msg_t; larger ones are allocated
+const size_t ZMQ_INLINE_MESSAGE_SIZE = 33;
+
+// zero-copy frames that may wait in libzmq's queues at once; beyond that frames are copied
+const size_t FRAME_HANDLE_POOL_SIZE = 8192;
+
+// real-time audit reports logged per timer tick
+const int MAX_AUDIT_REPORTS_LOGGED = 8;
+
+// storage of one binary spike or TTL batch, reserved before acquisition; a full batch is sent early
+const size_t MAX_BATCH_SPIKES = 256;
+const size_t MAX_BATCH_TTLS = 256;
+const size_t MAX_BATCH_WAVEFORM_SAMPLES = 256 * 4 * 64;
+
+// clients whose stats reports are kept for the metrics reply
+const size_t MAX_CLIENT_STATS = 256;
+
 struct EventData
 {
     uint8 type;
@@ -44,30 +93,93 @@ struct EventData
     uint8 eventChannel;
     uint8 numBytes;
     int sampleNum;
-    time_t eventTime;
+    int64 eventTimeMs;
     char application[256];
     char uuid[256];
     bool isEvent;
 };
 
+// a control connection of a client was identified or dropped
+struct ConnectionEvent
+{
+    char uuid[40];
+    int64 timeMs;
+    uint8 connected;
+};
+
+// how far a client is behind, after one of its lag reports
+struct LagReport
+{
+    char uuid[40];
+    int64 lag;
+    uint32 queueDepth;
+    uint32 processingUs;
+    uint8 lagging;
+};
+
+// the pipe carries one EventData (JSON requests), a batch of records (binary
+// requests), one ConnectionEvent or one LagReport; they are told apart by size
+static_assert (sizeof (EventData) % sizeof (ControlProtocol::Record) != 0, "pipe messages must be distinguishable by size");
+static_assert (sizeof (ConnectionEvent) < sizeof (ControlProtocol::Record) && sizeof (ConnectionEvent) != sizeof (EventData), "pipe messages must be distinguishable by size");
+static_assert (sizeof (LagReport) < sizeof (ControlProtocol::Record) && sizeof (LagReport) != sizeof (ConnectionEvent), "pipe messages must be distinguishable by size");
+
 ZmqInterface::ZmqInterface (const String& processorName)
     : GenericProcessor (processorName), Thread ("ZMQ thread")
 {
     context = nullptr;
     socket = nullptr;
+    eventSocket = nullptr;
     listenSocket = nullptr;
+    historySocket = nullptr;
+    historyThreadShouldExit = false;
+    historyPort = 0;
     controlSocket = nullptr;
     killSocket = nullptr;
     pipeInSocket = nullptr;
     pipeOutSocket = nullptr;
 
     messageNumber = 0;
+    for (auto& sequence : topicSequences)
+        sequence = 0;
     dataPort = 5556;
     listenPort = dataPort + 1;
+    eventPort = 5560;
+    eventHighWaterMark = 10000;
+    separateEventSocket = false;
     selectedStream = 0;
     selectedStreamSourceNodeId = 0;
     selectedStreamName = "";
     selectedStreamSampleRate = 0.0f;
+    routing = nullptr;
+
+    ttlFormat = TTL_JSON;
+    lineStatesEnabled = false;
+    lineStates = 0;
+    linesChanged = 0;
+
+    spikeFormat = SPIKE_JSON;
+    spikeWaveform = WAVEFORM_FULL;
+    spikeWindow = 8;
+
+    crossingsEnabled = false;
+    publishSelected = true;
+
+    heartbeatIntervalMs = 1000;
+    heartbeatTimeoutMs = 3000;
+    clientTimeoutMs = 5000;
+
+    lagPolicy = LAG_REPORT;
+    lagThreshold = 100;
+
+    governorLevel = CpuGovernor::NORMAL;
+    loggedGovernorLevel = CpuGovernor::NORMAL;
+
+    controlRecords.resize (MAX_CONTROL_RECORDS);
+
+    frameHandles.reset (new FrameHandle[FRAME_HANDLE_POOL_SIZE]);
+    nextFrameHandle = 0;
+
+    encodingCache.setPool (&encoderPool);
 
     createContext();
     openKillSocket();
@@ -84,8 +196,15 @@ ZmqInterface::~ZmqInterface()
     // zmq_msg_close(&messageEnvelope);
     // LOGD("Sent stop message");
 
+    if (localStream != nullptr)
+        LocalStreamRegistry::getInstance().removeStream (localStream->getName());
+
+    reliableChannel.stop();
+    encoderPool.stop();
+    closeEventSocket();
     closeDataSocket();
     closeListenSocket(); // stop the polling thread
+    closeHistorySocket();
 
     zmq_close (pipeOutSocket);
     zmq_close (killSocket);
@@ -104,6 +223,67 @@ void ZmqInterface::registerParameters()
     addMaskChannelsParameter (Parameter::STREAM_SCOPE, "channels", "Channels", "The input channels data to send");
     addSelectedStreamParameter (Parameter::PROCESSOR_SCOPE, "stream", "Stream", "The selected stream to send data from", {}, 0, true, true);
     addIntParameter (Parameter::PROCESSOR_SCOPE, "data_port", "Data Port", "Port number to send data", dataPort, 1000, 65535, true);
+
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "publish_selected", "Publish selected", "Publish the channels selected in the editor; turn off if all clients negotiate subscriptions", true, true);
+
+    addStringParameter (Parameter::PROCESSOR_SCOPE, "data_endpoints", "Data endpoints", "Additional endpoints for the data socket, e.g. \"ipc:///tmp/oe-data, inproc://oe-data\"", "", true);
+    addStringParameter (Parameter::PROCESSOR_SCOPE, "listen_endpoints", "Listen endpoints", "Additional endpoints for the listening (heartbeat/control) socket", "", true);
+    addStringParameter (Parameter::PROCESSOR_SCOPE, "event_endpoints", "Event endpoints", "Additional endpoints for the event socket", "", true);
+
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "heartbeat_interval", "Heartbeat interval", "Interval of the ZMTP heartbeats sent to connected clients, in ms; 0 disables them", heartbeatIntervalMs, 0, 60000, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "heartbeat_timeout", "Heartbeat timeout", "Time after which a client that does not answer heartbeats is disconnected, in ms", heartbeatTimeoutMs, 10, 600000, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "client_timeout", "Client timeout", "Time without requests after which a client without a live connection is considered gone, in ms", clientTimeoutMs, 100, 600000, true);
+
+    addCategoricalParameter (Parameter::PROCESSOR_SCOPE, "lag_policy", "Lag policy", "What to do when clients report falling behind: only report it, or thin the blocks of subscriptions whose clients all lag", { "Report", "Thin subscriptions" }, 0, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "lag_threshold", "Lag threshold", "Messages behind at which a client counts as lagging; it recovers below half of this", lagThreshold, 1, 1000000, true);
+
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "event_socket", "Event socket", "Publish events and spikes on a separate low-latency socket", false, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "event_port", "Event Port", "Port number to send events and spikes", eventPort, 1000, 65535, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "event_hwm", "Event HWM", "Maximum number of queued messages per subscriber on the event socket", eventHighWaterMark, 100, 1000000, true);
+
+    addCategoricalParameter (Parameter::PROCESSOR_SCOPE, "chunk_mode", "Chunking", "Send data per GUI block, in fixed-size chunks, or coalesced up to a size or latency limit", { "Block", "Fixed size", "Max latency" }, 0, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "chunk_samples", "Chunk size", "Samples per chunk (fixed size) or maximum samples per chunk (max latency)", 1024, 1, 65536, true);
+    addFloatParameter (Parameter::PROCESSOR_SCOPE, "chunk_latency", "Max latency", "Longest span of sample time held in a coalesced chunk", "ms", 10.0f, 0.0f, 1000.0f, 0.5f, true);
+
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "shared_memory", "Shared memory", "Also publish continuous data to a shared memory ring for readers on this machine", false, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "shm_slots", "Ring slots", "Number of blocks held in the shared memory ring", 256, 4, 65536, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "shm_block_size", "Slot size", "Samples per channel in one shared memory slot (longer blocks use several slots)", 1024, 16, 65536, true);
+
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "history", "History", "Keep recent data so clients can request ranges they missed over the listening socket", false, true);
+    addFloatParameter (Parameter::PROCESSOR_SCOPE, "history_seconds", "History length", "Seconds of data kept for history requests", "s", 10.0f, 0.1f, 3600.0f, 0.1f, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "history_mb", "History memory", "Upper bound on the memory used by the history, in MB", 256, 1, 65536, true);
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "history_mmap", "File-backed history", "Keep the history in a memory-mapped temporary file instead of RAM", false, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "history_port", "History Port", "Port number of the socket serving history requests (the listening socket answers them in smaller replies)", 5561, 1000, 65535, true);
+
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "retransmit", "Retransmit", "Keep recent messages so clients can request missed sequence numbers over the listening socket", false, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "retransmit_mb", "Retransmit memory", "Memory used to keep messages for retransmission, in MB", 64, 1, 4096, true);
+
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "reliable", "Reliable channel", "Deliver all messages without drops to credit-based consumers on a ROUTER socket", false, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "reliable_port", "Reliable Port", "Port number of the reliable channel", 5559, 1000, 65535, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "reliable_mb", "Reliable memory", "Memory for messages waiting for consumer credit, in MB", 256, 1, 16384, true);
+
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "encoder_threads", "Encoder threads", "Worker threads sharing the encoding of large channel sets; 0 encodes on the processing thread", 0, 0, 64, true);
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "encoder_pinning", "Pin encoders", "Bind each encoder thread to its own core", false, true);
+
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "governor", "CPU governor", "Shed load step by step when processing takes more than the CPU budget: drop crossings and line states, decimate, quantize, then send only the priority channels", false, true);
+    addFloatParameter (Parameter::PROCESSOR_SCOPE, "cpu_budget", "CPU budget", "Share of the block period the plugin may spend processing a block", "%", 50.0f, 5.0f, 100.0f, 1.0f, true);
+    addStringParameter (Parameter::PROCESSOR_SCOPE, "governor_priority", "Priority channels", "Channels still sent at the last governor step, e.g. \"0, 1, 5\" (default: the first half of the selected channels)", "", true);
+
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "local_api", "Local API", "Share published blocks with other plugins in this process (see LocalStreamApi.h)", false, true);
+
+    addCategoricalParameter (Parameter::PROCESSOR_SCOPE, "ttl_format", "TTL format", "One JSON message per TTL event, or one binary message per block", { "JSON", "Binary" }, 0, true);
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "line_states", "Line states", "Publish the state of all TTL lines once per block", false, true);
+
+    addCategoricalParameter (Parameter::PROCESSOR_SCOPE, "spike_format", "Spike format", "One JSON message per spike, or one binary message per block", { "JSON", "Binary" }, 0, true);
+    addCategoricalParameter (Parameter::PROCESSOR_SCOPE, "spike_waveform", "Spike waveform", "Waveform data sent with batched spikes", { "Full", "Peak channel", "Trimmed", "None" }, 0, true);
+    addIntParameter (Parameter::PROCESSOR_SCOPE, "spike_window", "Spike window", "Samples kept on each side of the peak for trimmed waveforms", spikeWindow, 1, 128, true);
+
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "crossings", "Crossings", "Publish threshold crossings of the selected channels", false, true);
+    addCategoricalParameter (Parameter::PROCESSOR_SCOPE, "crossing_mode", "Crossing mode", "Fixed thresholds or adaptive (MAD-based) thresholds", { "Fixed", "Adaptive" }, 1, true);
+    addFloatParameter (Parameter::PROCESSOR_SCOPE, "crossing_threshold", "Threshold", "Fixed crossing threshold (negative values detect downward crossings)", "uV", -50.0f, -5000.0f, 5000.0f, 1.0f, true);
+    addStringParameter (Parameter::PROCESSOR_SCOPE, "crossing_channel_thresholds", "Channel thresholds", "Per-channel fixed thresholds, e.g. \"3:-80, 12:-65\"", "", true);
+    addFloatParameter (Parameter::PROCESSOR_SCOPE, "crossing_multiplier", "MAD multiplier", "Adaptive threshold in multiples of the estimated noise", "", 4.5f, 1.0f, 20.0f, 0.1f, true);
+    addFloatParameter (Parameter::PROCESSOR_SCOPE, "crossing_refractory", "Refractory", "Minimum interval between crossings on one channel", "ms", 1.0f, 0.0f, 100.0f, 0.1f, true);
 }
 
 AudioProcessorEditor* ZmqInterface::createEditor()
@@ -116,6 +296,8 @@ void ZmqInterface::initialize (bool signalChainIsLoading)
 {
     openListenSocket();
     openDataSocket();
+    openEventSocket();
+    openHistorySocket();
 }
 
 OwnedArray<ZmqApplication>* ZmqInterface::getApplicationList()
@@ -130,6 +312,10 @@ int ZmqInterface::createContext()
     context = zmq_ctx_new();
     if (! context)
         return -1;
+
+    // one I/O thread for bulk data, one for events (see socket affinities)
+    zmq_ctx_set (context, ZMQ_IO_THREADS, 2);
+
     return 0;
 }
 
@@ -142,6 +328,12 @@ int ZmqInterface::openDataSocket()
         socket = zmq_socket (context, ZMQ_PUB);
         if (! socket)
             return -1;
+
+        uint64 affinity = DATA_IO_THREAD;
+        zmq_setsockopt (socket, ZMQ_AFFINITY, &affinity, sizeof (affinity));
+        applyHeartbeat (socket);
+        dataMonitor.start (context, socket, "inproc://zmqmonitordata");
+
         String urlstring;
         urlstring = String ("tcp://*:") + String (dataPort);
         LOGD ("[ZMQ data socket] ", urlstring);
@@ -155,17 +347,44 @@ int ZmqInterface::openDataSocket()
 
             getParameter ("data_port")->setNextValue (dataPort, false);
         }
+
+        bindEndpoints (socket, getParameter ("data_endpoints")->getValueAsString());
     }
 
     return 0;
 }
 
+int ZmqInterface::bindEndpoints (void* targetSocket, const String& endpoints)
+{
+    StringArray list;
+    list.addTokens (endpoints, ",; ", "");
+    list.trim();
+    list.removeEmptyStrings();
+
+    int numBound = 0;
+
+    // every endpoint is bound to the same socket, so each message is
+    // serialized once and fanned out to all transports by libzmq
+    for (auto& endpoint : list)
+    {
+        LOGD ("[ZMQ extra endpoint] ", endpoint);
+
+        if (zmq_bind (targetSocket, endpoint.toRawUTF8()) == 0)
+            numBound++;
+        else
+            LOGE ("Couldn't bind ", endpoint, ": ", zmq_strerror (zmq_errno()));
+    }
+
+    return numBound;
+}
+
 int ZmqInterface::closeDataSocket()
 {
     if (socket)
     {
         LOGD ("Closing data socket");
 
+        dataMonitor.stop();
         int rc = zmq_close (socket);
         jassert (rc == 0);
         socket = nullptr;
@@ -173,6 +392,63 @@ int ZmqInterface::closeDataSocket()
     return 0;
 }
 
+int ZmqInterface::openEventSocket()
+{
+    if (separateEventSocket && ! eventSocket)
+    {
+        LOGD ("Opening event socket");
+
+        eventSocket = zmq_socket (context, ZMQ_PUB);
+        if (! eventSocket)
+            return -1;
+
+        // events get their own I/O thread and queue limit, so they never
+        // wait behind continuous data in the data socket's TCP stream
+        uint64 affinity = EVENT_IO_THREAD;
+        zmq_setsockopt (eventSocket, ZMQ_AFFINITY, &affinity, sizeof (affinity));
+        zmq_setsockopt (eventSocket, ZMQ_SNDHWM, &eventHighWaterMark, sizeof (eventHighWaterMark));
+        applyHeartbeat (eventSocket);
+        eventMonitor.start (context, eventSocket, "inproc://zmqmonitorevents");
+
+        String urlstring;
+        urlstring = String ("tcp://*:") + String (eventPort);
+        LOGD ("[ZMQ event socket] ", urlstring);
+        int rc = zmq_bind (eventSocket, urlstring.toRawUTF8());
+        if (rc)
+        {
+            LOGE ("Couldn't open event socket, sending events on the data socket! ", zmq_strerror (zmq_errno()));
+
+            eventMonitor.stop();
+            zmq_close (eventSocket);
+            eventSocket = nullptr;
+            return -1;
+        }
+
+        bindEndpoints (eventSocket, getParameter ("event_endpoints")->getValueAsString());
+    }
+
+    return 0;
+}
+
+int ZmqInterface::closeEventSocket()
+{
+    if (eventSocket)
+    {
+        LOGD ("Closing event socket");
+
+        eventMonitor.stop();
+        int rc = zmq_close (eventSocket);
+        jassert (rc == 0);
+        eventSocket = nullptr;
+    }
+    return 0;
+}
+
+void* ZmqInterface::getEventSocket() const
+{
+    return eventSocket != nullptr ? eventSocket : socket;
+}
+
 void ZmqInterface::openListenSocket()
 {
     if (! listenSocket)
@@ -180,6 +456,8 @@ void ZmqInterface::openListenSocket()
         LOGD ("Opening listening socket");
 
         listenSocket = zmq_socket (context, ZMQ_REP);
+        applyHeartbeat (listenSocket);
+
         String urlstring;
         urlstring = String ("tcp://*:") + String (listenPort);
         LOGD ("[ZMQ listen socket] ", urlstring);
@@ -195,9 +473,11 @@ void ZmqInterface::openListenSocket()
             return;
         }
 
+        bindEndpoints (listenSocket, getParameter ("listen_endpoints")->getValueAsString());
+
         startThread();
         LOGD ("Starting timer callbacks");
-        startTimer (500);
+        startTimer (100);
     }
 }
 
@@ -234,8 +514,168 @@ void ZmqInterface::openPipeOutSocket()
     zmq_bind (pipeOutSocket, "inproc://zmqthreadpipe");
 }
 
+void ZmqInterface::applyHeartbeat (void* targetSocket)
+{
+    // libzmq pings every peer that speaks ZMTP 3.1 and drops connections
+    // that stay silent for the timeout; the TTL asks peers to do the same
+    const int ttl = jmin (heartbeatTimeoutMs, 6553599);
+
+    zmq_setsockopt (targetSocket, ZMQ_HEARTBEAT_IVL, &heartbeatIntervalMs, sizeof (heartbeatIntervalMs));
+    zmq_setsockopt (targetSocket, ZMQ_HEARTBEAT_TIMEOUT, &heartbeatTimeoutMs, sizeof (heartbeatTimeoutMs));
+    zmq_setsockopt (targetSocket, ZMQ_HEARTBEAT_TTL, &ttl, sizeof (ttl));
+}
+
+void ZmqInterface::pollMonitors()
+{
+    SocketMonitor::Event event;
+
+    while (dataMonitor.readEvent (event))
+    {
+    }
+
+    while (eventMonitor.readEvent (event))
+    {
+    }
+}
+
+void ZmqInterface::handleListenEvent (const SocketMonitor::Event& event)
+{
+    if (event.type == ZMQ_EVENT_ACCEPTED)
+    {
+        // the descriptor may be reused by a new connection
+        controlPeers.erase (event.value);
+    }
+    else if (event.type == ZMQ_EVENT_DISCONNECTED)
+    {
+        auto it = controlPeers.find (event.value);
+        if (it == controlPeers.end())
+            return;
+
+        sendConnectionEvent (it->second, false);
+        controlPeers.erase (it);
+    }
+}
+
+void ZmqInterface::trackControlPeer (int peerFd, const std::string& uuid)
+{
+    // inproc connections have no descriptor and are not monitored
+    if (peerFd < 0 || uuid.empty())
+        return;
+
+    auto it = controlPeers.find (peerFd);
+    if (it != controlPeers.end() && it->second == uuid)
+        return;
+
+    controlPeers[peerFd] = uuid;
+    sendConnectionEvent (uuid, true);
+}
+
+void ZmqInterface::sendConnectionEvent (const std::string& uuid, bool connected)
+{
+    ConnectionEvent ce;
+    memset (&ce, 0, sizeof (ce));
+    strncpy (ce.uuid, uuid.c_str(), sizeof (ce.uuid) - 1);
+    ce.timeMs = Time::currentTimeMillis();
+    ce.connected = connected ? 1 : 0;
+
+    zmq_send (pipeInSocket, &ce, sizeof (ce), 0);
+}
+
+ZmqInterface::ClientStats* ZmqInterface::findClientStats (const std::string& uuid)
+{
+    auto it = clientStats.find (uuid);
+
+    if (it == clientStats.end() && clientStats.size() < MAX_CLIENT_STATS)
+        it = clientStats.emplace (uuid, ClientStats()).first;
+
+    return it != clientStats.end() ? &it->second : nullptr;
+}
+
+void ZmqInterface::handleLagReport (const std::string& uuid, const var& report)
+{
+    ClientStats* stats = findClientStats (uuid);
+    if (stats == nullptr)
+        return;
+
+    stats->time = Time::currentTimeMillis();
+    stats->queueDepth = (uint32) (int64) report.getProperty ("queue_depth", 0);
+    stats->processingUs = (uint32) (int64) report.getProperty ("processing_us", 0);
+
+    if (DynamicObject* sequences = report["seq"].getDynamicObject())
+        for (auto& entry : sequences->getProperties())
+            updateTopicLag (*stats, entry.name.toString().toStdString(), (uint64) (int64) entry.value);
+
+    applyLagReport (uuid, *stats);
+}
+
+void ZmqInterface::updateTopicLag (ClientStats& stats, const std::string& topic, uint64 lastSequence)
+{
+    uint64 current = 0;
+    bool found = false;
+
+    for (int i = 0; i < NUM_TOPICS && ! found; i++)
+    {
+        if (topic == topicEnvelopes[i])
+        {
+            current = topicSequences[i].load (std::memory_order_relaxed); // written by the processing thread
+            found = true;
+        }
+    }
+
+    if (! found)
+        found = subscriptions.getSequence (topic, current);
+
+    // unknown topics are ignored; the number of topics kept per client is bounded
+    if (! found || (stats.topicLags.count (topic) == 0 && stats.topicLags.size() >= NUM_TOPICS + 16))
+        return;
+
+    stats.topicLags[topic] = current > lastSequence ? (int64) (current - lastSequence) : 0;
+}
+
+void ZmqInterface::applyLagReport (const std::string& uuid, ClientStats& stats)
+{
+    int64 lag = 0;
+    for (auto& entry : stats.topicLags)
+        lag = jmax (lag, entry.second);
+
+    stats.lag = lag;
+
+    // hysteresis: lagging above the threshold, recovered below half of it
+    const bool wasLagging = stats.lagging;
+
+    if (lag > lagThreshold)
+        stats.lagging = true;
+    else if (lag < lagThreshold / 2)
+        stats.lagging = false;
+
+    if (lagPolicy == LAG_THIN)
+        subscriptions.setClientLagging (uuid, stats.lagging);
+
+    LagReport report;
+    memset (&report, 0, sizeof (report));
+    strncpy (report.uuid, uuid.c_str(), sizeof (report.uuid) - 1);
+    report.lag = lag;
+    report.queueDepth = stats.queueDepth;
+    report.processingUs = stats.processingUs;
+    report.lagging = stats.lagging ? 1 : 0;
+
+    if (stats.lagging != wasLagging || lag != stats.reportedLag)
+    {
+        zmq_send (pipeInSocket, &report, sizeof (report), 0);
+        stats.reportedLag = lag;
+    }
+}
+
 void ZmqInterface::timerCallback()
 {
+    TRACE_THREAD ("message");
+
+    pollMonitors();
+
+    checkGovernor();
+
+    checkRealtimeAudit();
+
     receiveEvents();
 
     checkForApplications();
@@ -244,6 +684,7 @@ void ZmqInterface::timerCallback()
 void ZmqInterface::run()
 {
     LOGD ("Starting ZMQ thread");
+    TRACE_THREAD ("zmq");
 
     char* buffer = new char[MAX_MESSAGE_LENGTH];
 
@@ -257,36 +698,93 @@ void ZmqInterface::run()
 
     int size;
 
+    // connections of the control clients, so a dropped one is noticed at once
+    const bool monitoring = listenMonitor.start (context, listenSocket, "inproc://zmqmonitorlisten");
+    controlPeers.clear();
+
     zmq_pollitem_t items[] = {
         { listenSocket, 0, ZMQ_POLLIN, 0 },
-        { controlSocket, 0, ZMQ_POLLIN, 0 }
+        { controlSocket, 0, ZMQ_POLLIN, 0 },
+        { listenMonitor.getSocket(), 0, ZMQ_POLLIN, 0 }
     };
 
     while (! threadShouldExit())
     {
-        zmq_poll (items, 2, 100);
+        zmq_poll (items, monitoring ? 3 : 2, 100);
+
+        if (monitoring && (items[2].revents & ZMQ_POLLIN))
+        {
+            SocketMonitor::Event event;
+
+            while (listenMonitor.readEvent (event))
+                handleListenEvent (event);
+        }
 
         if (items[0].revents & ZMQ_POLLIN)
         {
-            size = zmq_recv (listenSocket, buffer, MAX_MESSAGE_LENGTH - 1, 0);
-            buffer[size] = 0;
+            TRACE_SCOPE ("listen request");
+
+            zmq_msg_t request;
+            zmq_msg_init (&request);
+
+            size = zmq_msg_recv (&request, listenSocket, 0);
 
             if (size < 0)
             {
                 LOGE ("Failed in receiving listen socket");
                 LOGE (zmq_strerror (zmq_errno()));
+                zmq_msg_close (&request);
                 jassert (false);
+                continue;
+            }
+
+            size = jmin (size, MAX_MESSAGE_LENGTH - 1);
+            memcpy (buffer, zmq_msg_data (&request), (size_t) size);
+            buffer[size] = 0;
+
+            const int peerFd = zmq_msg_get (&request, ZMQ_SRCFD);
+            zmq_msg_close (&request);
+
+            if (size > 0 && ControlProtocol::isRequest (buffer, (size_t) size))
+            {
+                handleControlRequest (buffer, (size_t) size, peerFd);
+                continue;
             }
+
             var v;
             Result rs = JSON::parse (String (buffer), v);
             bool ok = rs.wasOk();
 
+            if (ok && v["type"].toString() == "history")
+            {
+                sendHistory (v, listenSocket, MAX_LISTEN_HISTORY_BYTES, historyBuffer);
+                continue;
+            }
+
+            if (ok && v["type"].toString() == "retransmit")
+            {
+                sendRetransmissions (v);
+                continue;
+            }
+
+            if (ok && v["type"].toString() == "metrics")
+            {
+                sendMetrics();
+                continue;
+            }
+
+            if (ok && v["type"].toString() == "trace")
+            {
+                sendTrace (v);
+                continue;
+            }
+
             EventData ed;
             String app = v["application"];
             String appUuid = v["uuid"];
             strncpy (ed.application, app.toRawUTF8(), 255);
             strncpy (ed.uuid, appUuid.toRawUTF8(), 255);
-            ed.eventTime = time (NULL);
+            ed.eventTimeMs = Time::currentTimeMillis();
 
             String evT = v["type"];
 
@@ -313,9 +811,18 @@ void ZmqInterface::run()
             size += size_m;
             zmq_msg_close (&message);
 
+            trackControlPeer (peerFd, appUuid.toStdString());
+
+            if (ok && appUuid.isNotEmpty() && v["lag"].isObject())
+                handleLagReport (appUuid.toStdString(), v["lag"]);
+
             // send response
             String response;
-            if (ok)
+            if (ok && (evT == "subscribe" || evT == "unsubscribe"))
+            {
+                response = handleSubscription (v);
+            }
+            else if (ok)
             {
                 if (ed.isEvent)
                 {
@@ -331,12 +838,13 @@ void ZmqInterface::run()
                 response = String ("JSON message could not be read");
             }
 
-            zmq_send (listenSocket, response.getCharPointer(), response.length(), 0);
+            zmq_send (listenSocket, response.toRawUTF8(), response.getNumBytesAsUTF8(), 0);
         }
     }
 
     delete[] buffer;
 
+    listenMonitor.stop();
     zmq_close (pipeInSocket);
     zmq_close (controlSocket);
     pipeInSocket = nullptr;
@@ -357,7 +865,13 @@ void ZmqInterface::run()
     "num_samples": num of samples in this buffer
     "sample_num": index of first sample
     "sample_rate": sampling rate of this channel
+    "bit_volts": microvolts per bit of this channel
   }
+  the numbers of a data header are padded with spaces to a fixed width,
+  which JSON parsers ignore; while the CPU governor decimates (see below)
+  the content also has "decimation" and "encoding", num_samples and
+  sample_rate describe the decimated samples, and int16 data is followed
+  by a frame with the channel's float32 scale (value = int16 * scale)
   (for event)
   {
     "stream" : stream name (string)
@@ -376,6 +890,41 @@ void ZmqInterface::run()
     "sorted_id" : sorted ID (default = 0)
     "threshold" : threshold values across all channels
   }
+  (for ttl, batched binary format)
+  {
+    "stream" : stream name (string)
+    "sample_num" : index of the first sample of the block
+    "num_events" : number of 18-byte TtlRecords in the data frame
+  }
+  a block with more than 256 TTL events is sent in several batches
+  (for line_states, one message per block)
+  {
+    "stream" : stream name (string)
+    "sample_num" : index of the first sample of the block
+    "num_samples" : num of samples in the block
+  }
+  the data frame is a 28-byte LineStateRecord with the state of every
+  line at the end of the block and a mask of lines that changed in it
+  (for spikes, batched binary format)
+  {
+    "stream" : stream name (string)
+    "sample_num" : index of the first sample of the block
+    "num_spikes" : number of 36-byte SpikeRecords in the first data frame
+    "waveform" : "full"|"peak_channel"|"trimmed"|"none"
+    "waveform_size" : size of the second data frame (float32 waveforms,
+                      concatenated in record order, channel-major)
+  }
+  a block with more than 256 spikes (or 65536 waveform samples) is sent
+  in several batches; a waveform too large for any batch is left out and
+  its record has 0 waveform channels and samples
+  (for crossings)
+  {
+    "stream" : stream name (string)
+    "sample_num": index of the first sample of the block
+    "num_samples": num of samples in the block
+    "num_crossings": number of 12-byte records in the data frame
+    "sample_rate": sampling rate of the stream
+  }
   (for parameter) // todo
   {
     "param_name1": param_value1,
@@ -383,88 +932,427 @@ void ZmqInterface::run()
   }
   "data_size": size (if size > 0 it's the size of binary data coming in 
                the next frame (multi-part message))
+  "seq": 64-bit sequence number of the message within its topic (envelope:
+         DATA, EVENT, CROSSINGS or LINES); consecutive without gaps and not
+         reset between acquisitions
  }
  
  and then a possible data packet
+
+ history requests (on the listening socket, with "history" enabled)
+ {
+  "type": "history",
+  "stream": stream name (optional),
+  "sample_num": first sample wanted,
+  "num_samples": number of samples wanted
+ }
+ are answered with a two-part reply: a JSON header with "status"
+ ("ok"|"unavailable"|"unknown_stream"|"disabled"), "stream", "sample_rate",
+ "channels", "sample_num" and "num_samples" actually returned (starting at
+ the oldest sample kept if the request is older) and "oldest_sample" /
+ "newest_sample" (exclusive) of the history, then the samples as float32,
+ channel-major. Replies are capped at 1 MB; request the rest separately.
+ With "history" enabled, the same requests are also served on their own
+ REP socket at "history_port" (default 5561; each reply names it in
+ "history_port"), with replies of up to 16 MB, so long reads don't hold
+ up the listening socket.
+
+ retransmit requests (on the listening socket, with "retransmit" enabled)
+ {
+  "type": "retransmit",
+  "topic": "DATA"|"EVENT"|"CROSSINGS"|"LINES",
+  "ranges": [[first seq, last seq], ...] (inclusive)
+ }
+ are answered with a JSON header listing the sequence numbers "resent",
+ those no longer available ("missing"), the number of frames of each
+ resent message ("frames") and, if the reply was cut at 16 MB or 10000
+ messages, the first sequence number not handled ("next_seq"). The
+ frames of the resent messages follow, each message exactly as
+ published (envelope, header, data frames).
+
+ subscription requests (on the listening socket)
+ {
+  "type": "subscribe",
+  "application": name, "uuid": client id,
+  "stream": stream name (optional, default: first stream),
+  "channels": [channel indices] (optional, default: all),
+  "decimation": integer factor, or "sample_rate": desired rate (optional),
+  "encoding": "float32"|"int16" (optional)
+ }
+ are answered with {"status": "ok", "topic": "SUB-nnnn", ...} describing the
+ topic; subscribe to it on the data socket. Clients with identical requests
+ share a topic. Its messages have "type": "subscription" and carry the
+ decimated samples channel-major (plus per-channel float32 scales for int16,
+ value = int16 * scale). A topic is released with
+ {"type": "unsubscribe", "uuid": client id, "topic": name} or when the
+ client's heartbeat expires; re-sending the same request is harmless.
+ "thinning" in the header is 1 unless the lag policy thins the topic (see
+ below): then only every n-th block of output is sent.
+
+ lag reports: any JSON request with "uuid" (typically the heartbeat) may
+ carry
+ "lag": {
+  "seq": {topic: sequence number of the last message processed, ...},
+  "queue_depth": messages waiting in the client's receive queue,
+  "processing_us": processing time per block in microseconds
+ }
+ (the binary protocol has a LAG command for the same). The plugin turns
+ them into messages behind per topic; a client counts as lagging above
+ "lag_threshold" messages and recovers below half of it. Lag shows in the
+ editor's application list and under "clients" in the metrics. With
+ "lag_policy" set to thin subscriptions, a topic whose clients all lag
+ sends every 2nd, 4th, then 8th block until they catch up, stepping at
+ most once every 2 s.
+
+ {"type": "metrics"} on the listening socket is answered with a JSON
+ object holding the current sequence number of every topic and, if the
+ reliable channel runs, its buffer use ("backpressure", 0..1) and the
+ credit, backlog, sent and dropped counts of every consumer.
+ "governor" has the CPU governor's "level" and "step", its smoothed
+ "load" and "budget" (fractions of the block period) and the number of
+ level "changes". "crossings_dropped" counts the threshold crossings
+ found beyond the storage of a block (64 per channel on average) since the
+ detector was last configured. With "governor" enabled, the plugin measures the time
+ it spends on every block; above the budget it sheds load one step per
+ 0.5 s: drop_features (no crossings or line states), decimate (DATA
+ decimated by 4), quantize (and int16), priority_channels (only the
+ channels in "governor_priority"). It restores one step at a time once
+ the load stays below 60% of the budget, waiting longer after every
+ restore that did not hold.
+ "realtime_audit" (builds with the CMake option ZMQ_INTERFACE_RT_AUDIT
+ only) counts the audited audio-thread blocks, those that allocated,
+ locked or made blocking calls, and the allocations, frees, locks and
+ syscalls seen; every such block is also logged (see RealtimeAudit.h).
+ "encoding_cache" counts the block representations encoded and the
+ requests that reused one already encoded for another topic or consumer.
+ "clients" lists the latest stats report of every client using the binary
+ control protocol (received, missed, latency_us, age_ms) and the lag of
+ every client that reports it (lag, lagging, topic_lag, queue_depth,
+ processing_us).
+ "connections" counts, for the data, event and listening sockets, the
+ peers connected now and the connections accepted, dropped (including
+ those that stopped answering ZMTP heartbeats) and refused during the
+ handshake.
+
+ {"type": "trace"} is answered with the events recorded by the hot-path
+ tracing (process(), sending, control requests) in the Chrome trace event
+ format, for chrome://tracing or ui.perfetto.dev; with "file": path the
+ trace is written there instead and the reply is {"status": "ok", "file":
+ path}. Tracing is compiled in with the CMake option ZMQ_INTERFACE_TRACE
+ only; otherwise the reply is {"status": "disabled"}. Builds with tracing
+ also write the trace to a temporary file on stopping acquisition.
+
+ binary control requests (on the listening socket) start with the magic
+ "ZQC1" and batch heartbeats, events and stats reports of one client in a
+ single request; they are answered with an 8-byte binary reply. The format
+ is described in ControlProtocol.h.
+
+ a client is known from its first request on the listening socket (any
+ JSON message with "uuid", or a binary request). With ZMTP heartbeats on
+ ("heartbeat_interval" > 0) it stays alive as long as that connection:
+ libzmq drops peers that stop answering within "heartbeat_timeout", and the
+ client is released at once. Clients without a monitored connection (e.g.
+ inproc, or with heartbeats off) must send a request every
+ "client_timeout" ms, e.g. the JSON {"type": "heartbeat"}.
  */
 
 bool ZmqInterface::startAcquisition()
 {
+    TRACE_RESERVE_REALTIME_THREAD();
+
     messageNumber = 0;
 
+    {
+        RcuPointer<Routing>::ReadLock current (routingTable);
+
+        current->crossingDetector->reset();
+        current->rechunker->reset();
+
+        if (current->history != nullptr)
+            current->history->reset();
+    }
+
+    if (localStream != nullptr)
+        localStream->prepare ((int) chunkInputs.size(), LOCAL_STREAM_MAX_SAMPLES);
+
+    ttlRecords.clear();
+    ttlRecords.reserve (MAX_BATCH_TTLS);
+    lineStates = 0;
+    linesChanged = 0;
+
+    spikeRecords.clear();
+    spikeWaveforms.clear();
+    spikeRecords.reserve (MAX_BATCH_SPIKES);
+    spikeWaveforms.reserve (MAX_BATCH_WAVEFORM_SAMPLES);
+
     return true;
 }
 
 bool ZmqInterface::stopAcquisition()
 {
-    LOGC ("ZMQ Interface -- total messages sent: ", messageNumber);
+    {
+        RcuPointer<Routing>::ReadLock current (routingTable);
+        routing = current.get();
+
+        if (routing->rechunker->getNumPendingSamples() > 0)
+            routing->rechunker->flush ([this] (int64 chunkSampleNum, int chunkSamples)
+                                       { sendChunk (chunkSampleNum, chunkSamples); });
+
+        routing = nullptr;
+    }
+
+    LOGC ("ZMQ Interface -- total messages sent: ", messageNumber.load());
+
+#if ZMQ_INTERFACE_TRACE
+    const File traceFile = File::getSpecialLocation (File::tempDirectory).getNonexistentChildFile ("zmq-interface-trace", ".json");
+
+    if (Trace::writeFile (traceFile.getFullPathName().toStdString()))
+        LOGC ("ZMQ Interface -- trace written to ", traceFile.getFullPathName());
+#endif
 
     return true;
 }
 
-int ZmqInterface::sendData (float* data,
-                            int channelNum,
-                            const String& channelName,
-                            int nSamples,
-                            int64 sampleNumber,
-                            float sampleRate)
+int64 ZmqInterface::nextMessageNumber()
 {
-    messageNumber++;
+    // only the processing thread writes, so a plain load and store suffice
+    const int64 next = messageNumber.load (std::memory_order_relaxed) + 1;
+    messageNumber.store (next, std::memory_order_relaxed);
+    return next;
+}
 
-    DynamicObject::Ptr obj = new DynamicObject();
+uint64 ZmqInterface::nextSequence (int topic)
+{
+    const uint64 next = topicSequences[topic].load (std::memory_order_relaxed) + 1;
+    topicSequences[topic].store (next, std::memory_order_relaxed);
+    return next;
+}
 
-    int mn = messageNumber;
-    obj->setProperty ("message_num", mn);
-    obj->setProperty ("type", "data");
+int ZmqInterface::sendMessage (void* targetSocket,
+                               Topic topic,
+                               DynamicObject::Ptr header,
+                               const MessageFrame* frames,
+                               int numFrames)
+{
+    TRACE_SCOPE ("sendMessage");
+    RT_AUDIT_SCOPE ("sendMessage");
+
+    const uint64 sequence = nextSequence (topic);
+    header->setProperty ("seq", (int64) sequence);
+
+    RT_AUDIT_ALLOCATION ("JSON::toString");
+    const String headerString = JSON::toString (var (header));
+
+    return sendRenderedMessage (targetSocket,
+                                topic,
+                                sequence,
+                                headerString.toRawUTF8(),
+                                headerString.getNumBytesAsUTF8(),
+                                frames,
+                                numFrames);
+}
 
-    DynamicObject::Ptr c_obj = new DynamicObject();
+int ZmqInterface::sendRenderedMessage (void* targetSocket,
+                                       Topic topic,
+                                       uint64 sequence,
+                                       const char* header,
+                                       size_t headerSize,
+                                       const MessageFrame* frames,
+                                       int numFrames)
+{
+    const char* envelope = topicEnvelopes[topic];
+    const size_t envelopeSize = strlen (envelope) + 1;
 
-    c_obj->setProperty ("stream", selectedStreamName);
-    c_obj->setProperty ("channel_num", channelNum);
-    c_obj->setProperty ("channel_name", channelName);
-    c_obj->setProperty ("num_samples", nSamples);
-    c_obj->setProperty ("sample_num", sampleNumber);
-    c_obj->setProperty ("sample_rate", sampleRate);
+    int size = sendFrames (targetSocket, envelope, header, headerSize, frames, numFrames);
 
-    obj->setProperty ("content", var (c_obj));
-    obj->setProperty ("data_size", (int) (nSamples * sizeof (float)));
-    obj->setProperty ("timestamp", Time::currentTimeMillis());
+    if ((retransmitBuffer.isOpen() || reliableChannel.isRunning()) && numFrames <= MAX_MESSAGE_FRAMES)
+    {
+        RetransmitBuffer::Part parts[MAX_MESSAGE_FRAMES + 2];
+        ReliableChannel::Part reliableParts[MAX_MESSAGE_FRAMES + 2];
+
+        parts[0] = { envelope, envelopeSize };
+        parts[1] = { header, headerSize };
 
-    var json (obj);
+        for (int i = 0; i < numFrames; i++)
+            parts[i + 2] = { frames[i].data, frames[i].size };
 
-    String s = JSON::toString (json);
-    void* headerData = (void*) s.toRawUTF8();
+        for (int i = 0; i < numFrames + 2; i++)
+            reliableParts[i] = { parts[i].data, parts[i].size };
+
+        if (retransmitBuffer.isOpen())
+            retransmitBuffer.store (topic, sequence, parts, numFrames + 2);
+
+        if (reliableChannel.isRunning())
+            reliableChannel.publish (topic, sequence, reliableParts, numFrames + 2);
+    }
+
+    return size;
+}
+
+int ZmqInterface::sendFrames (void* targetSocket,
+                              const char* envelope,
+                              const char* header,
+                              size_t headerSize,
+                              const MessageFrame* frames,
+                              int numFrames)
+{
+    TRACE_SCOPE ("sendFrames");
+    RT_AUDIT_SCOPE ("sendFrames");
 
-    size_t headerSize = s.length();
+    const size_t envelopeSize = strlen (envelope) + 1;
 
     zmq_msg_t messageEnvelope;
-    zmq_msg_init_size (&messageEnvelope, strlen ("DATA") + 1);
-    memcpy (zmq_msg_data (&messageEnvelope), "DATA", strlen ("DATA") + 1);
-    int size = zmq_msg_send (&messageEnvelope, socket, ZMQ_SNDMORE);
+    RT_AUDIT_ALLOCATION_IF (envelopeSize > ZMQ_INLINE_MESSAGE_SIZE, "zmq_msg_init_size");
+    zmq_msg_init_size (&messageEnvelope, envelopeSize);
+    memcpy (zmq_msg_data (&messageEnvelope), envelope, envelopeSize);
+    int size = zmq_msg_send (&messageEnvelope, targetSocket, ZMQ_SNDMORE);
     jassert (size != -1);
     zmq_msg_close (&messageEnvelope);
 
     zmq_msg_t messageHeader;
+    RT_AUDIT_ALLOCATION_IF (headerSize > ZMQ_INLINE_MESSAGE_SIZE, "zmq_msg_init_size");
     zmq_msg_init_size (&messageHeader, headerSize);
-    memcpy (zmq_msg_data (&messageHeader), headerData, headerSize);
-    size = zmq_msg_send (&messageHeader, socket, ZMQ_SNDMORE);
+    memcpy (zmq_msg_data (&messageHeader), header, headerSize);
+    size = zmq_msg_send (&messageHeader, targetSocket, numFrames > 0 ? ZMQ_SNDMORE : 0);
     jassert (size != -1);
     zmq_msg_close (&messageHeader);
 
-    zmq_msg_t message;
-    zmq_msg_init_size (&message, sizeof (float) * nSamples);
-    memcpy (zmq_msg_data (&message), data, sizeof (float) * nSamples);
-    int size_m = zmq_msg_send (&message, socket, 0);
-    jassert (size_m);
-    size += size_m;
-    zmq_msg_close (&message);
+    for (int i = 0; i < numFrames; i++)
+    {
+        zmq_msg_t message;
+
+        // small frames live inside the zmq_msg_t, so copying them allocates nothing
+        FrameHandle* handle = frames[i].owner != nullptr && frames[i].size > ZMQ_INLINE_MESSAGE_SIZE
+                                  ? acquireFrameHandle (frames[i].owner)
+                                  : nullptr;
+
+        if (handle != nullptr)
+        {
+            // the frame keeps a reference to the shared buffer until ZMQ has sent it
+            RT_AUDIT_ALLOCATION ("zmq_msg_init_data");
+            zmq_msg_init_data (&message,
+                               const_cast<void*> (frames[i].data),
+                               frames[i].size,
+                               releaseFrameHandle,
+                               handle);
+        }
+        else
+        {
+            RT_AUDIT_ALLOCATION_IF (frames[i].size > ZMQ_INLINE_MESSAGE_SIZE, "zmq_msg_init_size");
+            zmq_msg_init_size (&message, frames[i].size);
+            memcpy (zmq_msg_data (&message), frames[i].data, frames[i].size);
+        }
+
+        int size_m = zmq_msg_send (&message, targetSocket, i < numFrames - 1 ? ZMQ_SNDMORE : 0);
+        jassert (size_m != -1);
+        size += size_m;
+        zmq_msg_close (&message);
+    }
 
     return size;
 }
 
+ZmqInterface::FrameHandle* ZmqInterface::acquireFrameHandle (const EncodingCache::BufferPtr& owner)
+{
+    // handles are released roughly in the order they were taken, so the next one is usually free
+    for (size_t n = 0; n < FRAME_HANDLE_POOL_SIZE; n++)
+    {
+        FrameHandle& handle = frameHandles[nextFrameHandle];
+        nextFrameHandle = (nextFrameHandle + 1) % FRAME_HANDLE_POOL_SIZE;
+
+        bool expected = false;
+        if (handle.inUse.compare_exchange_strong (expected, true, std::memory_order_acquire))
+        {
+            handle.owner = owner;
+            return &handle;
+        }
+    }
+
+    return nullptr;
+}
+
+void ZmqInterface::releaseFrameHandle (void*, void* hint)
+{
+    // called on a libzmq I/O thread once the frame has been sent
+    FrameHandle* handle = static_cast<FrameHandle*> (hint);
+    handle->owner = nullptr;
+    handle->inUse.store (false, std::memory_order_release);
+}
+
+DynamicObject::Ptr ZmqInterface::createDataHeader (const Routing::Channel& channel,
+                                                  const String& streamName,
+                                                  float sampleRate,
+                                                  const int64* values,
+                                                  const BlockEncoder::Format* format)
+{
+    DynamicObject::Ptr obj = new DynamicObject();
+
+    obj->setProperty ("message_num", values[SLOT_MESSAGE_NUM]);
+    obj->setProperty ("type", "data");
+
+    DynamicObject::Ptr c_obj = new DynamicObject();
+
+    c_obj->setProperty ("stream", streamName);
+    c_obj->setProperty ("channel_num", channel.index);
+    c_obj->setProperty ("channel_name", channel.name);
+    c_obj->setProperty ("num_samples", values[SLOT_NUM_SAMPLES]);
+    c_obj->setProperty ("sample_num", values[SLOT_SAMPLE_NUM]);
+    c_obj->setProperty ("sample_rate", sampleRate);
+    c_obj->setProperty ("bit_volts", channel.bitVolts);
+
+    if (format != nullptr)
+    {
+        c_obj->setProperty ("decimation", format->decimation);
+        c_obj->setProperty ("encoding", BlockEncoder::getEncodingName (format->encoding));
+    }
+
+    obj->setProperty ("content", var (c_obj));
+    obj->setProperty ("data_size", values[SLOT_DATA_SIZE]);
+    obj->setProperty ("timestamp", values[SLOT_TIMESTAMP]);
+    obj->setProperty ("seq", values[SLOT_SEQ]);
+
+    return obj;
+}
+
+int ZmqInterface::sendData (const float* data,
+                            const Routing::Channel& channel,
+                            int nSamples,
+                            int64 sampleNumber,
+                            const EncodingCache::BufferPtr& owner)
+{
+    TRACE_SCOPE ("sendData");
+
+    const int64 messageNum = nextMessageNumber();
+
+    const uint64 sequence = nextSequence (TOPIC_DATA);
+
+    const int64 values[NUM_DATA_HEADER_SLOTS] = {
+        messageNum,
+        nSamples,
+        sampleNumber,
+        (int64) (nSamples * sizeof (float)),
+        Time::currentTimeMillis(),
+        (int64) sequence
+    };
+
+    MessageFrame frame = { data, sizeof (float) * nSamples, owner };
+
+    if (channel.header.isValid())
+    {
+        channel.header.render (values, headerBuffer);
+        return sendRenderedMessage (socket, TOPIC_DATA, sequence, headerBuffer.data(), headerBuffer.size(), &frame, 1);
+    }
+
+    RT_AUDIT_SCOPE ("sendData");
+    RT_AUDIT_ALLOCATION ("JSON::toString");
+    const String header = JSON::toString (var (createDataHeader (channel, routing->streamName, routing->sampleRate, values)));
+
+    return sendRenderedMessage (socket, TOPIC_DATA, sequence, header.toRawUTF8(), header.getNumBytesAsUTF8(), &frame, 1);
+}
+
 int ZmqInterface::sendSpikeEvent (const SpikePtr spike)
 {
-    messageNumber++;
+    const int64 messageNum = nextMessageNumber();
     int size = 0;
 
     int bufferSize = spike->getChannelInfo()->getDataSize();
@@ -473,14 +1361,14 @@ int ZmqInterface::sendSpikeEvent (const SpikePtr spike)
         if (spike)
         {
             DynamicObject::Ptr obj = new DynamicObject();
-            obj->setProperty ("message_num", messageNumber);
+            obj->setProperty ("message_num", messageNum);
             obj->setProperty ("type", "spike");
 
             DynamicObject::Ptr c_obj = new DynamicObject();
             const SpikeChannel* channel = spike->getChannelInfo();
             int64 nChannels = channel->getNumChannels();
 
-            c_obj->setProperty ("stream", selectedStreamName);
+            c_obj->setProperty ("stream", routing->streamName);
             c_obj->setProperty ("source_node", spike->getProcessorId());
             c_obj->setProperty ("electrode", channel->getName());
             c_obj->setProperty ("sample_num", spike->getSampleNumber());
@@ -488,40 +1376,223 @@ int ZmqInterface::sendSpikeEvent (const SpikePtr spike)
             c_obj->setProperty ("num_samples", (int64) channel->getTotalSamples());
             c_obj->setProperty ("sorted_id", spike->getSortedId());
 
-            var t_var;
+            Array<var> thresholds;
+            thresholds.ensureStorageAllocated ((int) nChannels);
             for (int i = 0; i < nChannels; i++)
-                t_var.append (spike->getThreshold (i));
-            c_obj->setProperty ("threshold", t_var);
+                thresholds.add (spike->getThreshold (i));
+            c_obj->setProperty ("threshold", thresholds);
 
             obj->setProperty ("spike", var (c_obj));
             obj->setProperty ("timestamp", Time::currentTimeMillis());
 
-            var json (obj);
-            String s = JSON::toString (json);
-            void* headerData = (void*) s.toRawUTF8();
-            size_t headerSize = s.length();
-
-            zmq_msg_t messageEnvelope;
-            zmq_msg_init_size (&messageEnvelope, strlen ("EVENT") + 1);
-            memcpy (zmq_msg_data (&messageEnvelope), "EVENT", strlen ("EVENT") + 1);
-            size = zmq_msg_send (&messageEnvelope, socket, ZMQ_SNDMORE);
-            jassert (size != -1);
-            zmq_msg_close (&messageEnvelope);
-
-            zmq_msg_t messageHeader;
-            zmq_msg_init_size (&messageHeader, headerSize);
-            memcpy (zmq_msg_data (&messageHeader), headerData, headerSize);
-            size = zmq_msg_send (&messageHeader, socket, ZMQ_SNDMORE);
-            jassert (size != -1);
-            zmq_msg_close (&messageHeader);
-            zmq_msg_t message;
-            zmq_msg_init_size (&message, channel->getDataSize());
-            // getdatapointer???
-            memcpy (zmq_msg_data (&message), spike->getDataPointer(), channel->getDataSize());
-            size = zmq_msg_send (&message, socket, 0);
+            MessageFrame frame = { spike->getDataPointer(), channel->getDataSize() };
+
+            size = sendMessage (getEventSocket(), TOPIC_EVENT, obj, &frame, 1);
         }
     }
-    return 0;
+    return size;
+}
+
+void ZmqInterface::queueSpike (const SpikePtr spike)
+{
+    const SpikeChannel* channel = spike->getChannelInfo();
+    const int nChannels = channel->getNumChannels();
+    const int nSamples = (int) channel->getTotalSamples();
+    const int peakIndex = (int) channel->getPrePeakSamples();
+    const float* waveform = spike->getDataPointer();
+
+    SpikeRecord record;
+    record.sampleNumber = spike->getSampleNumber();
+    record.electrode = (uint32) channel->getLocalIndex();
+    record.sortedId = spike->getSortedId();
+    record.numChannels = (uint8) nChannels;
+
+    for (int i = 0; i < SPIKE_RECORD_THRESHOLDS; i++)
+        record.thresholds[i] = i < nChannels ? spike->getThreshold (i) : 0.0f;
+
+    // waveforms are stored channel-major
+    int peakChannel = 0;
+    float peakAmplitude = -1.0f;
+
+    for (int ch = 0; ch < nChannels; ch++)
+    {
+        float amplitude = std::abs (waveform[ch * nSamples + peakIndex]);
+
+        if (amplitude > peakAmplitude)
+        {
+            peakAmplitude = amplitude;
+            peakChannel = ch;
+        }
+    }
+
+    record.peakChannel = (uint16) peakChannel;
+
+    int firstChannel = 0;
+    int firstSample = 0;
+    record.waveformChannels = (uint8) nChannels;
+    record.waveformSamples = (uint16) nSamples;
+
+    switch (spikeWaveform)
+    {
+        case WAVEFORM_PEAK_CHANNEL:
+            firstChannel = peakChannel;
+            record.waveformChannels = 1;
+            break;
+        case WAVEFORM_TRIMMED:
+            firstSample = jmax (0, peakIndex - spikeWindow);
+            record.waveformSamples = (uint16) (jmin (nSamples, peakIndex + spikeWindow) - firstSample);
+            break;
+        case WAVEFORM_NONE:
+            record.waveformChannels = 0;
+            record.waveformSamples = 0;
+            break;
+        default:
+            break;
+    }
+
+    // never grow the batch on the audio thread: send it early, and keep only the
+    // record of a waveform that no batch can hold
+    if ((size_t) record.waveformChannels * record.waveformSamples > spikeWaveforms.capacity())
+    {
+        record.waveformChannels = 0;
+        record.waveformSamples = 0;
+    }
+
+    if (spikeRecords.size() >= spikeRecords.capacity()
+        || spikeWaveforms.size() + (size_t) record.waveformChannels * record.waveformSamples > spikeWaveforms.capacity())
+        sendSpikeBatch (getFirstSampleNumberForBlock (routing->selectedStream));
+
+    for (int ch = firstChannel; ch < firstChannel + record.waveformChannels; ch++)
+    {
+        const float* src = waveform + ch * nSamples + firstSample;
+        spikeWaveforms.insert (spikeWaveforms.end(), src, src + record.waveformSamples);
+    }
+
+    spikeRecords.push_back (record);
+}
+
+int ZmqInterface::sendSpikeBatch (int64 sampleNumber)
+{
+    const int64 messageNum = nextMessageNumber();
+
+    const size_t recordsSize = spikeRecords.size() * sizeof (SpikeRecord);
+    const size_t waveformSize = spikeWaveforms.size() * sizeof (float);
+
+    static const char* waveformNames[] = { "full", "peak_channel", "trimmed", "none" };
+
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty ("message_num", messageNum);
+    obj->setProperty ("type", "spikes");
+
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty ("stream", routing->streamName);
+    c_obj->setProperty ("sample_num", sampleNumber);
+    c_obj->setProperty ("num_spikes", (int) spikeRecords.size());
+    c_obj->setProperty ("waveform", waveformNames[spikeWaveform]);
+    c_obj->setProperty ("waveform_size", (int) waveformSize);
+
+    obj->setProperty ("content", var (c_obj));
+    obj->setProperty ("data_size", (int) recordsSize);
+    obj->setProperty ("timestamp", Time::currentTimeMillis());
+
+    MessageFrame frames[] = {
+        { spikeRecords.data(), recordsSize },
+        { spikeWaveforms.data(), waveformSize }
+    };
+
+    int size = sendMessage (getEventSocket(), TOPIC_EVENT, obj, frames, spikeWaveform != WAVEFORM_NONE ? 2 : 1);
+
+    spikeRecords.clear();
+    spikeWaveforms.clear();
+
+    return size;
+}
+
+int ZmqInterface::sendCrossings (const std::vector<CrossingRecord>& crossings, int64 sampleNumber, int nSamples)
+{
+    const int64 messageNum = nextMessageNumber();
+
+    const size_t dataSize = crossings.size() * sizeof (CrossingRecord);
+
+    DynamicObject::Ptr obj = new DynamicObject();
+
+    obj->setProperty ("message_num", messageNum);
+    obj->setProperty ("type", "crossings");
+
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty ("stream", routing->streamName);
+    c_obj->setProperty ("sample_num", sampleNumber);
+    c_obj->setProperty ("num_samples", nSamples);
+    c_obj->setProperty ("num_crossings", (int) crossings.size());
+    c_obj->setProperty ("sample_rate", routing->sampleRate);
+
+    obj->setProperty ("content", var (c_obj));
+    obj->setProperty ("data_size", (int) dataSize);
+    obj->setProperty ("timestamp", Time::currentTimeMillis());
+
+    MessageFrame frame = { crossings.data(), dataSize };
+
+    return sendMessage (getEventSocket(), TOPIC_CROSSINGS, obj, &frame, 1);
+}
+
+int ZmqInterface::sendTtlBatch (int64 sampleNumber)
+{
+    const int64 messageNum = nextMessageNumber();
+
+    const size_t dataSize = ttlRecords.size() * sizeof (TtlRecord);
+
+    DynamicObject::Ptr obj = new DynamicObject();
+
+    obj->setProperty ("message_num", messageNum);
+    obj->setProperty ("type", "ttl");
+
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty ("stream", routing->streamName);
+    c_obj->setProperty ("sample_num", sampleNumber);
+    c_obj->setProperty ("num_events", (int) ttlRecords.size());
+
+    obj->setProperty ("content", var (c_obj));
+    obj->setProperty ("data_size", (int) dataSize);
+    obj->setProperty ("timestamp", Time::currentTimeMillis());
+
+    MessageFrame frame = { ttlRecords.data(), dataSize };
+
+    int size = sendMessage (getEventSocket(), TOPIC_EVENT, obj, &frame, 1);
+
+    ttlRecords.clear();
+
+    return size;
+}
+
+int ZmqInterface::sendLineStates (int64 sampleNumber, int nSamples)
+{
+    const int64 messageNum = nextMessageNumber();
+
+    LineStateRecord record;
+    record.sampleNumber = sampleNumber;
+    record.numSamples = (uint32) nSamples;
+    record.states = lineStates;
+    record.changed = linesChanged;
+
+    linesChanged = 0;
+
+    DynamicObject::Ptr obj = new DynamicObject();
+
+    obj->setProperty ("message_num", messageNum);
+    obj->setProperty ("type", "line_states");
+
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty ("stream", routing->streamName);
+    c_obj->setProperty ("sample_num", sampleNumber);
+    c_obj->setProperty ("num_samples", nSamples);
+
+    obj->setProperty ("content", var (c_obj));
+    obj->setProperty ("data_size", (int) sizeof (LineStateRecord));
+    obj->setProperty ("timestamp", Time::currentTimeMillis());
+
+    MessageFrame frame = { &record, sizeof (LineStateRecord) };
+
+    return sendMessage (getEventSocket(), TOPIC_LINES, obj, &frame, 1);
 }
 
 int ZmqInterface::sendEvent (uint8 type,
@@ -530,17 +1601,15 @@ int ZmqInterface::sendEvent (uint8 type,
                              size_t numBytes,
                              const uint8* eventData)
 {
-    int size;
-
-    messageNumber++;
+    const int64 messageNum = nextMessageNumber();
 
     DynamicObject::Ptr obj = new DynamicObject();
 
-    obj->setProperty ("message_num", messageNumber);
+    obj->setProperty ("message_num", messageNum);
     obj->setProperty ("type", "event");
 
     DynamicObject::Ptr c_obj = new DynamicObject();
-    c_obj->setProperty ("stream", selectedStreamName);
+    c_obj->setProperty ("stream", routing->streamName);
     c_obj->setProperty ("source_node", sourceNodeId);
     c_obj->setProperty ("type", type);
     c_obj->setProperty ("sample_num", sampleNum);
@@ -549,47 +1618,43 @@ int ZmqInterface::sendEvent (uint8 type,
     obj->setProperty ("data_size", (int) numBytes);
     obj->setProperty ("timestamp", Time::currentTimeMillis());
 
-    var json (obj);
-    String s = JSON::toString (json);
-    void* headerData = (void*) s.toRawUTF8();
-    size_t headerSize = s.length();
+    MessageFrame frame = { eventData, numBytes };
 
-    zmq_msg_t messageEnvelope;
-    zmq_msg_init_size (&messageEnvelope, strlen ("EVENT") + 1);
-    memcpy (zmq_msg_data (&messageEnvelope), "EVENT", strlen ("EVENT") + 1);
-    size = zmq_msg_send (&messageEnvelope, socket, ZMQ_SNDMORE);
-    jassert (size != -1);
-    zmq_msg_close (&messageEnvelope);
-
-    zmq_msg_t messageHeader;
-    zmq_msg_init_size (&messageHeader, headerSize);
-    memcpy (zmq_msg_data (&messageHeader), headerData, headerSize);
-    if (numBytes == 0)
-    {
-        size = zmq_msg_send (&messageHeader, socket, 0);
-        jassert (size != -1);
-        zmq_msg_close (&messageHeader);
-    }
-    else
-    {
-        size = zmq_msg_send (&messageHeader, socket, ZMQ_SNDMORE);
-        jassert (size != -1);
-        zmq_msg_close (&messageHeader);
-        zmq_msg_t message;
-        zmq_msg_init_size (&message, numBytes);
-        memcpy (zmq_msg_data (&message), eventData, numBytes);
-        int size_m = zmq_msg_send (&message, socket, 0);
-        jassert (size_m);
-        size += size_m;
-        zmq_msg_close (&message);
-    }
-    return size;
+    return sendMessage (getEventSocket(), TOPIC_EVENT, obj, &frame, numBytes > 0 ? 1 : 0);
 }
 
 void ZmqInterface::handleTTLEvent (TTLEventPtr event)
 {
-    if (event->getEventType() == EventChannel::TTL && event->getStreamId() == selectedStream)
+    RT_AUDIT_SCOPE ("handleTTLEvent");
+
+    if (event->getEventType() == EventChannel::TTL && event->getStreamId() == routing->selectedStream)
     {
+        const uint8 line = event->getLine();
+        const bool state = event->getState();
+
+        if (line < 64)
+        {
+            const uint64 bit = uint64 (1) << line;
+            lineStates = state ? (lineStates | bit) : (lineStates & ~bit);
+            linesChanged |= bit;
+        }
+
+        if (ttlFormat == TTL_BINARY)
+        {
+            TtlRecord record;
+            record.line = line;
+            record.state = state ? 1 : 0;
+            record.sampleNumber = event->getSampleNumber();
+            record.word = event->getWord();
+
+            // never grow the batch on the audio thread
+            if (ttlRecords.size() >= ttlRecords.capacity())
+                sendTtlBatch (getFirstSampleNumberForBlock (routing->selectedStream));
+
+            ttlRecords.push_back (record);
+            return;
+        }
+
         const uint8* dataptr = reinterpret_cast<const uint8*> (event->getRawDataPointer());
         uint8 numBytes = event->getChannelInfo()->getDataSize();
 
@@ -603,122 +1668,1356 @@ void ZmqInterface::handleTTLEvent (TTLEventPtr event)
 
 void ZmqInterface::handleSpike (SpikePtr spike)
 {
-    if (spike->getStreamId() == selectedStream)
+    RT_AUDIT_SCOPE ("handleSpike");
+
+    if (spike->getStreamId() != routing->selectedStream)
+        return;
+
+    if (spikeFormat == SPIKE_BINARY)
+        queueSpike (spike);
+    else
         sendSpikeEvent (spike);
 }
 
+void ZmqInterface::handleControlRequest (const char* request, size_t size, int peerFd)
+{
+    ControlProtocol::Status status;
+    const int numRecords = ControlProtocol::decode (request, size, controlRecords.data(), (int) controlRecords.size(), status);
+    const int64 now = Time::currentTimeMillis();
+    ClientStats* stats = nullptr;
+    bool lagReported = false;
+
+    for (int i = 0; i < numRecords; i++)
+    {
+        ControlProtocol::Record& record = controlRecords[(size_t) i];
+        record.time = now;
+
+        if (record.command != ControlProtocol::STATS && record.command != ControlProtocol::LAG)
+            continue;
+
+        if (stats == nullptr && (stats = findClientStats (record.uuid)) == nullptr)
+            continue;
+
+        stats->time = now;
+
+        if (record.command == ControlProtocol::STATS)
+        {
+            stats->received = record.received;
+            stats->missed = record.missed;
+            stats->latencyUs = record.latencyUs;
+        }
+        else
+        {
+            stats->queueDepth = record.queueDepth;
+            stats->processingUs = record.processingUs;
+            updateTopicLag (*stats, record.topic, record.sequence);
+            lagReported = true;
+        }
+    }
+
+    if (numRecords > 0)
+    {
+        zmq_send (pipeInSocket, controlRecords.data(), sizeof (ControlProtocol::Record) * numRecords, 0);
+        trackControlPeer (peerFd, controlRecords[0].uuid);
+
+        if (lagReported)
+            applyLagReport (controlRecords[0].uuid, *stats);
+    }
+
+    uint8 reply[ControlProtocol::REPLY_SIZE];
+    ControlProtocol::encodeReply (status, numRecords, reply);
+    zmq_send (listenSocket, reply, sizeof (reply), 0);
+}
+
 int ZmqInterface::receiveEvents()
 {
-    EventData ed;
+    TRACE_SCOPE ("receiveEvents");
+
     while (true)
     {
-        int size = zmq_recv (pipeOutSocket, &ed, sizeof (ed), ZMQ_DONTWAIT);
+        zmq_msg_t message;
+        zmq_msg_init (&message);
+
+        int size = zmq_msg_recv (&message, pipeOutSocket, ZMQ_DONTWAIT);
         if (size == -1)
         {
-            if (zmq_errno() == EAGAIN)
-            {
-                break;
-            }
-            else
-            {
+            zmq_msg_close (&message);
+
+            if (zmq_errno() != EAGAIN)
                 LOGE ("Pipe out error: ", zmq_strerror (zmq_errno()));
-            }
+
+            break;
         }
 
-        int appNo = -1;
-        for (int i = 0; i < applications.size(); i++)
+        if (size == (int) sizeof (ConnectionEvent))
         {
-            ZmqApplication* app = applications[i];
-            if (app->Uuid == String (ed.uuid))
+            ConnectionEvent ce;
+            memcpy (&ce, zmq_msg_data (&message), sizeof (ce));
+
+            for (auto* app : applications)
             {
-                bool refreshEd = false;
-                appNo = i;
-                app->lastSeen = ed.eventTime;
-                if (! app->alive)
-                    refreshEd = true;
-                app->alive = true;
-                ZmqInterfaceEditor* zed = dynamic_cast<ZmqInterfaceEditor*> (getEditor());
-                zed->refreshListAsync();
+                if (app->Uuid != String (ce.uuid))
+                    continue;
+
+                if (ce.connected)
+                {
+                    app->connected = true;
+                }
+                else if (app->connected)
+                {
+                    app->connected = false;
 
-                break;
+                    if (app->alive)
+                        releaseApplication (app, "disconnected");
+                }
             }
         }
-
-        if (appNo == -1)
+        else if (size == (int) sizeof (LagReport))
         {
-            ZmqApplication* app = new ZmqApplication;
-            app->name = String (ed.application);
-            app->Uuid = String (ed.uuid);
-            app->lastSeen = ed.eventTime;
-            app->alive = true;
-            applications.add (app);
-            LOGC ("Adding new zmq client application ", app->name, " ", app->Uuid);
-            ZmqInterfaceEditor* zed = dynamic_cast<ZmqInterfaceEditor*> (getEditor());
-            zed->refreshListAsync();
+            LagReport report;
+            memcpy (&report, zmq_msg_data (&message), sizeof (report));
+
+            for (auto* app : applications)
+            {
+                if (app->Uuid != String (report.uuid))
+                    continue;
+
+                if ((bool) report.lagging != app->lagging)
+                    LOGC ("App ", app->name, report.lagging ? " is falling behind (" : " caught up (", report.lag, " messages)");
+
+                app->lag = report.lag;
+                app->queueDepth = report.queueDepth;
+                app->processingUs = report.processingUs;
+                app->lagging = report.lagging != 0;
+
+                ZmqInterfaceEditor* zed = dynamic_cast<ZmqInterfaceEditor*> (getEditor());
+
+                if (zed != nullptr)
+                    zed->refreshListAsync();
+            }
         }
+        else if (size == (int) sizeof (EventData))
+        {
+            EventData ed;
+            memcpy (&ed, zmq_msg_data (&message), sizeof (ed));
 
-        if (ed.isEvent)
+            updateApplication (String (ed.uuid), String (ed.application), ed.eventTimeMs);
+
+            if (ed.isEvent)
+            {
+                LOGD ("ZMQ event received");
+            }
+        }
+        else
         {
-            LOGD ("ZMQ event received");
+            const int numRecords = size / (int) sizeof (ControlProtocol::Record);
+            const ControlProtocol::Record* records = (const ControlProtocol::Record*) zmq_msg_data (&message);
+
+            // all records of a request come from the same client
+            if (numRecords > 0)
+                updateApplication (String (records[0].uuid), String::fromUTF8 (records[0].application), records[0].time);
+
+            for (int i = 0; i < numRecords; i++)
+                if (records[i].command == ControlProtocol::EVENT)
+                    LOGD ("ZMQ event received");
         }
+
+        zmq_msg_close (&message);
     }
 
     return 0;
 }
 
-void ZmqInterface::checkForApplications()
+void ZmqInterface::updateApplication (const String& uuid, const String& name, int64 timeMs)
 {
-    time_t timeNow = time (NULL);
-
     for (int i = 0; i < applications.size(); i++)
     {
         ZmqApplication* app = applications[i];
-
-        if ((timeNow - app->lastSeen) > 5 && app->alive)
+        if (app->Uuid == uuid)
         {
-            app->alive = false;
-            LOGC ("App ", app->name, " no longer alive");
+            app->lastSeenMs = timeMs;
+            app->alive = true;
             ZmqInterfaceEditor* zed = dynamic_cast<ZmqInterfaceEditor*> (getEditor());
+            zed->refreshListAsync();
 
-            if (zed != nullptr)
-                zed->refreshListAsync();
+            return;
         }
     }
+
+    ZmqApplication* app = new ZmqApplication;
+    app->name = name;
+    app->Uuid = uuid;
+    app->lastSeenMs = timeMs;
+    app->alive = true;
+    app->connected = false;
+    app->lag = -1;
+    app->queueDepth = 0;
+    app->processingUs = 0;
+    app->lagging = false;
+    applications.add (app);
+    LOGC ("Adding new zmq client application ", app->name, " ", app->Uuid);
+    ZmqInterfaceEditor* zed = dynamic_cast<ZmqInterfaceEditor*> (getEditor());
+    zed->refreshListAsync();
 }
 
-void ZmqInterface::process (AudioBuffer<float>& buffer)
+void ZmqInterface::checkForApplications()
 {
-    checkForEvents (true); // see if we got any TTL events or spikes
+    const int64 now = Time::currentTimeMillis();
 
-    for (auto stream : dataStreams)
+    for (int i = 0; i < applications.size(); i++)
     {
-        if (stream->getStreamId() == selectedStream)
-        {
-            // Send the sample number of the first sample in the buffer block
-            int64 sampleNum = getFirstSampleNumberForBlock (stream->getStreamId());
-            int numSamples = getNumSamplesInBlock (selectedStream);
+        ZmqApplication* app = applications[i];
 
-            if (numSamples == 0)
-                continue;
+        // with heartbeats on, libzmq drops connections whose peer stopped
+        // answering, so a client is alive as long as its connection is
+        if (app->connected && heartbeatIntervalMs > 0)
+            continue;
 
-            auto contChans = stream->getContinuousChannels();
+        if ((now - app->lastSeenMs) > clientTimeoutMs && app->alive)
+            releaseApplication (app, "timed out");
+    }
+}
 
-            for (auto chan : selectedChannels)
+void ZmqInterface::releaseApplication (ZmqApplication* app, const String& reason)
+{
+    app->alive = false;
+    LOGC ("App ", app->name, " no longer alive (", reason, ")");
+
+    subscriptions.release (app->Uuid.toStdString());
+    ZmqInterfaceEditor* zed = dynamic_cast<ZmqInterfaceEditor*> (getEditor());
+
+    if (zed != nullptr)
+        zed->refreshListAsync();
+}
+
+void ZmqInterface::process (AudioBuffer<float>& buffer)
+{
+    TRACE_REALTIME_THREAD ("audio");
+    TRACE_SCOPE ("process");
+    RT_AUDIT_SCOPE ("process");
+
+    const int64 startTicks = Time::getHighResolutionTicks();
+
+    RcuPointer<Routing>::ReadLock current (routingTable);
+    routing = current.get();
+    governorLevel = governor.getLevel();
+
+    {
+        TRACE_SCOPE ("checkForEvents");
+        checkForEvents (true); // see if we got any TTL events or spikes
+    }
+
+    if (routing->streams.empty())
+    {
+        routing = nullptr;
+        return;
+    }
+
+    const int64 blockSampleNum = getFirstSampleNumberForBlock (routing->selectedStream);
+
+    if (ttlRecords.size() > 0)
+        sendTtlBatch (blockSampleNum);
+
+    if (spikeRecords.size() > 0)
+        sendSpikeBatch (blockSampleNum);
+
+    const int selectedSamples = getNumSamplesInBlock (routing->selectedStream);
+
+    if (lineStatesEnabled && governorLevel < CpuGovernor::DROP_FEATURES)
+        sendLineStates (blockSampleNum, selectedSamples);
+
+    const bool hasSubscriptions = subscriptions.getNumTopics() > 0;
+
+    for (auto& stream : routing->streams)
+    {
+        const bool isSelected = stream.streamId == routing->selectedStream;
+        const int numSamples = getNumSamplesInBlock (stream.streamId);
+
+        if (numSamples == 0 || ! (hasSubscriptions || isSelected))
+            continue;
+
+        // every representation of this block is encoded at most once, whoever asks for it
+        const int numChannels = jmin ((int) stream.globalIndices.size(), (int) streamInputs.size());
+
+        for (int i = 0; i < numChannels; i++)
+            streamInputs[i] = buffer.getReadPointer (stream.globalIndices[i]);
+
+        encodingCache.beginBlock (stream.streamId, streamInputs.data(), numChannels, numSamples, getFirstSampleNumberForBlock (stream.streamId));
+
+        if (hasSubscriptions)
+        {
+            TRACE_SCOPE ("subscriptions");
+            RT_AUDIT_SCOPE ("subscriptions");
+            subscriptions.process (encodingCache,
+                                   [this] (const SubscriptionTable::Route& route, int64 topicSampleNum, int topicSamples)
+                                   { sendSubscriptionData (route, topicSampleNum, topicSamples); });
+        }
+
+        if (! isSelected)
+            continue;
+
+        // Send the sample number of the first sample in the buffer block
+        const int64 sampleNum = getFirstSampleNumberForBlock (stream.streamId);
+        const int numSelected = jmin ((int) routing->channels.size(), (int) chunkInputs.size());
+
+        for (int i = 0; i < numSelected; i++)
+            chunkInputs[i] = buffer.getReadPointer (routing->channels[i].globalIndex);
+
+        if (routing->sharedMemory != nullptr)
+            routing->sharedMemory->write (chunkInputs.data(), numSamples, sampleNum, Time::currentTimeMillis());
+
+        if (routing->history != nullptr)
+            routing->history->write (chunkInputs.data(), numSamples, sampleNum);
+
+        Rechunker& rechunker = *routing->rechunker;
+
+        if (reliableChannel.hasAdaptiveConsumers())
+            reliableChannel.publishBlock (encodingCache,
+                                          routing->format,
+                                          routing->channelNumbers.data(),
+                                          routing->sampleRate,
+                                          routing->streamNameUtf8);
+
+        if (localStream != nullptr)
+            localStream->publish (chunkInputs.data(),
+                                  routing->channelNumbers.data(),
+                                  numSelected,
+                                  numSamples,
+                                  sampleNum,
+                                  routing->sampleRate);
+
+        if (publishSelected && rechunker.getMode() == Rechunker::BLOCK && numSelected > 0 && governorLevel >= CpuGovernor::DECIMATE)
+        {
+            sendGovernedBlock (encodingCache.get (routing->governedFormats[governorLevel]), sampleNum);
+        }
+        else if (publishSelected && rechunker.getMode() == Rechunker::BLOCK && numSelected > 0)
+        {
+            // one float32 copy of the selected channels, shared by their DATA frames
+            EncodingCache::BufferPtr block;
+            {
+                TRACE_SCOPE ("encode");
+                block = encodingCache.get (routing->format);
+            }
+
+            for (int i = 0; i < numSelected; i++)
+                sendData ((const float*) block->getChannelData (i), routing->channels[i], numSamples, sampleNum, block);
+        }
+        else if (publishSelected && rechunker.getNumChannels() == numSelected)
+        {
+            rechunker.addBlock (chunkInputs.data(),
+                                numSamples,
+                                sampleNum,
+                                routing->sampleRate,
+                                [this] (int64 chunkSampleNum, int chunkSamples)
+                                { sendChunk (chunkSampleNum, chunkSamples); });
+        }
+
+        if (crossingsEnabled && governorLevel < CpuGovernor::DROP_FEATURES)
+            detectCrossings (buffer, numSamples, sampleNum);
+    }
+
+    if (routing->sampleRate > 0.0f)
+        governor.update (Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks),
+                         selectedSamples / (double) routing->sampleRate);
+
+    routing = nullptr;
+}
+
+void ZmqInterface::sendGovernedBlock (const EncodingCache::BufferPtr& block, int64 sampleNum)
+{
+    const std::vector<int>& positions = routing->governedChannels[governorLevel];
+
+    for (size_t i = 0; i < positions.size() && (int) i < block->numOutputChannels; i++)
+        sendEncodedData (*block, (int) i, routing->channels[(size_t) positions[i]], sampleNum, block);
+}
+
+int ZmqInterface::sendEncodedData (const EncodingCache::Buffer& block,
+                                   int outputChannel,
+                                   const Routing::Channel& channel,
+                                   int64 sampleNumber,
+                                   const EncodingCache::BufferPtr& owner)
+{
+    TRACE_SCOPE ("sendEncodedData");
+
+    const int64 messageNum = nextMessageNumber();
+
+    const uint64 sequence = nextSequence (TOPIC_DATA);
+    const int decimation = block.format.decimation;
+    const size_t size = block.getChannelSize();
+
+    const int64 values[NUM_DATA_HEADER_SLOTS] = {
+        messageNum,
+        block.numOutputSamples,
+        sampleNumber,
+        (int64) size,
+        Time::currentTimeMillis(),
+        (int64) sequence
+    };
+
+    MessageFrame frames[] = {
+        { block.getChannelData (outputChannel), size, owner },
+        { block.scales.empty() ? nullptr : &block.scales[(size_t) outputChannel], sizeof (float), nullptr }
+    };
+
+    const int numFrames = block.scales.empty() ? 1 : 2;
+
+    // the level's header template, unless the block was encoded some other way
+    const BlockEncoder::Format& levelFormat = routing->governedFormats[governorLevel];
+    const HeaderTemplate& header = channel.governedHeaders[governorLevel];
+
+    if (header.isValid() && levelFormat.decimation == decimation && levelFormat.encoding == block.format.encoding)
+    {
+        header.render (values, headerBuffer);
+        return sendRenderedMessage (socket, TOPIC_DATA, sequence, headerBuffer.data(), headerBuffer.size(), frames, numFrames);
+    }
+
+    RT_AUDIT_SCOPE ("sendEncodedData");
+    RT_AUDIT_ALLOCATION ("JSON::toString");
+    const String text = JSON::toString (var (createDataHeader (channel, routing->streamName, routing->sampleRate / decimation, values, &block.format)));
+
+    return sendRenderedMessage (socket, TOPIC_DATA, sequence, text.toRawUTF8(), text.getNumBytesAsUTF8(), frames, numFrames);
+}
+
+void ZmqInterface::checkGovernor()
+{
+    const int level = governor.getLevel();
+
+    if (level == loggedGovernorLevel)
+        return;
+
+    LOGC ("ZMQ Interface -- CPU governor ",
+          level > loggedGovernorLevel ? "shedding load" : "restoring service",
+          " at ",
+          roundToInt (governor.getLoad() * 100.0),
+          "% of the block period: ",
+          CpuGovernor::getLevelName (level));
+
+    loggedGovernorLevel = level;
+}
+
+void ZmqInterface::checkRealtimeAudit()
+{
+#if ZMQ_INTERFACE_RT_AUDIT
+    RealtimeAudit::Report report;
+
+    for (int i = 0; i < MAX_AUDIT_REPORTS_LOGGED && RealtimeAudit::popReport (report); i++)
+    {
+        String counts;
+
+        for (int kind = 0; kind < RealtimeAudit::NUM_KINDS; kind++)
+            if (report.counts[kind] > 0)
+                counts += (counts.isEmpty() ? "" : ", ") + String ((int) report.counts[kind]) + " " + RealtimeAudit::getKindName ((RealtimeAudit::Kind) kind);
+
+        LOGC ("ZMQ Interface -- real-time audit, block ", (int64) report.block, " (", report.entryPoint, ", first in ", report.site, "): ", counts);
+    }
+#endif
+}
+
+void ZmqInterface::updateGovernor()
+{
+    governor.setEnabled ((bool) getParameter ("governor")->getValue());
+    governor.setBudget ((float) getParameter ("cpu_budget")->getValue() / 100.0);
+}
+
+void ZmqInterface::sendChunk (int64 sampleNum, int numSamples)
+{
+    TRACE_SCOPE ("sendChunk");
+
+    const Rechunker& rechunker = *routing->rechunker;
+    const int numChannels = jmin ((int) routing->channels.size(), rechunker.getNumChannels());
+
+    if (governorLevel >= CpuGovernor::DECIMATE)
+    {
+        const BlockEncoder::Format& format = routing->governedChunkFormats[governorLevel];
+
+        for (int i = 0; i < numChannels && i < (int) chunkChannels.size(); i++)
+            chunkChannels[i] = rechunker.getChannelData (i);
+
+        std::shared_ptr<EncodingCache::Buffer> chunk = encodingCache.acquire();
+        chunk->streamId = routing->selectedStream;
+        chunk->sampleNumber = sampleNum;
+        chunk->numSamples = numSamples;
+        chunk->numOutputSamples = BlockEncoder::getNumOutputSamples (numSamples, format.decimation);
+        chunk->format = format;
+        chunk->numOutputChannels = BlockEncoder::prepareOutput (numChannels, numSamples, format, chunk->data, chunk->scales);
+
+        BlockEncoder::encodeChannels (chunkChannels.data(), numSamples, format, 0, chunk->numOutputChannels, chunk->data.data(), chunk->scales.data());
+
+        sendGovernedBlock (chunk, sampleNum);
+        return;
+    }
+
+    for (int i = 0; i < numChannels; i++)
+        sendData (rechunker.getChannelData (i), routing->channels[i], numSamples, sampleNum);
+}
+
+std::shared_ptr<Rechunker> ZmqInterface::createRechunker()
+{
+    Rechunker::Mode mode = (Rechunker::Mode) static_cast<CategoricalParameter*> (getParameter ("chunk_mode"))->getSelectedIndex();
+    int chunkSamples = (int) getParameter ("chunk_samples")->getValue();
+    double maxLatency = (double) (float) getParameter ("chunk_latency")->getValue();
+
+    std::shared_ptr<Rechunker> rechunker = std::make_shared<Rechunker>();
+    rechunker->prepare (mode, selectedChannels.size(), chunkSamples, maxLatency);
+
+    return rechunker;
+}
+
+void ZmqInterface::updateRouting (int parts)
+{
+    std::unique_ptr<Routing> next;
+
+    {
+        RcuPointer<Routing>::ReadLock current (routingTable);
+        next.reset (new Routing (*current));
+    }
+
+    // a new segment takes the old one's name, and two histories may not fit in memory:
+    // retire the old ones (the processing thread stops using them) before building others
+    const bool retireSharedMemory = (parts & ROUTE_SHARED_MEMORY) != 0 && next->sharedMemory != nullptr;
+    const bool retireHistory = (parts & ROUTE_HISTORY) != 0 && next->history != nullptr;
+
+    if (retireSharedMemory || retireHistory)
+    {
+        if (retireSharedMemory)
+            next->sharedMemory = nullptr;
+
+        if (retireHistory)
+            next->history = nullptr;
+
+        routingTable.publish (std::unique_ptr<Routing> (new Routing (*next)));
+    }
+
+    if (parts & ROUTE_CHANNELS)
+    {
+        std::unique_ptr<Routing> channels = createChannelRouting();
+
+        channels->crossingDetector = next->crossingDetector;
+        channels->rechunker = next->rechunker;
+        channels->sharedMemory = next->sharedMemory;
+        channels->history = next->history;
+
+        next = std::move (channels);
+    }
+
+    if (parts & ROUTE_CROSSINGS)
+        next->crossingDetector = createCrossingDetector();
+
+    if (parts & ROUTE_CHUNKS)
+        next->rechunker = createRechunker();
+
+    if (parts & ROUTE_SHARED_MEMORY)
+        next->sharedMemory = createSharedMemory();
+
+    if (parts & ROUTE_HISTORY)
+        next->history = createHistory();
+
+    routingTable.publish (std::move (next));
+
+    if (parts & ROUTE_CROSSINGS)
+        crossingsEnabled = (bool) getParameter ("crossings")->getValue();
+}
+
+std::unique_ptr<ZmqInterface::Routing> ZmqInterface::createChannelRouting()
+{
+    selectedChannelNumbers.clear();
+
+    for (auto chan : selectedChannels)
+        selectedChannelNumbers.push_back ((uint32_t) chan);
+
+    std::unique_ptr<Routing> next (new Routing());
+
+    for (auto stream : dataStreams)
+    {
+        Routing::Stream route;
+        route.streamId = stream->getStreamId();
+
+        auto contChans = stream->getContinuousChannels();
+
+        for (auto chan : contChans)
+            route.globalIndices.push_back (chan->getGlobalIndex());
+
+        next->streams.push_back (route);
+
+        if (route.streamId != selectedStream)
+            continue;
+
+        next->selectedStream = route.streamId;
+        next->streamName = selectedStreamName;
+        next->streamNameUtf8 = selectedStreamName.toStdString();
+        next->sampleRate = selectedStreamSampleRate;
+
+        for (auto chan : selectedChannels)
+        {
+            if (chan < 0 || chan >= contChans.size())
+                continue;
+
+            ContinuousChannel* channel = contChans.getUnchecked (chan);
+
+            Routing::Channel route;
+            route.index = chan;
+            route.globalIndex = channel->getGlobalIndex();
+            route.name = channel->getName();
+            route.bitVolts = channel->getBitVolts();
+
+            // render the DATA header once; only its numbers change from block to block
+            int64 placeholders[NUM_DATA_HEADER_SLOTS];
+            for (int slot = 0; slot < NUM_DATA_HEADER_SLOTS; slot++)
+                placeholders[slot] = HeaderTemplate::getPlaceholder (slot);
+
+            DynamicObject::Ptr header = createDataHeader (route, selectedStreamName, selectedStreamSampleRate, placeholders);
+            route.header.prepare (JSON::toString (var (header)).toStdString(), NUM_DATA_HEADER_SLOTS);
+
+            next->channels.push_back (route);
+            next->channelNumbers.push_back ((uint32_t) chan);
+            next->format.channels.push_back (chan);
+        }
+    }
+
+    // what the CPU governor still sends of the selected channels at each level
+    std::vector<int> all;
+    std::vector<int> priority;
+
+    StringArray priorityList;
+    priorityList.addTokens (getParameter ("governor_priority")->getValueAsString(), ",; ", "");
+    priorityList.removeEmptyStrings();
+
+    for (int i = 0; i < (int) next->channels.size(); i++)
+    {
+        all.push_back (i);
+
+        if (priorityList.contains (String (next->channels[(size_t) i].index)))
+            priority.push_back (i);
+    }
+
+    if (priority.empty())
+        priority.assign (all.begin(), all.begin() + (all.size() + 1) / 2);
+
+    for (int level = 0; level < CpuGovernor::NUM_LEVELS; level++)
+    {
+        BlockEncoder::Format& format = next->governedFormats[level];
+        BlockEncoder::Format& chunkFormat = next->governedChunkFormats[level];
+
+        format.decimation = chunkFormat.decimation = level >= CpuGovernor::DECIMATE ? GOVERNOR_DECIMATION : 1;
+        format.encoding = chunkFormat.encoding = level >= CpuGovernor::QUANTIZE ? BlockEncoder::INT16 : BlockEncoder::FLOAT32;
+
+        next->governedChannels[level] = level >= CpuGovernor::PRIORITY_CHANNELS ? priority : all;
+
+        for (int position : next->governedChannels[level])
+        {
+            format.channels.push_back (next->channels[(size_t) position].index);
+            chunkFormat.channels.push_back (position);
+        }
+
+        if (level < CpuGovernor::DECIMATE)
+            continue;
+
+        // shedding load must not cost more per message than normal operation
+        int64 placeholders[NUM_DATA_HEADER_SLOTS];
+        for (int slot = 0; slot < NUM_DATA_HEADER_SLOTS; slot++)
+            placeholders[slot] = HeaderTemplate::getPlaceholder (slot);
+
+        for (auto& channel : next->channels)
+        {
+            DynamicObject::Ptr header = createDataHeader (channel, selectedStreamName, selectedStreamSampleRate / format.decimation, placeholders, &format);
+            channel.governedHeaders[level].prepare (JSON::toString (var (header)).toStdString(), NUM_DATA_HEADER_SLOTS);
+        }
+    }
+
+    return next;
+}
+
+void ZmqInterface::updateLocalStream()
+{
+    const bool enabled = (bool) getParameter ("local_api")->getValue();
+    const std::string name = "ZMQ Interface " + std::to_string (getNodeId());
+
+    if (enabled && localStream == nullptr)
+    {
+        std::shared_ptr<LocalStream> stream = LocalStreamRegistry::getInstance().createStream (name, LOCAL_STREAM_POOL_SIZE);
+
+        // sized before the processing thread can see it
+        stream->prepare ((int) chunkInputs.size(), LOCAL_STREAM_MAX_SAMPLES);
+        localStream = stream;
+        LOGC ("ZMQ Interface -- in-process stream \"", name, "\" available");
+    }
+    else if (! enabled && localStream != nullptr)
+    {
+        LocalStreamRegistry::getInstance().removeStream (localStream->getName());
+        localStream = nullptr;
+    }
+}
+
+std::shared_ptr<SharedMemoryRing> ZmqInterface::createSharedMemory()
+{
+    if (! (bool) getParameter ("shared_memory")->getValue() || selectedChannels.size() == 0)
+        return nullptr;
+
+    char name[64];
+    zmqi_shm_default_name (dataPort, name, sizeof (name));
+
+    std::shared_ptr<SharedMemoryRing> sharedMemory = std::make_shared<SharedMemoryRing>();
+
+    bool ok = sharedMemory->create (name,
+                                   (int) getParameter ("shm_slots")->getValue(),
+                                   (int) getParameter ("shm_block_size")->getValue(),
+                                   selectedChannelNumbers,
+                                   selectedStreamSampleRate,
+                                   selectedStreamName.toStdString());
+
+    if (! ok)
+    {
+        LOGE ("Couldn't create shared memory segment ", name);
+        return nullptr;
+    }
+
+    LOGC ("ZMQ Interface -- publishing to shared memory segment ", name);
+    return sharedMemory;
+}
+
+std::shared_ptr<HistoryRing> ZmqInterface::createHistory()
+{
+    if (! (bool) getParameter ("history")->getValue() || selectedChannels.size() == 0 || selectedStreamSampleRate <= 0)
+        return nullptr;
+
+    const int64 maxBytes = (int64) (int) getParameter ("history_mb")->getValue() * 1024 * 1024;
+    const int64 samplesForDuration = (int64) std::ceil ((float) getParameter ("history_seconds")->getValue() * selectedStreamSampleRate);
+    const int64 samplesForMemory = maxBytes / ((int64) sizeof (float) * selectedChannels.size());
+
+    const int64 capacity = jmax ((int64) 1, jmin (samplesForDuration, samplesForMemory));
+
+    std::shared_ptr<HistoryRing> history = std::make_shared<HistoryRing>();
+
+    bool ok = history->prepare (capacity,
+                                selectedChannelNumbers,
+                                selectedStreamSampleRate,
+                                selectedStreamName.toStdString(),
+                                (bool) getParameter ("history_mmap")->getValue());
+
+    if (! ok)
+    {
+        LOGE ("Couldn't allocate the history buffer");
+        return nullptr;
+    }
+
+    LOGC ("ZMQ Interface -- keeping ", capacity / selectedStreamSampleRate, " s of history for ", selectedChannels.size(), " channels");
+    return history;
+}
+
+void ZmqInterface::sendHistory (const var& request, void* replySocket, int64 maxReplyBytes, std::vector<float>& samples)
+{
+    DynamicObject::Ptr reply = new DynamicObject();
+    reply->setProperty ("type", "history");
+
+    const String stream = request["stream"].toString();
+
+    // the routing keeps this history alive until the reply is built
+    RcuPointer<Routing>::ReadLock current (routingTable);
+    const HistoryRing* history = current->history.get();
+
+    if (historyPort.load() > 0)
+        reply->setProperty ("history_port", historyPort.load());
+
+    if (history == nullptr)
+    {
+        reply->setProperty ("status", "disabled");
+    }
+    else if (stream.isNotEmpty() && stream != String (history->getStreamName()))
+    {
+        reply->setProperty ("status", "unknown_stream");
+    }
+    else
+    {
+        const std::vector<uint32_t> channelNumbers = history->getChannelNumbers();
+        const int64 maxSamples = jmin ((int64) request.getProperty ("num_samples", 0),
+                                       maxReplyBytes / (int64) (sizeof (float) * jmax ((size_t) 1, channelNumbers.size())));
+
+        HistoryRing::Range range = history->read ((int64) request["sample_num"], maxSamples, samples);
+
+        Array<var> channels;
+        for (auto channel : channelNumbers)
+            channels.add ((int) channel);
+
+        reply->setProperty ("status", range.numSamples > 0 ? "ok" : "unavailable");
+        reply->setProperty ("stream", String (history->getStreamName()));
+        reply->setProperty ("sample_rate", history->getSampleRate());
+        reply->setProperty ("channels", channels);
+        reply->setProperty ("sample_num", range.sampleNumber);
+        reply->setProperty ("num_samples", range.numSamples);
+        reply->setProperty ("oldest_sample", range.oldestSample);
+        reply->setProperty ("newest_sample", range.newestSample);
+    }
+
+    String header = JSON::toString (var (reply));
+
+    if (reply->getProperty ("status").toString() != "ok")
+        samples.clear();
+
+    // REP reply: JSON header, then the samples channel-major as float32
+    zmq_send (replySocket, header.getCharPointer(), header.getNumBytesAsUTF8(), ZMQ_SNDMORE);
+    zmq_send (replySocket, samples.data(), samples.size() * sizeof (float), 0);
+}
+
+void ZmqInterface::openHistorySocket()
+{
+    if (historySocket != nullptr || ! (bool) getParameter ("history")->getValue())
+        return;
+
+    const int port = (int) getParameter ("history_port")->getValue();
+
+    historySocket = zmq_socket (context, ZMQ_REP);
+    applyHeartbeat (historySocket);
+
+    if (zmq_bind (historySocket, ("tcp://*:" + std::to_string (port)).c_str()) != 0)
+    {
+        LOGE ("Couldn't open the history socket on port ", port, ": ", zmq_strerror (zmq_errno()));
+        zmq_close (historySocket);
+        historySocket = nullptr;
+        return;
+    }
+
+    historyThreadShouldExit = false;
+    historyThread = std::thread (&ZmqInterface::runHistory, this);
+    historyPort = port;
+
+    LOGC ("ZMQ Interface -- serving history on port ", port);
+}
+
+void ZmqInterface::closeHistorySocket()
+{
+    if (historySocket == nullptr)
+        return;
+
+    historyPort = 0;
+    historyThreadShouldExit = true;
+    historyThread.join();
+
+    zmq_close (historySocket);
+    historySocket = nullptr;
+}
+
+void ZmqInterface::runHistory()
+{
+    TRACE_THREAD ("history");
+
+    std::vector<float> samples;
+    zmq_pollitem_t item = { historySocket, 0, ZMQ_POLLIN, 0 };
+
+    while (! historyThreadShouldExit)
+    {
+        if (zmq_poll (&item, 1, 100) <= 0 || (item.revents & ZMQ_POLLIN) == 0)
+            continue;
+
+        zmq_msg_t request;
+        zmq_msg_init (&request);
+
+        const int size = zmq_msg_recv (&request, historySocket, 0);
+
+        var v;
+        if (size >= 0)
+            JSON::parse (String::fromUTF8 ((const char*) zmq_msg_data (&request), size), v);
+
+        zmq_msg_close (&request);
+
+        if (size >= 0)
+            sendHistory (v, historySocket, MAX_REPLY_BYTES, samples);
+    }
+}
+
+void ZmqInterface::updateRetransmitBuffer()
+{
+    if (! (bool) getParameter ("retransmit")->getValue())
+    {
+        retransmitBuffer.release();
+        return;
+    }
+
+    const size_t bytes = (size_t) (int) getParameter ("retransmit_mb")->getValue() * 1024 * 1024;
+
+    if (retransmitBuffer.prepare (bytes, NUM_TOPICS))
+        LOGC ("ZMQ Interface -- keeping ", bytes / (1024 * 1024), " MB of messages for retransmission");
+    else
+        LOGE ("Couldn't allocate the retransmit buffer");
+}
+
+void ZmqInterface::sendRetransmissions (const var& request)
+{
+    DynamicObject::Ptr reply = new DynamicObject();
+    reply->setProperty ("type", "retransmit");
+
+    const String topicName = request["topic"].toString();
+    int topic = -1;
+
+    for (int i = 0; i < NUM_TOPICS; i++)
+        if (topicName == topicEnvelopes[i])
+            topic = i;
+
+    Array<var> resent;
+    Array<var> missing;
+    Array<var> frameCounts;
+
+    std::vector<uint8_t> message;
+    std::vector<size_t> partSizes;
+    MemoryBlock payload;
+    std::vector<size_t> payloadParts;
+
+    if (! retransmitBuffer.isOpen())
+    {
+        reply->setProperty ("status", "disabled");
+    }
+    else if (topic < 0)
+    {
+        reply->setProperty ("status", "unknown_topic");
+    }
+    else
+    {
+        // "ranges": [[first, last], ...], both inclusive
+        const Array<var>* ranges = request["ranges"].getArray();
+        int64 requested = 0;
+        bool truncated = false;
+
+        for (int r = 0; ranges != nullptr && r < ranges->size() && ! truncated; r++)
+        {
+            const int64 first = (int64) (*ranges)[r][0];
+            const int64 last = (int64) (*ranges)[r][1];
+
+            for (int64 sequence = jmax ((int64) 1, first); sequence <= last; sequence++)
+            {
+                if (requested++ == MAX_RETRANSMIT_REQUEST || (int64) payload.getSize() >= MAX_REPLY_BYTES)
+                {
+                    reply->setProperty ("next_seq", sequence);
+                    truncated = true;
+                    break;
+                }
+
+                if (! retransmitBuffer.fetch (topic, (uint64) sequence, message, partSizes))
+                {
+                    missing.add (sequence);
+                    continue;
+                }
+
+                payload.append (message.data(), message.size());
+                payloadParts.insert (payloadParts.end(), partSizes.begin(), partSizes.end());
+
+                resent.add (sequence);
+                frameCounts.add ((int) partSizes.size());
+            }
+        }
+
+        reply->setProperty ("status", "ok");
+        reply->setProperty ("topic", topicName);
+    }
+
+    reply->setProperty ("resent", resent);
+    reply->setProperty ("missing", missing);
+    reply->setProperty ("frames", frameCounts);
+
+    String header = JSON::toString (var (reply));
+
+    // REP reply: JSON header, then the frames of every resent message in order
+    zmq_send (listenSocket, header.getCharPointer(), header.getNumBytesAsUTF8(), payloadParts.empty() ? 0 : ZMQ_SNDMORE);
+
+    size_t offset = 0;
+    for (size_t i = 0; i < payloadParts.size(); i++)
+    {
+        zmq_send (listenSocket, (const char*) payload.getData() + offset, payloadParts[i], i + 1 < payloadParts.size() ? ZMQ_SNDMORE : 0);
+        offset += payloadParts[i];
+    }
+}
+
+void ZmqInterface::updateReliableChannel()
+{
+    reliableChannel.stop();
+
+    if (! (bool) getParameter ("reliable")->getValue())
+        return;
+
+    const int port = (int) getParameter ("reliable_port")->getValue();
+    const size_t bytes = (size_t) (int) getParameter ("reliable_mb")->getValue() * 1024 * 1024;
+
+    std::vector<std::string> topics (topicEnvelopes, topicEnvelopes + NUM_TOPICS);
+
+    if (reliableChannel.start (context, "tcp://*:" + std::to_string (port), bytes, topics))
+        LOGC ("ZMQ Interface -- reliable channel on port ", port);
+    else
+        LOGE ("Couldn't open the reliable channel on port ", port, ": ", zmq_strerror (zmq_errno()));
+}
+
+void ZmqInterface::updateEncoderPool()
+{
+    const int numThreads = (int) getParameter ("encoder_threads")->getValue();
+    const bool pinning = (bool) getParameter ("encoder_pinning")->getValue();
+
+    encoderPool.start (numThreads, pinning);
+
+    if (numThreads > 0)
+        LOGC ("ZMQ Interface -- encoding on ", numThreads, " worker threads", pinning ? " pinned to cores" : "");
+}
+
+void ZmqInterface::sendMetrics()
+{
+    DynamicObject::Ptr reply = new DynamicObject();
+    reply->setProperty ("type", "metrics");
+    reply->setProperty ("message_num", messageNumber.load (std::memory_order_relaxed));
+
+    Array<var> sequences;
+    for (int i = 0; i < NUM_TOPICS; i++)
+        sequences.add ((int64) topicSequences[i].load (std::memory_order_relaxed));
+    reply->setProperty ("seq", sequences);
+
+    if (reliableChannel.isRunning())
+    {
+        ReliableChannel::Stats stats = reliableChannel.getStats();
+
+        DynamicObject::Ptr reliable = new DynamicObject();
+        reliable->setProperty ("buffered_bytes", (int64) stats.bufferedBytes);
+        reliable->setProperty ("max_buffered_bytes", (int64) stats.maxBufferedBytes);
+        reliable->setProperty ("backpressure", stats.maxBufferedBytes > 0 ? (double) stats.bufferedBytes / stats.maxBufferedBytes : 0.0);
+        reliable->setProperty ("dropped_at_input", (int64) stats.droppedAtInput);
+
+        Array<var> consumers;
+        for (auto& c : stats.consumers)
+        {
+            DynamicObject::Ptr consumer = new DynamicObject();
+            consumer->setProperty ("application", String (c.name));
+            consumer->setProperty ("credit", (int64) c.credit);
+            consumer->setProperty ("queued_messages", (int64) c.queuedMessages);
+            consumer->setProperty ("queued_bytes", (int64) c.queuedBytes);
+            consumer->setProperty ("sent", (int64) c.sent);
+            consumer->setProperty ("dropped", (int64) c.dropped);
+            consumer->setProperty ("overflowing", c.overflowing);
+            consumer->setProperty ("mode", c.adaptive ? "adaptive" : "reliable");
+            if (c.adaptive)
+                consumer->setProperty ("tier", c.tier);
+            consumers.add (var (consumer));
+        }
+        reliable->setProperty ("consumers", consumers);
+
+        reply->setProperty ("reliable", var (reliable));
+    }
+
+    if (! clientStats.empty())
+    {
+        Array<var> clients;
+        for (auto& entry : clientStats)
+        {
+            DynamicObject::Ptr client = new DynamicObject();
+            client->setProperty ("uuid", String (entry.first));
+            client->setProperty ("received", (int64) entry.second.received);
+            client->setProperty ("missed", (int64) entry.second.missed);
+            client->setProperty ("latency_us", (int64) entry.second.latencyUs);
+            client->setProperty ("age_ms", Time::currentTimeMillis() - entry.second.time);
+
+            if (! entry.second.topicLags.empty())
             {
-                int globalChanIndex = contChans.getUnchecked (chan)->getGlobalIndex();
-                String channelName = contChans.getUnchecked (chan)->getName();
-                sendData (buffer.getWritePointer (globalChanIndex), chan, channelName, numSamples, sampleNum, selectedStreamSampleRate);
+                DynamicObject::Ptr topics = new DynamicObject();
+                for (auto& topic : entry.second.topicLags)
+                    topics->setProperty (String (topic.first), topic.second);
+
+                client->setProperty ("lag", entry.second.lag);
+                client->setProperty ("lagging", entry.second.lagging);
+                client->setProperty ("topic_lag", var (topics));
+                client->setProperty ("queue_depth", (int64) entry.second.queueDepth);
+                client->setProperty ("processing_us", (int64) entry.second.processingUs);
             }
+
+            clients.add (var (client));
         }
+        reply->setProperty ("clients", clients);
+    }
+
+    DynamicObject::Ptr connections = new DynamicObject();
+    const std::pair<const char*, const SocketMonitor*> monitors[] = {
+        { "data", &dataMonitor },
+        { "events", &eventMonitor },
+        { "listen", &listenMonitor }
+    };
+
+    for (auto& monitor : monitors)
+    {
+        DynamicObject::Ptr counts = new DynamicObject();
+        counts->setProperty ("peers", monitor.second->getNumPeers());
+        counts->setProperty ("accepted", (int64) monitor.second->getNumAccepted());
+        counts->setProperty ("disconnected", (int64) monitor.second->getNumDisconnected());
+        counts->setProperty ("handshake_failures", (int64) monitor.second->getNumHandshakeFailures());
+        connections->setProperty (monitor.first, var (counts));
+    }
+    reply->setProperty ("connections", var (connections));
+
+    DynamicObject::Ptr cpu = new DynamicObject();
+    cpu->setProperty ("level", governor.getLevel());
+    cpu->setProperty ("step", CpuGovernor::getLevelName (governor.getLevel()));
+    cpu->setProperty ("load", governor.getLoad());
+    cpu->setProperty ("budget", governor.getBudget());
+    cpu->setProperty ("changes", (int64) governor.getNumChanges());
+    reply->setProperty ("governor", var (cpu));
+
+    {
+        RcuPointer<Routing>::ReadLock current (routingTable);
+        reply->setProperty ("crossings_dropped", (int64) current->crossingDetector->getNumDropped());
+    }
+
+#if ZMQ_INTERFACE_RT_AUDIT
+    const RealtimeAudit::Totals totals = RealtimeAudit::getTotals();
+
+    DynamicObject::Ptr audit = new DynamicObject();
+    audit->setProperty ("blocks", (int64) totals.blocks);
+    audit->setProperty ("violating_blocks", (int64) totals.violatingBlocks);
+    audit->setProperty ("allocations", (int64) totals.counts[RealtimeAudit::ALLOCATION]);
+    audit->setProperty ("frees", (int64) totals.counts[RealtimeAudit::FREE]);
+    audit->setProperty ("locks", (int64) totals.counts[RealtimeAudit::LOCK]);
+    audit->setProperty ("syscalls", (int64) totals.counts[RealtimeAudit::SYSCALL]);
+    reply->setProperty ("realtime_audit", var (audit));
+#endif
+
+    DynamicObject::Ptr cache = new DynamicObject();
+    cache->setProperty ("encoded", (int64) encodingCache.getNumEncoded());
+    cache->setProperty ("shared", (int64) encodingCache.getNumShared());
+    reply->setProperty ("encoding_cache", var (cache));
+
+    String response = JSON::toString (var (reply));
+    zmq_send (listenSocket, response.toRawUTF8(), response.getNumBytesAsUTF8(), 0);
+}
+
+void ZmqInterface::sendTrace (const var& request)
+{
+    DynamicObject::Ptr reply = new DynamicObject();
+    reply->setProperty ("type", "trace");
+
+#if ZMQ_INTERFACE_TRACE
+    const String file = request["file"].toString();
+
+    if (file.isEmpty())
+    {
+        const std::string json = Trace::toChromeJson();
+        zmq_send (listenSocket, json.data(), json.size(), 0);
+        return;
+    }
+
+    const bool written = Trace::writeFile (file.toStdString());
+    reply->setProperty ("status", written ? "ok" : "error");
+    reply->setProperty ("file", file);
+#else
+    ignoreUnused (request);
+    reply->setProperty ("status", "disabled");
+#endif
+
+    String response = JSON::toString (var (reply));
+    zmq_send (listenSocket, response.toRawUTF8(), response.getNumBytesAsUTF8(), 0);
+}
+
+String ZmqInterface::handleSubscription (const var& request)
+{
+    DynamicObject::Ptr reply = new DynamicObject();
+    reply->setProperty ("type", request["type"]);
+
+    const std::string client = request["uuid"].toString().toStdString();
+
+    if (client.empty())
+    {
+        reply->setProperty ("status", "error");
+        reply->setProperty ("error", "uuid required");
+        return JSON::toString (var (reply));
+    }
+
+    if (request["type"].toString() == "unsubscribe")
+    {
+        subscriptions.unsubscribe (client, request["topic"].toString().toStdString());
+        reply->setProperty ("status", "ok");
+        return JSON::toString (var (reply));
+    }
+
+    std::vector<int> channels;
+    if (const Array<var>* requested = request["channels"].getArray())
+        for (auto& channel : *requested)
+            channels.push_back ((int) channel);
+
+    const BlockEncoder::Encoding encoding = request["encoding"].toString() == "int16" ? BlockEncoder::INT16 : BlockEncoder::FLOAT32;
+
+    std::string error;
+    std::string topicName = subscriptions.subscribe (client,
+                                                     request["stream"].toString().toStdString(),
+                                                     channels,
+                                                     (int) request.getProperty ("decimation", 1),
+                                                     (double) request.getProperty ("sample_rate", 0.0),
+                                                     encoding,
+                                                     error);
+
+    SubscriptionTable::Topic topic;
+
+    if (topicName.empty() || ! subscriptions.getTopicInfo (topicName, topic))
+    {
+        reply->setProperty ("status", "error");
+        reply->setProperty ("error", String (error));
+        return JSON::toString (var (reply));
+    }
+
+    Array<var> topicChannels;
+    for (int channel : topic.format.channels)
+        topicChannels.add (channel);
+
+    reply->setProperty ("status", "ok");
+    reply->setProperty ("topic", String (topic.name));
+    reply->setProperty ("stream", String (topic.streamName));
+    reply->setProperty ("channels", topicChannels);
+    reply->setProperty ("decimation", topic.format.decimation);
+    reply->setProperty ("sample_rate", topic.sampleRate / topic.format.decimation);
+    reply->setProperty ("encoding", BlockEncoder::getEncodingName (topic.format.encoding));
+
+    return JSON::toString (var (reply));
+}
+
+int ZmqInterface::sendSubscriptionData (const SubscriptionTable::Route& route, int64 sampleNumber, int numSamples)
+{
+    TRACE_SCOPE ("sendSubscriptionData");
+
+    SubscriptionTable::Topic& topic = *route.topic;
+    const EncodingCache::BufferPtr& output = topic.output;
+
+    const int64 messageNum = nextMessageNumber();
+
+    const int decimation = topic.format.decimation;
+    const int thinning = topic.thinning.load (std::memory_order_relaxed);
+    const int64 sequence = (int64) ++topic.sequence;
+
+    MessageFrame frames[] = {
+        { output->data.data(), output->data.size(), output },
+        { output->scales.data(), output->scales.size() * sizeof (float), output }
+    };
+
+    const int numFrames = output->scales.empty() ? 1 : 2;
+
+    // the header was rendered when the topic was created; only its numbers change
+    if (route.header.isValid())
+    {
+        const int64 values[SubscriptionTable::NUM_HEADER_SLOTS] = {
+            messageNum,
+            sampleNumber,
+            numSamples,
+            numSamples / decimation,
+            thinning,
+            (int64) output->data.size(),
+            Time::currentTimeMillis(),
+            sequence
+        };
+
+        route.header.render (values, headerBuffer);
+        return sendFrames (socket, topic.name.c_str(), headerBuffer.data(), headerBuffer.size(), frames, numFrames);
+    }
+
+    RT_AUDIT_SCOPE ("sendSubscriptionData");
+    RT_AUDIT_ALLOCATION ("JSON::toString");
+
+    DynamicObject::Ptr obj = new DynamicObject();
+
+    obj->setProperty ("message_num", messageNum);
+    obj->setProperty ("type", "subscription");
+
+    Array<var> channels;
+    for (int channel : topic.format.channels)
+        channels.add (channel);
+
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty ("topic", String (topic.name));
+    c_obj->setProperty ("stream", String (topic.streamName));
+    c_obj->setProperty ("sample_num", sampleNumber);
+    c_obj->setProperty ("num_samples", numSamples);
+    c_obj->setProperty ("num_output_samples", numSamples / decimation);
+    c_obj->setProperty ("decimation", decimation);
+    c_obj->setProperty ("thinning", thinning);
+    c_obj->setProperty ("sample_rate", route.sampleRate / decimation);
+    c_obj->setProperty ("encoding", BlockEncoder::getEncodingName (topic.format.encoding));
+    c_obj->setProperty ("channels", channels);
+
+    obj->setProperty ("content", var (c_obj));
+    obj->setProperty ("data_size", (int) output->data.size());
+    obj->setProperty ("timestamp", Time::currentTimeMillis());
+    obj->setProperty ("seq", sequence);
+
+    const String header = JSON::toString (var (obj));
+
+    return sendFrames (socket, topic.name.c_str(), header.toRawUTF8(), header.getNumBytesAsUTF8(), frames, numFrames);
+}
+
+void ZmqInterface::detectCrossings (AudioBuffer<float>& buffer,
+                                    int numSamples,
+                                    int64 sampleNum)
+{
+    ThresholdCrossingDetector& detector = *routing->crossingDetector;
+    detector.beginBlock();
+
+    for (size_t i = 0; i < routing->channels.size(); i++)
+    {
+        const Routing::Channel& channel = routing->channels[i];
+
+        detector.detect ((int) i,
+                         (uint32) channel.index,
+                         buffer.getReadPointer (channel.globalIndex),
+                         numSamples,
+                         sampleNum);
+    }
+
+    if (detector.getCrossings().size() > 0)
+        sendCrossings (detector.getCrossings(), sampleNum, numSamples);
+}
+
+std::shared_ptr<ThresholdCrossingDetector> ZmqInterface::createCrossingDetector()
+{
+    std::shared_ptr<ThresholdCrossingDetector> detector = std::make_shared<ThresholdCrossingDetector>();
+
+    detector->setMode ((ThresholdCrossingDetector::Mode) static_cast<CategoricalParameter*> (getParameter ("crossing_mode"))->getSelectedIndex());
+    detector->setAdaptiveMultiplier ((float) getParameter ("crossing_multiplier")->getValue());
+    detector->setFixedThreshold ((float) getParameter ("crossing_threshold")->getValue());
+    detector->prepare (selectedChannels.size(), selectedStreamSampleRate);
+    detector->setRefractoryPeriod ((float) getParameter ("crossing_refractory")->getValue());
+
+    // per-channel overrides, as "channel:threshold" pairs
+    StringArray overrides;
+    overrides.addTokens (getParameter ("crossing_channel_thresholds")->getValueAsString(), ",;", "");
+    overrides.trim();
+    overrides.removeEmptyStrings();
+
+    for (auto& item : overrides)
+    {
+        int chan = item.upToFirstOccurrenceOf (":", false, false).getIntValue();
+        float threshold = item.fromFirstOccurrenceOf (":", false, false).getFloatValue();
+
+        int index = selectedChannels.indexOf (chan);
+
+        if (index >= 0)
+            detector->setChannelThreshold (index, threshold);
     }
+
+    return detector;
 }
 
 void ZmqInterface::updateSettings()
 {
+    std::vector<SubscriptionTable::StreamInfo> streams;
+    size_t maxChannels = 0;
+
+    for (auto stream : dataStreams)
+    {
+        streams.push_back ({ stream->getStreamId(),
+                             stream->getName().toStdString(),
+                             stream->getChannelCount(),
+                             stream->getSampleRate() });
+        maxChannels = jmax (maxChannels, (size_t) stream->getChannelCount());
+    }
+
+    subscriptions.setStreams (streams);
+    streamInputs.resize (maxChannels);
+    chunkInputs.resize (maxChannels);
+    chunkChannels.resize (maxChannels);
+
     if (dataStreams.size() > 0)
     {
         parameterValueChanged (getDataStream (selectedStream)->getParameter ("channels"));
     }
+    else
+    {
+        updateRouting (ROUTE_ALL);
+    }
 }
 
 void ZmqInterface::parameterValueChanged (Parameter* param)
@@ -726,7 +3025,10 @@ void ZmqInterface::parameterValueChanged (Parameter* param)
     if (param->getName().equalsIgnoreCase ("channels"))
     {
         if (param->getStreamId() == selectedStream)
+        {
             selectedChannels = static_cast<MaskChannelsParameter*> (param)->getArrayValue();
+            updateRouting (ROUTE_ALL);
+        }
     }
     else if (param->getName().equalsIgnoreCase ("stream"))
     {
@@ -745,6 +3047,110 @@ void ZmqInterface::parameterValueChanged (Parameter* param)
         {
             selectedChannels = p->getArrayValue();
         }
+
+        updateRouting (ROUTE_ALL);
+    }
+    else if (param->getName().equalsIgnoreCase ("publish_selected"))
+    {
+        publishSelected = (bool) param->getValue();
+    }
+    else if (param->getName().equalsIgnoreCase ("data_endpoints") || param->getName().equalsIgnoreCase ("listen_endpoints"))
+    {
+        closeListenSocket();
+        closeDataSocket();
+        openListenSocket();
+        openDataSocket();
+    }
+    else if (param->getName().startsWith ("event_"))
+    {
+        separateEventSocket = (bool) getParameter ("event_socket")->getValue();
+        eventPort = (int) getParameter ("event_port")->getValue();
+        eventHighWaterMark = (int) getParameter ("event_hwm")->getValue();
+
+        closeEventSocket();
+        openEventSocket();
+    }
+    else if (param->getName().equalsIgnoreCase ("ttl_format"))
+    {
+        ttlFormat = (TtlFormat) static_cast<CategoricalParameter*> (param)->getSelectedIndex();
+    }
+    else if (param->getName().equalsIgnoreCase ("line_states"))
+    {
+        lineStatesEnabled = (bool) param->getValue();
+    }
+    else if (param->getName().startsWith ("spike_"))
+    {
+        spikeFormat = (SpikeFormat) static_cast<CategoricalParameter*> (getParameter ("spike_format"))->getSelectedIndex();
+        spikeWaveform = (SpikeWaveform) static_cast<CategoricalParameter*> (getParameter ("spike_waveform"))->getSelectedIndex();
+        spikeWindow = (int) getParameter ("spike_window")->getValue();
+    }
+    else if (param->getName().startsWith ("crossing"))
+    {
+        updateRouting (ROUTE_CROSSINGS);
+    }
+    else if (param->getName().startsWith ("chunk_"))
+    {
+        updateRouting (ROUTE_CHUNKS);
+    }
+    else if (param->getName().equalsIgnoreCase ("shared_memory") || param->getName().startsWith ("shm_"))
+    {
+        updateRouting (ROUTE_SHARED_MEMORY);
+    }
+    else if (param->getName().startsWith ("history"))
+    {
+        updateRouting (ROUTE_HISTORY);
+
+        closeHistorySocket();
+        openHistorySocket();
+    }
+    else if (param->getName().startsWith ("retransmit"))
+    {
+        updateRetransmitBuffer();
+    }
+    else if (param->getName().startsWith ("reliable"))
+    {
+        updateReliableChannel();
+    }
+    else if (param->getName().startsWith ("encoder_"))
+    {
+        updateEncoderPool();
+    }
+    else if (param->getName().equalsIgnoreCase ("local_api"))
+    {
+        updateLocalStream();
+    }
+    else if (param->getName().startsWith ("heartbeat_"))
+    {
+        heartbeatIntervalMs = (int) getParameter ("heartbeat_interval")->getValue();
+        heartbeatTimeoutMs = (int) getParameter ("heartbeat_timeout")->getValue();
+
+        // heartbeat options apply to connections made after they are set
+        closeListenSocket();
+        closeDataSocket();
+        closeEventSocket();
+        openListenSocket();
+        openDataSocket();
+        openEventSocket();
+    }
+    else if (param->getName().equalsIgnoreCase ("governor_priority"))
+    {
+        updateRouting (ROUTE_CHANNELS);
+    }
+    else if (param->getName().equalsIgnoreCase ("governor") || param->getName().equalsIgnoreCase ("cpu_budget"))
+    {
+        updateGovernor();
+    }
+    else if (param->getName().startsWith ("lag_"))
+    {
+        lagPolicy = (LagPolicy) static_cast<CategoricalParameter*> (getParameter ("lag_policy"))->getSelectedIndex();
+        lagThreshold = (int) getParameter ("lag_threshold")->getValue();
+
+        if (lagPolicy == LAG_REPORT)
+            subscriptions.resetThinning();
+    }
+    else if (param->getName().equalsIgnoreCase ("client_timeout"))
+    {
+        clientTimeoutMs = (int) param->getValue();
     }
     else if (param->getName().equalsIgnoreCase ("data_port"))
     {
@@ -760,6 +3166,9 @@ void ZmqInterface::parameterValueChanged (Parameter* param)
             listenPort = dataPort + 1;
             openListenSocket();
             openDataSocket();
+
+            if ((bool) getParameter ("shared_memory")->getValue())
+                updateRouting (ROUTE_SHARED_MEMORY); // segment name follows the data port
         }
     }
 }
\ No newline at end of file
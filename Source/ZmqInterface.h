@@ -29,14 +29,44 @@
 
 #include <ProcessorHeaders.h>
 
+#include "ControlProtocol.h"
+#include "CpuGovernor.h"
+#include "EncoderPool.h"
+#include "EncodingCache.h"
+#include "HeaderTemplate.h"
+#include "HistoryRing.h"
+#include "RcuPointer.h"
+#include "RealtimeAudit.h"
+#include "Rechunker.h"
+#include "ReliableChannel.h"
+#include "RetransmitBuffer.h"
+#include "SharedMemoryRing.h"
+#include "SocketMonitor.h"
+#include "SubscriptionTable.h"
+#include "ThresholdCrossingDetector.h"
+#include "Trace.h"
+
+#include <atomic>
+#include <memory>
 #include <queue>
+#include <thread>
+#include <vector>
+
+class LocalStream;
 
 struct ZmqApplication
 {
     String name;
     String Uuid;
-    time_t lastSeen;
+    int64 lastSeenMs;
     bool alive;
+    bool connected;
+
+    /** From the client's lag reports; lag is -1 until it sends one */
+    int64 lag;
+    uint32 queueDepth;
+    uint32 processingUs;
+    bool lagging;
 };
 
 class ZmqInterface : public GenericProcessor, public Thread, public Timer
@@ -99,6 +129,18 @@ private:
     /** Closes the data socket */
     int closeDataSocket();
 
+    /** Binds a socket to a comma-separated list of additional endpoints (tcp://, ipc://, inproc://) */
+    int bindEndpoints (void* targetSocket, const String& endpoints);
+
+    /** Opens the event socket, if events are sent separately from data */
+    int openEventSocket();
+
+    /** Closes the event socket */
+    int closeEventSocket();
+
+    /** Returns the socket events and spikes are sent on */
+    void* getEventSocket() const;
+
     /** Called at the start of acquisition */
     bool startAcquisition();
 
@@ -111,8 +153,174 @@ private:
     /** Called whenever a new spike arrives */
     void handleSpike (SpikePtr spike) override;
 
-    /** Sends continuous data for one channel over the ZMQ socket */
-    int sendData (float* data, int channelNum, const String& channelName, int nSamples, int64 sampleNumber, float sampleRate);
+    struct MessageFrame
+    {
+        const void* data;
+        size_t size;
+
+        /** If set, data lies in this buffer and is sent without copying it
+            (frames small enough to live inside a zmq_msg_t are copied anyway) */
+        EncodingCache::BufferPtr owner;
+    };
+
+    /** A reference to a frame's buffer, held by libzmq until the frame has been sent */
+    struct FrameHandle
+    {
+        EncodingCache::BufferPtr owner;
+        std::atomic<bool> inUse { false };
+    };
+
+    /** Message topics, each with its own envelope and sequence numbers */
+    enum Topic
+    {
+        TOPIC_DATA = 0,
+        TOPIC_EVENT,
+        TOPIC_CROSSINGS,
+        TOPIC_LINES,
+        NUM_TOPICS
+    };
+
+    /** Counts a sent message and returns its number (processing thread) */
+    int64 nextMessageNumber();
+
+    /** Counts a message of a topic and returns its sequence number (processing thread) */
+    uint64 nextSequence (int topic);
+
+    /** Sends the topic's envelope, the JSON header (stamped with the topic's next
+        sequence number) and a number of binary frames as one multi-part message */
+    int sendMessage (void* targetSocket, Topic topic, DynamicObject::Ptr header, const MessageFrame* frames, int numFrames);
+
+    /** Sends a message whose header (already stamped with sequence) is rendered, and keeps
+        it for retransmission and the reliable channel */
+    int sendRenderedMessage (void* targetSocket,
+                             Topic topic,
+                             uint64 sequence,
+                             const char* header,
+                             size_t headerSize,
+                             const MessageFrame* frames,
+                             int numFrames);
+
+    /** Returns an unused handle from frameHandles holding owner, or nullptr if all are in use */
+    FrameHandle* acquireFrameHandle (const EncodingCache::BufferPtr& owner);
+
+    /** libzmq's free function for zero-copy frames; returns the handle to the pool */
+    static void releaseFrameHandle (void* data, void* hint);
+
+    /** Sends an envelope, a header and a number of binary frames as one multi-part message */
+    int sendFrames (void* targetSocket,
+                    const char* envelope,
+                    const char* header,
+                    size_t headerSize,
+                    const MessageFrame* frames,
+                    int numFrames);
+
+    /** Numbers that change between DATA messages of a channel */
+    enum DataHeaderSlot
+    {
+        SLOT_MESSAGE_NUM = 0,
+        SLOT_NUM_SAMPLES,
+        SLOT_SAMPLE_NUM,
+        SLOT_DATA_SIZE,
+        SLOT_TIMESTAMP,
+        SLOT_SEQ,
+        NUM_DATA_HEADER_SLOTS
+    };
+
+    /** Everything the processing thread needs to route a block. Rebuilt from the
+        streams and the selection whenever they change, and swapped in as a whole */
+    struct Routing
+    {
+        struct Channel
+        {
+            int index;       // in the selected stream
+            int globalIndex; // in the processing buffer
+            String name;
+            float bitVolts;
+
+            /** The channel's DATA header, patched for every message */
+            HeaderTemplate header;
+
+            /** The same at each CPU governor level from DECIMATE on, with that level's
+                "decimation", "encoding" and sample rate */
+            HeaderTemplate governedHeaders[CpuGovernor::NUM_LEVELS];
+        };
+
+        struct Stream
+        {
+            uint16 streamId;
+            std::vector<int> globalIndices;
+        };
+
+        std::vector<Stream> streams;
+
+        uint16 selectedStream = 0;
+        String streamName;
+        std::string streamNameUtf8;
+        float sampleRate = 0.0f;
+        std::vector<Channel> channels;
+        std::vector<uint32_t> channelNumbers;
+        BlockEncoder::Format format;
+
+        /** What is sent of the selected channels at each CPU governor level: the format
+            for the encoding cache (channel indices in the stream), the format for
+            rechunked data (positions in channels) and the positions of the channels sent */
+        BlockEncoder::Format governedFormats[CpuGovernor::NUM_LEVELS];
+        BlockEncoder::Format governedChunkFormats[CpuGovernor::NUM_LEVELS];
+        std::vector<int> governedChannels[CpuGovernor::NUM_LEVELS];
+
+        /** The stateful processors of the selected channels. Only the processing thread
+            writes to them (and the ZMQ thread reads the history); a parameter change builds
+            replacements and publishes them in a new Routing, which shares the others */
+        std::shared_ptr<ThresholdCrossingDetector> crossingDetector = std::make_shared<ThresholdCrossingDetector>();
+        std::shared_ptr<Rechunker> rechunker = std::make_shared<Rechunker>();
+        std::shared_ptr<SharedMemoryRing> sharedMemory; // null when disabled
+        std::shared_ptr<HistoryRing> history;           // null when disabled
+    };
+
+    /** Parts of the Routing that updateRouting() rebuilds */
+    enum RoutingPart
+    {
+        ROUTE_CHANNELS = 1,
+        ROUTE_CROSSINGS = 2,
+        ROUTE_CHUNKS = 4,
+        ROUTE_SHARED_MEMORY = 8,
+        ROUTE_HISTORY = 16,
+        ROUTE_ALL = 31
+    };
+
+    /** Builds the JSON header of a DATA message; values are indexed by DataHeaderSlot.
+        An encoded format adds its "decimation" and "encoding" */
+    DynamicObject::Ptr createDataHeader (const Routing::Channel& channel,
+                                         const String& streamName,
+                                         float sampleRate,
+                                         const int64* values,
+                                         const BlockEncoder::Format* format = nullptr);
+
+    /** Sends continuous data for one selected channel over the ZMQ socket */
+    int sendData (const float* data,
+                  const Routing::Channel& channel,
+                  int nSamples,
+                  int64 sampleNumber,
+                  const EncodingCache::BufferPtr& owner = nullptr);
+
+    /** Sends the selected channels of a block encoded for the current governor level */
+    void sendGovernedBlock (const EncodingCache::BufferPtr& block, int64 sampleNum);
+
+    /** Sends one output channel of a decimated or quantized block as a DATA message */
+    int sendEncodedData (const EncodingCache::Buffer& block,
+                         int outputChannel,
+                         const Routing::Channel& channel,
+                         int64 sampleNumber,
+                         const EncodingCache::BufferPtr& owner);
+
+    /** Logs the CPU governor's level changes (message thread) */
+    void checkGovernor();
+
+    /** Logs the blocks in which the real-time audit saw allocations, locks or syscalls (message thread) */
+    void checkRealtimeAudit();
+
+    /** Applies the governor parameters */
+    void updateGovernor();
 
     /** Sends an event over the ZMQ socket */
     int sendEvent (uint8 type,
@@ -124,6 +332,124 @@ private:
     /** Sends a spike over the ZMQ socket */
     int sendSpikeEvent (const SpikePtr spike);
 
+    /** Adds a spike to the batch sent at the end of the block */
+    void queueSpike (const SpikePtr spike);
+
+    /** Sends all spikes queued during the current block as one message */
+    int sendSpikeBatch (int64 sampleNumber);
+
+    /** Sends all TTL events queued during the current block as one message */
+    int sendTtlBatch (int64 sampleNumber);
+
+    /** Sends the state of all TTL lines at the end of the current block */
+    int sendLineStates (int64 sampleNumber, int nSamples);
+
+    /** Sends the threshold crossings detected in the current block */
+    int sendCrossings (const std::vector<CrossingRecord>& crossings, int64 sampleNumber, int nSamples);
+
+    /** Sends the chunk currently held by the rechunker, one message per channel */
+    void sendChunk (int64 sampleNum, int numSamples);
+
+    /** Publishes a new Routing with the given RoutingParts rebuilt from the parameters
+        and the others carried over. Waits for the processing thread (message thread only) */
+    void updateRouting (int parts);
+
+    /** Keeps selectedChannelNumbers in sync with selectedChannels and builds the channel routing */
+    std::unique_ptr<Routing> createChannelRouting();
+
+    /** Builds a rechunker with the chunking parameters */
+    std::shared_ptr<Rechunker> createRechunker();
+
+    /** Registers or removes the in-process stream according to the parameters */
+    void updateLocalStream();
+
+    /** Creates the shared memory segment if the parameters enable it */
+    std::shared_ptr<SharedMemoryRing> createSharedMemory();
+
+    /** Allocates the history ring if the parameters enable it */
+    std::shared_ptr<HistoryRing> createHistory();
+
+    /** Answers a history request on a REP socket with at most maxReplyBytes of samples,
+        read into the calling thread's buffer */
+    void sendHistory (const var& request, void* replySocket, int64 maxReplyBytes, std::vector<float>& samples);
+
+    /** Opens the history socket and starts its thread if the parameters enable it */
+    void openHistorySocket();
+
+    /** Stops the history thread and closes its socket */
+    void closeHistorySocket();
+
+    /** Serves history requests on the history socket (history thread) */
+    void runHistory();
+
+    /** Allocates or releases the retransmit buffer according to the parameters */
+    void updateRetransmitBuffer();
+
+    /** Answers a retransmit request received on the listening socket (ZMQ thread) */
+    void sendRetransmissions (const var& request);
+
+    /** Starts or stops the reliable channel according to the parameters */
+    void updateReliableChannel();
+
+    /** Starts the encoding workers from the "encoder_threads" and "encoder_pinning" parameters */
+    void updateEncoderPool();
+
+    /** Decodes a binary control request, forwards its records to the message thread and replies (ZMQ thread) */
+    void handleControlRequest (const char* request, size_t size, int peerFd);
+
+    /** Marks a client as alive, adding it to the application list if it is new */
+    void updateApplication (const String& uuid, const String& name, int64 timeMs);
+
+    /** Marks a client as gone and releases its subscriptions */
+    void releaseApplication (ZmqApplication* app, const String& reason);
+
+    /** Sets the ZMTP heartbeat options on a socket before it is bound */
+    void applyHeartbeat (void* targetSocket);
+
+    /** Drains the connection events of the data and event sockets */
+    void pollMonitors();
+
+    /** Reports control clients whose connection was dropped to the message thread (ZMQ thread) */
+    void handleListenEvent (const SocketMonitor::Event& event);
+
+    /** Remembers which client a control connection belongs to (ZMQ thread) */
+    void trackControlPeer (int peerFd, const std::string& uuid);
+
+    /** Tells the message thread that a client's control connection was identified or dropped (ZMQ thread) */
+    void sendConnectionEvent (const std::string& uuid, bool connected);
+
+    struct ClientStats;
+
+    /** Returns the stats of a client, adding them if there is room (ZMQ thread) */
+    ClientStats* findClientStats (const std::string& uuid);
+
+    /** Handles the "lag" object of a JSON request (ZMQ thread) */
+    void handleLagReport (const std::string& uuid, const var& report);
+
+    /** Records how many messages of a topic a client has not processed yet */
+    void updateTopicLag (ClientStats& stats, const std::string& topic, uint64 lastSequence);
+
+    /** Updates a client's lagging state, applies the lag policy and informs the message thread */
+    void applyLagReport (const std::string& uuid, ClientStats& stats);
+
+    /** Answers a metrics request received on the listening socket (ZMQ thread) */
+    void sendMetrics();
+
+    /** Answers a trace request: the recorded trace as Chrome trace JSON, or written to "file" (ZMQ thread) */
+    void sendTrace (const var& request);
+
+    /** Handles a subscribe or unsubscribe request (ZMQ thread); returns the JSON reply */
+    String handleSubscription (const var& request);
+
+    /** Sends the output of one negotiated subscription topic */
+    int sendSubscriptionData (const SubscriptionTable::Route& route, int64 sampleNumber, int numSamples);
+
+    /** Runs threshold crossing detection on the selected channels of one block */
+    void detectCrossings (AudioBuffer<float>& buffer, int numSamples, int64 sampleNum);
+
+    /** Builds a detector with the crossing parameters */
+    std::shared_ptr<ThresholdCrossingDetector> createCrossingDetector();
+
     /** Currently only supports events related to keeping track of connected applications */
     int receiveEvents();
 
@@ -135,6 +461,7 @@ private:
 
     void* context;
     void* socket;
+    void* eventSocket;
     void* listenSocket;
     void* controlSocket;
     void* killSocket;
@@ -143,13 +470,133 @@ private:
 
     OwnedArray<ZmqApplication> applications;
 
-    int messageNumber;
+    /** Written by the processing thread only; the ZMQ thread reads them for metrics and lag */
+    std::atomic<int64> messageNumber;
+    std::atomic<uint64> topicSequences[NUM_TOPICS];
     int dataPort;
     int listenPort;
+    int eventPort;
+    int eventHighWaterMark;
+    bool separateEventSocket;
 
     Array<int> selectedChannels;
+    std::vector<uint32_t> selectedChannelNumbers;
+
+    RcuPointer<Routing> routingTable;
+
+    /** The routing in use on the processing thread, valid while process() or stopAcquisition() runs */
+    const Routing* routing;
+    std::string headerBuffer;
     std::map<uint16, String> streamNamesMap;
 
+    /** Handles of zero-copy frames, so sending one does not allocate; nextFrameHandle is where the search starts */
+    std::unique_ptr<FrameHandle[]> frameHandles;
+    size_t nextFrameHandle;
+
+    enum TtlFormat
+    {
+        TTL_JSON = 0,
+        TTL_BINARY
+    };
+
+    TtlFormat ttlFormat;
+    std::vector<TtlRecord> ttlRecords;
+
+    bool lineStatesEnabled;
+    uint64 lineStates;
+    uint64 linesChanged;
+
+    enum SpikeFormat
+    {
+        SPIKE_JSON = 0,
+        SPIKE_BINARY
+    };
+
+    enum SpikeWaveform
+    {
+        WAVEFORM_FULL = 0,
+        WAVEFORM_PEAK_CHANNEL,
+        WAVEFORM_TRIMMED,
+        WAVEFORM_NONE
+    };
+
+    SpikeFormat spikeFormat;
+    SpikeWaveform spikeWaveform;
+    int spikeWindow;
+    std::vector<SpikeRecord> spikeRecords;
+    std::vector<float> spikeWaveforms;
+
+    std::vector<const float*> chunkInputs;
+    std::vector<const float*> chunkChannels;
+
+    CpuGovernor governor;
+
+    /** The governor level of the block being processed */
+    int governorLevel;
+    int loggedGovernorLevel;
+
+    std::vector<float> historyBuffer;
+
+    /** Long history replies go out on their own socket and thread, so they don't hold up the listening socket */
+    void* historySocket;
+    std::thread historyThread;
+    std::atomic<bool> historyThreadShouldExit;
+    std::atomic<int> historyPort; // 0 while the socket is closed
+
+    RetransmitBuffer retransmitBuffer;
+    ReliableChannel reliableChannel;
+
+    /** Binary control requests, decoded on the ZMQ thread */
+    std::vector<ControlProtocol::Record> controlRecords;
+
+    struct ClientStats
+    {
+        uint64 received = 0;
+        uint64 missed = 0;
+        uint32 latencyUs = 0;
+        int64 time = 0;
+
+        /** Messages behind per topic and on the topic furthest behind */
+        std::map<std::string, int64> topicLags;
+        int64 lag = 0;
+        int64 reportedLag = -1;
+        bool lagging = false;
+        uint32 queueDepth = 0;
+        uint32 processingUs = 0;
+    };
+
+    enum LagPolicy
+    {
+        LAG_REPORT = 0,
+        LAG_THIN
+    };
+
+    /** Latest stats report of each client (ZMQ thread) */
+    std::map<std::string, ClientStats> clientStats;
+
+    SocketMonitor dataMonitor;
+    SocketMonitor eventMonitor;
+    SocketMonitor listenMonitor;
+
+    /** Client uuid of each control connection, by file descriptor (ZMQ thread) */
+    std::map<int, std::string> controlPeers;
+
+    int heartbeatIntervalMs;
+    int heartbeatTimeoutMs;
+    int clientTimeoutMs;
+
+    LagPolicy lagPolicy;
+    int lagThreshold;
+
+    SubscriptionTable subscriptions;
+    std::vector<const float*> streamInputs;
+    EncoderPool encoderPool;
+    EncodingCache encodingCache;
+    bool publishSelected;
+    std::shared_ptr<LocalStream> localStream;
+
+    bool crossingsEnabled;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ZmqInterface);
 };
 
@@ -78,11 +78,20 @@ public:
             const int x = getTickX();
 
             g.setFont (height * 0.7f);
-            if (i->alive)
-                g.setColour (Colours::green);
-            else
+            if (! i->alive)
                 g.setColour (Colours::red);
+            else if (i->lagging)
+                g.setColour (Colours::orange);
+            else
+                g.setColour (Colours::green);
             g.drawText (item, 5, 0, width, height, Justification::centredLeft, true);
+
+            if (i->alive && i->lag >= 0)
+            {
+                // messages behind, receive queue, processing time per block
+                const String lag = String (i->lag) + " / " + String (i->queueDepth) + " / " + String (i->processingUs / 1000.0, 1) + " ms";
+                g.drawText (lag, 5, 0, width - 10, height, Justification::centredRight, true);
+            }
         } // end of function
     }
 
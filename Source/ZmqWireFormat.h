@@ -0,0 +1,89 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef ZMQWIREFORMAT_H_INCLUDED
+#define ZMQWIREFORMAT_H_INCLUDED
+
+#include <cstdint>
+
+/* Fixed-size binary records carried in the data frame of multi-part
+   messages. All fields are little-endian and the structs are packed,
+   so clients can map a frame directly, e.g. in numpy:
+
+   np.dtype([('channel', '<u4'), ('sample_num', '<i8')])
+ */
+
+#pragma pack(push, 1)
+
+/** One threshold crossing (type "crossings") */
+struct CrossingRecord
+{
+    uint32_t channel; // local channel index, same as "channel_num" in data messages
+    int64_t sampleNumber; // sample number of the first sample past the threshold
+};
+
+/** One TTL event in a batched TTL message (type "ttl") */
+struct TtlRecord
+{
+    uint8_t line;
+    uint8_t state;
+    int64_t sampleNumber;
+    uint64_t word; // full TTL word after the event
+};
+
+/** State of all TTL lines for one block (type "line_states") */
+struct LineStateRecord
+{
+    int64_t sampleNumber; // first sample of the block
+    uint32_t numSamples;
+    uint64_t states; // bit n = state of line n at the end of the block
+    uint64_t changed; // bit n set if line n changed during the block
+};
+
+/** Number of per-channel thresholds carried in a SpikeRecord */
+const int SPIKE_RECORD_THRESHOLDS = 4;
+
+/** One spike in a batched spike message (type "spikes") */
+struct SpikeRecord
+{
+    int64_t sampleNumber; // sample number of the peak
+    uint32_t electrode; // local index of the spike channel within its stream
+    uint16_t sortedId;
+    uint8_t numChannels; // channels of the electrode
+    uint8_t waveformChannels; // channels of this spike in the waveform frame (0 = none)
+    uint16_t waveformSamples; // samples per channel in the waveform frame
+    uint16_t peakChannel; // channel with the largest absolute amplitude at the peak
+    float thresholds[SPIKE_RECORD_THRESHOLDS]; // thresholds of the first channels, 0 if unused
+};
+
+#pragma pack(pop)
+
+static_assert (sizeof (CrossingRecord) == 12, "CrossingRecord must be packed");
+static_assert (sizeof (TtlRecord) == 18, "TtlRecord must be packed");
+static_assert (sizeof (LineStateRecord) == 28, "LineStateRecord must be packed");
+static_assert (sizeof (SpikeRecord) == 36, "SpikeRecord must be packed");
+
+#endif // ZMQWIREFORMAT_H_INCLUDED